@@ -85,8 +85,9 @@ if ($iter_start == 0) {
   if($NO_FILTER_RT) {
       safesystem("cp $TRAVATAR_CONFIG $WORKING_DIR/run1.ini");
   } else {
-      my $format = ($IN_FORMAT ? "-src-format $IN_FORMAT" : "");
-      safesystem("$TRAVATAR_DIR/script/train/filter-model.pl $TRAVATAR_CONFIG $WORKING_DIR/run1.ini $WORKING_DIR/filtered \"$TRAVATAR_DIR/script/train/filter-rule-table.py $SRC\"") or die "Couldn't filter";
+      my $format = ($IN_FORMAT ? "-in_format $IN_FORMAT" : "");
+      $format .= " -binarize $1" if($DECODER_OPTIONS =~ /-binarize\s+(\S+)/);
+      safesystem("$TRAVATAR_DIR/script/train/filter-model.pl $TRAVATAR_CONFIG $WORKING_DIR/run1.ini $WORKING_DIR/filtered \"$TRAVATAR_DIR/src/bin/rt-filter -threads $THREADS $format $SRC\"") or die "Couldn't filter";
   }
   $iter_start = 1;
 }
@@ -110,7 +111,7 @@ foreach $iter ($iter_start .. $MAX_ITERS) {
     # Candidate options
     my $CAND_OPTIONS;
     if($CAND_TYPE =~ "^nbest") { $CAND_OPTIONS = "-nbest $NBEST -nbest_out $prev.nbest"; }
-    elsif($CAND_TYPE eq "forest") { $CAND_OPTIONS = "-forest_out $prev.forest -forest_nbest_trim $NBEST"; }
+    elsif($CAND_TYPE eq "forest") { $CAND_OPTIONS = "-forest_out $prev.forest -forest_format binary -forest_nbest_trim $NBEST"; }
     # Do the decoding
     my $format = ($IN_FORMAT ? "-in_format $IN_FORMAT" : "");
     my $trace = ($TRACE ? "-trace_out $prev.trace -buffer false" : "");
@@ -0,0 +1,14 @@
+#include <travatar/config-rt-compile-runner.h>
+#include <travatar/rt-compile-runner.h>
+
+using namespace travatar;
+using namespace std;
+
+int main(int argc, char** argv) {
+    // load the arguments
+    ConfigRtCompileRunner conf;
+    vector<string> args = conf.LoadConfig(argc,argv);
+    // compile the rule table
+    RtCompileRunner runner;
+    runner.Run(conf);
+}
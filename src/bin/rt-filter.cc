@@ -0,0 +1,14 @@
+#include <travatar/config-rt-filter-runner.h>
+#include <travatar/rt-filter-runner.h>
+
+using namespace travatar;
+using namespace std;
+
+int main(int argc, char** argv) {
+    // load the arguments
+    ConfigRtFilterRunner conf;
+    vector<string> args = conf.LoadConfig(argc,argv);
+    // filter the rule table
+    RtFilterRunner runner;
+    runner.Run(conf);
+}
@@ -15,6 +15,8 @@ class ConfigBatchTune;
 class TuningExample;
 class EvalMeasure;
 class Tune;
+class HyperGraph;
+class BinaryTreeFile;
 
 class BatchTuneRunnerTask : public Task {
 
@@ -37,6 +39,23 @@ private:
 
 };
 
+// Read a range of the forests in a binary file
+class ForestLoadTask : public Task {
+
+public:
+    ForestLoadTask(const BinaryTreeFile & file, int begin, int end,
+                   std::vector<HyperGraph*> & forests) :
+        file_(&file), begin_(begin), end_(end), forests_(&forests) { }
+
+    void Run();
+
+private:
+    const BinaryTreeFile * file_;
+    int begin_, end_;
+    std::vector<HyperGraph*> * forests_;
+
+};
+
 class BatchTuneRunner {
 public:
 
@@ -58,6 +77,9 @@ private:
     // Load n-best lists or forests
     void LoadNbests(std::istream & sys_in, Tune & tune, std::istream * stat_in);
     void LoadForests(std::istream & sys_in, Tune & tune);
+    void LoadForests(const BinaryTreeFile & sys_file, Tune & tune, int threads);
+    // Add the forest for sentence id
+    void AddForest(int id, HyperGraph * forest, Tune & tune);
 
     // The evaluation measure to use
     int ref_len_;
@@ -0,0 +1,103 @@
+#ifndef TRAVATAR_COMPACT_HYPER_GRAPH__
+#define TRAVATAR_COMPACT_HYPER_GRAPH__
+
+#include <travatar/real.h>
+#include <travatar/sentence.h>
+#include <vector>
+
+namespace travatar {
+
+class HyperGraph;
+class HyperEdge;
+class WeightVector;
+
+// A frozen, read-only view of the topology and features of a HyperGraph,
+// stored in flat arrays so passes that only need scores don't have to
+// follow pointers between nodes and edges. The edges of each node are
+// numbered contiguously in the order of HyperNode::GetEdges, and the tails
+// and features of each edge are slices of shared arrays. Nodes keep their
+// IDs, and each edge keeps a pointer to the original HyperEdge for passes
+// that need translations, so the graph must outlive the view.
+// As nothing is changed after construction and edge scores are held by
+// the caller, the view can be used by any number of threads at once.
+class CompactHyperGraph {
+public:
+    CompactHyperGraph(const HyperGraph & graph);
+
+    int NumNodes() const { return node_offsets_.size() - 1; }
+    int NumEdges() const { return edges_.size(); }
+
+    // The edges of a node are EdgeBegin(node) to EdgeEnd(node)-1
+    int EdgeBegin(int node) const { return node_offsets_[node]; }
+    int EdgeEnd(int node) const { return node_offsets_[node+1]; }
+    // The tails of an edge
+    int NumTails(int edge) const { return tail_offsets_[edge+1] - tail_offsets_[edge]; }
+    int GetTail(int edge, int i) const { return tails_[tail_offsets_[edge] + i]; }
+    // The features of an edge are FeatBegin(edge) to FeatEnd(edge)-1 of
+    // GetFeatIds() and GetFeatVals(). Feature IDs are the dense IDs of
+    // Dict::FeatureId, and GetFeatures() holds the Dict ID of each distinct
+    // feature
+    int FeatBegin(int edge) const { return feat_offsets_[edge]; }
+    int FeatEnd(int edge) const { return feat_offsets_[edge+1]; }
+    const std::vector<int> & GetFeatIds() const { return feat_ids_; }
+    const std::vector<Real> & GetFeatVals() const { return feat_vals_; }
+    const std::vector<WordId> & GetFeatures() const { return feats_; }
+    // The original edge
+    HyperEdge * GetEdge(int edge) const { return edges_[edge]; }
+    // The nodes that can be reached from the root, with the tails of each
+    // edge before its head (see HyperGraph::GetTopologicalOrder)
+    const std::vector<int> & GetTopologicalOrder() const { return order_; }
+
+    // Calculate the score of each edge given the weights. The weights are
+    // read directly by dense feature ID, and the products are summed in the
+    // same order as HyperGraph::ScoreEdges, so the scores are identical
+    void ScoreEdges(const WeightVector & weights, std::vector<Real> & scores) const;
+
+    // Find the best derivation of the root given the edge scores, breaking
+    // ties in the same way as HyperGraph::GetNbest. Its original edges are
+    // put in depth-first left-to-right order, as in a HyperPath, and its
+    // score is returned. If the root has no derivation, edges is empty and
+    // -REAL_MAX is returned
+    Real GetViterbiEdges(const std::vector<Real> & scores, std::vector<HyperEdge*> & edges) const;
+
+protected:
+    std::vector<int> node_offsets_;
+    std::vector<int> tail_offsets_;
+    std::vector<int> tails_;
+    std::vector<int> feat_offsets_;
+    std::vector<int> feat_ids_;
+    std::vector<Real> feat_vals_;
+    std::vector<WordId> feats_;
+    std::vector<HyperEdge*> edges_;
+    std::vector<int> order_;
+
+};
+
+// Calculate the inside value of each node of a compact graph in a semiring
+// (see hyper-graph-semiring.h), where edge_func is called with the number
+// of each edge. Nodes without edges get the value leaf
+template <class Semiring, class EdgeFunc>
+void CalcInside(const CompactHyperGraph & graph,
+                const EdgeFunc & edge_func,
+                const typename Semiring::Value & leaf,
+                std::vector<typename Semiring::Value> & inside) {
+    inside.assign(graph.NumNodes(), Semiring::Zero());
+    const std::vector<int> & order = graph.GetTopologicalOrder();
+    for(int i = 0; i < (int)order.size(); i++) {
+        int id = order[i];
+        if(graph.EdgeBegin(id) == graph.EdgeEnd(id)) {
+            inside[id] = leaf;
+            continue;
+        }
+        for(int edge = graph.EdgeBegin(id); edge < graph.EdgeEnd(id); edge++) {
+            typename Semiring::Value val = edge_func(edge);
+            for(int j = 0; j < graph.NumTails(edge); j++)
+                Semiring::Times(val, inside[graph.GetTail(edge, j)]);
+            Semiring::Plus(inside[id], val);
+        }
+    }
+}
+
+}
+
+#endif
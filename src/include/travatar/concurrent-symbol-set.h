@@ -0,0 +1,109 @@
+#ifndef TRAVATAR_CONCURRENT_SYMBOL_SET_H__
+#define TRAVATAR_CONCURRENT_SYMBOL_SET_H__
+
+#include <travatar/sentence.h>
+#include <boost/atomic.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/mutex.hpp>
+#include <stdexcept>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace travatar {
+
+// A set of symbols that can be shared by many threads.
+//
+// Symbols are never removed, so they are stored in fixed-size chunks that
+// never move once allocated, and looking up the symbol for an ID never takes
+// a lock. Looking up the ID for a symbol uses an open-addressing hash table
+// that is read without locks. Adding a symbol takes a mutex, and when the
+// table becomes too full it is copied into a larger one. Old tables are kept
+// until the set is destroyed, as other threads may still be reading them.
+// Symbols can also be given a second, dense index, which numbers only the
+// symbols that ask for one, and can also be read without locks.
+class ConcurrentSymbolSet {
+
+public:
+    ConcurrentSymbolSet();
+    ~ConcurrentSymbolSet();
+
+    // Get the symbol of an ID
+    const std::string & GetSymbol(WordId id) const {
+        if(id < 0 || id >= size_.load(boost::memory_order_acquire))
+            throw std::runtime_error("Symbol ID out of range");
+        return GetSymbolUnchecked(id);
+    }
+
+    // Get the ID of a symbol, adding it if it does not exist and add is true.
+    // Return -1 if the symbol does not exist and is not added
+    WordId GetId(const std::string & sym, bool add = false) {
+        return GetIdFromBuffer(sym.data(), sym.length(), add);
+    }
+    // The same for a symbol in a buffer, which is only copied if it is added
+    WordId GetIdFromBuffer(const char * sym, size_t len, bool add = false);
+
+    int size() const { return size_.load(boost::memory_order_acquire); }
+
+    // Get the dense index of an ID, or -1 if it has none
+    int GetIndex(WordId id) const {
+        if(id < 0) return -1;
+        const boost::atomic<int> * chunk = index_chunks_[id >> CHUNK_BITS].load(boost::memory_order_acquire);
+        return (chunk == NULL ? -1 : chunk[id & (CHUNK_SIZE-1)].load(boost::memory_order_acquire));
+    }
+    // Give an ID the next dense index if it does not have one, and return it
+    int AddIndex(WordId id);
+    // The number of dense indices
+    int NumIndices() const { return num_indices_.load(boost::memory_order_acquire); }
+
+    // Save all symbols in binary format
+    void WriteBinary(std::ostream & out) const;
+    // Read symbols written by WriteBinary. Symbols that already exist must
+    // have the same IDs as in the file, and new symbols are added in order
+    void ReadBinary(std::istream & in);
+
+protected:
+    // The hash table from symbols to IDs. Each slot holds the ID+1, or zero
+    // if it is empty
+    struct Table {
+        Table(size_t capacity);
+        ~Table() { delete [] slots; }
+        size_t mask;
+        boost::atomic<int> * slots;
+    };
+
+    const std::string & GetSymbolUnchecked(WordId id) const {
+        return chunks_[id >> CHUNK_BITS].load(boost::memory_order_acquire)[id & (CHUNK_SIZE-1)];
+    }
+    static size_t Hash(const char * sym, size_t len) {
+        return boost::hash_range(sym, sym + len);
+    }
+    WordId Find(const Table & table, const char * sym, size_t len, size_t hash) const;
+    void Insert(Table & table, size_t hash, WordId id);
+
+    static const int CHUNK_BITS = 14;
+    static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const int MAX_CHUNKS = 1 << 16;
+
+    // The chunks of symbols
+    boost::atomic<std::string*> * chunks_;
+    // The number of symbols
+    boost::atomic<int> size_;
+    // The chunks of dense indices (-1 for none), allocated when first used,
+    // and the number of indices
+    boost::atomic<boost::atomic<int>*> * index_chunks_;
+    boost::atomic<int> num_indices_;
+    // The current hash table, and tables that have been replaced
+    boost::atomic<Table*> table_;
+    std::vector<Table*> old_tables_;
+    // Held while adding symbols
+    boost::mutex mutex_;
+
+private:
+    ConcurrentSymbolSet(const ConcurrentSymbolSet &);
+    ConcurrentSymbolSet & operator=(const ConcurrentSymbolSet &);
+};
+
+}
+
+#endif
@@ -27,7 +27,7 @@ public:
 );
 
         AddConfigEntry("nbest", "", "The pointer to a file containing the n-best list of system output");
-        AddConfigEntry("forest", "", "The pointer to a file containing translation forests");
+        AddConfigEntry("forest", "", "The pointer to a file containing translation forests, in JSON or binary format");
         AddConfigEntry("algorithm", "mert", "Which tuning algorithm to use (mert)");
         AddConfigEntry("debug", "0", "What level of debugging output to print");
         AddConfigEntry("eval", "bleu", "Which evaluation measure to use (ainterp/bleu/ribes/interp/ter/wer)");
@@ -0,0 +1,40 @@
+#ifndef CONFIG_RT_COMPILE_RUNNER_H__
+#define CONFIG_RT_COMPILE_RUNNER_H__
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <sstream>
+#include <travatar/config-base.h>
+
+namespace travatar {
+
+class ConfigRtCompileRunner : public ConfigBase {
+
+public:
+
+    ConfigRtCompileRunner() : ConfigBase() {
+        minArgs_ = 2;
+        maxArgs_ = 2;
+
+        SetUsage(
+"~~~ rt-compile ~~~\n"
+"\n"
+"Compiles a text rule table into a binary table that can be memory mapped\n"
+"by the decoder (tm_storage=marisa-bin or fsm-bin). Rules with the same\n"
+"source must be on consecutive lines, as in a table sorted by source.\n"
+"  Usage: rt-compile RULE_TABLE OUTPUT_FILE\n"
+);
+
+        AddConfigEntry("debug", "0", "What level of debugging output to print");
+        AddConfigEntry("format", "marisa", "The type of table to compile, tree-to-string (marisa) or hiero (fsm)");
+        AddConfigEntry("table_limit", "0", "Keep only this many rules for each source, scored with weight_vals, and sort them in descending order of score (0 for no limit)");
+        AddConfigEntry("weight_vals", "", "Weights used to score the rules for table_limit");
+
+    }
+	
+};
+
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef CONFIG_RT_FILTER_RUNNER_H__
+#define CONFIG_RT_FILTER_RUNNER_H__
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <sstream>
+#include <travatar/config-base.h>
+
+namespace travatar {
+
+class ConfigRtFilterRunner : public ConfigBase {
+
+public:
+
+    ConfigRtFilterRunner() : ConfigBase() {
+        minArgs_ = 1;
+        maxArgs_ = 3;
+
+        SetUsage(
+"~~~ rt-filter ~~~\n"
+"\n"
+"Filters a text rule table, keeping only the rules that can be used to\n"
+"translate the input. If the rule table or output are not specified, they\n"
+"are read from standard input and written to standard output.\n"
+"  Usage: rt-filter INPUT [RULE_TABLE [OUTPUT_FILE]]\n"
+);
+
+        AddConfigEntry("binarize", "right", "How to binarize the input trees, this must be the same as in the decoder (none/left/right)");
+        AddConfigEntry("block_size", "10000", "The number of lines of the rule table processed at once by each thread");
+        AddConfigEntry("compile", "false", "Write the filtered table in binary format, like rt-compile");
+        AddConfigEntry("debug", "0", "What level of debugging output to print");
+        AddConfigEntry("format", "guess", "The type of table, tree-to-string (marisa), hiero (fsm), or guess from the first rule (guess)");
+        AddConfigEntry("in_format", "penn", "The format of the input (penn/egret/moses/word)");
+        AddConfigEntry("threads", "1", "The number of threads to use in filtering");
+
+    }
+	
+};
+
+}
+
+#endif
@@ -35,20 +35,36 @@ public:
         AddConfigEntry("consider_trg", "false", "Whether lookup t2s consider about target side or not.");
         AddConfigEntry("debug", "1", "What level of debugging output to print");
         AddConfigEntry("forest_out", "", "Forest output file location");
+        AddConfigEntry("forest_format", "json", "The format of forest_out (json/binary). Binary forests are much faster to write and for batch-tune to read");
         AddConfigEntry("forest_nbest_trim", "0", "Trim the forest so it only includes edges in the n-best");
         AddConfigEntry("in_format", "penn", "The format of the input (penn/egret)");
+        AddConfigEntry("lm_cache_size", "0", "The size in MB of the cache of LM phrase scores shared by all threads and sentences (0 to disable)");
+        AddConfigEntry("lm_coarse_file", "", "A small LM used for coarse-to-fine decoding. The forest of a first pass with this LM is pruned and only the rules that remain are composed with the first LM in lm_file");
+        AddConfigEntry("lm_coarse_pop_limit", "100", "The pop limit of the coarse pass of coarse-to-fine decoding");
+        AddConfigEntry("lm_coarse_threshold", "5", "Prune edges of the coarse forest whose best derivation is worse than the best derivation by more than this score");
         AddConfigEntry("lm_file", "", "Language model file location");
+        AddConfigEntry("lm_threads", "1", "The number of threads used to compose a single sentence with the LM. Independent chart cells are processed in parallel and the result is the same for any number of threads");
+        AddConfigEntry("lm_precompute", "false", "Calculate the LM scores of the words inside of each rule when the rule is loaded, and only score the n-grams crossing non-terminals during search");
         AddConfigEntry("lm_multi_type", "joint", "How to combine multiple LMs (joint/consec)");
+        AddConfigEntry("lookup_threads", "1", "The number of threads used to build the edges of the hiero rules matched for a single sentence (tm_storage fsm/fsm-bin). The rules are matched by one thread and the result is the same for any number of threads");
         AddConfigEntry("nbest", "1", "The length of the n-best list");
         AddConfigEntry("nbest_out", "", "n-best output file location");
         AddConfigEntry("nbest_uniq", "false", "Print only n-best entries with unique target sides");
+        AddConfigEntry("outside_beam", "0", "Estimate the best score of a derivation through each node with the rule scores and the LM scores of the words in the rules, and give linearly fewer pops and chart items to nodes that are worse than the best, down to one at this difference (0 to disable)");
         AddConfigEntry("pop_limit", "2000", "The number of pops necessary");
+        AddConfigEntry("reorder_window", "0", "The number of translated sentences that can wait for an earlier sentence to finish before threads are paused (0 = 4*threads)");
+        AddConfigEntry("rule_trim", "none", "Trim the rule graph of each sentence using only the TM scores before it is composed with the LM (none/max_marginal/posterior)");
+        AddConfigEntry("rule_trim_threshold", "5", "For rule_trim=max_marginal, the score difference from the best derivation. For rule_trim=posterior, the minimum posterior probability");
+        AddConfigEntry("rule_trim_top_k", "0", "Keep only this many edges with the best derivations at each node of the rule graph before composing with the LM (0 to keep all)");
         AddConfigEntry("search", "inc", "The type of search (Cube Pruning (cp)/Incremental (inc))");
         AddConfigEntry("threads", "1", "The number of threads to use in translation");
         AddConfigEntry("tm_file", "", "Translation model file location");
-        AddConfigEntry("tm_storage", "marisa", "Method of storing the rule table (marisa/hash/hiero/fsm)");
+        AddConfigEntry("tm_storage", "marisa", "Method of storing the rule table (marisa/marisa-bin/hash/trie/fsm/fsm-bin)");
+        AddConfigEntry("tm_table_limit", "0", "Keep only this many rules for each source in the TM, scored with the initial weights, and sort them in descending order of score (0 for no limit)");
         AddConfigEntry("trace_out", "", "trace output file location");
         AddConfigEntry("trg_factors", "1", "The number of types of output to produce");
+        AddConfigEntry("vocab_in", "", "A binary vocabulary written by vocab_out to load before the models, so word IDs are the same as in that run");
+        AddConfigEntry("vocab_out", "", "Write the vocabulary to this binary file after loading the models");
         AddConfigEntry("weight_vals", "", "Weight values in format \"name1=val1 name2=val2\", existing features override the file, other features are left unchanged");
         AddConfigEntry("delete_unknown", "false", "Delete unknown source word");
         AddConfigEntry("hiero_span_limit","20", "The span limit of non terminal symbol in hiero translation");
@@ -25,8 +25,8 @@ public:
 "  Usage: tree-converter [SRC_TREES]\n"
 );
 
-        AddConfigEntry("input_format", "penn", "The format of the input (penn/json/egret/word)");
-        AddConfigEntry("output_format", "penn", "The format of the output (penn/json/egret/word)");
+        AddConfigEntry("input_format", "penn", "The format of the input (penn/json/binary/egret/mosesxml/word)");
+        AddConfigEntry("output_format", "penn", "The format of the output (penn/json/binary/egret/mosesxml/word)");
         AddConfigEntry("split", "", "A regular expression to split words in the tree (e.g. \"-\")");
         AddConfigEntry("compoundsplit", "", "The language model file for use in compound splitting");
         AddConfigEntry("compoundsplit_filler", "", "Optional fillers for compound splitting, e.g. \"e:es\" for German");
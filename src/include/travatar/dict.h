@@ -4,15 +4,13 @@
 #include <travatar/sentence.h>
 #include <travatar/cfg-data.h>
 #include <travatar/sparse-map.h>
+#include <travatar/concurrent-symbol-set.h>
 #include <string>
 #include <vector>
 #include <iostream>
 
 namespace travatar {
 
-template <class T>
-class SymbolSet;
-
 struct Dict {
     // Call Freeze to prevent new IDs from being used
     static void Freeze() {
@@ -23,12 +21,20 @@ struct Dict {
 
     // Get the word ID
     static WordId WID(const std::string & str);
+    // Get the ID of a word in a buffer, without copying it unless it is new
+    static WordId WID(const char * str, size_t len);
 
     // Get the quoted word ID
     static WordId WIDAnnotated(const std::string & str);
 
     // Get the word symbol
     static const std::string & WSym(WordId id);
+
+    // Save the vocabulary to a binary file, or load it back. Loading must be
+    // done before any other words are added, and afterwards each word has the
+    // same ID as when the vocabulary was saved
+    static void WriteVocab(std::ostream & out);
+    static void ReadVocab(std::istream & in);
     
     // Get the word symbol
     static std::string WSymEscaped(WordId id);
@@ -52,6 +58,15 @@ struct Dict {
     static SparseVector ParseSparseVector(std::istream & iss);
     static SparseVector ParseSparseVector(const std::string & str);
 
+    // Get the dense ID of a feature, or -1 if it has none. Features are
+    // numbered from zero when they are parsed or given a weight, so values
+    // for each feature can be kept in flat arrays indexed by these IDs
+    static int FeatureId(WordId feat) { return wids_.GetIndex(feat); }
+    // Get the dense ID of a feature, giving it one if necessary
+    static int AddFeatureId(WordId feat) { return wids_.AddIndex(feat); }
+    // The number of features with dense IDs
+    static int NumFeatureIds() { return wids_.NumIndices(); }
+
     // Get the word ID
     static Sentence ParseWords(const std::string & str);
     static std::vector<Sentence> ParseWordVector(const std::string & str);
@@ -65,7 +80,7 @@ struct Dict {
     static std::string EncodeXML(const std::string & str);
 
 private:
-    static SymbolSet<WordId> wids_;
+    static ConcurrentSymbolSet wids_;
     static bool add_;
 
 };
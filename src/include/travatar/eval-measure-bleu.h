@@ -14,6 +14,7 @@
 #include <travatar/eval-measure.h>
 #include <travatar/real.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <map>
 #include <vector>
 
@@ -104,7 +105,10 @@ public:
     NgramStats * ExtractNgrams(const Sentence & sentence) const;
 
     // Clear the ngram cache
-    virtual void ClearCache() { cache_.clear(); }
+    virtual void ClearCache() {
+        boost::mutex::scoped_lock lock(cache_mutex_);
+        cache_.clear();
+    }
 
     int GetNgramOrder() const { return ngram_order_; }
     void SetNgramOrder(int ngram_order) { ngram_order_ = ngram_order; }
@@ -118,6 +122,8 @@ protected:
     Real smooth_val_;
     // A cache to hold the stats
     StatsCache cache_;
+    // The cache is shared by the threads that calculate convex hulls
+    boost::mutex cache_mutex_;
     // The scope
     BleuScope scope_;
     // The weight of precision in F-measure, from one to zero (default 1)
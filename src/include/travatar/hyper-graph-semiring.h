@@ -0,0 +1,155 @@
+#ifndef TRAVATAR_HYPER_GRAPH_SEMIRING__
+#define TRAVATAR_HYPER_GRAPH_SEMIRING__
+
+#include <travatar/hyper-graph.h>
+#include <travatar/mert-geometry.h>
+#include <travatar/real.h>
+#include <boost/foreach.hpp>
+#include <vector>
+#include <cmath>
+
+namespace travatar {
+
+// Semirings for the inside and outside passes below. Each defines the type
+// of its values, the identities Zero() and One(), and the operations Plus,
+// which combines alternative derivations, and Times, which combines the
+// parts of a derivation. Both operations update their first argument
+
+// Scores where the best derivation is taken (the Viterbi semiring)
+struct TropicalSemiring {
+    typedef Real Value;
+    static Value Zero() { return -REAL_MAX; }
+    static Value One() { return 0; }
+    static void Plus(Value & a, const Value & b) { if(b > a) a = b; }
+    static void Times(Value & a, const Value & b) {
+        a = (a == -REAL_MAX || b == -REAL_MAX ? -REAL_MAX : a + b);
+    }
+};
+
+// Log probabilities, where the probabilities of derivations are summed
+struct LogSemiring {
+    typedef Real Value;
+    static Value Zero() { return -REAL_MAX; }
+    static Value One() { return 0; }
+    static void Plus(Value & a, const Value & b) {
+        if(b == -REAL_MAX) return;
+        if(a == -REAL_MAX) { a = b; return; }
+        a = (a > b ? a + log1p(exp(b-a)) : b + log1p(exp(a-b)));
+    }
+    static void Times(Value & a, const Value & b) {
+        a = (a == -REAL_MAX || b == -REAL_MAX ? -REAL_MAX : a + b);
+    }
+};
+
+// A log probability, and the expectation of a quantity that is summed over
+// the edges of a derivation (such as its length or a feature value) under
+// the distribution over derivations. The expectation is kept divided by
+// the probability, so neither part underflows on large forests
+struct ExpectationSemiring {
+    struct Value {
+        Value(Real p = -REAL_MAX, Real e = 0) : prob(p), expect(e) { }
+        Real prob, expect;
+    };
+    static Value Zero() { return Value(-REAL_MAX, 0); }
+    static Value One() { return Value(0, 0); }
+    static void Plus(Value & a, const Value & b) {
+        if(b.prob == -REAL_MAX) return;
+        if(a.prob == -REAL_MAX) { a = b; return; }
+        Real prob = a.prob;
+        LogSemiring::Plus(prob, b.prob);
+        a.expect = exp(a.prob-prob) * a.expect + exp(b.prob-prob) * b.expect;
+        a.prob = prob;
+    }
+    static void Times(Value & a, const Value & b) {
+        if(a.prob == -REAL_MAX || b.prob == -REAL_MAX) { a = Zero(); return; }
+        a.prob += b.prob;
+        a.expect += b.expect;
+    }
+};
+
+// The upper envelopes of lines used by MERT over forests (see mert-geometry.h)
+struct MertSemiring {
+    typedef MertHull Value;
+    static Value Zero() { return MertHull(); }
+    static Value One() { return MertHull(1); }
+    static void Plus(Value & a, const Value & b) { a += b; }
+    static void Times(Value & a, const Value & b) { a *= b; }
+};
+
+// Edge values held in a vector indexed by edge ID
+template <class Value>
+struct EdgeValueArray {
+    EdgeValueArray(const std::vector<Value> & values) : values_(values) { }
+    const Value & operator()(const HyperEdge & edge) const { return values_[edge.GetId()]; }
+    const std::vector<Value> & values_;
+};
+
+// The scores of the edges themselves
+struct EdgeScore {
+    Real operator()(const HyperEdge & edge) const { return edge.GetScore(); }
+};
+
+// The value of an edge times the inside values of its tails
+template <class Semiring, class EdgeFunc>
+inline typename Semiring::Value CalcEdgeInside(const HyperEdge & edge, const EdgeFunc & edge_func,
+                                               const std::vector<typename Semiring::Value> & inside) {
+    typename Semiring::Value ret = edge_func(edge);
+    BOOST_FOREACH(const HyperNode * tail, edge.GetTails())
+        Semiring::Times(ret, inside[tail->GetId()]);
+    return ret;
+}
+
+// Calculate the inside value of each node, visiting the nodes in an order
+// where the tails of each edge come before its head, such as that of
+// HyperGraph::GetTopologicalOrder. Nodes without edges get the value leaf,
+// and nodes that are not in the order get Zero()
+template <class Semiring, class EdgeFunc>
+void CalcInside(const std::vector<HyperNode*> & nodes,
+                const std::vector<int> & order,
+                const EdgeFunc & edge_func,
+                const typename Semiring::Value & leaf,
+                std::vector<typename Semiring::Value> & inside) {
+    inside.assign(nodes.size(), Semiring::Zero());
+    BOOST_FOREACH(int id, order) {
+        const std::vector<HyperEdge*> & edges = nodes[id]->GetEdges();
+        if(edges.size() == 0) {
+            inside[id] = leaf;
+            continue;
+        }
+        BOOST_FOREACH(const HyperEdge * edge, edges)
+            Semiring::Plus(inside[id], CalcEdgeInside<Semiring>(*edge, edge_func, inside));
+    }
+}
+
+// Calculate the outside value of each node given the inside values, in the
+// reverse of the same order. The last node in the order is the root, whose
+// outside value is One(). Each edge adds the outside value of its head times
+// the edge value and the inside values of the other tails to each tail, so
+// no division is needed
+template <class Semiring, class EdgeFunc>
+void CalcOutside(const std::vector<HyperNode*> & nodes,
+                 const std::vector<int> & order,
+                 const EdgeFunc & edge_func,
+                 const std::vector<typename Semiring::Value> & inside,
+                 std::vector<typename Semiring::Value> & outside) {
+    outside.assign(nodes.size(), Semiring::Zero());
+    if(order.size() == 0) return;
+    outside[*order.rbegin()] = Semiring::One();
+    BOOST_REVERSE_FOREACH(int id, order) {
+        BOOST_FOREACH(const HyperEdge * edge, nodes[id]->GetEdges()) {
+            const std::vector<HyperNode*> & tails = edge->GetTails();
+            for(int i = 0; i < (int)tails.size(); i++) {
+                typename Semiring::Value val = edge_func(*edge);
+                for(int j = 0; j < (int)tails.size(); j++)
+                    if(j != i)
+                        Semiring::Times(val, inside[tails[j]->GetId()]);
+                Semiring::Times(val, outside[id]);
+                Semiring::Plus(outside[tails[i]->GetId()], val);
+            }
+        }
+    }
+}
+
+}
+
+#endif
@@ -19,7 +19,9 @@ class HyperNode;
 class HyperGraph;
 class TranslationRule;
 class Weights;
+class WeightVector;
 class RuleEdge;
+class RuleLMScores;
 
 typedef std::pair< std::pair<int,int>, WordId > LabeledSpan;
 typedef std::map< std::pair<int,int>, WordId > LabeledSpans;
@@ -36,8 +38,14 @@ protected:
     std::string src_str_;
     CfgDataVector trg_data_;
     SparseVector features_;
+    // The LM scores of the rule used by this edge. These are owned by the
+    // rule, so they are only valid as long as the rule table
+    const RuleLMScores * lm_scores_;
+    // The ID of the edge in the input graph that this edge was created from
+    // when composing with an LM, or -1
+    NodeId origin_;
 public:
-    HyperEdge(HyperNode* head = NULL) : id_(-1), head_(head), score_(0.0) { };
+    HyperEdge(HyperNode* head = NULL) : id_(-1), head_(head), score_(0.0), lm_scores_(NULL), origin_(-1) { };
     virtual ~HyperEdge() { };
 
     // Refresh the pointers to head and tail nodes so they point to
@@ -77,6 +85,10 @@ public:
     void SetSrcStr(const std::string & str) { src_str_ = str; }
     void SetTrgData(const CfgDataVector & trg) { trg_data_ = trg; }
     void SetFeatures(const SparseVector & feat) { features_ = feat; }
+    const RuleLMScores * GetLMScores() const { return lm_scores_; }
+    void SetLMScores(const RuleLMScores * lm_scores) { lm_scores_ = lm_scores; }
+    NodeId GetOrigin() const { return origin_; }
+    void SetOrigin(NodeId origin) { origin_ = origin; }
     // void AddFeature(int idx, Real feat) { features_[idx] += feat; }
     void AddTrgWord(int idx, int factor = 0) {
         if((int)trg_data_.size() <= factor)
@@ -169,7 +181,8 @@ public:
     // Set or get the viterbi score without re-calculating it
     void SetViterbiScore(Real viterbi_score) { viterbi_score_ = viterbi_score; }
     Real GetViterbiScore() const { return viterbi_score_; }
-    // Calculate new viterbi scores if necessary
+    // Calculate new viterbi scores if necessary, for this node and the nodes
+    // below it that don't have one
     Real CalcViterbiScore();
 
     // Calculate the spans and frontiers using the GHKM algorithm
@@ -187,10 +200,6 @@ public:
     // Remover
     void RemoveEdge(int position) { edges_.erase(edges_.begin() + position); }
 
-    // Functions for the inside-outside algorithm
-    Real GetInsideProb(std::vector<Real> & inside);
-    Real GetOutsideProb(const std::vector< std::vector<HyperEdge*> > & all_edges, std::vector<Real> & outside) const;
-
     // Getters/Setters
     void SetSym(WordId sym) { sym_ = sym; }
     WordId GetSym() const { return sym_; }
@@ -338,8 +347,10 @@ public:
     void DeleteNodes();
     void DeleteEdges();
 
-    // Score each edge in the graph
+    // Score each edge in the graph, either directly with the current weights
+    // or with a WeightVector that was built from them once
     void ScoreEdges(const Weights & weights);
+    void ScoreEdges(const WeightVector & weights);
 
     // Get the n-best paths through the graph
     NbestList GetNbest(int n, bool uniq = false);
@@ -371,10 +382,34 @@ public:
 
     void ResetViterbiScores();
 
-    // Perform the inside-outside algorithm
-    std::vector< std::vector<HyperEdge*> > GetReversedEdges();
+    // Get the IDs of the nodes that can be reached from the root, in an
+    // order where the tails of each edge come before its head and the root
+    // comes last. The graph is walked without recursion, so very deep
+    // graphs can be handled
+    void GetTopologicalOrder(std::vector<int> & order) const;
+
+    // Group the nodes that can be reached from the root by height, where
+    // nodes with no tails have a height of zero and other nodes are one
+    // higher than their highest tail. Nodes of the same height never depend
+    // on each other, and the root is alone in the last level
+    void GetHeightLevels(std::vector<std::vector<int> > & levels) const;
+
+    // Perform the inside-outside algorithm, where each edge score is a log
+    // probability, and replace each edge score with its posterior
     void InsideOutsideNormalize();
 
+    // Calculate the Viterbi inside and outside score of each node that can
+    // be reached from the root, where edge_scores holds the score of each
+    // edge by ID. Other nodes get -REAL_MAX for both
+    void CalcViterbiInsideOutside(const std::vector<Real> & edge_scores,
+                                  std::vector<Real> & inside,
+                                  std::vector<Real> & outside) const;
+    // The same, but summing over the derivations of each node, where the
+    // edge scores are log probabilities
+    void CalcInsideOutside(const std::vector<Real> & edge_scores,
+                           std::vector<Real> & inside,
+                           std::vector<Real> & outside) const;
+
     // Get labeled spans
     LabeledSpans GetLabeledSpans() const;
 
@@ -8,6 +8,9 @@
 #include <boost/foreach.hpp>
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <string>
+#include <stdint.h>
 #include <set>
 
 namespace std {
@@ -75,6 +78,62 @@ public:
         return IoUtil::ReadUntil(in, delim.c_str(), forbid.c_str());
     }
 
+    // Write a single value in raw binary form
+    template <class T>
+    static void WriteBinary(std::ostream & out, T val) {
+        out.write(reinterpret_cast<const char*>(&val), sizeof(T));
+    }
+
+    // Read a value written by WriteBinary from memory and advance the pointer.
+    // The pointer need not be aligned.
+    template <class T>
+    static T ReadBinary(const char * & ptr) {
+        T ret;
+        memcpy(&ret, ptr, sizeof(T));
+        ptr += sizeof(T);
+        return ret;
+    }
+
+    // Append an unsigned value to a buffer as a varint of 7 bits per byte,
+    // lowest bits first, with the high bit set on all but the last byte
+    static void AppendVarint(std::string & buf, uint64_t val) {
+        while(val >= 0x80) {
+            buf += (char)((val & 0x7F) | 0x80);
+            val >>= 7;
+        }
+        buf += (char)val;
+    }
+
+    // Read a varint written by AppendVarint from memory and advance the pointer
+    static uint64_t ReadVarint(const char * & ptr, const char * end) {
+        uint64_t ret = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            if(ptr == end)
+                THROW_ERROR("Varint runs past the end of the buffer");
+            unsigned char c = *ptr++;
+            ret |= (uint64_t)(c & 0x7F) << shift;
+            if(!(c & 0x80))
+                return ret;
+        }
+        THROW_ERROR("Varint is too long");
+        return ret;
+    }
+
+    // Map signed values to unsigned ones so small negative values also have
+    // short varints (0, -1, 1, -2, ... to 0, 1, 2, 3, ...)
+    static uint64_t ZigZag(int64_t val) {
+        return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+    }
+    static int64_t UnZigZag(uint64_t val) {
+        return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+    }
+
+    // Pad a seekable stream to an 8-byte boundary
+    static void PadBinary(std::ostream & out) {
+        static const char zeros[8] = {0,0,0,0,0,0,0,0};
+        out.write(zeros, (8 - out.tellp() % 8) % 8);
+    }
+
 };
 
 }
@@ -0,0 +1,109 @@
+#ifndef TRAVATAR_LAZY_KBEST__
+#define TRAVATAR_LAZY_KBEST__
+
+#include <travatar/real.h>
+#include <boost/unordered_set.hpp>
+#include <vector>
+
+namespace travatar {
+
+class HyperGraph;
+class HyperNode;
+class HyperEdge;
+
+// Lazy k-best extraction over an acyclic hypergraph, following Algorithm 3
+// of Huang and Chiang (2005) "Better k-best Parsing."
+//
+// Each derivation is stored only as a back-pointer: the edge used at the
+// node and the rank of the derivation used for each tail. Derivations are
+// ordered by score, then number of edges (more first), then the IDs of the
+// edges in depth-first left-to-right order. Scores are compared exactly,
+// so this is a total order and the result does not depend on the order in
+// which candidates are found. No function recurses over the graph, so
+// forests of any depth can be searched.
+class LazyKbest {
+public:
+    LazyKbest(const HyperGraph & graph);
+
+    // Compute derivations of the root until the k-th (zero-indexed) is found.
+    // Return false if the root has k or fewer derivations
+    bool HasKth(int k) { return FindKth(0, k); }
+
+    // Get information about the k-th derivation of the root (HasKth(k) must
+    // have already returned true)
+    Real GetScore(int k) const { return GetBest(0, k).score; }
+    void GetEdges(int k, std::vector<HyperEdge*> & edges) const;
+
+protected:
+
+    // A single derivation, the edge used and the rank of each tail's derivation
+    struct Derivation {
+        HyperEdge * edge;
+        int pos; // The position of the edge in the head's edge list
+        std::vector<int> ranks;
+        Real score;
+        int size;
+    };
+
+    // Hash and compare derivations by their position in the pool of a node
+    class DerivationHash {
+    public:
+        DerivationHash(const std::vector<Derivation> * derivs = NULL) : derivs_(derivs) { }
+        size_t operator()(int x) const;
+    private:
+        const std::vector<Derivation> * derivs_;
+    };
+    class DerivationEqual {
+    public:
+        DerivationEqual(const std::vector<Derivation> * derivs = NULL) : derivs_(derivs) { }
+        bool operator()(int x, int y) const {
+            return (*derivs_)[x].pos == (*derivs_)[y].pos && (*derivs_)[x].ranks == (*derivs_)[y].ranks;
+        }
+    private:
+        const std::vector<Derivation> * derivs_;
+    };
+    typedef boost::unordered_set<int, DerivationHash, DerivationEqual> DerivationSet;
+
+    // The state of a single node. Every derivation that has been proposed
+    // is kept once in derivs, and the other members refer to it by position.
+    // Proposals in pending are waiting for the derivations of their tails
+    // to be found, and are moved to the candidate heap once they are
+    struct KbestNode {
+        KbestNode() : init(false), done(false) { }
+        bool init, done;
+        std::vector<Derivation> derivs;
+        std::vector<int> best, cand, pending;
+        DerivationSet seen;
+    };
+
+    // Compare derivations of the same node
+    class DerivationWorse {
+    public:
+        DerivationWorse(const LazyKbest * kbest, int node) : kbest_(kbest), node_(node) { }
+        bool operator()(int x, int y) const {
+            const std::vector<Derivation> & derivs = kbest_->nodes_[node_].derivs;
+            return kbest_->Better(derivs[y], derivs[x]);
+        }
+    private:
+        const LazyKbest * kbest_;
+        int node_;
+    };
+
+    const Derivation & GetBest(int node, int k) const {
+        const KbestNode & kn = nodes_[node];
+        return kn.derivs[kn.best[k]];
+    }
+
+    bool FindKth(int node, int k);
+    void Propose(int node, int pos, const std::vector<int> & ranks);
+    bool Better(const Derivation & x, const Derivation & y) const;
+    int LexCompare(const Derivation & x, const Derivation & y) const;
+
+    const HyperGraph & graph_;
+    std::vector<KbestNode> nodes_;
+
+};
+
+}
+
+#endif
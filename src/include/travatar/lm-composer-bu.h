@@ -13,27 +13,40 @@ class HyperNode;
 class HyperGraph;
 
 typedef std::vector<HyperNode*> ChartEntry;
+// The LM states of each node in a chart entry, for each LM
+typedef std::vector<std::vector<lm::ngram::ChartState> > ChartEntryStates;
 
 // A virtual class to represent templated functions needed for handling
 // various types of KenLM LMs
 class LMComposerBUFunc {
 public:
     static LMComposerBUFunc * CreateFromType(lm::ngram::ModelType type);
-    virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<HyperNode*> & tails, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state) = 0;
+    virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<const std::vector<lm::ngram::ChartState>*> & tail_states, int lm_id, lm::ngram::ChartState & out_state) = 0;
+    // Calculate the same score as CalcNontermScore, but only score the
+    // n-grams that cross the boundaries of the non-terminals, taking the
+    // rest from the score calculated when the rule was loaded
+    virtual std::pair<Real,int> CalcBoundaryScore(const LMData* data, const RuleLMScore & rule_score, const Sentence & syms, const std::vector<const std::vector<lm::ngram::ChartState>*> & tail_states, int lm_id, lm::ngram::ChartState & out_state) = 0;
     virtual Real CalcFinalScore(const void * lm, const lm::ngram::ChartState & prev_state) = 0;
     virtual ~LMComposerBUFunc() { }
 };
 
 template <class LMType>
 class LMComposerBUFuncTemplate : public LMComposerBUFunc {
-    virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<HyperNode*> & tails, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, lm::ngram::ChartState & out_state);
+    virtual std::pair<Real,int> CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<const std::vector<lm::ngram::ChartState>*> & tail_states, int lm_id, lm::ngram::ChartState & out_state);
+    virtual std::pair<Real,int> CalcBoundaryScore(const LMData* data, const RuleLMScore & rule_score, const Sentence & syms, const std::vector<const std::vector<lm::ngram::ChartState>*> & tail_states, int lm_id, lm::ngram::ChartState & out_state);
     virtual Real CalcFinalScore(const void * lm, const lm::ngram::ChartState & prev_state);
     virtual ~LMComposerBUFuncTemplate() { }
 };
 
 // A bottom up language model composer that uses cube pruning to keep the
 // search space small
+//
+// If the number of threads is more than one, chart entries whose nodes do not
+// depend on each other are built in parallel on the shared ThreadPool. The
+// entries are added to the output graph in the same order as the serial
+// search, so the result is identical regardless of the number of threads.
 class LMComposerBU : public LMComposer {
+    friend class LMComposerBUTask;
 
 protected:
 
@@ -43,16 +56,18 @@ protected:
     int chart_limit_;
     // The functions used to calculate LM scores for each model
     std::vector<LMComposerBUFunc*> funcs_;
+    // The number of threads to use within a single sentence
+    int num_threads_;
 
 public:
     LMComposerBU(const std::vector<std::string> & str) :
-            LMComposer(str), stack_pop_limit_(0), chart_limit_(0) {
+            LMComposer(str), stack_pop_limit_(0), chart_limit_(0), num_threads_(1) {
         for(int i = 0; i < (int)lm_data_.size(); i++)
             funcs_.push_back(LMComposerBUFunc::CreateFromType(lm_data_[i]->GetType()));
             
     }
     LMComposerBU(void * lm, lm::ngram::ModelType type, VocabMap * vocab_map) :
-            LMComposer(lm, type, vocab_map), stack_pop_limit_(0), chart_limit_(0) { 
+            LMComposer(lm, type, vocab_map), stack_pop_limit_(0), chart_limit_(0), num_threads_(1) { 
         for(int i = 0; i < (int)lm_data_.size(); i++)
             funcs_.push_back(LMComposerBUFunc::CreateFromType(lm_data_[i]->GetType()));
     }
@@ -66,14 +81,57 @@ public:
     void SetStackPopLimit(int stack_pop_limit) { stack_pop_limit_ = stack_pop_limit; }
     int GetChartLimit() const { return chart_limit_; }
     void SetChartLimit(Real chart_limit) { chart_limit_ = chart_limit; }
+    int GetNumThreads() const { return num_threads_; }
+    void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
 
 protected:
 
-    // Build a chart entry for one of the nodes in the input parse
+    // Calculate the LM score of a phrase and its tails, using the score cache
+    // if there is one, and the scores calculated when the rule was loaded if
+    // rule_scores is not NULL
+    std::pair<Real,int> CalcNontermScore(
+                        const RuleLMScores * rule_scores,
+                        const Sentence & syms,
+                        const std::vector<const std::vector<lm::ngram::ChartState>*> & tail_states,
+                        int lm_id,
+                        lm::ngram::ChartState & out_state) const;
+
+    // Build a chart entry for one of the nodes in the input parse, after
+    // recursively building the entries of its tails
     const ChartEntry & BuildChartCubePruning(
                         const HyperGraph & parse,
                         std::vector<boost::shared_ptr<ChartEntry> > & chart, 
-                        std::vector<std::vector<lm::ngram::ChartState> > & states, 
+                        std::vector<ChartEntryStates> & states, 
+                        const LMOutsideEstimates * est,
+                        int id,
+                        HyperGraph & graph) const;
+
+    // Build all chart entries reachable from the root, processing entries
+    // that are independent of each other in parallel
+    void BuildChartParallel(
+                        const HyperGraph & parse,
+                        std::vector<boost::shared_ptr<ChartEntry> > & chart, 
+                        std::vector<ChartEntryStates> & states, 
+                        const LMOutsideEstimates * est,
+                        HyperGraph & graph) const;
+
+    // Build the chart entry for a single node. The entries of all of its
+    // tails must be finished already. If est is not NULL, the queue is
+    // ordered with the LM estimates of the rules, and the pop and chart
+    // limits are scaled for the node
+    void BuildChartEntry(
+                        const HyperGraph & parse,
+                        std::vector<boost::shared_ptr<ChartEntry> > & chart, 
+                        std::vector<ChartEntryStates> & states, 
+                        const LMOutsideEstimates * est,
+                        int id) const;
+
+    // Add the chart entries built by BuildChartParallel to the graph, in the
+    // order that BuildChartCubePruning would have added them
+    void AddChartEntries(
+                        const HyperGraph & parse,
+                        const std::vector<boost::shared_ptr<ChartEntry> > & chart, 
+                        std::vector<bool> & added,
                         int id,
                         HyperGraph & graph) const;
 
@@ -0,0 +1,64 @@
+#ifndef LM_COMPOSER_COARSE_TO_FINE_H__
+#define LM_COMPOSER_COARSE_TO_FINE_H__
+
+#include <travatar/graph-transformer.h>
+#include <travatar/trimmer-max-marginal.h>
+#include <travatar/real.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace travatar {
+
+class HyperGraph;
+
+// Statistics about the passes of coarse-to-fine decoding
+class CoarseToFineStats {
+public:
+    CoarseToFineStats() : sentences(0), coarse_time(0), fine_time(0), edges(0), kept_edges(0) { }
+    // The number of sentences, and the seconds spent in each pass
+    long sentences;
+    double coarse_time, fine_time;
+    // The number of edges in the rule graphs, and the number kept for the
+    // fine pass
+    long edges, kept_edges;
+};
+
+// Composes a rule graph with an LM in two passes. The coarse pass, usually
+// with a small or low-order LM, builds a forest, and every edge of this
+// forest that is not in a derivation within a threshold of the best
+// derivation is pruned. The rule graph is then reduced to the rules used by
+// the remaining edges, and composed with the full LM in the fine pass:
+//  Slav Petrov; Aria Haghighi; Dan Klein
+//  Coarse-to-Fine Syntactic Machine Translation using Language Projections
+//  EMNLP 2008
+//
+// The features of the coarse pass are not kept, so the output is the same
+// as the fine pass over a smaller rule graph.
+class LMComposerCoarseToFine : public GraphTransformer {
+
+public:
+    LMComposerCoarseToFine(const boost::shared_ptr<GraphTransformer> & coarse,
+                           const boost::shared_ptr<GraphTransformer> & fine,
+                           Real threshold) :
+        coarse_(coarse), fine_(fine), trimmer_(threshold) { }
+    virtual ~LMComposerCoarseToFine() { }
+
+    virtual HyperGraph * TransformGraph(const HyperGraph & hg) const;
+
+    const GraphTransformer & GetCoarse() const { return *coarse_; }
+    const GraphTransformer & GetFine() const { return *fine_; }
+
+    // Get the statistics over all sentences so far
+    CoarseToFineStats GetStats() const;
+
+protected:
+    boost::shared_ptr<GraphTransformer> coarse_, fine_;
+    TrimmerMaxMarginal trimmer_;
+    mutable CoarseToFineStats stats_;
+    mutable boost::mutex stats_mutex_;
+
+};
+
+}
+
+#endif
@@ -65,6 +65,9 @@ public:
     // Convert all of the edges together into a node
     NBestComplete Complete(std::vector<PartialEdge> &partial);
 
+    // Move all nodes and edges of another forest to the end of this one
+    void Absorb(Forest & other);
+
   private:
     travatar::HyperGraph* hg;
     travatar::WordId lm_id_;
@@ -89,7 +92,11 @@ class HyperGraph;
 //  Kenneth Heafield; Philipp Koehn; Alon Lavie
 //  Grouping Language Model Boundary Words to Speed K–Best Extraction from Hypergraphs
 //  NAACL 2013
+//
+// Like LMComposerBU, vertices that do not depend on each other can be
+// calculated in parallel when the number of threads is more than one.
 class LMComposerIncremental : public LMComposer {
+    template <class LMType> friend class LMComposerIncrementalTask;
 
 protected:
 
@@ -99,10 +106,13 @@ protected:
     // The maximum number of edges to add during search
     int edge_limit_;
 
+    // The number of threads to use within a single sentence
+    int num_threads_;
+
 public:
     LMComposerIncremental(const std::vector<std::string> & str);
     LMComposerIncremental(void * lm, lm::ngram::ModelType type, VocabMap * vocab_map, int factor = 0) :
-        LMComposer(lm, type, vocab_map), stack_pop_limit_(0), edge_limit_(1000) { }
+        LMComposer(lm, type, vocab_map), stack_pop_limit_(0), edge_limit_(1000), num_threads_(1) { }
     virtual ~LMComposerIncremental() { }
 
     // Intersect this graph with a language model, using incremental search
@@ -111,6 +121,8 @@ public:
     // Accessors
     int GetStackPopLimit() const { return stack_pop_limit_; }
     void SetStackPopLimit(Real stack_pop_limit) { stack_pop_limit_ = stack_pop_limit; }
+    int GetNumThreads() const { return num_threads_; }
+    void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
 
 protected:
 
@@ -118,12 +130,38 @@ protected:
     template <class LMType>
     HyperGraph * TransformGraphTemplate(const HyperGraph & hg) const;
 
-    // Calculate a single vertex
+    // Calculate a single vertex, after recursively calculating its children
     template <class LMType>
     search::Vertex* CalculateVertex(
                     const HyperGraph & parse, std::vector<search::Vertex*> & verticies,
                     search::Context<LMType> & context, search::Forest & best,
-                    int id) const;
+                    const LMOutsideEstimates * est, int id) const;
+    // Calculate a single vertex whose children have already been calculated.
+    // If est is not NULL, the pop limit is scaled for the vertex
+    template <class LMType>
+    search::Vertex* BuildVertex(
+                    const HyperGraph & parse, std::vector<search::Vertex*> & verticies,
+                    search::Context<LMType> & context, search::Forest & best,
+                    const LMOutsideEstimates * est, int id) const;
+    // Calculate all vertices reachable from the root, processing vertices
+    // that are independent of each other in parallel. The nodes are added to
+    // best in the same order as CalculateVertex would have added them
+    template <class LMType>
+    void CalculateVerticesParallel(
+                    const HyperGraph & parse, std::vector<search::Vertex*> & verticies,
+                    search::Context<LMType> & context, search::Forest & best,
+                    const LMOutsideEstimates * est) const;
+    // Move the forests of each vertex into best in the serial order
+    void AbsorbForests(
+                    const HyperGraph & parse, std::vector<search::Vertex*> & vertices,
+                    std::vector<boost::shared_ptr<search::Forest> > & forests,
+                    std::vector<bool> & added, int id, search::Forest & best) const;
+    // Calculate the LM score of the words in a rule, and the states between
+    // its non-terminals
+    template <class LMType>
+    std::pair<Real,int> CalcRuleScore(
+                    const Sentence & syms, const std::vector<lm::WordIndex> & words,
+                    lm::ngram::ChartState * between) const;
     // Calculate the root vertex
     template <class LMType>
     search::Vertex* CalculateRootVertex(
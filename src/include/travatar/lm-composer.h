@@ -6,16 +6,23 @@
 #include <travatar/sparse-map.h>
 #include <travatar/dict.h>
 #include <travatar/real.h>
+#include <travatar/translation-rule.h>
 #include <lm/left.hh>
 #include <lm/model.hh>
 #include <boost/unordered_map.hpp>
+#include <boost/shared_ptr.hpp>
 #include <string>
 #include <utility>
 
 namespace travatar {
 
-// A map from Travatar vocab to KenLM vocab
-typedef boost::unordered_map<WordId, lm::WordIndex> VocabMap;
+class LMScoreCache;
+class HyperEdge;
+class HyperGraph;
+
+// A map from Travatar vocab to KenLM vocab, indexed by WordId. Words that
+// are past the end of the map are unknown to the LM
+typedef std::vector<lm::WordIndex> VocabMap;
 
 class MapEnumerateVocab : public lm::EnumerateVocab {
 public:
@@ -27,7 +34,7 @@ public:
 
     virtual void Add(lm::WordIndex index, const StringPiece &str);
 
-    boost::unordered_map<WordId, lm::WordIndex> * GetAndFreeVocabMap() {
+    VocabMap * GetAndFreeVocabMap() {
         VocabMap * ret = vocab_map_;
         vocab_map_ = NULL;
         return ret;
@@ -51,7 +58,15 @@ public:
 
     virtual ~LMData();
 
-    lm::WordIndex GetMapping(WordId wid) const;
+    lm::WordIndex GetMapping(WordId wid) const {
+        return wid < (WordId)vocab_map_->size() ? (*vocab_map_)[wid] : 0;
+    }
+
+    // Score words with non-terminals marked as lm::kMaxWordIndex, without
+    // considering the context of the non-terminals. The states of the words
+    // before, between, and after the non-terminals are written to between,
+    // and the number of unknown words is added to unk
+    float ScoreRule(const std::vector<lm::WordIndex> & words, lm::ngram::ChartState * between, int & unk) const;
 
     void * GetLM() { return lm_; }
     const void * GetLM() const { return lm_; }
@@ -82,6 +97,61 @@ protected:
     int factor_; 
 };
 
+// The LM score of the words inside of a rule, which does not depend on the
+// rule's tails and can thus be calculated when the rule is loaded
+class RuleLMScore {
+public:
+    RuleLMScore() : lm(NULL), prob(0), unk(0) { }
+    // The model that the score was calculated with
+    const void * lm;
+    // The total score of the n-grams that do not cross a non-terminal
+    float prob;
+    // The number of unknown words
+    int unk;
+    // The states of the words before, between, and after the non-terminals,
+    // which hold the boundary words already mapped to the LM vocabulary
+    std::vector<lm::ngram::ChartState> between;
+};
+
+// The scores of a single rule for every LM
+class RuleLMScores {
+public:
+    // Find the score for a particular model, or NULL if there is none
+    const RuleLMScore * Find(const void * lm) const {
+        for(int i = 0; i < (int)scores.size(); i++)
+            if(scores[i].lm == lm)
+                return &scores[i];
+        return NULL;
+    }
+    std::vector<RuleLMScore> scores;
+};
+
+// Calculates the rule-internal LM scores of rules as they are loaded
+class LMRulePreparer : public RulePreparer {
+public:
+    void AddData(const LMData * data) { lm_data_.push_back(data); }
+    virtual void Prepare(TranslationRule & rule) const;
+protected:
+    std::vector<const LMData*> lm_data_;
+};
+
+// Estimates for the nodes and edges of a rule graph before it is composed
+// with the LM, used to spend less search effort on nodes that are unlikely
+// to be in the best derivation
+class LMOutsideEstimates {
+public:
+    // For each edge, the estimated weighted LM score of the words in its rule
+    std::vector<Real> edge_lm;
+    // For each node, the fraction of the pop and chart limits it can use
+    std::vector<Real> scale;
+
+    // Scale a limit for a node, keeping at least one
+    int ScaleLimit(int id, int limit) const {
+        int ret = (int)(limit * scale[id] + 0.999);
+        return ret < 1 ? 1 : ret;
+    }
+};
+
 // A parent class for search algorithms that compose a rule graph with a
 // target side language model
 class LMComposer : public GraphTransformer {
@@ -89,10 +159,15 @@ class LMComposer : public GraphTransformer {
 protected:
     std::vector<LMData*> lm_data_;
     WordId root_sym_;
+    // A cache of phrase scores, which may be shared with other composers
+    boost::shared_ptr<LMScoreCache> score_cache_;
+    // The difference from the best estimated score at which a node only
+    // gets a single pop (0 to disable)
+    Real outside_beam_;
 
 public:
     LMComposer(const std::vector<std::string> & str);
-    LMComposer(void * model, lm::ngram::ModelType type, VocabMap* vocab_map) {
+    LMComposer(void * model, lm::ngram::ModelType type, VocabMap* vocab_map) : outside_beam_(0) {
         LMData * data = new LMData(model, type, vocab_map);
         lm_data_.push_back(data);
         root_sym_ = Dict::WID("LMROOT");
@@ -105,9 +180,31 @@ public:
 
     void UpdateWeights(const SparseMap & weights);
 
+    // Set the cache used to look up phrase scores. If it is NULL (the
+    // default), all scores are calculated with the LM directly
+    const boost::shared_ptr<LMScoreCache> & GetScoreCache() const { return score_cache_; }
+    void SetScoreCache(const boost::shared_ptr<LMScoreCache> & cache) { score_cache_ = cache; }
+
+    // Set the beam for the outside estimates. If it is more than zero, the
+    // best score of a derivation through each node is estimated with the
+    // rule scores and the LM scores of the words in the rules. Nodes whose
+    // estimate is worse than the best get linearly fewer pops and chart
+    // items, down to one when they are outside_beam worse
+    Real GetOutsideBeam() const { return outside_beam_; }
+    void SetOutsideBeam(Real outside_beam) { outside_beam_ = outside_beam; }
+
     // Compose the rule graph with a language model
     virtual HyperGraph * TransformGraph(const HyperGraph & hg) const = 0;
 
+protected:
+
+    // Estimate the weighted LM score of the words inside of the rule of an
+    // edge, not considering the context of the non-terminals
+    Real CalcRuleLMEstimate(const HyperEdge * edge) const;
+
+    // Calculate the outside estimates for a rule graph
+    void CalcOutsideEstimates(const HyperGraph & parse, LMOutsideEstimates & est) const;
+
 };
 
 }
@@ -0,0 +1,134 @@
+#ifndef LM_SCORE_CACHE_H__
+#define LM_SCORE_CACHE_H__
+
+// A cache of language model scores for target phrases that is shared by all
+// threads and kept across sentences. Each entry is keyed by the kind of
+// composer, the LM, the words of the phrase (with non-terminals as negative
+// IDs), and the LM states of the non-terminals, and holds the LM score, the
+// number of unknown words, and the resulting LM states. What the score and
+// states mean depends on the composer, so composers of different kinds that
+// share a cache never see each other's entries.
+//
+// The entries are split into shards by their hash, and each shard has its
+// own lock. A shard keeps two generations of entries: when the newer one
+// exceeds the shard's share of the memory budget it replaces the older one,
+// and entries found in the older generation are moved to the newer one. This
+// roughly keeps the entries that have been used recently. Lookups hash the
+// caller's words and states in place, and only a miss that is added copies
+// them into a Key.
+
+#include <travatar/sentence.h>
+#include <travatar/real.h>
+#include <lm/state.hh>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+namespace travatar {
+
+class LMScoreCache {
+public:
+
+    // The kinds of composer that calculate values
+    enum Kind { BOTTOM_UP, INCREMENTAL };
+
+    struct Key {
+        Key() : kind(BOTTOM_UP), lm(NULL) { }
+        // The kind of composer that calculated the value
+        Kind kind;
+        // The model that the score was calculated with
+        const void * lm;
+        // The words of the phrase
+        Sentence words;
+        // The states of the non-terminals in the phrase (if any)
+        std::vector<lm::ngram::ChartState> states;
+        bool operator==(const Key & rhs) const {
+            return kind == rhs.kind && lm == rhs.lm && words == rhs.words && states == rhs.states;
+        }
+    };
+
+    // The parts of a key as they are held by the caller, so entries can be
+    // found without copying the words and states into a Key. The states of
+    // the non-terminals are the lm_id'th states of each tail
+    struct KeyRef {
+        KeyRef(const Key & key) :
+            kind(key.kind), lm(key.lm), words(&key.words), key_states(&key.states),
+            tail_states(NULL), lm_id(0) { }
+        KeyRef(Kind my_kind, const void * my_lm, const Sentence & my_words,
+               const std::vector<const std::vector<lm::ngram::ChartState>*> * my_tail_states = NULL,
+               int my_lm_id = 0) :
+            kind(my_kind), lm(my_lm), words(&my_words), key_states(NULL),
+            tail_states(my_tail_states), lm_id(my_lm_id) { }
+        int NumStates() const {
+            return key_states ? key_states->size() : (tail_states ? tail_states->size() : 0);
+        }
+        const lm::ngram::ChartState & GetState(int i) const {
+            return key_states ? (*key_states)[i] : (*(*tail_states)[i])[lm_id];
+        }
+        // Make a key holding copies of the words and states
+        Key ToKey() const;
+        Kind kind;
+        const void * lm;
+        const Sentence * words;
+        const std::vector<lm::ngram::ChartState> * key_states;
+        const std::vector<const std::vector<lm::ngram::ChartState>*> * tail_states;
+        int lm_id;
+    };
+
+    struct Value {
+        Value() : score(0), unk(0) { }
+        Real score;
+        int unk;
+        std::vector<lm::ngram::ChartState> states;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key & key) const { return (*this)(KeyRef(key)); }
+        size_t operator()(const KeyRef & key) const;
+    };
+
+    // Create a cache that uses about max_bytes of memory
+    LMScoreCache(size_t max_bytes, int num_shards = 64);
+
+    // Find the value for a key, returning false if it is not cached
+    bool Find(const KeyRef & key, Value & value);
+    // Add the value for a key
+    void Add(const KeyRef & key, const Value & value);
+    // Remove all entries and reset the counters
+    void Clear();
+
+    // Statistics
+    long GetHits() const;
+    long GetMisses() const;
+    long GetSize() const;
+    size_t GetBytes() const;
+    size_t GetMaxBytes() const { return max_bytes_; }
+
+protected:
+    typedef boost::unordered_map<Key, Value, KeyHash> EntryMap;
+
+    struct Shard {
+        Shard() : bytes(0), hits(0), misses(0) { }
+        mutable boost::mutex mutex;
+        EntryMap curr, prev;
+        size_t bytes;
+        long hits, misses;
+    };
+
+    // The approximate memory used by a single entry
+    static size_t EntryBytes(const Key & key, const Value & value);
+    // Get the shard of a key hash
+    Shard & GetShard(size_t hash) { return *shards_[(hash >> 16) % shards_.size()]; }
+    // Add an entry to a shard that is already locked
+    void AddLocked(Shard & shard, const EntryMap::value_type & entry);
+
+    std::vector<boost::shared_ptr<Shard> > shards_;
+    size_t max_bytes_;
+    size_t shard_bytes_;
+
+};
+
+}
+
+#endif
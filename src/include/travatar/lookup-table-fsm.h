@@ -1,15 +1,22 @@
 #ifndef LOOKUP_TABLE_FSM_H__
 #define LOOKUP_TABLE_FSM_H__
 
+#include <travatar/global-debug.h>
 #include <travatar/graph-transformer.h>
 #include <travatar/sentence.h>
 #include <travatar/sparse-map.h>
 #include <travatar/translation-rule-hiero.h>
 #include <marisa/marisa.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <vector>
 #include <map>
 #include <set>
+#include <stdint.h>
+
+namespace boost { namespace iostreams { class mapped_file_source; } }
 
 namespace travatar {
 
@@ -17,15 +24,65 @@ class HyperNode;
 class HyperEdge;
 class LookupNodeFSM;
 class TranslationRuleHiero;
+class RuleTableLimit;
 
 typedef std::vector<std::pair<int,int> > HieroRuleSpans;
 typedef std::map<HieroHeadLabels, HyperNode*> HeadNodePairs;
-typedef std::map<std::pair<int,int>, HeadNodePairs> HieroNodeMap;
 typedef std::vector<HyperEdge* > EdgeList;
 typedef std::pair<int, std::pair<int,int> > TailSpanKey;
 typedef std::map<HieroHeadLabels,std::set<HieroHeadLabels> > UnaryMap;
 typedef std::map<WordId, LookupNodeFSM*> LookupNodeMap;
 typedef std::map<HieroHeadLabels, LookupNodeFSM*> NTLookupNodeMap;
+
+// A rule matched while building the chart, and the spans of the key that
+// matched it, which are stored in HieroMatches::spans
+struct HieroMatch {
+    TranslationRuleHiero * rule;
+    HyperNode * head;
+    int spans_begin, spans_end;
+    bool save_src_str;
+};
+
+// The rules matched while building the chart of a sentence. Their edges are
+// only built once the chart is finished, as the chart itself only depends
+// on the head labels of the rules
+struct HieroMatches {
+    std::vector<HieroMatch> rules;
+    HieroRuleSpans spans;
+};
+
+// The chart of nodes built while parsing a sentence, with a cell for every
+// span that holds the node for each label. Cells are stored in a flat array,
+// and are iterated in order of span start, then span end
+class HieroNodeMap {
+public:
+    HieroNodeMap(int length) : length_(length), cells_(length*length) { }
+
+    // Get the cell for a span, or NULL if it has no nodes
+    HeadNodePairs * Find(int begin, int end) {
+        HeadNodePairs & cell = cells_[Index(begin, end)];
+        return cell.size() ? &cell : NULL;
+    }
+    const HeadNodePairs * Find(int begin, int end) const {
+        const HeadNodePairs & cell = cells_[Index(begin, end)];
+        return cell.size() ? &cell : NULL;
+    }
+    // Get the cell for a span, which may be empty
+    HeadNodePairs & Get(int begin, int end) { return cells_[Index(begin, end)]; }
+
+    int GetLength() const { return length_; }
+
+protected:
+    int Index(int begin, int end) const {
+        if(begin < 0 || end <= begin || end > length_)
+            THROW_ERROR("Invalid span range in constructing HyperGraph: " << begin << "," << end);
+        return begin * length_ + end - 1;
+    }
+
+    int length_;
+    std::vector<HeadNodePairs> cells_;
+};
+
 class LookupNodeFSM {
 protected:
     LookupNodeMap lookup_map_;
@@ -59,24 +116,58 @@ protected:
     typedef std::vector<TranslationRuleHiero*> RuleVec;
     typedef std::vector<RuleVec> RuleSet; 
 
-    // The trie indexing the rules, and the rules
+    // The trie indexing the rules, and the rules. When mapped from a
+    // binary image, rules_ is filled lazily by FindRules
     marisa::Trie trie_;
-    RuleSet rules_;
+    mutable RuleSet rules_;
 
     // Other statistics
     UnaryMap unaries_;
     int span_length_;
     bool save_src_str_;
+
+    // The mapped binary image, if any
+    boost::scoped_ptr<boost::iostreams::mapped_file_source> mapped_;
+    // The offset of each key's rules in the payload
+    const uint64_t * offsets_;
+    // The rule payload
+    const char * payload_;
+    // The image's vocabulary, and the mapping from Dict IDs to it
+    std::vector<WordId> vocab_;
+    boost::unordered_map<WordId, WordId> local_ids_;
+    // Protects lazy decoding of rules_
+    mutable boost::shared_mutex rules_mutex_;
+    // Prepares the rules once they are loaded (default NULL)
+    boost::shared_ptr<RulePreparer> preparer_;
+    // Limits the rules for each key once they are loaded (default NULL)
+    boost::shared_ptr<RuleTableLimit> table_limit_;
+
 public:
 
     friend class LookupTableFSM;
 
-    RuleFSM() : span_length_(20), save_src_str_(false) { }
+    RuleFSM();
 
     virtual ~RuleFSM();
     
     static RuleFSM * ReadFromRuleTable(std::istream & in);
 
+    // Compile a text rule table into a binary image holding the trie, the
+    // rules and the unary closure. The output must be seekable. If limit is
+    // given, only the best rules for each key are written, in order of score.
+    // Rules with the same source must be on consecutive lines (as in a
+    // sorted table), as only the rules of one source are held in memory.
+    // The keys of the trie are kept for the whole table.
+    static void CompileRuleTable(std::istream & in, std::ostream & out,
+                                 const RuleTableLimit * limit = NULL);
+
+    // Map a binary image created by CompileRuleTable
+    static RuleFSM * ReadFromBinaryFile(const std::string & filename);
+
+    // Expand the unary map into its transitive closure, so the unary nodes
+    // over a span can be built in a single pass
+    static void ExpandUnaries(UnaryMap & unaries);
+
     static TranslationRuleHiero * BuildRule(travatar::TranslationRuleHiero * rule, std::vector<std::string> & source, 
             std::vector<std::string> & target, SparseMap& features);
 
@@ -90,13 +181,48 @@ public:
     // MUTATOR
     void SetSpanLimit(const int length) { span_length_ = length; }
     void SetSaveSrcStr(const bool save_src_str) { save_src_str_ = save_src_str; }
+    // Set an object that prepares each rule once it is loaded. Rules that
+    // have already been loaded are prepared immediately
+    void SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer);
+    // Set a limit on the number of rules for each key. Rules that have
+    // already been loaded are limited immediately
+    void SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit);
 
 protected:
-    void BuildHyperGraphComponent(HieroNodeMap & node_map, EdgeList & edge_set,
-        const Sentence & input, const std::string & state, int position, HieroRuleSpans & spans) const;
+    // Parse the input with dotted rules that start at "position". The key of
+    // the dotted rule so far and the spans it covers are extended in place,
+    // and restored before returning. The agent is reused for every search
+    void BuildHyperGraphComponent(HieroNodeMap & node_map, HieroMatches & matches,
+        const Sentence & input, std::string & key, int position, HieroRuleSpans & spans,
+        marisa::Agent & agent) const;
+
+    // Add the head nodes and matches for the rules that exactly match "key",
+    // and return whether there are any longer rules that start with it
+    bool MatchKey(const std::string & key, const HieroRuleSpans & spans,
+                  HieroNodeMap & node_map, HieroMatches & matches,
+                  marisa::Agent & agent) const;
+
+    // Add the nodes that can be built by unary rules from the nodes of a cell
+    void ExpandUnaryNodes(HieroNodeMap & node_map, int begin, int end) const;
 
     static std::string CreateKey(const CfgData & src_data,
                                  const std::vector<CfgData> & trg_data);
+
+    // Get the rules for a particular trie key
+    const RuleVec & FindRules(size_t id) const;
+
+    // Decode the rules for a single key from the mapped payload
+    void DecodeRules(size_t id, RuleVec & rules) const;
+
+    // Convert a Dict word ID into the ID used in the trie keys. Returns false
+    // if the word does not appear in a mapped image.
+    bool MapWord(WordId & wid) const {
+        if(!mapped_.get()) return true;
+        boost::unordered_map<WordId, WordId>::const_iterator it = local_ids_.find(wid);
+        if(it == local_ids_.end()) return false;
+        wid = it->second;
+        return true;
+    }
 private:
     // void AddRule(int position, LookupNodeFSM* target_node, TranslationRuleHiero* rule);
 };
@@ -114,6 +240,8 @@ protected:
     HieroHeadLabels root_symbol_;
     HieroHeadLabels unk_symbol_;
     bool save_src_str_;
+    // The number of threads used to build the edges of a single sentence
+    int num_threads_;
 public:
     LookupTableFSM();
     ~LookupTableFSM();
@@ -128,16 +256,21 @@ public:
     const HieroHeadLabels & GetRootSymbol() const { return root_symbol_; } 
     const HieroHeadLabels & GetUnkSymbol() const { return unk_symbol_; } 
     bool GetDeleteUnknown() const { return delete_unknown_; } 
+    int GetNumThreads() const { return num_threads_; }
 
     void SetDeleteUnknown(bool delete_unk) { delete_unknown_ = delete_unk; }
+    void SetNumThreads(int num_threads) { num_threads_ = num_threads; }
     void SetRootSymbol(WordId symbol) { root_symbol_ = HieroHeadLabels(std::vector<WordId>(trg_factors_+1,symbol)); }
     void SetSpanLimits(const std::vector<int>& limits);
     void SetTrgFactors(const int trg_factors) { trg_factors_ = trg_factors; } 
     void SetSaveSrcStr(const bool save_src_str);
+    void SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer);
+    void SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit);
 
     static TranslationRuleHiero* GetUnknownRule(WordId unknown_word, const HieroHeadLabels& head_labels);
 
     static LookupTableFSM * ReadFromFiles(const std::vector<std::string> & filenames);
+    static LookupTableFSM * ReadFromBinaryFiles(const std::vector<std::string> & filenames);
 
     static HyperEdge* TransformRuleIntoEdge(HieroNodeMap& map, const int head_first, 
             const int head_second, const std::vector<TailSpanKey > & tail_spans, TranslationRuleHiero* rule, bool save_src_str=false);
@@ -145,6 +278,15 @@ public:
     static HyperEdge* TransformRuleIntoEdge(TranslationRuleHiero* rule, const HieroRuleSpans & rule_span, HieroNodeMap & node_map, bool save_src_str=false);
 
     static HyperNode* FindNode(HieroNodeMap& map, const int span_begin, const int span_end, const HieroHeadLabels& head_label);
+
+    // Build the edge of a match once the chart is finished. The edge is not
+    // added to its head, so the edges of several matches can be built at once
+    static HyperEdge* BuildMatchEdge(const HieroMatch & match, const HieroRuleSpans & spans, const HieroNodeMap & node_map);
+
+protected:
+    // Build the edges of all the matches, in parallel if there are several
+    // threads, and add them to their heads in the order they were matched
+    void BuildMatchEdges(const HieroMatches & matches, const HieroNodeMap & node_map, EdgeList & edge_list) const;
     
 };
 }
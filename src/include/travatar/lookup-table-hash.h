@@ -15,8 +15,8 @@ public:
     LookupTableHash() { }
     virtual ~LookupTableHash();
 
-    virtual LookupState * GetInitialState() const {
-        return new LookupState;
+    virtual LookupState * GetInitialState(LookupStateArena & arena) const {
+        return arena.New<LookupState>();
     }
 
     static LookupTableHash * ReadFromFile(std::string & filename);
@@ -36,18 +36,21 @@ public:
         src_matches.insert(str);
     }
 
+    virtual void SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer);
+    virtual void SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit);
+
 protected:
 
     // Match a single node
-    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const;
 
     // Match the start of an edge
-    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const;
     
     // Match the end of an edge
-    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const;
 
-    LookupState * MatchState(const std::string & next, const LookupState & state) const;
+    LookupState * MatchState(const std::string & next, const LookupState & state, LookupStateArena & arena) const;
 
     void AddRule(const std::string & str, TranslationRule * rule);
 
@@ -3,7 +3,12 @@
 
 #include <travatar/lookup-table.h>
 #include <marisa/marisa.h>
+#include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
 #include <vector>
+#include <stdint.h>
+
+namespace boost { namespace iostreams { class mapped_file_source; } }
 
 namespace travatar {
 
@@ -12,31 +17,55 @@ class HyperNode;
 // A table that allows rules to be looked up in a hash table
 class LookupTableMarisa : public LookupTable {
 public:
-    LookupTableMarisa() { }
+    LookupTableMarisa();
     virtual ~LookupTableMarisa();
 
-    virtual LookupState * GetInitialState() const {
-        return new LookupState;
+    virtual LookupState * GetInitialState(LookupStateArena & arena) const {
+        return arena.New<LookupState>();
     }
 
     static LookupTableMarisa * ReadFromFile(std::string & filename);
     static LookupTableMarisa * ReadFromRuleTable(std::istream & in);
 
+    // Compile a text rule table into the binary format read by
+    // ReadFromBinaryFile. The output must be seekable, as the header
+    // is written after all the other sections are known. If limit is given,
+    // only the best rules for each source are written, in order of score.
+    static void CompileRuleTable(std::istream & in, std::ostream & out,
+                                 const RuleTableLimit * limit = NULL);
+
+    // Map a compiled rule table into memory. The trie is used directly from
+    // the mapped pages, and rules are only decoded the first time they
+    // are looked up.
+    static LookupTableMarisa * ReadFromBinaryFile(const std::string & filename);
+
     // Find rules associated with a particular source pattern
     virtual const std::vector<TranslationRule*> * FindRules(const LookupState & state) const;
 
+    virtual void SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer);
+    virtual void SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit);
+
 protected:
 
     // Match a single node
-    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const;
 
     // Match the start of an edge
-    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const;
     
     // Match the end of an edge
-    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state) const;
+    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const;
 
-    LookupState * MatchState(const std::string & next, const LookupState & state) const;
+    LookupState * MatchState(const std::string & next, const LookupState & state, LookupStateArena & arena) const;
+
+    // Decode the rules for a single key from the mapped payload
+    void DecodeRules(size_t id, std::vector<TranslationRule*> & rules) const;
+    // Map a table-local word ID read from the payload to a Dict word ID
+    WordId MapWord(int32_t val, bool allow_negative) const;
+
+    // The rules decoded from a mapped table for a single key
+    typedef boost::atomic<std::vector<TranslationRule*>*> DecodedSlot;
+    DecodedSlot & GetDecodedSlot(size_t id) const;
 
     // void AddRule(TranslationRule * rule) {
     //     rules_[rule->GetSrcStr()].push_back(rule);
@@ -50,8 +79,26 @@ protected:
 
 protected:
     marisa::Trie trie_;
+    // The rules of a table read from text
     RuleSet rules_;
 
+    // The mapped binary table, if any
+    boost::scoped_ptr<boost::iostreams::mapped_file_source> mapped_;
+    // The offset of each key's rules in the payload
+    const uint64_t * offsets_;
+    // The rule payload
+    const char * payload_;
+    // The size of the payload in bytes
+    uint64_t payload_size_;
+    // Mapping from the table's vocabulary to Dict word IDs
+    std::vector<WordId> vocab_;
+    // Rules decoded from the mapped table. Slots are kept in chunks of
+    // DECODED_CHUNK_SIZE keys, and a chunk is only allocated when one of its
+    // keys is first looked up, so loading touches nothing per key
+    static const size_t DECODED_CHUNK_SIZE = 1024;
+    size_t num_decoded_chunks_;
+    boost::atomic<DecodedSlot*> * decoded_;
+
 };
 
 }
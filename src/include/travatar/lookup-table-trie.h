@@ -0,0 +1,106 @@
+#ifndef LOOKUP_TABLE_TRIE_H__
+#define LOOKUP_TABLE_TRIE_H__
+
+#include <travatar/lookup-table.h>
+#include <boost/unordered_map.hpp>
+#include <vector>
+#include <stdint.h>
+
+namespace travatar {
+
+class HyperNode;
+
+// A lookup state that remembers the node of the trie that it has reached
+class LookupStateTrie : public LookupState {
+public:
+    LookupStateTrie() : trie_node_(0) { }
+    virtual ~LookupStateTrie() { }
+
+    int GetTrieNode() const { return trie_node_; }
+    void SetTrieNode(int trie_node) { trie_node_ = trie_node; }
+
+protected:
+    int trie_node_;
+};
+
+// A table that indexes the source side of rules in a trie over WordIds.
+// Rather than building a string for every partial match and searching from
+// the root, states store their trie node and are extended by one symbol at
+// a time.
+class LookupTableTrie : public LookupTable {
+public:
+    // The kind of symbol on a trie transition
+    typedef enum {
+        TRIE_WORD = 0,    // A terminal "word"
+        TRIE_OPEN = 1,    // The start of an edge "SYM ("
+        TRIE_CLOSE = 2,   // The end of an edge ")"
+        TRIE_NONTERM = 3  // A non-terminal "xN:SYM"
+    } TrieSymbolType;
+
+    LookupTableTrie() : num_nodes_(1), rules_(1) { }
+    virtual ~LookupTableTrie();
+
+    virtual LookupState * GetInitialState(LookupStateArena & arena) const {
+        return arena.New<LookupStateTrie>();
+    }
+
+    static LookupTableTrie * ReadFromFile(std::string & filename);
+    static LookupTableTrie * ReadFromRuleTable(std::istream & in);
+
+    // Find rules associated with a particular source pattern
+    virtual const std::vector<TranslationRule*> * FindRules(const LookupState & state) const;
+
+    // Add a rule with the source side given in tree format,
+    // e.g. S ( NP ( PRP ( "he" ) ) x0:VP ). Returns false if the source
+    // cannot be matched (non-terminals are not numbered in order)
+    bool AddRule(const std::string & src, TranslationRule * rule);
+
+    virtual void SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer);
+    virtual void SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit);
+
+    int GetNumNodes() const { return num_nodes_; }
+
+protected:
+
+    // Match a single node
+    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const;
+
+    // Match the start of an edge
+    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const;
+    
+    // Match the end of an edge
+    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const;
+
+    // Follow a single transition from the state's node, and create a new state
+    // if it exists. The source string is only built when it will be saved.
+    LookupStateTrie * MatchState(TrieSymbolType type, WordId wid,
+                                 const LookupState & state,
+                                 LookupStateArena & arena) const;
+
+    // Get the key of a transition from a node
+    static uint64_t GetTransitionKey(int node, TrieSymbolType type, WordId wid) {
+        return ((uint64_t)node << 32) | ((uint64_t)wid << 2) | type;
+    }
+
+    // Find the node following a transition, or -1 if there is none
+    int FindTransition(int node, TrieSymbolType type, WordId wid) const {
+        TransitionMap::const_iterator it = transitions_.find(GetTransitionKey(node, type, wid));
+        return (it == transitions_.end() ? -1 : it->second);
+    }
+
+    // Find the node following a transition, adding it if necessary
+    int AddTransition(int node, TrieSymbolType type, WordId wid);
+
+protected:
+    // All transitions in the trie keyed by the source node and symbol
+    typedef boost::unordered_map<uint64_t, int> TransitionMap;
+    TransitionMap transitions_;
+    int num_nodes_;
+    // The rules for each node of the trie
+    std::vector<std::vector<TranslationRule*> > rules_;
+
+};
+
+}
+
+#endif
@@ -12,6 +12,7 @@
 namespace travatar {
 
 class HyperNode;
+class RuleTableLimit;
 
 // A single state for a partial rule match
 // This must be overloaded with a state that is used in a specific implementation
@@ -37,7 +38,41 @@ protected:
     std::string curr_string_;
 };
 
-typedef std::pair<std::vector<boost::shared_ptr<LookupState> >, const HyperNode*> SpannedState;
+// A pool that owns all of the LookupStates created while looking up rules
+// for a single sentence. States are constructed in large blocks and are
+// only released together when the arena is cleared or destroyed, so partial
+// matches can be passed around as plain pointers.
+class LookupStateArena {
+public:
+    LookupStateArena() : pos_(0) { }
+    ~LookupStateArena() { Clear(); }
+
+    // Create a new state of type T in the arena
+    template <class T>
+    T * New() {
+        T * ret = new(Allocate(sizeof(T))) T;
+        states_.push_back(ret);
+        return ret;
+    }
+
+    // Destroy all states and release the memory
+    void Clear();
+
+    size_t size() const { return states_.size(); }
+
+protected:
+    void * Allocate(size_t size);
+
+    std::vector<char*> blocks_;
+    size_t pos_;
+    std::vector<LookupState*> states_;
+
+private:
+    LookupStateArena(const LookupStateArena &);
+    LookupStateArena & operator=(const LookupStateArena &);
+};
+
+typedef std::pair<std::vector<LookupState*>, const HyperNode*> SpannedState;
 
 // Class to compare State, basically comparison is based on the span length.
 // The shorter comes first.
@@ -57,9 +92,11 @@ public:
     virtual HyperGraph * TransformGraph(const HyperGraph & parse) const;
 
     // Find all the translation rules rooted at a particular node in a parse graph
-    std::vector<boost::shared_ptr<LookupState> > LookupSrc(
+    // All new states are allocated from arena
+    std::vector<LookupState*> LookupSrc(
             const HyperNode & node, 
-            const std::vector<boost::shared_ptr<LookupState> > & old_states) const;
+            const std::vector<LookupState*> & old_states,
+            LookupStateArena & arena) const;
 
     // Find rules associated with a particular source pattern
     virtual const std::vector<TranslationRule*> * FindRules(const LookupState & state) const = 0;
@@ -67,7 +104,7 @@ public:
     // Get the unknown rule
     const TranslationRule * GetUnknownRule() const;
 
-    virtual LookupState * GetInitialState() const = 0;
+    virtual LookupState * GetInitialState(LookupStateArena & arena) const = 0;
 
     // Accessors
     void SetMatchAllUnk(bool match_all_unk) { match_all_unk_ = match_all_unk; }
@@ -76,6 +113,13 @@ public:
     bool GetSaveSrcStr() { return save_src_str_; }
     void SetConsiderTrg(bool consider_trg) { consider_trg_ = consider_trg; }
     bool GetConsiderTrg() { return consider_trg_; } 
+
+    // Set an object that prepares each rule once it is loaded. Rules that
+    // have already been loaded are prepared immediately
+    virtual void SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer) { preparer_ = preparer; }
+    // Set a limit on the number of rules for each source. Rules that have
+    // already been loaded are limited immediately
+    virtual void SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit) { table_limit_ = limit; }
 protected:
 
     // Match a single node
@@ -83,19 +127,24 @@ protected:
     // If matching a non-terminal (e.g. VP), advance the state and push "node"
     // on to the list of non-terminals. Otherwise, just advance the state
     // Returns NULL if no rules were matched
-    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state) const = 0;
+    // New states are allocated from arena
+    virtual LookupState * MatchNode(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const = 0;
 
     // Match the start of an edge
     // For example S(NP(PRN("he")) x0:VP) will match the opening bracket 
     // of S( or NP( or PRN(
-    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state) const = 0;
+    virtual LookupState * MatchStart(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const = 0;
     
     // Match the end of an edge
     // For example S(NP(PRN("he")) x0:VP) will match the closing brackets for
     // of (S...) or (NP...) or (PRN...)
-    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state) const = 0;
+    virtual LookupState * MatchEnd(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const = 0;
 
     TranslationRule unk_rule_;
+    // Prepares the rules once they are loaded (default NULL)
+    boost::shared_ptr<RulePreparer> preparer_;
+    // Limits the rules for each source once they are loaded (default NULL)
+    boost::shared_ptr<RuleTableLimit> table_limit_;
     // Match all nodes with the unknown rule, not just when no other rule is matched (default false)
     bool match_all_unk_;
     // Save the source string in the graph or not (default false)
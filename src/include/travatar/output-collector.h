@@ -5,25 +5,41 @@
 // environments. Modeled after the Moses implementation
 
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <pthread.h>
 #include <iostream>
+#include <map>
 
 namespace travatar {
 
 class OutputCollector {
 public:
-    OutputCollector(std::ostream* out_stream=&std::cout, std::ostream* err_stream=&std::cerr, bool buffer=true) :
-            next_(0), out_stream_(out_stream), err_stream_(err_stream), buffer_(buffer) { }
+    OutputCollector(std::ostream* out_stream=&std::cout, std::ostream* err_stream=&std::cerr, bool buffer=true, int window=0) :
+            next_(0), out_stream_(out_stream), err_stream_(err_stream), buffer_(buffer),
+            window_(window), max_saved_(0) { }
 
     void Write(int id, const std::string & out, const std::string & err);
     void Flush();
-    void Skip();
+
+    // The maximum number of outputs that may be held waiting for an earlier
+    // output. Writers that are further ahead wait until the earlier outputs
+    // are written (0 = no limit)
+    void SetWindow(int window) { window_ = window; }
+    int GetWindow() const { return window_; }
+
+    // The number of outputs currently waiting, and the most that have ever waited
+    int GetNumSaved();
+    int GetMaxSaved();
+
 private:
     std::map<int,std::pair<std::string,std::string> > saved_;
     int next_;
     std::ostream *out_stream_, *err_stream_;
     boost::mutex mutex_;
+    boost::condition_variable window_moved_;
     bool buffer_;
+    int window_;
+    int max_saved_;
 
 };
 
@@ -0,0 +1,24 @@
+#ifndef RT_COMPILE_RUNNER_H__ 
+#define RT_COMPILE_RUNNER_H__
+
+namespace travatar {
+
+class ConfigRtCompileRunner;
+
+// A class to compile rule tables into binary format
+class RtCompileRunner {
+public:
+
+    RtCompileRunner() { }
+    ~RtCompileRunner() { }
+    
+    // Run the model
+    void Run(const ConfigRtCompileRunner & config);
+
+private:
+
+};
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef RT_FILTER_RUNNER_H__ 
+#define RT_FILTER_RUNNER_H__
+
+#include <travatar/task.h>
+#include <string>
+#include <vector>
+
+namespace travatar {
+
+class ConfigRtFilterRunner;
+class OutputCollector;
+class RuleTableFilter;
+
+// A task to filter a single block of the rule table
+class RtFilterTask : public Task {
+public:
+    RtFilterTask(int id, const RuleTableFilter * filter, OutputCollector * collector) :
+        id_(id), filter_(filter), collector_(collector) { }
+    void Run();
+    std::vector<std::string> & GetLines() { return lines_; }
+private:
+    int id_;
+    std::vector<std::string> lines_;
+    const RuleTableFilter * filter_;
+    OutputCollector * collector_;
+};
+
+// A class to filter rule tables for a set of inputs
+class RtFilterRunner {
+public:
+
+    RtFilterRunner() { }
+    ~RtFilterRunner() { }
+    
+    // Run the model
+    void Run(const ConfigRtFilterRunner & config);
+
+private:
+
+};
+
+}
+
+#endif
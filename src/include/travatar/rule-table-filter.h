@@ -0,0 +1,95 @@
+#ifndef RULE_TABLE_FILTER_H__
+#define RULE_TABLE_FILTER_H__
+
+#include <travatar/sentence.h>
+#include <boost/functional/hash.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace travatar {
+
+class HyperGraph;
+class HyperNode;
+
+// Decides whether the source side of a rule can be used when translating
+// any of a set of inputs, so a rule table can be filtered for a test set.
+// After all inputs are added, Matches() can be called from several threads.
+// Symbols that are not in the dictionary (if it is frozen) never match
+class RuleTableFilter {
+public:
+    virtual ~RuleTableFilter() { }
+
+    // Add an input that the rules should be matched against
+    virtual void AddInput(const HyperGraph & input) = 0;
+
+    // Check whether the source side of a rule matches any of the inputs
+    virtual bool Matches(const std::string & src) const = 0;
+
+    // Write the lines of a rule table that match any of the inputs
+    void FilterLines(const std::vector<std::string> & lines, std::ostream & out) const;
+
+protected:
+    // Add a sentence to an index of words to the sentences they appear in
+    static void IndexWords(const Sentence & words, int sent,
+                           boost::unordered_map<WordId, std::vector<int> > & index);
+    // Intersect a sorted list of sentences with another
+    static void Intersect(std::vector<int> & sents, const std::vector<int> & other);
+};
+
+// Matches tree-to-string rules, whose sources are tree fragments such as
+// S ( NP ( PRP ( "he" ) ) x0:VP ), against the nodes of input parses or
+// forests in the same way as LookupTable
+class RuleTableFilterTree : public RuleTableFilter {
+public:
+    virtual void AddInput(const HyperGraph & input);
+    virtual bool Matches(const std::string & src) const;
+
+protected:
+    // A node of a tree fragment
+    struct Fragment {
+        Fragment() : sym(-1), terminal(false) { }
+        WordId sym;
+        // A word, as opposed to a non-terminal or an internal node
+        bool terminal;
+        // The children of an internal node (empty for non-terminals)
+        std::vector<Fragment> children;
+    };
+
+    // Parse a fragment starting at tokens[pos], advancing pos. Returns false
+    // if the tokens are not a well-formed fragment
+    static bool ParseFragment(const std::vector<std::string> & tokens, int & pos, Fragment & frag);
+    // Add the keys of the one-level productions at all internal nodes of a
+    // fragment. A key holds the symbol of the node and its children, with
+    // terminals as negative IDs. Returns the depth of the fragment, or -1 if
+    // it contains an unknown symbol
+    static int AddProductionKeys(const Fragment & frag, std::vector<Sentence> & keys);
+    // Check whether an internal fragment node matches an input node
+    static bool MatchFragment(const HyperNode & node, const Fragment & frag);
+
+    // The inputs, their non-terminal nodes by symbol, and the sentences
+    // that each one-level production appears in
+    std::vector<boost::shared_ptr<HyperGraph> > inputs_;
+    std::vector<boost::unordered_map<WordId, std::vector<const HyperNode*> > > nodes_;
+    boost::unordered_map<Sentence, std::vector<int> > productions_;
+};
+
+// Matches hiero rules, whose sources are sequences of words and
+// non-terminals such as "eat" x0:X @ X, against the words of the inputs.
+// Each non-terminal must cover at least one word
+class RuleTableFilterHiero : public RuleTableFilter {
+public:
+    virtual void AddInput(const HyperGraph & input);
+    virtual bool Matches(const std::string & src) const;
+
+protected:
+    std::vector<Sentence> sents_;
+    // The sentences that each word appears in
+    boost::unordered_map<WordId, std::vector<int> > words_;
+};
+
+}
+
+#endif
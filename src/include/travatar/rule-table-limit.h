@@ -0,0 +1,66 @@
+#ifndef RULE_TABLE_LIMIT_H__
+#define RULE_TABLE_LIMIT_H__
+
+#include <travatar/sparse-map.h>
+#include <travatar/real.h>
+#include <vector>
+#include <algorithm>
+
+namespace travatar {
+
+// Limits the number of rules for each source key of a rule table. Rules are
+// scored with a fixed set of weights, and only the best ones are kept, sorted
+// in descending order of score. Rules with equal scores keep their order in
+// the table
+class RuleTableLimit {
+public:
+    RuleTableLimit(int limit, const SparseMap & weights) :
+        limit_(limit), weights_(weights) { }
+
+    // The score of a rule with the given features
+    Real Score(const SparseVector & features) const { return weights_ * features; }
+
+    // Sort scored items of a single key, and drop all but the best ones
+    template <class T>
+    void Apply(std::vector<std::pair<Real,T> > & items) const {
+        std::stable_sort(items.begin(), items.end(), &RuleTableLimit::IsBetter<T>);
+        if(limit_ > 0 && (int)items.size() > limit_)
+            items.resize(limit_);
+    }
+
+    // Sort the rules of a single key, and delete all but the best ones
+    template <class Rule>
+    void ApplyRules(std::vector<Rule*> & rules) const {
+        std::vector<std::pair<Real,Rule*> > scored;
+        scored.reserve(rules.size());
+        for(int i = 0; i < (int)rules.size(); i++)
+            scored.push_back(std::make_pair(Score(rules[i]->GetFeatures()), rules[i]));
+        std::stable_sort(scored.begin(), scored.end(), &RuleTableLimit::IsBetter<Rule*>);
+        rules.clear();
+        for(int i = 0; i < (int)scored.size(); i++) {
+            if(limit_ <= 0 || i < limit_)
+                rules.push_back(scored[i].second);
+            else
+                delete scored[i].second;
+        }
+    }
+
+    int GetLimit() const { return limit_; }
+    const SparseMap & GetWeights() const { return weights_; }
+
+protected:
+
+    template <class T>
+    static bool IsBetter(const std::pair<Real,T> & lhs, const std::pair<Real,T> & rhs) {
+        return lhs.first > rhs.first;
+    }
+
+    // The maximum number of rules for each key (0 to only sort the rules)
+    int limit_;
+    SparseMap weights_;
+
+};
+
+}
+
+#endif
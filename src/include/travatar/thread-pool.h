@@ -4,49 +4,152 @@
 // A thread manager that allows submission of tasks to be run in different
 // threads. (This was highly influenced by Moses's ThreadPool, but
 // re-implemented and tweaked a bit.
+//
+// Each worker has its own deque of tasks. Tasks submitted from inside a
+// worker are pushed on that worker's deque and popped from the back
+// (depth-first), while idle workers steal from the front of the other
+// deques. Tasks submitted from outside of the pool go to a shared queue
+// that is processed in first-in first-out order.
 
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
 #include <pthread.h>
-#include <queue>
+#include <deque>
+#include <vector>
 
 namespace travatar {
 
 class Task;
+class TaskGroup;
 
 class ThreadPool {
+    friend class TaskGroup;
 
 public:
     // Create a thread pool with a certain number of threads
     ThreadPool(int size, int queue_limit = 0);
+    ~ThreadPool();
+
+    // Set the number of threads of the pool shared by the whole process.
+    // This is done once from the configuration, before the pool is first
+    // used, and it is an error to change the size after that
+    static void SetSharedSize(int size);
+    // Get the shared pool, creating it on the first call with the size
+    // given to SetSharedSize (or one thread per core if it was never set).
+    // The pool is stopped and its threads joined when the process exits
+    static ThreadPool & GetShared();
 
     // Submit a task for execution
     void Submit(Task * task);
 
-    // Stop the remaining values
+    // Stop the pool and join its threads. If process_remaining is true,
+    // all submitted tasks are run first. Otherwise, tasks that are running
+    // are finished, and tasks that have not started are discarded without
+    // being run (they are still deleted if the pool or their group deletes
+    // its tasks)
     void Stop(bool process_remaining);
-    
-    // Wait until all of the running threads have stopped
+
+    // Wait until all of the submitted tasks have finished
     void Wait();
 
     // Set whether to delete tasks after they finish executing
     void SetDeleteTasks(bool delete_tasks) { delete_tasks_ = delete_tasks; }
 
+    // The number of tasks waiting in the shared queue, and the most that
+    // have ever waited
+    int GetQueueSize();
+    int GetMaxQueueSize();
+
+    int GetNumThreads() const { return workers_.size(); }
+
 protected:
+    // A task along with the group it belongs to (if any)
+    typedef std::pair<Task*, TaskGroup*> Item;
+
+    // The deque owned by each worker
+    struct Worker {
+        std::deque<Item> tasks;
+        boost::mutex mutex;
+    };
+
     // The function executed by each thread, which will wait for a task, then
     // execute it when it is ready
-    void Run();
+    void Run(int id);
 
-    std::queue<Task*> tasks_;
+    // Add a task to the current worker's deque or the shared queue
+    void Push(const Item & item);
+    // Get a task from the current worker's deque or steal from other workers
+    bool PopLocal(Item & item);
+    // Get a task from the shared queue
+    bool PopShared(Item & item);
+    // Check whether there is anything to do
+    bool HasWork();
+    // Execute a task and mark it as finished
+    void Execute(const Item & item);
+    // Mark a task as finished, deleting it if necessary
+    void Finish(const Item & item);
+    // Discard all tasks that have not started
+    void Discard();
+
+    std::vector<boost::shared_ptr<Worker> > workers_;
     boost::thread_group threads_;
+    // The shared queue of tasks submitted from outside of the pool
+    std::deque<Item> shared_;
+    boost::mutex shared_mutex_;
+    boost::condition_variable shared_available_;
+    // Used for sleeping and waking idle workers
     boost::mutex mutex_;
     boost::condition_variable thread_needed_;
-    boost::condition_variable thread_available_;
-    bool stopped_;
+    boost::condition_variable all_done_;
+    boost::atomic<int> num_idle_;
+    boost::atomic<int> num_pending_;
+    // Checked by the workers before they take each task
+    boost::atomic<bool> stopped_;
     bool stopping_;
     bool delete_tasks_;
     int queue_limit_;
+    int max_queue_size_;
+
+};
+
+// A group of tasks that can be waited for together (fork-join). When
+// Wait() is called from a worker of the pool, the worker keeps executing
+// tasks from its own deque, or stolen from other workers, until all tasks
+// in the group are done. It never picks up new tasks from the shared queue.
+class TaskGroup {
+    friend class ThreadPool;
+
+public:
+    // Create a group. If limit is non-zero, Submit() will block until fewer
+    // than limit tasks of the group are unfinished
+    TaskGroup(ThreadPool & pool, int limit = 0) :
+        pool_(&pool), pending_(0), limit_(limit), delete_tasks_(true) { }
+    ~TaskGroup() { Wait(); }
+
+    void Submit(Task * task);
+    void Wait();
+
+    // Set whether to delete tasks after they finish executing
+    void SetDeleteTasks(bool delete_tasks) { delete_tasks_ = delete_tasks; }
+    bool GetDeleteTasks() const { return delete_tasks_; }
+
+protected:
+    // Wait until the number of pending tasks is at most max_pending
+    void WaitUntil(int max_pending);
+    void Finish();
+
+    ThreadPool * pool_;
+    boost::mutex mutex_;
+    boost::condition_variable finished_;
+    int pending_;
+    int limit_;
+    bool delete_tasks_;
 
+private:
+    TaskGroup(const TaskGroup &);
+    TaskGroup & operator=(const TaskGroup &);
 };
 
 }
@@ -5,11 +5,14 @@
 #include <travatar/sentence.h>
 #include <travatar/cfg-data.h>
 #include <travatar/sparse-map.h>
+#include <boost/shared_ptr.hpp>
 #include <string>
 #include <vector>
 
 namespace travatar {
 
+class RuleLMScores;
+
 class TranslationRule {
 
 public:
@@ -42,6 +45,10 @@ public:
     // std::string & GetSrcStr() { return src_str_; }
     CfgDataVector & GetTrgData() { return trg_data_; }
     SparseVector & GetFeatures() { return features_; }
+    // The LM scores of the words inside of the rule, if they have been
+    // calculated in advance
+    const RuleLMScores * GetLMScores() const { return lm_scores_.get(); }
+    void SetLMScores(const boost::shared_ptr<RuleLMScores> & lm_scores) { lm_scores_ = lm_scores; }
 
     void AddTrgWord(WordId word, int factor = 0) {
         if(factor <= (int)trg_data_.size())
@@ -63,6 +70,7 @@ protected:
     // std::string src_str_;
     CfgDataVector trg_data_;
     SparseVector features_;
+    boost::shared_ptr<RuleLMScores> lm_scores_;
 
 };
 inline std::ostream &operator<<( std::ostream &out, const TranslationRule &L ) {
@@ -70,6 +78,15 @@ inline std::ostream &operator<<( std::ostream &out, const TranslationRule &L ) {
     return out;
 }
 
+// Adds information to rules after they are loaded, for example the scores
+// of the language models. Tables that decode rules lazily call Prepare()
+// for each rule when it is decoded, possibly from several threads at once
+class RulePreparer {
+public:
+    virtual ~RulePreparer() { }
+    virtual void Prepare(TranslationRule & rule) const = 0;
+};
+
 }
 
 #endif
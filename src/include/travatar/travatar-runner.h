@@ -5,7 +5,9 @@
 #include <travatar/output-collector.h>
 #include <travatar/sparse-map.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <vector>
+#include <string>
 
 namespace travatar {
 
@@ -14,14 +16,18 @@ class HyperGraph;
 class GraphTransformer;
 class LookupTable;
 class Weights;
+class WeightVector;
 class TravatarRunner;
 class EvalMeasure;
+class LMScoreCache;
+class LMComposerCoarseToFine;
+class TreeIO;
 typedef std::vector<int> Sentence;
 
 class TravatarRunnerTask : public Task {
 public:
     TravatarRunnerTask(int sent,
-                       const boost::shared_ptr<HyperGraph> & tree_graph,
+                       const std::string & tree_str,
                        TravatarRunner * runner,
                        std::vector<Sentence> refs,
                        OutputCollector * collector,
@@ -29,13 +35,13 @@ public:
                        OutputCollector * trace_collector,
                        OutputCollector * forest_collector
                        )
-        : sent_(sent), tree_graph_(tree_graph), refs_(refs), runner_(runner),
+        : sent_(sent), tree_str_(tree_str), refs_(refs), runner_(runner),
           collector_(collector), nbest_collector_(nbest_collector), 
           trace_collector_(trace_collector), forest_collector_(forest_collector) { }
     void Run();
 private:
     int sent_; // ID of this sentence
-    boost::shared_ptr<HyperGraph> tree_graph_; // The input
+    std::string tree_str_; // The unparsed input
     std::vector<Sentence> refs_; // References
     TravatarRunner * runner_; // The runner holding all the information
     OutputCollector * collector_; // The output collector
@@ -47,24 +53,28 @@ private:
 class TravatarRunner {
 public:
 
-    TravatarRunner() { }
+    TravatarRunner() : input_error_sent_(-1) { }
     ~TravatarRunner() { }
     
     // Run the model
     void Run(const ConfigTravatarRunner & config);
     
     // Getters/setters
+    TreeIO & GetTreeIO() const { return *tree_io_; }
+    TreeIO & GetForestIO() const { return *forest_io_; }
     bool HasBinarizer() const { return binarizer_.get() != NULL; }
     const GraphTransformer & GetBinarizer() const { return *binarizer_; }
     bool HasTM() const { return tm_.get() != NULL; }
     const GraphTransformer & GetTM() const { return *tm_; }
     bool HasLM() const { return lms_.size() > 0; }
     const std::vector<boost::shared_ptr<GraphTransformer> > & GetLMs() const { return lms_; }
+    const std::vector<boost::shared_ptr<GraphTransformer> > & GetRuleTrimmers() const { return rule_trimmers_; }
     bool HasTrimmer() const { return trimmer_.get() != NULL; }
     const GraphTransformer & GetTrimmer() const { return *trimmer_; }
     bool HasWeights() const { return weights_.get() != NULL; }
     const Weights & GetWeights() const { return *weights_; }
     Weights & GetWeights() { return *weights_; }
+    const WeightVector & GetWeightVector() const { return *weight_vector_; }
     bool HasEvalMeasure() const { return tune_eval_measure_.get() != NULL; }
     const EvalMeasure & GetEvalMeasure() const { return *tune_eval_measure_; }
     int GetNbestCount() const { return nbest_count_; }
@@ -72,6 +82,11 @@ public:
     int GetThreads() const { return threads_; }
     bool GetDoTuning() const { return do_tuning_; } 
 
+    // Record that the input of a sentence could not be parsed. Once all
+    // running sentences are finished, Run fails with the first such error
+    void SetInputError(int sent, const std::string & error);
+    bool HasInputError() const;
+
 private:
 
     boost::shared_ptr<GraphTransformer> CreateLMComposer(
@@ -80,17 +95,33 @@ private:
         int pop_limit,
         const SparseMap & weights);
 
+    boost::shared_ptr<TreeIO> tree_io_;
+    // The format of forest_out
+    boost::shared_ptr<TreeIO> forest_io_;
     boost::shared_ptr<GraphTransformer> binarizer_;
     boost::shared_ptr<GraphTransformer> tm_;
     std::vector<boost::shared_ptr<GraphTransformer> > lms_;
     boost::shared_ptr<GraphTransformer> trimmer_;
+    // Trimmers applied to the rule graph before LM composition
+    std::vector<boost::shared_ptr<GraphTransformer> > rule_trimmers_;
     boost::shared_ptr<Weights> weights_;
+    // The weights in a flat array, used to score the rule graphs when the
+    // weights are not being tuned
+    boost::shared_ptr<WeightVector> weight_vector_;
     boost::shared_ptr<EvalMeasure> tune_eval_measure_;
+    boost::shared_ptr<LMScoreCache> lm_cache_;
+    // The LM used for the coarse pass and the composer performing both
+    // passes, if coarse-to-fine decoding is used
+    boost::shared_ptr<GraphTransformer> coarse_lm_;
+    boost::shared_ptr<LMComposerCoarseToFine> ctf_;
     int nbest_count_;
     bool nbest_uniq_;
     int threads_;
     bool do_tuning_;
-
+    // The earliest sentence whose input could not be parsed, and its error
+    mutable boost::mutex input_error_mutex_;
+    int input_error_sent_;
+    std::string input_error_;
 
 };
 
@@ -2,15 +2,16 @@
 #define TRAVATAR_TREE_IO__
 
 #include <travatar/sentence.h>
+#include <boost/scoped_ptr.hpp>
 #include <vector>
 #include <iostream>
 
+namespace boost { namespace iostreams { class mapped_file_source; } }
+
 namespace travatar {
 
 class HyperGraph;
 class HyperNode;
-template <class T>
-class SymbolSet;
 
 // A virtual class to read in and write out parse trees
 class TreeIO {
@@ -18,7 +19,16 @@ public:
     virtual ~TreeIO() { };
     virtual HyperGraph * ReadTree(std::istream & in) = 0;
     HyperGraph * ReadFromString(const std::string & str);
+    // Read a tree from the start of a buffer, such as a record or a mapped
+    // file, and advance ptr past it. Returns NULL if there are no more trees.
+    // By default this reads from a stream over a copy of the buffer, but
+    // readers that scan the buffer directly are much faster
+    virtual HyperGraph * ReadFromBuffer(const char * & ptr, const char * end);
     virtual void WriteTree(const HyperGraph & tree, std::ostream & out) = 0;
+    // Read the text of a single tree without parsing it, so it can be parsed
+    // later (possibly in another thread) by ReadFromString. By default one
+    // tree is one line. Return false at the end of the input
+    virtual bool ReadRecord(std::istream & in, std::string & record);
 };
 
 // Read in and write out Penn Treebank format trees
@@ -26,6 +36,8 @@ class PennTreeIO : public TreeIO {
 public:
     virtual ~PennTreeIO() { }
     virtual HyperGraph * ReadTree(std::istream & in);
+    virtual HyperGraph * ReadFromBuffer(const char * & ptr, const char * end);
+    virtual bool ReadRecord(std::istream & in, std::string & record);
     void WriteNode(const std::vector<WordId> & words,
                    const HyperNode & node, std::ostream & out);
     virtual void WriteTree(const HyperGraph & tree, std::ostream & out);
@@ -59,17 +71,54 @@ public:
     virtual void WriteTree(const HyperGraph & tree, std::ostream & out);
 };
 
+// Read in and write out hypergraphs in a compact binary format, which is much
+// faster to read and write than JSON. Each graph is a record holding a magic
+// number, the length of the rest of the record, a table of the symbols that
+// the graph uses, and then the words, nodes and edges, with all IDs and
+// symbols as varints. Records are independent of the dictionary and of each
+// other, so they can be written by separate threads and read in any order.
+// A newline after a record is skipped, so records can be written with endl
+// like the text formats
+class BinaryTreeIO : public TreeIO {
+public:
+    virtual ~BinaryTreeIO() { }
+    virtual HyperGraph * ReadTree(std::istream & in);
+    virtual bool ReadRecord(std::istream & in, std::string & record);
+    virtual void WriteTree(const HyperGraph & tree, std::ostream & out);
+    virtual HyperGraph * ReadFromBuffer(const char * & ptr, const char * end);
+    // Check whether the next record of a stream is a binary graph
+    static bool IsBinary(std::istream & in);
+};
+
+// A file of binary graphs that is mapped into memory and indexed, so any of
+// its graphs can be read without reading the ones before it. Graphs can be
+// read from several threads at once
+class BinaryTreeFile {
+public:
+    BinaryTreeFile(const std::string & filename);
+    ~BinaryTreeFile();
+    int NumTrees() const { return records_.size() - 1; }
+    HyperGraph * ReadTree(int i) const;
+    // Check whether a file is an uncompressed file of binary graphs
+    static bool IsBinaryFile(const std::string & filename);
+private:
+    boost::scoped_ptr<boost::iostreams::mapped_file_source> mapped_;
+    // The start of each record, and the end of the file
+    std::vector<const char*> records_;
+};
+
 // Read in and write the format of the Egret parser
 class EgretTreeIO : public TreeIO {
 public:
     EgretTreeIO() : TreeIO(), normalize_(true) { }
     virtual ~EgretTreeIO() { }
     virtual HyperGraph * ReadTree(std::istream & in);
+    virtual HyperGraph * ReadFromBuffer(const char * & ptr, const char * end);
+    virtual bool ReadRecord(std::istream & in, std::string & record);
     virtual void WriteTree(const HyperGraph & tree, std::ostream & out);
     void SetNormalize(bool normalize) { normalize_ = normalize; }
     bool GetNormalize(bool normalize) const { return normalize_; }
 private:
-    HyperNode * MakeEgretNode(const std::string & str_id, SymbolSet<int> & node_map, HyperGraph * graph);
 
     // Whether to normalize edge posteriors to per-node confusions (def: true)
     bool normalize_;
@@ -80,6 +129,7 @@ class MosesXMLTreeIO : public TreeIO {
 public:
     virtual ~MosesXMLTreeIO() { }
     virtual HyperGraph * ReadTree(std::istream & in);
+    virtual HyperGraph * ReadFromBuffer(const char * & ptr, const char * end);
     virtual void WriteTree(const HyperGraph & tree, std::ostream & out);
     void WriteNode(const std::vector<WordId> & words,
                    const HyperNode & node, std::ostream & out);
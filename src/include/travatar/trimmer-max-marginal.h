@@ -0,0 +1,38 @@
+#ifndef TRIMMER_MAX_MARGINAL_H__
+#define TRIMMER_MAX_MARGINAL_H__
+
+#include <travatar/trimmer.h>
+#include <travatar/real.h>
+#include <vector>
+#include <map>
+
+namespace travatar {
+
+class HyperGraph;
+
+// A class to trim a hypergraph to only include edges whose max-marginal,
+// the score of the best derivation that uses the edge, is within a
+// threshold of the score of the best derivation overall
+class TrimmerMaxMarginal : public Trimmer {
+
+public:
+
+    TrimmerMaxMarginal(Real threshold) : Trimmer(), threshold_(threshold) { }
+
+    // Find which nodes and edges should be active in this hypergraph
+    virtual void FindActive(const HyperGraph & hg,
+                            std::map<int,int> & active_nodes,
+                            std::map<int,int> & active_edges) const;
+
+    // Mark the edges whose max-marginal is within the threshold
+    void FindActiveEdges(const HyperGraph & hg, std::vector<bool> & active) const;
+
+protected:
+
+    Real threshold_;
+
+};
+
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef TRIMMER_POSTERIOR_H__
+#define TRIMMER_POSTERIOR_H__
+
+#include <travatar/trimmer.h>
+#include <travatar/real.h>
+#include <vector>
+#include <map>
+
+namespace travatar {
+
+class HyperGraph;
+
+// A class to trim a hypergraph to only include edges whose posterior
+// probability is at least a threshold, where the edge scores are treated as
+// log probabilities. The edges of the best derivation are always kept
+class TrimmerPosterior : public Trimmer {
+
+public:
+
+    TrimmerPosterior(Real threshold) : Trimmer(), threshold_(threshold) { }
+
+    // Find which nodes and edges should be active in this hypergraph
+    virtual void FindActive(const HyperGraph & hg,
+                            std::map<int,int> & active_nodes,
+                            std::map<int,int> & active_edges) const;
+
+    // Mark the edges whose posterior is above the threshold
+    void FindActiveEdges(const HyperGraph & hg, std::vector<bool> & active) const;
+
+protected:
+
+    Real threshold_;
+
+};
+
+}
+
+#endif
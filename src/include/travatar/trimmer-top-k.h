@@ -0,0 +1,36 @@
+#ifndef TRIMMER_TOP_K_H__
+#define TRIMMER_TOP_K_H__
+
+#include <travatar/trimmer.h>
+#include <vector>
+#include <map>
+
+namespace travatar {
+
+class HyperGraph;
+
+// A class to trim a hypergraph to only include the k edges of each node
+// that have the best derivations, according to the edge scores
+class TrimmerTopK : public Trimmer {
+
+public:
+
+    TrimmerTopK(int k) : Trimmer(), k_(k) { }
+
+    // Find which nodes and edges should be active in this hypergraph
+    virtual void FindActive(const HyperGraph & hg,
+                            std::map<int,int> & active_nodes,
+                            std::map<int,int> & active_edges) const;
+
+    // Mark the k best edges of each node
+    void FindActiveEdges(const HyperGraph & hg, std::vector<bool> & active) const;
+
+protected:
+
+    int k_;
+
+};
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define TRIMMER_H__
 
 #include <travatar/graph-transformer.h>
+#include <vector>
 #include <map>
 
 namespace travatar {
@@ -24,6 +25,16 @@ public:
 protected:
     // A utility function to add an ID to a map only if it doesn't exist
     static void AddId(std::map<int,int> & id_map, int id);
+    // Activate the root, and each edge marked in active_edges along with its
+    // head and tails
+    static void AddEdges(const HyperGraph & hg,
+                         const std::vector<bool> & active_edges,
+                         std::map<int,int> & active_nodes,
+                         std::map<int,int> & active_edge_ids);
+    // Deactivate edges that have a tail that cannot be derived using only
+    // active edges, and edges that cannot be reached from the root
+    static void RemoveDeadEdges(const HyperGraph & hg,
+                                std::vector<bool> & active_edges);
 
 };
 
@@ -46,12 +46,15 @@ public:
 
     // **** Static Utility Members ****
 
-    // Perform line search given the current weights and gradient
+    // Perform line search given the current weights and gradient. If threads
+    // is more than one, the convex hulls are calculated and combined on the
+    // shared thread pool, and the result is identical to that with one thread
     static LineSearchResult LineSearch(
       const SparseMap & weights,
       const SparseMap & gradient,
       std::vector<boost::shared_ptr<TuningExample> > & examps,
-      std::pair<Real,Real> range = std::pair<Real,Real>(-REAL_MAX, REAL_MAX));
+      std::pair<Real,Real> range = std::pair<Real,Real>(-REAL_MAX, REAL_MAX),
+      int threads = 1);
 
     // **** Non-static Members ****
     TuneMert();
@@ -64,6 +67,9 @@ public:
 
     void SetDirections(const std::string & str);
 
+    int GetThreads() const { return threads_; }
+    void SetThreads(int threads) { threads_ = threads; }
+
     // void UpdateBest(const SparseMap &gradient, const LineSearchResult &result);
 
 protected:
@@ -72,6 +78,8 @@ protected:
     int num_random_;
     std::vector<Real> xeval_scales_;
     GradientXeval xeval_gradient_;
+    // The number of threads to use in each line search
+    int threads_;
 
 };
 
@@ -4,16 +4,17 @@
 #include <travatar/real.h>
 #include <travatar/tuning-example.h>
 #include <travatar/sentence.h>
+#include <travatar/cfg-data.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <set>
 #include <cfloat>
 
 namespace travatar {
 
 class HyperGraph;
+class CompactHyperGraph;
 class EvalMeasure;
-class MertHull;
-class MertHullWeightFunction;
 
 class TuningExampleForest : public TuningExample {
 
@@ -50,6 +51,11 @@ public:
     virtual ConvexHull CalculateConvexHull(
                                 const SparseMap & weights,
                                 const SparseMap & gradient) const;
+    virtual ConvexHull CalculateConvexHull(
+                                const SparseMap & weights,
+                                const SparseMap & gradient,
+                                const WeightVector & weight_vec,
+                                const WeightVector & gradient_vec) const;
     
     // Add a forest hypothesis
     void AddHypothesis(const boost::shared_ptr<HyperGraph> & forest);
@@ -67,14 +73,19 @@ protected:
     
     std::vector<ExamplePair> last_nbest_;
 
-    // Recursively calculate the MERT hull
-    const MertHull & CalculateMertHull(
-                            const MertHullWeightFunction & func,
-                            std::vector<boost::shared_ptr<MertHull> > & hulls, 
-                            int node_id) const;
+    // Get a compact view of the forest, which is created when it is first
+    // needed after the forest changes
+    const CompactHyperGraph & GetCompactForest() const;
+
+    // Find the translation of the best derivation given the weights
+    CfgDataVector CalculateViterbiTranslation(const WeightVector & weights) const;
 
     EvalMeasure * measure_;
     boost::shared_ptr<HyperGraph> forest_;
+    // The compact view of the forest, which can be created from several
+    // threads that calculate hulls
+    mutable boost::shared_ptr<CompactHyperGraph> compact_forest_;
+    mutable boost::mutex compact_mutex_;
     std::vector<Sentence> refs_;
     // The score that the best hypothesis in the forest achieves
     Real oracle_score_;
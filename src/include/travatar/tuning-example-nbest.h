@@ -24,6 +24,7 @@ public:
     virtual void CountWeights(std::set<WordId> & weights);
 
     // Calculate the convex hull for this example given the current weights and gradients
+    using TuningExample::CalculateConvexHull;
     virtual ConvexHull CalculateConvexHull(
                                 const SparseMap & weights,
                                 const SparseMap & gradient) const;
@@ -13,6 +13,7 @@ namespace travatar {
 // A span, a span with a score, and a convex hull (collection of scored spans)
 class EvalStats;
 class Weights;
+class WeightVector;
 typedef boost::shared_ptr<EvalStats> EvalStatsPtr;
 typedef std::pair<Real,Real> Span;
 typedef std::pair<Span, EvalStatsPtr> ScoredSpan;
@@ -42,6 +43,17 @@ public:
                                 const SparseMap & weights,
                                 const SparseMap & gradient) const = 0;
 
+    // The same, also given the weights and gradient as WeightVectors, which
+    // a line search builds once for all of its examples. By default the
+    // WeightVectors are not used
+    virtual ConvexHull CalculateConvexHull(
+                                const SparseMap & weights,
+                                const SparseMap & gradient,
+                                const WeightVector & weight_vec,
+                                const WeightVector & gradient_vec) const {
+        return CalculateConvexHull(weights, gradient);
+    }
+
     // Calculate the n-best list giving the current weights
     virtual const std::vector<ExamplePair> & 
                        CalculateNbest(const Weights & weights) = 0;
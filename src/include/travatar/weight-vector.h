@@ -0,0 +1,82 @@
+#ifndef TRAVATAR_WEIGHT_VECTOR_H__
+#define TRAVATAR_WEIGHT_VECTOR_H__
+
+#include <travatar/real.h>
+#include <travatar/sentence.h>
+#include <travatar/sparse-map.h>
+#include <travatar/dict.h>
+#include <vector>
+
+namespace travatar {
+
+// A vector of feature weights.
+//
+// The weights are stored in a flat array indexed by the dense feature IDs
+// of Dict (see Dict::FeatureId), so looking up the weight of a feature is
+// two array accesses, and the size of the vector follows the number of
+// features rather than the size of the vocabulary. Features that were never
+// given a weight count as zero, like a missing key in a SparseMap. The
+// vector is meant to be built once each time the weights change, and shared
+// by every graph that is scored with them.
+class WeightVector {
+public:
+    WeightVector() { }
+    WeightVector(const SparseMap & weights) { SetWeights(weights); }
+
+    // Replace all of the weights
+    void SetWeights(const SparseMap & weights);
+
+    // Get and set the weight of a single feature (identified by its Dict ID)
+    Real GetWeight(WordId feat) const {
+        size_t id = Dict::FeatureId(feat);
+        return (id < vals_.size() ? vals_[id] : 0.0);
+    }
+    void SetWeight(WordId feat, Real val) { GetWeightRef(feat) = val; }
+
+    // Add a scaled feature vector to the weights
+    void Add(const SparseVector & feats, Real scale = 1.0);
+
+    // Get the dense ID of a feature, or -1 if it has no weight
+    int GetFeatureId(WordId feat) const {
+        size_t id = Dict::FeatureId(feat);
+        return (id < vals_.size() && has_weight_[id] ? (int)id : -1);
+    }
+
+    // Convert back into a sparse map, with an entry for each feature that
+    // was given a weight
+    SparseMap ToMap() const;
+
+    // The weights indexed by dense feature ID
+    const std::vector<Real> & GetValues() const { return vals_; }
+
+protected:
+    // Get a reference to the weight of a feature, giving it a dense ID and
+    // growing the array if necessary
+    Real & GetWeightRef(WordId feat);
+
+    // The weights indexed by dense feature ID, and whether each was given
+    // a weight
+    std::vector<Real> vals_;
+    std::vector<bool> has_weight_;
+    // The Dict IDs of the features that were given a weight
+    std::vector<WordId> feats_;
+
+};
+
+// The dot product of the weights and a sparse vector, with the products
+// summed in the order of the sparse vector
+inline Real operator*(const WeightVector & lhs, const SparseVector & rhs) {
+    Real ret = 0;
+    const std::vector<Real> & vals = lhs.GetValues();
+    for(SparseVector::SparseVectorImpl::const_iterator it = rhs.begin(); it != rhs.end(); it++) {
+        // Features without a dense ID are -1, and so out of range as size_t
+        size_t id = Dict::FeatureId(it->first);
+        if(id < vals.size())
+            ret += it->second * vals[id];
+    }
+    return ret;
+}
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "search/context.hh"
 
+#include <boost/thread/mutex.hpp>
 #include <boost/unordered_map.hpp>
 
 #include <algorithm>
@@ -110,6 +111,12 @@ const unsigned char kPolicyOneRight = 2;
 // Reveal everything in the next branch.  Used to terminate the left/right policies.
 //    static const unsigned char kPolicyEverything = 3;
 
+// Lazily building the extensions of a node is the only change made to a
+// vertex once it is finished, so locking it allows the parents of a vertex
+// to be searched in parallel.  Nodes share a fixed set of locks.
+const std::size_t kExtendLocks = 64;
+boost::mutex extend_locks[kExtendLocks];
+
 } // namespace
 
 namespace {
@@ -123,6 +130,7 @@ struct GreaterByScore : public std::binary_function<const HypoState &, const Hyp
 void VertexNode::FinishRoot() {
   std::sort(hypos_.begin(), hypos_.end(), GreaterByScore());
   extend_.clear();
+  built_ = false;
   // HACK: extend to one hypo so that root can be blank.
   state_.left.full = false;
   state_.left.length = 0;
@@ -176,9 +184,11 @@ void VertexNode::FinishedAppending(const unsigned char common_left, const unsign
 
 void VertexNode::BuildExtend() {
   // Already built.
-  if (!extend_.empty()) return;
+  if (__atomic_load_n(&built_, __ATOMIC_ACQUIRE)) return;
   // Nothing to build since this is a leaf.
   if (hypos_.size() <= 1) return;
+  boost::mutex::scoped_lock lock(extend_locks[(reinterpret_cast<uintptr_t>(this) / sizeof(VertexNode)) % kExtendLocks]);
+  if (built_) return;
   bool left_branch = true;
   switch (policy_) {
     case kPolicyAlternate:
@@ -200,6 +210,7 @@ void VertexNode::BuildExtend() {
     // TODO: provide more here for branching?
     i->FinishedAppending(state_.left.length, state_.right.length);
   }
+  __atomic_store_n(&built_, true, __ATOMIC_RELEASE);
 }
 
 } // namespace search
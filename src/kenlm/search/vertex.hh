@@ -24,7 +24,7 @@ struct HypoState {
 
 class VertexNode {
   public:
-    VertexNode() {}
+    VertexNode() : built_(false) {}
 
     void InitRoot() { hypos_.clear(); }
 
@@ -95,6 +95,8 @@ class VertexNode {
     std::vector<HypoState> hypos_;
 
     std::vector<VertexNode> extend_;
+    // Whether extend_ has been built.  Only changes under a lock.
+    bool built_;
 
     lm::ngram::ChartState state_;
     bool right_full_;
@@ -19,6 +19,7 @@
 #include <travatar/string-util.h>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -73,28 +74,55 @@ void BatchTuneRunner::LoadNbests(istream & sys_in, Tune & tune, istream * stat_i
     PRINT_DEBUG(endl, 1);
 }
 
+void BatchTuneRunner::AddForest(int id, HyperGraph * forest, Tune & tune) {
+    bool normalize_len = false;
+    if(id % 100 == 0)
+        PRINT_DEBUG(id << ".", 1);
+    PRINT_DEBUG("Loading line " << id << endl, 1);
+    const std::vector<Sentence> & ref = refs_[id];
+    // Add the example
+    if((int)tune.NumExamples() <= id) {
+        Real norm = (normalize_len ? ref.size() / (Real)ref_len_ : 1.0 / refs_.size());
+        tune.AddExample(
+            boost::shared_ptr<TuningExample>(
+                new TuningExampleForest(
+                    eval_.get(),
+                    ref, id, norm)));
+    }
+    ((TuningExampleForest&)tune.GetExample(id)).AddHypothesis(boost::shared_ptr<HyperGraph>(forest));
+}
+
 void BatchTuneRunner::LoadForests(istream & sys_in, Tune & tune) {
-    JSONTreeIO io;
+    // Forests are either binary or JSON, one per line
+    boost::scoped_ptr<TreeIO> io;
+    if(BinaryTreeIO::IsBinary(sys_in))
+        io.reset(new BinaryTreeIO);
+    else
+        io.reset(new JSONTreeIO);
     HyperGraph * curr_ptr;
     int id = 0;
-    bool normalize_len = false;
-    while((curr_ptr = io.ReadTree(sys_in)) != NULL) {
-        if(id % 100 == 0)
-            PRINT_DEBUG(id << ".", 1);
-        PRINT_DEBUG("Loading line " << id << endl, 1);
-        const std::vector<Sentence> & ref = refs_[id];
-        // Add the example
-        if((int)tune.NumExamples() <= id) {
-            Real norm = (normalize_len ? ref.size() / (Real)ref_len_ : 1.0 / refs_.size());
-            tune.AddExample(
-                boost::shared_ptr<TuningExample>(
-                    new TuningExampleForest(
-                        eval_.get(),
-                        ref, id, norm)));
-        }
-        ((TuningExampleForest&)tune.GetExample(id)).AddHypothesis(boost::shared_ptr<HyperGraph>(curr_ptr));
-        id++;
+    while((curr_ptr = io->ReadTree(sys_in)) != NULL)
+        AddForest(id++, curr_ptr, tune);
+}
+
+void ForestLoadTask::Run() {
+    for(int i = begin_; i < end_; i++)
+        (*forests_)[i] = file_->ReadTree(i);
+}
+
+void BatchTuneRunner::LoadForests(const BinaryTreeFile & sys_file, Tune & tune, int threads) {
+    // Records of a mapped file can be read in any order, so read blocks of
+    // them in parallel, then add them in order
+    vector<HyperGraph*> forests(sys_file.NumTrees(), (HyperGraph*)NULL);
+    {
+        TaskGroup group(ThreadPool::GetShared());
+        int block_size = 100;
+        for(int i = 0; i < (int)forests.size(); i += block_size)
+            group.Submit(new ForestLoadTask(sys_file, i, min(i+block_size, (int)forests.size()), forests));
+        group.Wait();
     }
+    for(int id = 0; id < (int)forests.size(); id++)
+        AddForest(id, forests[id], tune);
 }
 
 // Perform tuning
@@ -103,12 +131,14 @@ void BatchTuneRunner::DoTuning(const ConfigBatchTune & config) {
     // Save number of threads and runs
     int threads = config.GetInt("threads");
     int runs = config.GetInt("restarts")+2;
+    ThreadPool::SetSharedSize(threads);
     
     // Chose the tuning method
     boost::shared_ptr<Tune> tune;
     if(config.GetString("algorithm") == "mert") {
         TuneMert *tm = new TuneMert;
         tm->SetDirections(config.GetString("mert_directions"));
+        tm->SetThreads(threads);
         tune.reset(tm);
     } else if(config.GetString("algorithm") == "greedy-mert") {
         TuneGreedyMert *tgm = new TuneGreedyMert;
@@ -186,6 +216,12 @@ void BatchTuneRunner::DoTuning(const ConfigBatchTune & config) {
     // Convert the n-best lists or forests into example pairs for tuning
     PRINT_DEBUG("Loading system output..." << endl, 1);
     for(int i = 0; i < (int)sys_files.size(); i++) {
+        // Map uncompressed binary forests
+        if(use_forest && BinaryTreeFile::IsBinaryFile(sys_files[i])) {
+            BinaryTreeFile sys_file(sys_files[i]);
+            LoadForests(sys_file, *tune, config.GetInt("threads"));
+            continue;
+        }
         // Open the system file
         InputFileStream sys_in(sys_files[i].c_str());
         if(!sys_in)
@@ -205,8 +241,8 @@ void BatchTuneRunner::DoTuning(const ConfigBatchTune & config) {
     // If there is any shared initialization to be done, do it here
     tune->Init(weights);
 
-    // Build the thread pool
-    ThreadPool pool(threads, threads*5);
+    // Run the tuning tasks on the shared threads
+    TaskGroup pool(ThreadPool::GetShared(), threads*6);
     pool.SetDeleteTasks(false);
     
     // Set up tasks for each amount of weights
@@ -233,7 +269,7 @@ void BatchTuneRunner::DoTuning(const ConfigBatchTune & config) {
         tasks[i] = boost::shared_ptr<BatchTuneRunnerTask>(new BatchTuneRunnerTask(i, oss.str(), *tune, rand_weights));
         pool.Submit(tasks[i].get());
     }
-    pool.Stop(true);
+    pool.Wait();
 
     // Find the best result
     SparseMap best_weights = tasks[0]->GetWeights();
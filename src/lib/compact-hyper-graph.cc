@@ -0,0 +1,104 @@
+#include <travatar/compact-hyper-graph.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/weight-vector.h>
+#include <travatar/dict.h>
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace travatar;
+
+CompactHyperGraph::CompactHyperGraph(const HyperGraph & graph) {
+    node_offsets_.reserve(graph.NumNodes()+1);
+    tail_offsets_.reserve(graph.NumEdges()+1);
+    feat_offsets_.reserve(graph.NumEdges()+1);
+    edges_.reserve(graph.NumEdges());
+    node_offsets_.push_back(0);
+    tail_offsets_.push_back(0);
+    feat_offsets_.push_back(0);
+    // Whether each dense feature ID has been seen
+    vector<bool> seen;
+    BOOST_FOREACH(const HyperNode * node, graph.GetNodes()) {
+        BOOST_FOREACH(HyperEdge * edge, node->GetEdges()) {
+            edges_.push_back(edge);
+            BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+                tails_.push_back(tail->GetId());
+            tail_offsets_.push_back(tails_.size());
+            BOOST_FOREACH(const SparsePair & feat, edge->GetFeatures().GetImpl()) {
+                int id = Dict::AddFeatureId(feat.first);
+                if(id >= (int)seen.size())
+                    seen.resize(id+1, false);
+                if(!seen[id]) {
+                    seen[id] = true;
+                    feats_.push_back(feat.first);
+                }
+                feat_ids_.push_back(id);
+                feat_vals_.push_back(feat.second);
+            }
+            feat_offsets_.push_back(feat_ids_.size());
+        }
+        node_offsets_.push_back(edges_.size());
+    }
+    graph.GetTopologicalOrder(order_);
+}
+
+void CompactHyperGraph::ScoreEdges(const WeightVector & weights, std::vector<Real> & scores) const {
+    // Features past the end of the weights have no weight and are skipped
+    const vector<Real> & vals = weights.GetValues();
+    scores.resize(edges_.size());
+    for(int edge = 0; edge < (int)edges_.size(); edge++) {
+        Real score = 0;
+        for(int i = feat_offsets_[edge]; i < feat_offsets_[edge+1]; i++) {
+            size_t id = feat_ids_[i];
+            if(id < vals.size())
+                score += feat_vals_[i] * vals[id];
+        }
+        scores[edge] = score;
+    }
+}
+
+Real CompactHyperGraph::GetViterbiEdges(const std::vector<Real> & scores, std::vector<HyperEdge*> & edges) const {
+    edges.clear();
+    // The best edge of each node (-1 if it has no derivation), and the score
+    // and number of edges of its derivation
+    vector<int> best(NumNodes(), -1), size(NumNodes(), 0);
+    vector<Real> best_score(NumNodes(), -REAL_MAX);
+    BOOST_FOREACH(int node, order_) {
+        for(int edge = node_offsets_[node]; edge < node_offsets_[node+1]; edge++) {
+            Real score = scores[edge];
+            int my_size = 1, i;
+            for(i = tail_offsets_[edge]; i < tail_offsets_[edge+1] && best[tails_[i]] >= 0; i++) {
+                score += best_score[tails_[i]];
+                my_size += size[tails_[i]];
+            }
+            if(i != tail_offsets_[edge+1])
+                continue;
+            // Compare by score, then size, then edge ID, as in LazyKbest
+            bool better;
+            if(best[node] < 0)
+                better = true;
+            else if(score != best_score[node])
+                better = score > best_score[node];
+            else if(my_size != size[node])
+                better = my_size > size[node];
+            else
+                better = edges_[edge]->GetId() < edges_[best[node]]->GetId();
+            if(better) {
+                best[node] = edge;
+                best_score[node] = score;
+                size[node] = my_size;
+            }
+        }
+    }
+    if(NumNodes() == 0 || best[0] < 0)
+        return -REAL_MAX;
+    // Add the edges depth-first, pushing the tails in reverse
+    vector<int> stack(1, 0);
+    while(stack.size()) {
+        int edge = best[stack.back()];
+        stack.pop_back();
+        edges.push_back(edges_[edge]);
+        for(int i = tail_offsets_[edge+1]-1; i >= tail_offsets_[edge]; i--)
+            stack.push_back(tails_[i]);
+    }
+    return best_score[0];
+}
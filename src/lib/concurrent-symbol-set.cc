@@ -0,0 +1,144 @@
+#include <travatar/concurrent-symbol-set.h>
+#include <travatar/io-util.h>
+#include <travatar/global-debug.h>
+#include <boost/foreach.hpp>
+#include <stdint.h>
+#include <cstring>
+
+using namespace travatar;
+using namespace std;
+using namespace boost;
+
+#define CSS_INITIAL_CAPACITY 1024
+
+ConcurrentSymbolSet::Table::Table(size_t capacity) :
+        mask(capacity-1), slots(new boost::atomic<int>[capacity]) {
+    for(size_t i = 0; i < capacity; i++)
+        slots[i].store(0, boost::memory_order_relaxed);
+}
+
+ConcurrentSymbolSet::ConcurrentSymbolSet() :
+        chunks_(new boost::atomic<std::string*>[MAX_CHUNKS]), size_(0),
+        index_chunks_(new boost::atomic<boost::atomic<int>*>[MAX_CHUNKS]), num_indices_(0),
+        table_(new Table(CSS_INITIAL_CAPACITY)) {
+    for(int i = 0; i < MAX_CHUNKS; i++) {
+        chunks_[i].store(NULL, boost::memory_order_relaxed);
+        index_chunks_[i].store(NULL, boost::memory_order_relaxed);
+    }
+}
+
+ConcurrentSymbolSet::~ConcurrentSymbolSet() {
+    for(int i = 0; i < MAX_CHUNKS; i++) {
+        delete [] chunks_[i].load();
+        delete [] index_chunks_[i].load();
+    }
+    delete [] chunks_;
+    delete [] index_chunks_;
+    delete table_.load();
+    BOOST_FOREACH(Table * table, old_tables_)
+        delete table;
+}
+
+WordId ConcurrentSymbolSet::Find(const Table & table, const char * sym, size_t len, size_t hash) const {
+    for(size_t i = hash & table.mask; ; i = (i+1) & table.mask) {
+        int val = table.slots[i].load(boost::memory_order_acquire);
+        if(val == 0)
+            return -1;
+        const string & str = GetSymbolUnchecked(val-1);
+        if(str.length() == len && !memcmp(str.data(), sym, len))
+            return val-1;
+    }
+}
+
+void ConcurrentSymbolSet::Insert(Table & table, size_t hash, WordId id) {
+    size_t i = hash & table.mask;
+    while(table.slots[i].load(boost::memory_order_relaxed) != 0)
+        i = (i+1) & table.mask;
+    table.slots[i].store(id+1, boost::memory_order_release);
+}
+
+WordId ConcurrentSymbolSet::GetIdFromBuffer(const char * sym, size_t len, bool add) {
+    size_t hash = Hash(sym, len);
+    WordId id = Find(*table_.load(boost::memory_order_acquire), sym, len, hash);
+    if(id >= 0 || !add)
+        return id;
+    boost::mutex::scoped_lock lock(mutex_);
+    // Check again, as another thread may have added it in the meantime
+    Table * table = table_.load(boost::memory_order_relaxed);
+    id = Find(*table, sym, len, hash);
+    if(id >= 0)
+        return id;
+    // Store the symbol, then make it visible
+    id = size_.load(boost::memory_order_relaxed);
+    int chunk = id >> CHUNK_BITS;
+    if(chunk >= MAX_CHUNKS)
+        THROW_ERROR("Too many symbols in ConcurrentSymbolSet");
+    if(chunks_[chunk].load(boost::memory_order_relaxed) == NULL)
+        chunks_[chunk].store(new string[CHUNK_SIZE], boost::memory_order_release);
+    chunks_[chunk].load(boost::memory_order_relaxed)[id & (CHUNK_SIZE-1)].assign(sym, len);
+    size_.store(id+1, boost::memory_order_release);
+    // Keep the table at most half full
+    if((size_t)(id+1)*2 > table->mask+1) {
+        Table * bigger = new Table((table->mask+1)*2);
+        for(WordId i = 0; i < id; i++) {
+            const string & str = GetSymbolUnchecked(i);
+            Insert(*bigger, Hash(str.data(), str.length()), i);
+        }
+        table_.store(bigger, boost::memory_order_release);
+        old_tables_.push_back(table);
+        table = bigger;
+    }
+    Insert(*table, hash, id);
+    return id;
+}
+
+int ConcurrentSymbolSet::AddIndex(WordId id) {
+    int index = GetIndex(id);
+    if(index >= 0)
+        return index;
+    boost::mutex::scoped_lock lock(mutex_);
+    if(id < 0 || id >= size_.load(boost::memory_order_relaxed))
+        THROW_ERROR("Symbol ID out of range: " << id);
+    int chunk = id >> CHUNK_BITS;
+    boost::atomic<int> * indices = index_chunks_[chunk].load(boost::memory_order_relaxed);
+    if(indices == NULL) {
+        indices = new boost::atomic<int>[CHUNK_SIZE];
+        for(int i = 0; i < CHUNK_SIZE; i++)
+            indices[i].store(-1, boost::memory_order_relaxed);
+        index_chunks_[chunk].store(indices, boost::memory_order_release);
+    }
+    // Check again, as another thread may have added it in the meantime
+    index = indices[id & (CHUNK_SIZE-1)].load(boost::memory_order_relaxed);
+    if(index < 0) {
+        index = num_indices_.load(boost::memory_order_relaxed);
+        indices[id & (CHUNK_SIZE-1)].store(index, boost::memory_order_release);
+        num_indices_.store(index+1, boost::memory_order_release);
+    }
+    return index;
+}
+
+void ConcurrentSymbolSet::WriteBinary(ostream & out) const {
+    int size = this->size();
+    IoUtil::WriteBinary(out, (uint32_t)size);
+    for(int i = 0; i < size; i++) {
+        const string & sym = GetSymbolUnchecked(i);
+        IoUtil::WriteBinary(out, (uint32_t)sym.length());
+        out.write(sym.c_str(), sym.length());
+    }
+}
+
+void ConcurrentSymbolSet::ReadBinary(istream & in) {
+    uint32_t size, len;
+    in.read(reinterpret_cast<char*>(&size), sizeof(size));
+    string sym;
+    for(uint32_t i = 0; in && i < size; i++) {
+        in.read(reinterpret_cast<char*>(&len), sizeof(len));
+        sym.resize(len);
+        if(len) in.read(&sym[0], len);
+        if(!in) break;
+        if(GetId(sym, true) != (WordId)i)
+            THROW_ERROR("Symbol " << sym << " already has a different ID than " << i << " in the binary file");
+    }
+    if(!in)
+        THROW_ERROR("Unexpected end of file while reading symbols");
+}
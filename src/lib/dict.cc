@@ -4,7 +4,7 @@
 #include <travatar/global-debug.h>
 #include <travatar/string-util.h>
 #include <travatar/dict.h>
-#include <travatar/symbol-set.h>
+#include <travatar/concurrent-symbol-set.h>
 #include <travatar/hyper-graph.h>
 
 using namespace travatar;
@@ -12,7 +12,7 @@ using namespace std;
 using namespace boost;
 
 bool Dict::add_ = true;
-SymbolSet<WordId> travatar::Dict::wids_ = SymbolSet<WordId>(true);
+ConcurrentSymbolSet travatar::Dict::wids_;
 
 std::string Dict::PrintSparseMap(const SparseMap & feats) {
     std::ostringstream oss;
@@ -39,7 +39,9 @@ SparseMap Dict::ParseSparseMap(std::istream & iss) {
     while(iss >> buff) {
         size_t pos = buff.rfind('=');
         if(pos == string::npos) THROW_ERROR("Bad feature string @ " << buff);
-        ret.insert(make_pair(Dict::WID(buff.substr(0, pos)), atof(buff.substr(pos+1).c_str())));
+        WordId feat = Dict::WID(buff.substr(0, pos));
+        if(feat >= 0) AddFeatureId(feat);
+        ret.insert(make_pair(feat, atof(buff.substr(pos+1).c_str())));
     }
     return ret;
 }
@@ -53,7 +55,9 @@ SparseVector Dict::ParseSparseVector(std::istream & iss) {
     while(iss >> buff) {
         size_t pos = buff.rfind('=');
         if(pos == string::npos) THROW_ERROR("Bad feature string @ " << buff);
-        ret.push_back(make_pair(Dict::WID(buff.substr(0, pos)), atof(buff.substr(pos+1).c_str())));
+        WordId feat = Dict::WID(buff.substr(0, pos));
+        if(feat >= 0) AddFeatureId(feat);
+        ret.push_back(make_pair(feat, atof(buff.substr(pos+1).c_str())));
     }
     return SparseVector(ret);
 }
@@ -70,6 +74,18 @@ WordId Dict::WID(const std::string & str) {
     return wids_.GetId(str, add_);
 }
 
+WordId Dict::WID(const char * str, size_t len) {
+    return wids_.GetIdFromBuffer(str, len, add_);
+}
+
+void Dict::WriteVocab(std::ostream & out) {
+    wids_.WriteBinary(out);
+}
+
+void Dict::ReadVocab(std::istream & in) {
+    wids_.ReadBinary(in);
+}
+
 std::string Dict::WSymEscaped(WordId id) {
     ostringstream oss;
     if(id < 0) {
@@ -27,14 +27,18 @@ EvalMeasureBleu::NgramStats * EvalMeasureBleu::ExtractNgrams(const Sentence & se
 
 boost::shared_ptr<EvalMeasureBleu::NgramStats> EvalMeasureBleu::GetCachedStats(const Sentence & sent, int cache_id) {
     if(cache_id == INT_MAX) return boost::shared_ptr<NgramStats>(ExtractNgrams(sent));
-    StatsCache::const_iterator it = cache_.find(cache_id);
-    if(it == cache_.end()) {
-        boost::shared_ptr<NgramStats> new_stats(ExtractNgrams(sent));
-        cache_.insert(make_pair(cache_id, new_stats));
-        return new_stats;
-    } else {
-        return it->second;
+    {
+        boost::mutex::scoped_lock lock(cache_mutex_);
+        StatsCache::const_iterator it = cache_.find(cache_id);
+        if(it != cache_.end())
+            return it->second;
     }
+    // Extract the n-grams without holding the lock, so misses in other
+    // threads are not held up. If another thread added the same sentence in
+    // the meantime, its stats are kept and returned
+    boost::shared_ptr<NgramStats> new_stats(ExtractNgrams(sent));
+    boost::mutex::scoped_lock lock(cache_mutex_);
+    return cache_.insert(make_pair(cache_id, new_stats)).first->second;
 }
 
 boost::shared_ptr<EvalStats> EvalMeasureBleu::CalculateStats(const Sentence & ref, const Sentence & sys) const {
@@ -85,8 +85,7 @@ void ForestExtractorRunner::Run(const ConfigForestExtractorRunner & config) {
         // Parse into the appropriate data structures
         boost::shared_ptr<HyperGraph> src_graph;
         try {
-            istringstream src_iss(src_line);
-            src_graph.reset(src_io->ReadTree(src_iss));
+            src_graph.reset(src_io->ReadFromString(src_line));
         } catch (std::runtime_error & e) {
             THROW_ERROR("Error reading tree on line " << sent+1 << endl << src_line << endl << e.what());
         }
@@ -99,8 +98,7 @@ void ForestExtractorRunner::Run(const ConfigForestExtractorRunner & config) {
         Sentence trg_sent;
         LabeledSpans trg_labs;
         if(trg_io.get() != NULL) {
-            istringstream trg_iss(trg_line);
-            boost::shared_ptr<HyperGraph> trg_graph(trg_io->ReadTree(trg_iss));
+            boost::shared_ptr<HyperGraph> trg_graph(trg_io->ReadFromString(trg_line));
             trg_sent = trg_graph->GetWords();
             trg_labs = trg_graph->GetLabeledSpans();    
         } else {
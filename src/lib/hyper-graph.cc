@@ -5,13 +5,15 @@
 #include <lm/left.hh>
 #include <lm/model.hh>
 #include <travatar/weights.h>
+#include <travatar/weight-vector.h>
 #include <travatar/hyper-graph.h>
+#include <travatar/hyper-graph-semiring.h>
+#include <travatar/lazy-kbest.h>
 #include <travatar/translation-rule.h>
 #include <travatar/global-debug.h>
 #include <travatar/string-util.h>
 #include <travatar/io-util.h>
 #include <travatar/check-equal.h>
-#include <travatar/softmax.h>
 #include <travatar/dict.h>
 
 using namespace std;
@@ -272,66 +274,24 @@ SparseVector HyperPath::GetFeatures() {
     return ret;
 }
 
-class PathScoreMore {
-public:
-    bool operator()(const boost::shared_ptr<HyperPath> x, const boost::shared_ptr<HyperPath> y) {
-        if(abs(x->GetScore() - y->GetScore()) > 1e-6) { return x->GetScore() > y->GetScore(); }
-        const vector<HyperEdge*> & xe = x->GetEdges(), ye = y->GetEdges();
-        if(xe.size() != ye.size()) { return xe.size() > ye.size(); }
-        for(int i = 0; i < (int)xe.size(); i++)
-            if(xe[i]->GetId() != ye[i]->GetId())
-                return xe[i]->GetId() < ye[i]->GetId();
-        return false;
-    }
-};
-
 vector<boost::shared_ptr<HyperPath> > HyperGraph::GetNbest(int n, bool uniq) {
-    set<boost::shared_ptr<HyperPath>, PathScoreMore> paths;
-    boost::shared_ptr<HyperPath> init_path(new HyperPath);
-    init_path->PushNode(nodes_[0]);
-    init_path->AddScore(nodes_[0]->CalcViterbiScore());
-    // cerr << "Generating nbest, viterbi = " << nodes_[0]->CalcViterbiScore() << endl;
-    paths.insert(init_path);
     vector<boost::shared_ptr<HyperPath> > ret;
+    if(nodes_.size() == 0) return ret;
+    // The Viterbi scores are not needed for search, but are expected to be
+    // set on the graph afterwards
+    nodes_[0]->CalcViterbiScore();
+    // Find derivations lazily, and only build paths for the ones we return
+    LazyKbest kbest(*this);
     set<CfgDataVector> uniq_sents;
-    while(paths.size() > 0 && (int)ret.size() < n) {
-        boost::shared_ptr<HyperPath> curr_path = *paths.begin();
-        paths.erase(paths.begin());
-        // cerr << " Processing " << *curr_path << "    size: " << paths.size() << endl;
-        HyperNode * node = curr_path->PopNode();
-        if(node == NULL) {
-            CfgDataVector trg = curr_path->CalcTranslations();
-            // cerr << "  Attempting to add " << Dict::PrintWords(trg) << endl;
-            curr_path->SetTrgData(trg);
-            if(!uniq) {
-                ret.push_back(curr_path);
-            } else if(uniq_sents.find(trg) == uniq_sents.end()) {
-                uniq_sents.insert(trg);
-                ret.push_back(curr_path);
-            }
-        } else {
-            curr_path->AddScore(-1*node->CalcViterbiScore());
-            // Expand each different edge
-            BOOST_FOREACH(HyperEdge * edge, node->GetEdges()) {
-                // Create a new path that is a copy of the old one, and add
-                // the edge and its corresponding score
-                boost::shared_ptr<HyperPath> next_path(new HyperPath(*curr_path));
-                next_path->AddEdge(edge);
-                next_path->AddScore(edge->GetScore());
-                BOOST_FOREACH(HyperNode * tail_node, edge->GetTails())
-                    next_path->AddScore(tail_node->CalcViterbiScore());
-                // Add the nodes in reverse order, to ensure that we
-                // are doing a depth-first left-to-right traversal
-                BOOST_REVERSE_FOREACH(HyperNode * tail, edge->GetTails())
-                    next_path->PushNode(tail);
-                paths.insert(next_path);
-                // cerr << "  Pushed " << *next_path << "   size: " << paths.size() << endl;
-            }
-            if(!uniq)
-                while((int)paths.size() > n)
-                    paths.erase(boost::prior(paths.end()));
-        }
-        
+    for(int k = 0; (int)ret.size() < n && kbest.HasKth(k); k++) {
+        boost::shared_ptr<HyperPath> path(new HyperPath);
+        kbest.GetEdges(k, path->GetEdges());
+        path->SetScore(kbest.GetScore(k));
+        CfgDataVector trg = path->CalcTranslations();
+        if(uniq && !uniq_sents.insert(trg).second)
+            continue;
+        path->SetTrgData(trg);
+        ret.push_back(path);
     }
     return ret;
 }
@@ -376,31 +336,49 @@ SparseVector HyperPath::CalcFeatures() {
 }
 
 // Calculate the translation of the path
+// Translate the derivation starting at edge idx, leaving idx after its last
+// edge. The edges are visited in depth-first order with an explicit stack,
+// each entry holding an edge and the translations of the tails finished so
+// far, so paths through deep forests can be translated
 CfgData HyperPath::CalcTranslation(int factor, int & idx) {
-    vector<CfgData> child_trans;
-    int my_id = idx++;
-    BOOST_FOREACH(HyperNode * tail, edges_[my_id]->GetTails()) {
-        if(tail != edges_[idx]->GetHead())
-            THROW_ERROR("Unmatching hyper-nodes " << *tail);
-        child_trans.push_back(CalcTranslation(factor, idx));
-    }
-    CfgData ret;
-    if(factor >= (int)edges_[my_id]->GetTrgData().size())
-        return ret;
-    BOOST_FOREACH(int wid, edges_[my_id]->GetTrgData()[factor].words) {
-        if(wid >= 0) {
-            ret.words.push_back(wid);
-        } else {
-            ret.AppendChild(child_trans[-1 - wid]);
+    vector<pair<int, vector<CfgData> > > stack(1, make_pair(idx++, vector<CfgData>()));
+    while(true) {
+        int my_id = stack.back().first;
+        const vector<HyperNode*> & tails = edges_[my_id]->GetTails();
+        int num_done = stack.back().second.size();
+        if(num_done < (int)tails.size()) {
+            if(idx >= (int)edges_.size() || tails[num_done] != edges_[idx]->GetHead())
+                THROW_ERROR("Unmatching hyper-nodes " << *tails[num_done]);
+            stack.push_back(make_pair(idx++, vector<CfgData>()));
+            continue;
         }
+        CfgData ret;
+        if(factor < (int)edges_[my_id]->GetTrgData().size()) {
+            const vector<CfgData> & child_trans = stack.back().second;
+            BOOST_FOREACH(int wid, edges_[my_id]->GetTrgData()[factor].words) {
+                if(wid >= 0) {
+                    ret.words.push_back(wid);
+                } else {
+                    ret.AppendChild(child_trans[-1 - wid]);
+                }
+            }
+        }
+        stack.pop_back();
+        if(stack.size() == 0)
+            return ret;
+        stack.back().second.push_back(ret);
     }
-    return ret;
 }
 
 // Score each edge in the graph
 void HyperGraph::ScoreEdges(const Weights & weights) {
+    const SparseMap & current = weights.GetCurrent();
+    BOOST_FOREACH(HyperEdge * edge, edges_)
+        edge->SetScore(current * edge->GetFeatures());
+}
+void HyperGraph::ScoreEdges(const WeightVector & weights) {
     BOOST_FOREACH(HyperEdge * edge, edges_)
-        edge->SetScore(weights.GetCurrent() * edge->GetFeatures());
+        edge->SetScore(weights * edge->GetFeatures());
 }
 
 class QueueEntry {
@@ -416,84 +394,144 @@ void HyperEdge::SetRule(const TranslationRule * rule, const SparseVector & orig_
     // src_str_ = rule->GetSrcStr();
     features_ = rule->GetFeatures() + orig_features;
     trg_data_ = rule->GetTrgData();
-}
-
-Real HyperNode::GetInsideProb(vector<Real> & inside) {
-    if(inside[id_] != -REAL_MAX)
-        return inside[id_];
-    else if(IsTerminal())
-        return (inside[id_] = 0);
-    // cerr << "@node: " << *this << ": " << edges_.size() << endl;
-    vector<Real> sum_over;
-    BOOST_FOREACH(HyperEdge * edge, edges_) {
-        // cerr << "   @edge: " << *edge << endl;
-        Real next = edge->GetScore();
-        BOOST_FOREACH(HyperNode * tail, edge->GetTails())
-            next += tail->GetInsideProb(inside);
-        sum_over.push_back(next);
-    }
-    inside[id_] = AddLogProbs(sum_over);
-    // cerr << "Inside over " << sum_over.size() << " edges=" << edges_.size() << " @ " << id_ << ": " << AddLogProbs(sum_over) << endl;
-    for(int i = 0; i < (int)sum_over.size(); i++) {
-        // cerr << "edges_["<<i<<"->SetScore("<<sum_over[i]<<" - " << inside[id_]<<")" << endl;
-        edges_[i]->SetScore(sum_over[i] - inside[id_]);
-    }
-    return inside[id_];
-}
-
-Real HyperNode::GetOutsideProb(const vector< vector<HyperEdge*> > & all_edges, vector<Real> & outside) const {
-    if(outside[id_] != -REAL_MAX)
-        return outside[id_];
-    else if(id_ == 0)
-        return (outside[id_] = 0);
-    else if(all_edges[id_].size() == 0)
-        return (outside[id_] = -REAL_MAX);
-    vector<Real> sum_over;
-    BOOST_FOREACH(const HyperEdge * edge, all_edges[id_]) {
-        Real next = edge->GetScore() + edge->GetHead()->GetOutsideProb(all_edges, outside);
-        sum_over.push_back(next);
+    lm_scores_ = rule->GetLMScores();
+}
+
+void HyperGraph::GetTopologicalOrder(vector<int> & order) const {
+    order.clear();
+    if(nodes_.size() == 0) return;
+    vector<bool> visited(nodes_.size(), false);
+    // Each entry is a node that is being visited, and the edge and tail to
+    // visit next. Nodes are added to the order after all their tails
+    vector<pair<const HyperNode*, pair<int,int> > > stack;
+    stack.push_back(make_pair(nodes_[0], make_pair(0, 0)));
+    visited[0] = true;
+    while(stack.size()) {
+        const HyperNode * node = stack.rbegin()->first;
+        pair<int,int> & pos = stack.rbegin()->second;
+        const vector<HyperEdge*> & edges = node->GetEdges();
+        while(pos.first < (int)edges.size() && pos.second == (int)edges[pos.first]->GetTails().size()) {
+            pos.first++;
+            pos.second = 0;
+        }
+        if(pos.first == (int)edges.size()) {
+            order.push_back(node->GetId());
+            stack.pop_back();
+        } else {
+            const HyperNode * tail = edges[pos.first]->GetTail(pos.second++);
+            if(!visited[tail->GetId()]) {
+                visited[tail->GetId()] = true;
+                stack.push_back(make_pair(tail, make_pair(0, 0)));
+            }
+        }
     }
-    // cerr << "Outside over " << sum_over.size() << " @ " << id_ << " : " << AddLogProbs(sum_over) << endl;
-    return (outside[id_] = AddLogProbs(sum_over));
 }
 
-vector< vector<HyperEdge*> > HyperGraph::GetReversedEdges() {
-    vector< vector<HyperEdge*> > ret(nodes_.size());
-    BOOST_FOREACH(HyperEdge* edge, edges_)
-        BOOST_FOREACH(HyperNode* tail, edge->GetTails())
-            ret[tail->GetId()].push_back(edge);
-    return ret;
+void HyperGraph::GetHeightLevels(vector<vector<int> > & levels) const {
+    levels.clear();
+    vector<int> order;
+    GetTopologicalOrder(order);
+    vector<int> heights(nodes_.size(), 0);
+    BOOST_FOREACH(int id, order) {
+        int & height = heights[id];
+        BOOST_FOREACH(const HyperEdge * edge, nodes_[id]->GetEdges())
+            BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+                height = max(height, heights[tail->GetId()]+1);
+        if(height >= (int)levels.size())
+            levels.resize(height+1);
+        levels[height].push_back(id);
+    }
 }
 
 // Perform the inside-outside algorithm, where each edge score is a log probability
 void HyperGraph::InsideOutsideNormalize() {
-    // Calculate the inside and outside probabilities
-    vector<Real> inside(nodes_.size(), -REAL_MAX), outside(nodes_.size(), -REAL_MAX);
-    vector<vector<HyperEdge*> > rev_edges = GetReversedEdges();
-    vector<Real> new_scores(edges_.size(), -REAL_MAX);
-    nodes_[0]->GetInsideProb(inside);
-    // cerr << exp(nodes_[0]->GetInsideProb(inside)) << endl;
-    // Re-score the current edges
+    vector<int> order;
+    GetTopologicalOrder(order);
+    vector<Real> inside, outside;
+    CalcInside<LogSemiring>(nodes_, order, EdgeScore(), LogSemiring::One(), inside);
+    // Normalize each edge score to the probability of the edge given its
+    // head. The inside probability of every node is then one, and the
+    // outside probability is the probability that the node is used
+    vector<Real> norm_scores(edges_.size(), -REAL_MAX);
+    BOOST_FOREACH(const HyperEdge * edge, edges_) {
+        Real score = CalcEdgeInside<LogSemiring>(*edge, EdgeScore(), inside);
+        if(score != -REAL_MAX)
+            norm_scores[edge->GetId()] = score - inside[edge->GetHead()->GetId()];
+    }
+    EdgeValueArray<Real> norm_func(norm_scores);
+    CalcOutside<LogSemiring>(nodes_, order, norm_func, vector<Real>(nodes_.size(), 0), outside);
+    // Re-score the current edges with their posteriors
     BOOST_FOREACH(HyperEdge * edge, edges_) {
-        Real next = edge->GetScore() + edge->GetHead()->GetOutsideProb(rev_edges, outside);
-        // cerr << "next @ "<<edge->GetId()<<": " << edge->GetScore() << " + " << edge->GetHead()->GetOutsideProb(rev_edges, outside);
-        new_scores[edge->GetId()] = next;
+        Real score = norm_scores[edge->GetId()];
+        LogSemiring::Times(score, outside[edge->GetHead()->GetId()]);
+        edge->SetScore(score);
     }
-    for(int i = 0; i < (int)new_scores.size(); i++)
-        edges_[i]->SetScore(new_scores[i]);
 }
 
-// Calculate new viterbi scores if necessary
+namespace travatar {
+
+// Calculate the inside and outside scores of each node that can be reached
+// from the root in a semiring over Real scores
+template <class Semiring>
+inline void CalcGraphInsideOutside(const HyperGraph & graph,
+                                   const vector<Real> & edge_scores,
+                                   vector<Real> & inside,
+                                   vector<Real> & outside) {
+    vector<int> order;
+    graph.GetTopologicalOrder(order);
+    EdgeValueArray<Real> edge_func(edge_scores);
+    CalcInside<Semiring>(graph.GetNodes(), order, edge_func, Semiring::One(), inside);
+    // If the root has no derivation, no node is part of one
+    if(order.size() == 0 || inside[0] == Semiring::Zero())
+        outside.assign(graph.NumNodes(), Semiring::Zero());
+    else
+        CalcOutside<Semiring>(graph.GetNodes(), order, edge_func, inside, outside);
+}
+
+}
+
+void HyperGraph::CalcViterbiInsideOutside(const vector<Real> & edge_scores,
+                                          vector<Real> & inside,
+                                          vector<Real> & outside) const {
+    CalcGraphInsideOutside<TropicalSemiring>(*this, edge_scores, inside, outside);
+}
+
+void HyperGraph::CalcInsideOutside(const vector<Real> & edge_scores,
+                                   vector<Real> & inside,
+                                   vector<Real> & outside) const {
+    CalcGraphInsideOutside<LogSemiring>(*this, edge_scores, inside, outside);
+}
+
+// Calculate new viterbi scores if necessary. This is called on nodes that
+// are not yet in a graph, so the scores are kept in the nodes instead of
+// arrays, but the nodes below are still visited with an explicit stack
 Real HyperNode::CalcViterbiScore() {
-    if(viterbi_score_ == -REAL_MAX) {
-        // if(edges_.size() == 0)
-        //     THROW_ERROR("Cannot GetViterbiScore for a node with no edges");
-        BOOST_FOREACH(HyperEdge * edge, edges_) {
-            Real score = edge->GetScore();
-            BOOST_FOREACH(HyperNode * tail, edge->GetTails())
-                score += tail->CalcViterbiScore();
-            if(score > viterbi_score_)
-                viterbi_score_ = score;
+    if(viterbi_score_ != -REAL_MAX)
+        return viterbi_score_;
+    // Each entry is a node without a score, and the edge and tail to visit next
+    vector<pair<HyperNode*, pair<int,int> > > stack;
+    stack.push_back(make_pair(this, make_pair(0, 0)));
+    while(stack.size()) {
+        HyperNode * node = stack.rbegin()->first;
+        pair<int,int> & pos = stack.rbegin()->second;
+        const vector<HyperEdge*> & edges = node->edges_;
+        while(pos.first < (int)edges.size() && pos.second == (int)edges[pos.first]->GetTails().size()) {
+            pos.first++;
+            pos.second = 0;
+        }
+        if(pos.first == (int)edges.size()) {
+            // All the tails have scores, so score the node
+            BOOST_FOREACH(const HyperEdge * edge, edges) {
+                Real score = edge->GetScore();
+                BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+                    TropicalSemiring::Times(score, tail->viterbi_score_);
+                TropicalSemiring::Plus(node->viterbi_score_, score);
+            }
+            stack.pop_back();
+        } else {
+            HyperNode * tail = edges[pos.first]->GetTail(pos.second++);
+            if(tail->viterbi_score_ == -REAL_MAX)
+                stack.push_back(make_pair(tail, make_pair(0, 0)));
         }
     }
     return viterbi_score_;
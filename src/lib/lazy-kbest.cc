@@ -0,0 +1,152 @@
+#include <travatar/lazy-kbest.h>
+#include <travatar/hyper-graph.h>
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+
+using namespace std;
+using namespace travatar;
+
+LazyKbest::LazyKbest(const HyperGraph & graph) :
+    graph_(graph), nodes_(graph.NumNodes()) { }
+
+size_t LazyKbest::DerivationHash::operator()(int x) const {
+    const Derivation & deriv = (*derivs_)[x];
+    size_t ret = deriv.pos;
+    boost::hash_combine(ret, boost::hash_range(deriv.ranks.begin(), deriv.ranks.end()));
+    return ret;
+}
+
+// Find the k-th best derivation of a node, lazily creating only the
+// derivations of the tails that are necessary to do so. Instead of
+// recursing into the tails, nodes whose derivations are needed are put on
+// a stack, and the node that needs them is revisited once they are found
+bool LazyKbest::FindKth(int node, int k) {
+    vector<pair<int,int> > stack(1, make_pair(node, k));
+    while(stack.size()) {
+        int my_node = stack.back().first, my_k = stack.back().second;
+        KbestNode & kn = nodes_[my_node];
+        if((int)kn.best.size() > my_k || kn.done) {
+            stack.pop_back();
+            continue;
+        }
+        if(!kn.init) {
+            kn.init = true;
+            // The set refers to the pool of this node, which no longer moves
+            kn.seen = DerivationSet(8, DerivationHash(&kn.derivs), DerivationEqual(&kn.derivs));
+            const HyperNode * hn = graph_.GetNode(my_node);
+            for(int pos = hn->NumEdges()-1; pos >= 0; pos--)
+                Propose(my_node, pos, vector<int>(hn->GetEdge(pos)->NumTails(), 0));
+        }
+        // Move pending proposals to the candidates, first finding the
+        // derivations of their tails if necessary
+        bool blocked = false;
+        while(kn.pending.size() && !blocked) {
+            Derivation & deriv = kn.derivs[kn.pending.back()];
+            bool valid = true;
+            for(int i = 0; i < (int)deriv.ranks.size(); i++) {
+                const KbestNode & tn = nodes_[deriv.edge->GetTail(i)->GetId()];
+                if((int)tn.best.size() > deriv.ranks[i])
+                    continue;
+                if(tn.done) {
+                    valid = false;
+                } else {
+                    stack.push_back(make_pair(deriv.edge->GetTail(i)->GetId(), deriv.ranks[i]));
+                    blocked = true;
+                }
+                break;
+            }
+            if(blocked)
+                break;
+            int id = kn.pending.back();
+            kn.pending.pop_back();
+            if(!valid)
+                continue;
+            for(int i = 0; i < (int)deriv.ranks.size(); i++) {
+                const Derivation & tail_deriv = GetBest(deriv.edge->GetTail(i)->GetId(), deriv.ranks[i]);
+                deriv.score += tail_deriv.score;
+                deriv.size += tail_deriv.size;
+            }
+            kn.cand.push_back(id);
+            push_heap(kn.cand.begin(), kn.cand.end(), DerivationWorse(this, my_node));
+        }
+        if(blocked)
+            continue;
+        if(kn.cand.size() == 0) {
+            kn.done = true;
+            continue;
+        }
+        pop_heap(kn.cand.begin(), kn.cand.end(), DerivationWorse(this, my_node));
+        kn.best.push_back(kn.cand.back());
+        kn.cand.pop_back();
+        // Propose the neighbors of the new derivation, which are only moved
+        // to the candidates when the next derivation is needed
+        vector<int> ranks = kn.derivs[kn.best.back()].ranks;
+        int pos = kn.derivs[kn.best.back()].pos;
+        for(int i = (int)ranks.size()-1; i >= 0; i--) {
+            ranks[i]++;
+            Propose(my_node, pos, ranks);
+            ranks[i]--;
+        }
+    }
+    return (int)nodes_[node].best.size() > k;
+}
+
+// Add a derivation to the pending proposals of a node if it has not been
+// proposed yet
+void LazyKbest::Propose(int node, int pos, const vector<int> & ranks) {
+    KbestNode & kn = nodes_[node];
+    // GetNbest returns non-const edges, so cast away the const here
+    Derivation deriv;
+    deriv.edge = const_cast<HyperEdge*>(graph_.GetNode(node)->GetEdge(pos));
+    deriv.pos = pos;
+    deriv.ranks = ranks;
+    deriv.score = deriv.edge->GetScore();
+    deriv.size = 1;
+    kn.derivs.push_back(deriv);
+    if(!kn.seen.insert(kn.derivs.size()-1).second) {
+        kn.derivs.pop_back();
+        return;
+    }
+    kn.pending.push_back(kn.derivs.size()-1);
+}
+
+// Derivations are ordered by score, then size, then the edge IDs in
+// depth-first order
+bool LazyKbest::Better(const Derivation & x, const Derivation & y) const {
+    if(x.score != y.score) return x.score > y.score;
+    if(x.size != y.size) return x.size > y.size;
+    return LexCompare(x, y) < 0;
+}
+
+// Compare the edge IDs of two derivations of the same node in depth-first
+// order. As the edge sequences of complete derivations can never be
+// prefixes of each other, this can be done tail-by-tail, skipping tails
+// that use the same derivation
+int LazyKbest::LexCompare(const Derivation & x, const Derivation & y) const {
+    vector<pair<const Derivation*, const Derivation*> > stack(1, make_pair(&x, &y));
+    while(stack.size()) {
+        const Derivation & my_x = *stack.back().first, & my_y = *stack.back().second;
+        stack.pop_back();
+        if(my_x.edge->GetId() != my_y.edge->GetId())
+            return (my_x.edge->GetId() < my_y.edge->GetId() ? -1 : 1);
+        for(int i = (int)my_x.ranks.size()-1; i >= 0; i--) {
+            if(my_x.ranks[i] != my_y.ranks[i]) {
+                int tail = my_x.edge->GetTail(i)->GetId();
+                stack.push_back(make_pair(&GetBest(tail, my_x.ranks[i]), &GetBest(tail, my_y.ranks[i])));
+            }
+        }
+    }
+    return 0;
+}
+
+// Add the edges of a derivation in depth-first left-to-right order
+void LazyKbest::GetEdges(int k, vector<HyperEdge*> & edges) const {
+    vector<const Derivation*> stack(1, &GetBest(0, k));
+    while(stack.size()) {
+        const Derivation & deriv = *stack.back();
+        stack.pop_back();
+        edges.push_back(deriv.edge);
+        for(int i = (int)deriv.ranks.size()-1; i >= 0; i--)
+            stack.push_back(&GetBest(deriv.edge->GetTail(i)->GetId(), deriv.ranks[i]));
+    }
+}
@@ -3,7 +3,11 @@
 #include <travatar/dict.h>
 #include <travatar/global-debug.h>
 #include <travatar/vector-hash.h>
+#include <travatar/thread-pool.h>
+#include <travatar/task.h>
+#include <travatar/lm-score-cache.h>
 #include <boost/unordered_set.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <lm/left.hh>
 #include <vector>
@@ -52,6 +56,38 @@ public:
     }
 };
 
+// A task to build a single chart entry
+class LMComposerBUTask : public Task {
+public:
+    LMComposerBUTask(const LMComposerBU * composer,
+                     const HyperGraph & parse,
+                     vector<boost::shared_ptr<ChartEntry> > & chart,
+                     vector<ChartEntryStates> & states,
+                     const LMOutsideEstimates * est,
+                     int id) :
+        composer_(composer), parse_(parse), chart_(chart), states_(states), est_(est), id_(id) { }
+    void Run() {
+        composer_->BuildChartEntry(parse_, chart_, states_, est_, id_);
+    }
+protected:
+    const LMComposerBU * composer_;
+    const HyperGraph & parse_;
+    vector<boost::shared_ptr<ChartEntry> > & chart_;
+    vector<ChartEntryStates> & states_;
+    const LMOutsideEstimates * est_;
+    int id_;
+};
+
+// Add the nodes in a chart entry and their edges to the graph
+inline void AddChartEntry(const ChartEntry & entry, HyperGraph & graph) {
+    BOOST_FOREACH(HyperNode * node, entry) {
+        graph.AddNode(node);
+        BOOST_FOREACH(HyperEdge * edge, node->GetEdges())
+            graph.AddEdge(edge);
+    }
+}
+
+
 }
 
 
@@ -75,7 +111,7 @@ LMComposerBUFunc * LMComposerBUFunc::CreateFromType(lm::ngram::ModelType type) {
 }
 
 template <class LMType>
-pair<Real,int> LMComposerBUFuncTemplate<LMType>::CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<HyperNode*> & tails, const std::vector<std::vector<lm::ngram::ChartState> > & states, int lm_id, ChartState & out_state) {
+pair<Real,int> LMComposerBUFuncTemplate<LMType>::CalcNontermScore(const LMData* data, const Sentence & syms, const std::vector<const std::vector<lm::ngram::ChartState>*> & tail_states, int lm_id, ChartState & out_state) {
     // Get the rule score for the appropriate model
     RuleScore<LMType> my_rule_score(*static_cast<const LMType*>(data->GetLM()), out_state);
     int unk = 0;
@@ -83,7 +119,7 @@ pair<Real,int> LMComposerBUFuncTemplate<LMType>::CalcNontermScore(const LMData*
         if(trg_id < 0) {
             int curr_id = -1 - trg_id;
             // Add that edge to our non-terminal
-            const vector<ChartState> & child_state = states[tails[curr_id]->GetId()];
+            const vector<ChartState> & child_state = *tail_states[curr_id];
             // cerr << " Adding node context " << *next_edge->GetTail(curr_id) << " : " << PrintContext(child_state[lm_id].left) << ", " << PrintContext(child_state[lm_id].right) << endl;
             my_rule_score.NonTerminal(child_state[lm_id], 0);
         } else {
@@ -97,6 +133,22 @@ pair<Real,int> LMComposerBUFuncTemplate<LMType>::CalcNontermScore(const LMData*
     return make_pair(my_rule_score.Finish(), unk);
 }
 
+template <class LMType>
+pair<Real,int> LMComposerBUFuncTemplate<LMType>::CalcBoundaryScore(const LMData* data, const RuleLMScore & rule_score, const Sentence & syms, const std::vector<const std::vector<lm::ngram::ChartState>*> & tail_states, int lm_id, ChartState & out_state) {
+    RuleScore<LMType> my_rule_score(*static_cast<const LMType*>(data->GetLM()), out_state);
+    // The words between the non-terminals were scored on their own, so add
+    // them like non-terminals with no score
+    vector<ChartState>::const_iterator between = rule_score.between.begin();
+    my_rule_score.NonTerminal(*between++, 0);
+    BOOST_FOREACH(int trg_id, syms) {
+        if(trg_id < 0) {
+            my_rule_score.NonTerminal((*tail_states[-1 - trg_id])[lm_id], 0);
+            my_rule_score.NonTerminal(*between++, 0);
+        }
+    }
+    return make_pair(rule_score.prob + my_rule_score.Finish(), rule_score.unk);
+}
+
 template <class LMType>
 Real LMComposerBUFuncTemplate<LMType>::CalcFinalScore(const void * lm, const ChartState & prev_state) {
     ChartState my_state;
@@ -107,18 +159,119 @@ Real LMComposerBUFuncTemplate<LMType>::CalcFinalScore(const void * lm, const Cha
     return my_rule_score.Finish();
 }
 
+pair<Real,int> LMComposerBU::CalcNontermScore(
+                    const RuleLMScores * rule_scores,
+                    const Sentence & syms,
+                    const vector<const vector<ChartState>*> & tail_states,
+                    int lm_id, ChartState & out_state) const {
+    const LMData* data = lm_data_[lm_id];
+    const RuleLMScore * rule_score = (rule_scores ? rule_scores->Find(data->GetLM()) : NULL);
+    if(score_cache_.get() == NULL) {
+        if(rule_score)
+            return funcs_[lm_id]->CalcBoundaryScore(data, *rule_score, syms, tail_states, lm_id, out_state);
+        return funcs_[lm_id]->CalcNontermScore(data, syms, tail_states, lm_id, out_state);
+    }
+    // The score only depends on the words and the states of the tails
+    LMScoreCache::KeyRef key(LMScoreCache::BOTTOM_UP, data->GetLM(), syms, &tail_states, lm_id);
+    LMScoreCache::Value val;
+    if(score_cache_->Find(key, val)) {
+        out_state = val.states[0];
+        return make_pair(val.score, val.unk);
+    }
+    pair<Real,int> ret = (rule_score ?
+        funcs_[lm_id]->CalcBoundaryScore(data, *rule_score, syms, tail_states, lm_id, out_state) :
+        funcs_[lm_id]->CalcNontermScore(data, syms, tail_states, lm_id, out_state));
+    val.score = ret.first;
+    val.unk = ret.second;
+    val.states.push_back(out_state);
+    score_cache_->Add(key, val);
+    return ret;
+}
+
 const ChartEntry & LMComposerBU::BuildChartCubePruning(
                     const HyperGraph & parse,
                     vector<boost::shared_ptr<ChartEntry> > & chart,
-                    vector<vector<ChartState> > & states,
+                    vector<ChartEntryStates> & states,
+                    const LMOutsideEstimates * est,
                     int id,
                     HyperGraph & rule_graph) const {
-    // Save the nodes for easy access
-    const vector<HyperNode*> & nodes = parse.GetNodes();
     // Don't build already finished charts
     if(chart[id].get() != NULL) return *chart[id];
-    chart[id].reset(new ChartEntry);
-    ChartEntry & my_chart = *chart[id].get();
+    // Build the tails first. Tails after an empty one are never used
+    BOOST_FOREACH(const HyperEdge * edge, parse.GetNode(id)->GetEdges())
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+            if(BuildChartCubePruning(parse, chart, states, est, tail->GetId(), rule_graph).size() == 0)
+                break;
+    BuildChartEntry(parse, chart, states, est, id);
+    AddChartEntry(*chart[id], rule_graph);
+    return *chart[id];
+}
+
+void LMComposerBU::BuildChartParallel(
+                    const HyperGraph & parse,
+                    vector<boost::shared_ptr<ChartEntry> > & chart,
+                    vector<ChartEntryStates> & states,
+                    const LMOutsideEstimates * est,
+                    HyperGraph & rule_graph) const {
+    // Group the nodes by height, as nodes of the same height never depend on
+    // each other
+    vector<vector<int> > levels;
+    parse.GetHeightLevels(levels);
+    ThreadPool & pool = ThreadPool::GetShared();
+    BOOST_FOREACH(const vector<int> & level, levels) {
+        if(level.size() == 1) {
+            BuildChartEntry(parse, chart, states, est, level[0]);
+        } else {
+            TaskGroup group(pool);
+            BOOST_FOREACH(int id, level)
+                group.Submit(new LMComposerBUTask(this, parse, chart, states, est, id));
+            group.Wait();
+        }
+    }
+    // Add the entries to the graph, and delete any that the serial search
+    // would never have built
+    vector<bool> added(parse.NumNodes(), false);
+    AddChartEntries(parse, chart, added, 0, rule_graph);
+    for(int i = 0; i < (int)chart.size(); i++) {
+        if(chart[i].get() != NULL && !added[i]) {
+            BOOST_FOREACH(HyperNode * node, *chart[i]) {
+                BOOST_FOREACH(HyperEdge * edge, node->GetEdges())
+                    delete edge;
+                delete node;
+            }
+            chart[i].reset();
+        }
+    }
+}
+
+void LMComposerBU::AddChartEntries(
+                    const HyperGraph & parse,
+                    const vector<boost::shared_ptr<ChartEntry> > & chart,
+                    vector<bool> & added,
+                    int id,
+                    HyperGraph & rule_graph) const {
+    if(added[id]) return;
+    added[id] = true;
+    BOOST_FOREACH(const HyperEdge * edge, parse.GetNode(id)->GetEdges()) {
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails()) {
+            AddChartEntries(parse, chart, added, tail->GetId(), rule_graph);
+            if(chart[tail->GetId()]->size() == 0)
+                break;
+        }
+    }
+    AddChartEntry(*chart[id], rule_graph);
+}
+
+void LMComposerBU::BuildChartEntry(
+                    const HyperGraph & parse,
+                    vector<boost::shared_ptr<ChartEntry> > & chart,
+                    vector<ChartEntryStates> & states,
+                    const LMOutsideEstimates * est,
+                    int id) const {
+    // Save the nodes for easy access
+    const vector<HyperNode*> & nodes = parse.GetNodes();
+    ChartEntry * my_chart_ptr = new ChartEntry;
+    ChartEntry & my_chart = *my_chart_ptr;
     // The priority queue of values yet to be expanded
     priority_queue<pair<Real, vector<int> > > hypo_queue;
     // The hypothesis combination map
@@ -133,10 +286,11 @@ const ChartEntry & LMComposerBU::BuildChartCubePruning(
         HyperEdge * my_edge = node_edges[i];
         vector<int> q_id(my_edge->GetTails().size()+1);
         q_id[0] = i;
-        Real viterbi_score = my_edge->GetScore();
+        // Order the queue with the estimated LM score of the rule if possible
+        Real viterbi_score = my_edge->GetScore() + (est ? est->edge_lm[my_edge->GetId()] : 0);
         for(int j = 1; j < (int)q_id.size(); j++) {
             q_id[j] = 0;
-            const ChartEntry & my_entry = BuildChartCubePruning(parse, chart, states, my_edge->GetTail(j-1)->GetId(), rule_graph);
+            const ChartEntry & my_entry = *chart[my_edge->GetTail(j-1)->GetId()];
             // For empty nodes, break
             if(my_entry.size() == 0) {
                 viterbi_score = -REAL_MAX;
@@ -150,8 +304,10 @@ const ChartEntry & LMComposerBU::BuildChartCubePruning(
     }
     // For each edge on the queue, process it
     int num_popped = 0;
+    int pop_limit = (est ? est->ScaleLimit(id, stack_pop_limit_) : stack_pop_limit_);
+    int chart_limit = (est && chart_limit_ > 0 ? est->ScaleLimit(id, chart_limit_) : chart_limit_);
     while(hypo_queue.size() != 0) {
-        if(num_popped++ >= stack_pop_limit_) break;
+        if(num_popped++ >= pop_limit) break;
         // Get the score, id string, and edge
         Real top_score = hypo_queue.top().first;
         vector<int> id_str = hypo_queue.top().second;
@@ -163,16 +319,20 @@ const ChartEntry & LMComposerBU::BuildChartCubePruning(
         next_edge->SetFeatures(id_edge->GetFeatures());
         next_edge->SetTrgData(id_edge->GetTrgData());
         next_edge->SetSrcStr(id_edge->GetSrcStr());
+        next_edge->SetLMScores(id_edge->GetLMScores());
+        next_edge->SetOrigin(id_edge->GetId());
         vector<ChartState> my_state(lm_data_.size());
+        vector<const vector<ChartState>*> tail_states(id_edge->GetTails().size());
         // *** Get the data, etc. necessary for scoring
         for(int curr_id = 0; curr_id < (int)id_edge->GetTails().size(); curr_id++) {
             const HyperNode * tail = id_edge->GetTail(curr_id);
             // Get the chart for the particular node we're interested in
-            const ChartEntry & my_entry = BuildChartCubePruning(parse, chart, states, tail->GetId(), rule_graph);
+            const ChartEntry & my_entry = *chart[tail->GetId()];
             // From the node, get the appropriately ranked node
             int edge_pos = id_str[curr_id+1];
             HyperNode * chart_node = my_entry[edge_pos];
             next_edge->AddTail(chart_node);
+            tail_states[curr_id] = &states[tail->GetId()][edge_pos];
             // If we have not gotten to the end, insert a new value into the queue
             if(edge_pos+1 < (int)my_entry.size()) {
                 vector<int> next_str = id_str;
@@ -190,7 +350,7 @@ const ChartEntry & LMComposerBU::BuildChartCubePruning(
         for(int lm_id = 0; lm_id < (int)lm_data_.size(); lm_id++) {
             LMData* data = lm_data_[lm_id];
 
-            pair<Real,int> lm_scores = funcs_[lm_id]->CalcNontermScore(data, id_edge->GetTrgData()[data->GetFactor()].words, next_edge->GetTails(), states, lm_id, my_state[lm_id]);
+            pair<Real,int> lm_scores = CalcNontermScore(id_edge->GetLMScores(), id_edge->GetTrgData()[data->GetFactor()].words, tail_states, lm_id, my_state[lm_id]);
             // Add to the features and the score
             total_score += lm_scores.first * data->GetWeight() + lm_scores.second * data->GetUnkWeight();
             if(lm_scores.first != 0.0)
@@ -214,6 +374,7 @@ const ChartEntry & LMComposerBU::BuildChartCubePruning(
         } else {
             next_node = it->second;
         }
+        if(est) top_score -= est->edge_lm[id_edge->GetId()];
         next_node->SetViterbiScore(max(next_node->GetViterbiScore(),total_score + top_score));
         next_edge->SetHead(next_node);
         next_edge->SetScore(id_edge->GetScore() + total_score);
@@ -223,22 +384,19 @@ const ChartEntry & LMComposerBU::BuildChartCubePruning(
     }
     sort(my_chart.begin(), my_chart.end(), NodeScoreMore());
     // Destroy all edges/nodes over the chart limit
-    if(chart_limit_ > 0 && (int)my_chart.size() > chart_limit_) {
-        for(int i = chart_limit_; i < (int)my_chart.size(); i++) {
+    if(chart_limit > 0 && (int)my_chart.size() > chart_limit) {
+        for(int i = chart_limit; i < (int)my_chart.size(); i++) {
             BOOST_FOREACH(HyperEdge * edge, my_chart[i]->GetEdges())
                 delete edge;
             delete my_chart[i];
         }
-        my_chart.resize(chart_limit_);
+        my_chart.resize(chart_limit);
     }
-    // Add the rest of the nodes to the chart
-    BOOST_FOREACH(HyperNode * node, my_chart) {
-        rule_graph.AddNode(node);
-        states.push_back(hypo_rev[node]);
-        BOOST_FOREACH(HyperEdge * edge, node->GetEdges())
-            rule_graph.AddEdge(edge);
-    }
-    return my_chart;
+    // Save the states of the remaining nodes
+    ChartEntryStates & my_states = states[id];
+    BOOST_FOREACH(HyperNode * node, my_chart)
+        my_states.push_back(hypo_rev[node]);
+    chart[id].reset(my_chart_ptr);
 }
 
 // Intersect this rule_graph with a language model, using cube pruning to control
@@ -252,8 +410,8 @@ HyperGraph * LMComposerBU::TransformGraph(const HyperGraph & parse) const {
     //   each element of the vector is a node in the new rule_graph
     //   these must be sorted in ascending order of Viterbi probability
     vector<boost::shared_ptr<ChartEntry> > chart(nodes.size());
-    // This contains the chart states, indexed by node IDs in the new rule graph
-    vector<vector<ChartState> > states;
+    // This contains the chart states of each node in the chart
+    vector<ChartEntryStates> states(nodes.size());
     HyperGraph * ret = new HyperGraph;
     ret->SetWords(parse.GetWords());
     // Add the root node and its corresponding state
@@ -261,12 +419,21 @@ HyperGraph * LMComposerBU::TransformGraph(const HyperGraph & parse) const {
     HyperNode * root = new HyperNode(root_sym_, -1, make_pair(0,len));
     ret->AddNode(root);
     if(parse.NumNodes() == 0) return ret;
-    states.resize(1);
+    // Estimate how promising each node is
+    boost::scoped_ptr<LMOutsideEstimates> est;
+    if(outside_beam_ > 0) {
+        est.reset(new LMOutsideEstimates);
+        CalcOutsideEstimates(parse, *est);
+    }
     // Build the chart
-    BuildChartCubePruning(parse, chart, states, 0, *ret);
+    if(num_threads_ > 1)
+        BuildChartParallel(parse, chart, states, est.get(), *ret);
+    else
+        BuildChartCubePruning(parse, chart, states, est.get(), 0, *ret);
 
     // Build the final nodes
-    BOOST_FOREACH(HyperNode * node, *chart[0]) {
+    for(int i = 0; i < (int)chart[0]->size(); i++) {
+        HyperNode * node = (*chart[0])[i];
         HyperEdge * edge = new HyperEdge(root);
         edge->SetTrgData(CfgDataVector(GlobalVars::trg_factors, CfgData(Sentence(1, -1))));
         edge->AddTail(node);
@@ -279,7 +446,7 @@ HyperGraph * LMComposerBU::TransformGraph(const HyperGraph & parse) const {
             // my_rule_score.NonTerminal(states[node->GetId()][lm_id], 0);
             // my_rule_score.Terminal(static_cast<LMType*>(data->GetLM())->GetVocabulary().Index("</s>"));
             // Real my_score = my_rule_score.Finish();
-            Real my_score = funcs_[lm_id]->CalcFinalScore(data->GetLM(), states[node->GetId()][lm_id]);
+            Real my_score = funcs_[lm_id]->CalcFinalScore(data->GetLM(), states[0][i][lm_id]);
             if(my_score != 0.0)
                 edge->GetFeatures().Add(data->GetFeatureName(), my_score);
             total_score += my_score * data->GetWeight();
@@ -0,0 +1,74 @@
+#include <travatar/lm-composer-coarse-to-fine.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/global-debug.h>
+#include <travatar/timer.h>
+#include <boost/scoped_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <vector>
+
+using namespace travatar;
+using namespace std;
+using namespace boost;
+
+namespace travatar {
+
+// Trims a rule graph to the edges marked as active
+class TrimmerActiveEdges : public Trimmer {
+public:
+    TrimmerActiveEdges(const vector<bool> & active) : active_(active) { }
+    virtual void FindActive(const HyperGraph & hg,
+                            std::map<int,int> & active_nodes,
+                            std::map<int,int> & active_edges) const {
+        Trimmer::AddEdges(hg, active_, active_nodes, active_edges);
+    }
+protected:
+    const vector<bool> & active_;
+};
+
+}
+
+HyperGraph * LMComposerCoarseToFine::TransformGraph(const HyperGraph & hg) const {
+    Timer timer;
+    timer.start();
+    // Find the rule graph edges used by the derivations close to the best
+    // in the coarse pass
+    boost::scoped_ptr<HyperGraph> coarse_graph(coarse_->TransformGraph(hg));
+    vector<bool> coarse_active, active(hg.NumEdges(), false);
+    trimmer_.FindActiveEdges(*coarse_graph, coarse_active);
+    int kept_edges = 0;
+    BOOST_FOREACH(const HyperEdge * edge, coarse_graph->GetEdges()) {
+        int origin = edge->GetOrigin();
+        if(coarse_active[edge->GetId()] && origin >= 0 && !active[origin]) {
+            active[origin] = true;
+            kept_edges++;
+        }
+    }
+    coarse_graph.reset();
+    double coarse_time = timer.get_elapsed_time();
+    // Perform the fine pass, over the whole graph if the coarse pass found
+    // no translation
+    HyperGraph * ret;
+    if(kept_edges > 0) {
+        boost::scoped_ptr<HyperGraph> pruned(TrimmerActiveEdges(active).TransformGraph(hg));
+        ret = fine_->TransformGraph(*pruned);
+    } else {
+        kept_edges = hg.NumEdges();
+        ret = fine_->TransformGraph(hg);
+    }
+    double fine_time = timer.get_elapsed_time() - coarse_time;
+    PRINT_DEBUG("Coarse-to-fine: kept " << kept_edges << "/" << hg.NumEdges() << " edges, coarse=" << coarse_time << "s, fine=" << fine_time << "s" << endl, 2);
+    {
+        boost::mutex::scoped_lock lock(stats_mutex_);
+        stats_.sentences++;
+        stats_.coarse_time += coarse_time;
+        stats_.fine_time += fine_time;
+        stats_.edges += hg.NumEdges();
+        stats_.kept_edges += kept_edges;
+    }
+    return ret;
+}
+
+CoarseToFineStats LMComposerCoarseToFine::GetStats() const {
+    boost::mutex::scoped_lock lock(stats_mutex_);
+    return stats_;
+}
@@ -2,7 +2,11 @@
 #include <travatar/hyper-graph.h>
 #include <travatar/dict.h>
 #include <travatar/global-debug.h>
+#include <travatar/thread-pool.h>
+#include <travatar/task.h>
+#include <travatar/lm-score-cache.h>
 #include <boost/unordered_set.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <lm/left.hh>
 #include <search/context.hh>
@@ -21,7 +25,7 @@ using namespace lm;
 using namespace search;
 
 LMComposerIncremental::LMComposerIncremental(const std::vector<std::string> & str) :
-    LMComposer(str), stack_pop_limit_(0), edge_limit_(1000) {
+    LMComposer(str), stack_pop_limit_(0), edge_limit_(1000), num_threads_(1) {
     if(lm_data_.size() != 1)
         THROW_ERROR("Cannot perform search using 'inc' when using more than one language model. Try using 'cp' instead.");
 }
@@ -36,8 +40,9 @@ NBestComplete Forest::Complete(std::vector<PartialEdge> &partial) {
     // For each vector, create a node
     HyperNode * node = new HyperNode;
     hg->AddNode(node);
-    // For remembering duplicate edges
-    map<vector<WordId>, HyperEdge*> node_memo;
+    // For remembering duplicate edges. Tails are identified by pointer, as
+    // nodes created in different forests may share the same ID
+    map<pair<int, vector<HyperNode*> >, HyperEdge*> node_memo;
     // For each edge, add a hyperedge to the graph
     PartialEdge best;
     HyperEdge *old_edge = NULL, *edge = NULL;
@@ -49,14 +54,15 @@ NBestComplete Forest::Complete(std::vector<PartialEdge> &partial) {
         // Add the new tails in *source* order 
         vector<HyperNode*> tails;
         Sentence wids;
-        vector<WordId> node_id;
+        pair<int, vector<HyperNode*> > node_id;
         if(old_edge) {
             wids = old_edge->GetTrgData()[factor_].words;
-            node_id = vector<WordId>(old_edge->GetTails().size()+1);
-            node_id[old_edge->GetTails().size()] = old_edge->GetId();
+            node_id.first = old_edge->GetId();
+            node_id.second.resize(old_edge->GetTails().size());
         } else{
             wids = Sentence(1,-1);
-            node_id = vector<WordId>(1);
+            node_id.first = -1;
+            node_id.second.resize(1);
         }
         BOOST_FOREACH(WordId wid, wids) {
             if(wid < 0) {
@@ -65,8 +71,8 @@ NBestComplete Forest::Complete(std::vector<PartialEdge> &partial) {
                 HyperNode* child = (HyperNode*)part.End();
                 tails.push_back(child);
                 edge_score -= child->GetViterbiScore();
-                // Keep track of the node ID
-                node_id[tid] = child->GetId();
+                // Keep track of the node
+                node_id.second[tid] = child;
             }
         }
         // Skip duplicate edges
@@ -79,6 +85,7 @@ NBestComplete Forest::Complete(std::vector<PartialEdge> &partial) {
         int lm_unk = 0;
         if(old_edge) {
             edge = new HyperEdge(*old_edge);
+            edge->SetOrigin(old_edge->GetId());
             lm_unk = lm_unks_[old_edge->GetId()];
         } else {
             edge = new HyperEdge;
@@ -110,22 +117,188 @@ NBestComplete Forest::Complete(std::vector<PartialEdge> &partial) {
         return NBestComplete(node, best.CompletedState(), best.GetScore());
 }
 
+void Forest::Absorb(Forest & other) {
+    BOOST_FOREACH(HyperNode * node, other.hg->GetNodes()) {
+        if(node == NULL) continue;
+        node->SetId(-1);
+        hg->AddNode(node);
+        BOOST_FOREACH(HyperEdge * edge, node->GetEdges())
+            hg->AddEdge(edge);
+    }
+    other.hg->GetNodes().clear();
+    other.hg->GetEdges().clear();
+}
+
+namespace travatar {
+
+// A task to calculate a single vertex with its own forest
+template <class LMType>
+class LMComposerIncrementalTask : public Task {
+public:
+    LMComposerIncrementalTask(const LMComposerIncremental * composer,
+                              const HyperGraph & parse,
+                              vector<search::Vertex*> & vertices,
+                              search::Context<LMType> & context,
+                              search::Forest & forest,
+                              const LMOutsideEstimates * est,
+                              int id) :
+        composer_(composer), parse_(parse), vertices_(vertices),
+        context_(context), forest_(forest), est_(est), id_(id) { }
+    void Run() {
+        composer_->BuildVertex(parse_, vertices_, context_, forest_, est_, id_);
+    }
+protected:
+    const LMComposerIncremental * composer_;
+    const HyperGraph & parse_;
+    vector<search::Vertex*> & vertices_;
+    search::Context<LMType> & context_;
+    search::Forest & forest_;
+    const LMOutsideEstimates * est_;
+    int id_;
+};
+
+}
+
 // Calculate a single vertex
 template <class LMType>
 search::Vertex* LMComposerIncremental::CalculateVertex(
                     const HyperGraph & parse, vector<search::Vertex*> & vertices,
                     search::Context<LMType> & context, search::Forest & best,
-                    int id) const {
+                    const LMOutsideEstimates * est, int id) const {
     // Don't redo ones we've already finished
     if(vertices[id]) return vertices[id];
     // Get the nodes from the parse
     const vector<HyperNode*> & nodes = parse.GetNodes();
+    if(id < 0 || id >= (int)nodes.size() || nodes[id] == NULL)
+        THROW_ERROR("Bad id=" << id << " at nodes.size() == " << nodes.size());
+    // Calculate the children in target order, skipping those after an empty one
+    LMData* data = lm_data_[0];
+    BOOST_FOREACH(const HyperEdge * edge, nodes[id]->GetEdges()) {
+        BOOST_FOREACH(WordId wid, edge->GetTrgData()[data->GetFactor()].words) {
+            if(wid < 0 && CalculateVertex(parse, vertices, context, best, est, edge->GetTail(-1 - wid)->GetId())->Empty())
+                break;
+        }
+    }
+    return BuildVertex(parse, vertices, context, best, est, id);
+}
+
+template <class LMType>
+void LMComposerIncremental::CalculateVerticesParallel(
+                    const HyperGraph & parse, vector<search::Vertex*> & vertices,
+                    search::Context<LMType> & context, search::Forest & best,
+                    const LMOutsideEstimates * est) const {
+    // Group the vertices by height, as vertices of the same height never
+    // depend on each other
+    vector<vector<int> > levels;
+    parse.GetHeightLevels(levels);
+    // Each vertex creates its nodes in its own forest
+    LMData* data = lm_data_[0];
+    vector<boost::shared_ptr<search::Forest> > forests(parse.NumNodes());
+    ThreadPool & pool = ThreadPool::GetShared();
+    BOOST_FOREACH(const vector<int> & level, levels) {
+        TaskGroup group(pool);
+        BOOST_FOREACH(int id, level) {
+            forests[id].reset(new search::Forest(data->GetFeatureName(), data->GetWeight(), data->GetUnkFeatureName(), data->GetUnkWeight(), root_sym_, data->GetFactor()));
+            LMComposerIncrementalTask<LMType> * task = new LMComposerIncrementalTask<LMType>(this, parse, vertices, context, *forests[id], est, id);
+            if(level.size() == 1) {
+                task->Run();
+                delete task;
+            } else {
+                group.Submit(task);
+            }
+        }
+        group.Wait();
+    }
+    // Move the nodes into the final forest. Nodes of vertices that the serial
+    // search would never have calculated are deleted with their forests
+    vector<bool> added(parse.NumNodes(), false);
+    AbsorbForests(parse, vertices, forests, added, 0, best);
+}
+
+void LMComposerIncremental::AbsorbForests(
+                    const HyperGraph & parse, vector<search::Vertex*> & vertices,
+                    vector<boost::shared_ptr<search::Forest> > & forests,
+                    vector<bool> & added, int id, search::Forest & best) const {
+    if(added[id]) return;
+    added[id] = true;
+    int factor = lm_data_[0]->GetFactor();
+    // Each entry is a vertex being visited, and the edge and word to visit
+    // next. Vertices are absorbed after all of their children
+    vector<pair<int, pair<int,int> > > stack(1, make_pair(id, make_pair(0, 0)));
+    while(stack.size()) {
+        int curr = stack.rbegin()->first;
+        pair<int,int> & pos = stack.rbegin()->second;
+        const vector<HyperEdge*> & edges = parse.GetNode(curr)->GetEdges();
+        if(pos.first == (int)edges.size()) {
+            best.Absorb(*forests[curr]);
+            stack.pop_back();
+            continue;
+        }
+        const vector<WordId> & words = edges[pos.first]->GetTrgData()[factor].words;
+        if(pos.second == (int)words.size()) {
+            pos.first++;
+            pos.second = 0;
+        } else if(words[pos.second] >= 0) {
+            pos.second++;
+        } else {
+            int child = edges[pos.first]->GetTail(-1 - words[pos.second])->GetId();
+            if(!added[child]) {
+                // Come back to this word after the child is finished
+                added[child] = true;
+                stack.push_back(make_pair(child, make_pair(0, 0)));
+            } else if(vertices[child]->Empty()) {
+                // Skip the rest of the edge after an empty child
+                pos.first++;
+                pos.second = 0;
+            } else {
+                pos.second++;
+            }
+        }
+    }
+}
+
+// Score the words of a rule, using the score cache if there is one
+template <class LMType>
+pair<Real,int> LMComposerIncremental::CalcRuleScore(
+                    const Sentence & syms, const vector<lm::WordIndex> & words,
+                    lm::ngram::ChartState * between) const {
+    const LMData* data = lm_data_[0];
+    if(score_cache_.get() == NULL) {
+        search::ScoreRuleRet score = search::ScoreRule(*static_cast<const LMType*>(data->GetLM()), words, between);
+        return make_pair(score.prob, (int)score.oov);
+    }
+    // The score and the states between the non-terminals only depend on the
+    // words of the rule
+    LMScoreCache::KeyRef key(LMScoreCache::INCREMENTAL, data->GetLM(), syms);
+    LMScoreCache::Value val;
+    if(!score_cache_->Find(key, val)) {
+        int num_nts = 0;
+        BOOST_FOREACH(lm::WordIndex index, words)
+            if(index == lm::kMaxWordIndex)
+                num_nts++;
+        search::ScoreRuleRet score = search::ScoreRule(*static_cast<const LMType*>(data->GetLM()), words, between);
+        val.score = score.prob;
+        val.unk = score.oov;
+        val.states.assign(between, between + num_nts + 1);
+        score_cache_->Add(key, val);
+    } else {
+        copy(val.states.begin(), val.states.end(), between);
+    }
+    return make_pair(val.score, val.unk);
+}
+
+// Calculate a single vertex whose children are finished
+template <class LMType>
+search::Vertex* LMComposerIncremental::BuildVertex(
+                    const HyperGraph & parse, vector<search::Vertex*> & vertices,
+                    search::Context<LMType> & context, search::Forest & best,
+                    const LMOutsideEstimates * est, int id) const {
+    // Get the nodes from the parse
+    const vector<HyperNode*> & nodes = parse.GetNodes();
     // For the edges coming from this node, add them to the EdgeGenerator
     search::EdgeGenerator edges;
     int num_edges = 0;
     LMData* data = lm_data_[0];
-    if(id < 0 || id >= (int)nodes.size() || nodes[id] == NULL)
-        THROW_ERROR("Bad id=" << id << " at nodes.size() == " << nodes.size());
     BOOST_FOREACH(const HyperEdge * edge, nodes[id]->GetEdges()) {
         // Create the words
         std::vector<lm::WordIndex> words;
@@ -133,13 +306,15 @@ search::Vertex* LMComposerIncremental::CalculateVertex(
         unsigned long int terminals = 0;
         float below_score = 0.0;
         int unk = 0;
+        // The score of the words calculated when the rule was loaded, if any
+        const RuleLMScore * rule_score = (edge->GetLMScores() ? edge->GetLMScores()->Find(data->GetLM()) : NULL);
         // Iterate over all output words in the target edge
         BOOST_FOREACH(WordId wid, edge->GetTrgData()[data->GetFactor()].words) {
             // Add non-terminal
             if(wid < 0) {
                 words.push_back(lm::kMaxWordIndex);
                 int tid = -1 - wid;
-                Vertex* vertex = CalculateVertex(parse, vertices, context, best, edge->GetTail(tid)->GetId());
+                Vertex* vertex = vertices[edge->GetTail(tid)->GetId()];
                 children.push_back(vertex);
                 if(vertex->Empty()) {
                     below_score = -FLT_MAX;
@@ -147,7 +322,7 @@ search::Vertex* LMComposerIncremental::CalculateVertex(
                 }
                 below_score += children.back()->Bound();
             // Add terminal
-            } else {
+            } else if(rule_score == NULL) {
                 lm::WordIndex index = data->GetMapping(wid);
                 if(index == 0) unk++;
                 words.push_back(index);
@@ -166,9 +341,15 @@ search::Vertex* LMComposerIncremental::CalculateVertex(
             *nt = (*i)->RootAlternate();
 
         // Score the rule
-        search::ScoreRuleRet score = search::ScoreRule(*static_cast<LMType*>(data->GetLM()), words, pedge.Between());
-        pedge.SetScore(below_score + edge->GetScore() + data->GetWeight() * score.prob + data->GetUnkWeight() * score.oov);
-        best.SetLMUnk(edge->GetId(), score.oov);
+        pair<Real,int> score;
+        if(rule_score) {
+            copy(rule_score->between.begin(), rule_score->between.end(), pedge.Between());
+            score = make_pair(rule_score->prob, rule_score->unk);
+        } else {
+            score = CalcRuleScore<LMType>(edge->GetTrgData()[data->GetFactor()].words, words, pedge.Between());
+        }
+        pedge.SetScore(below_score + edge->GetScore() + data->GetWeight() * score.first + data->GetUnkWeight() * score.second);
+        best.SetLMUnk(edge->GetId(), score.second);
 
         // Set the note
         search::Note note;
@@ -180,8 +361,16 @@ search::Vertex* LMComposerIncremental::CalculateVertex(
 
     vertices[id] = new search::Vertex;
     if(!edges.Empty()) {
-        search::VertexGenerator<search::Forest> vertex_gen(context, *vertices[id], best);
-        edges.Search(context, vertex_gen);
+        if(est) {
+            // Search with the pop limit for this vertex
+            const search::Config & config = context.GetConfig();
+            search::Context<LMType> my_context(search::Config(config.LMWeight(), est->ScaleLimit(id, config.PopLimit()), config.GetNBest()), context.LanguageModel());
+            search::VertexGenerator<search::Forest> vertex_gen(my_context, *vertices[id], best);
+            edges.Search(my_context, vertex_gen);
+        } else {
+            search::VertexGenerator<search::Forest> vertex_gen(context, *vertices[id], best);
+            edges.Search(context, vertex_gen);
+        }
     }
     return vertices[id];
 }
@@ -258,11 +447,21 @@ HyperGraph * LMComposerIncremental::TransformGraphTemplate(const HyperGraph & pa
     search::Forest best(data->GetFeatureName(), data->GetWeight(), data->GetUnkFeatureName(), data->GetUnkWeight(), root_sym_, data->GetFactor());
     // search::Forest best(data->GetWeight(), data->GetUnkWeight(), data->GetFactor());
 
+    // Estimate how promising each vertex is
+    boost::scoped_ptr<LMOutsideEstimates> est;
+    if(outside_beam_ > 0) {
+        est.reset(new LMOutsideEstimates);
+        CalcOutsideEstimates(parse, *est);
+    }
+
     // Create the search graph
     vector<search::Vertex*> vertices(parse.NumNodes() + 1);
     for(int i = 0; i < parse.NumNodes(); i++)
         vertices[i] = NULL;
-    vertices[0] = CalculateVertex(parse, vertices, context, best, 0);
+    if(num_threads_ > 1)
+        CalculateVerticesParallel(parse, vertices, context, best, est.get());
+    else
+        vertices[0] = CalculateVertex(parse, vertices, context, best, est.get(), 0);
 
     // Create the final vertex
     CalculateRootVertex(vertices, context, best);
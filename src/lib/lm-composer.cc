@@ -2,14 +2,19 @@
 #include <travatar/dict.h>
 #include <travatar/global-debug.h>
 #include <travatar/string-util.h>
+#include <travatar/hyper-graph.h>
 #include <boost/lexical_cast.hpp>
 #include <boost/foreach.hpp>
+#include <search/rule.hh>
 
 using namespace std;
 using namespace travatar;
 
 void MapEnumerateVocab::Add(lm::WordIndex index, const StringPiece &str) {
-    vocab_map_->insert(std::make_pair(Dict::WID(str.as_string()), index));
+    WordId wid = Dict::WID(str.as_string());
+    if(wid >= (WordId)vocab_map_->size())
+        vocab_map_->resize(wid+1, 0);
+    (*vocab_map_)[wid] = index;
 }
 
 LMData::LMData(void * model, lm::ngram::ModelType type, VocabMap* vocab_map) :
@@ -45,9 +50,56 @@ LMData::~LMData() {
     if(vocab_map_) delete vocab_map_;
 }
 
-lm::WordIndex LMData::GetMapping(WordId wid) const {
-    VocabMap::const_iterator it = vocab_map_->find(wid);
-    return it == vocab_map_->end() ? 0 : it->second;
+float LMData::ScoreRule(const vector<lm::WordIndex> & words, lm::ngram::ChartState * between, int & unk) const {
+    search::ScoreRuleRet ret;
+    switch(type_) {
+    case lm::ngram::PROBING:
+        ret = search::ScoreRule(*static_cast<const lm::ngram::ProbingModel*>(lm_), words, between);
+        break;
+    case lm::ngram::REST_PROBING:
+        ret = search::ScoreRule(*static_cast<const lm::ngram::RestProbingModel*>(lm_), words, between);
+        break;
+    case lm::ngram::TRIE:
+        ret = search::ScoreRule(*static_cast<const lm::ngram::TrieModel*>(lm_), words, between);
+        break;
+    case lm::ngram::QUANT_TRIE:
+        ret = search::ScoreRule(*static_cast<const lm::ngram::QuantTrieModel*>(lm_), words, between);
+        break;
+    case lm::ngram::ARRAY_TRIE:
+        ret = search::ScoreRule(*static_cast<const lm::ngram::ArrayTrieModel*>(lm_), words, between);
+        break;
+    case lm::ngram::QUANT_ARRAY_TRIE:
+        ret = search::ScoreRule(*static_cast<const lm::ngram::QuantArrayTrieModel*>(lm_), words, between);
+        break;
+    default:
+        THROW_ERROR("Unrecognized kenlm model type " << type_);
+    }
+    unk += ret.oov;
+    return ret.prob;
+}
+
+void LMRulePreparer::Prepare(TranslationRule & rule) const {
+    boost::shared_ptr<RuleLMScores> lm_scores(new RuleLMScores);
+    lm_scores->scores.resize(lm_data_.size());
+    for(int i = 0; i < (int)lm_data_.size(); i++) {
+        const LMData * data = lm_data_[i];
+        RuleLMScore & score = lm_scores->scores[i];
+        score.lm = data->GetLM();
+        // Map the words, with non-terminals marked for ScoreRule
+        vector<lm::WordIndex> words;
+        int num_nts = 0;
+        BOOST_FOREACH(WordId wid, rule.GetTrgData()[data->GetFactor()].words) {
+            if(wid < 0) {
+                words.push_back(search::kNonTerminal);
+                num_nts++;
+            } else {
+                words.push_back(data->GetMapping(wid));
+            }
+        }
+        score.between.resize(num_nts+1);
+        score.prob = data->ScoreRule(words, &score.between[0], score.unk);
+    }
+    rule.SetLMScores(lm_scores);
 }
 
 LMData::LMData(const std::string & str) : 
@@ -106,7 +158,7 @@ LMData::LMData(const std::string & str) :
     vocab_map_ = lm_save.GetAndFreeVocabMap();    
 }
 
-LMComposer::LMComposer(const std::vector<std::string> & params) : lm_data_(), root_sym_(Dict::WID("LMROOT")) {
+LMComposer::LMComposer(const std::vector<std::string> & params) : lm_data_(), root_sym_(Dict::WID("LMROOT")), outside_beam_(0) {
     BOOST_FOREACH(const std::string & param, params) {
         lm_data_.push_back(new LMData(param));
     }
@@ -125,3 +177,42 @@ void LMComposer::UpdateWeights(const SparseMap & weights) {
         data->SetUnkWeight(it2 != weights.end() ? it2->second : 0);
     }
 }
+
+Real LMComposer::CalcRuleLMEstimate(const HyperEdge * edge) const {
+    Real ret = 0;
+    BOOST_FOREACH(const LMData * data, lm_data_) {
+        const RuleLMScore * rule_score = (edge->GetLMScores() ? edge->GetLMScores()->Find(data->GetLM()) : NULL);
+        if(rule_score != NULL) {
+            ret += rule_score->prob * data->GetWeight() + rule_score->unk * data->GetUnkWeight();
+            continue;
+        }
+        vector<lm::WordIndex> words;
+        BOOST_FOREACH(WordId wid, edge->GetTrgData()[data->GetFactor()].words)
+            words.push_back(wid < 0 ? search::kNonTerminal : data->GetMapping(wid));
+        vector<lm::ngram::ChartState> between(words.size()+1);
+        int unk = 0;
+        Real prob = data->ScoreRule(words, &between[0], unk);
+        ret += prob * data->GetWeight() + unk * data->GetUnkWeight();
+    }
+    return ret;
+}
+
+void LMComposer::CalcOutsideEstimates(const HyperGraph & parse, LMOutsideEstimates & est) const {
+    // Find the estimated score of each edge
+    est.edge_lm.assign(parse.NumEdges(), 0);
+    vector<Real> edge_scores(parse.NumEdges());
+    BOOST_FOREACH(const HyperEdge * edge, parse.GetEdges()) {
+        est.edge_lm[edge->GetId()] = CalcRuleLMEstimate(edge);
+        edge_scores[edge->GetId()] = edge->GetScore() + est.edge_lm[edge->GetId()];
+    }
+    // Compare the best derivation through each node with the best overall
+    vector<Real> inside, outside;
+    parse.CalcViterbiInsideOutside(edge_scores, inside, outside);
+    est.scale.assign(parse.NumNodes(), 0);
+    if(parse.NumNodes() == 0 || inside[0] == -REAL_MAX) return;
+    for(int i = 0; i < parse.NumNodes(); i++) {
+        if(inside[i] == -REAL_MAX || outside[i] == -REAL_MAX) continue;
+        Real diff = inside[0] - (inside[i] + outside[i]);
+        est.scale[i] = max((Real)0, 1 - diff / outside_beam_);
+    }
+}
@@ -0,0 +1,164 @@
+#include <travatar/lm-score-cache.h>
+#include <travatar/global-debug.h>
+#include <boost/functional/hash.hpp>
+#include <boost/foreach.hpp>
+
+using namespace travatar;
+using namespace std;
+using namespace boost;
+
+size_t LMScoreCache::KeyHash::operator()(const KeyRef & key) const {
+    size_t hash = boost::hash<const void*>()(key.lm);
+    boost::hash_combine(hash, (int)key.kind);
+    BOOST_FOREACH(WordId wid, *key.words)
+        boost::hash_combine(hash, wid);
+    for(int i = 0; i < key.NumStates(); i++)
+        boost::hash_combine(hash, lm::ngram::hash_value(key.GetState(i)));
+    return hash;
+}
+
+LMScoreCache::Key LMScoreCache::KeyRef::ToKey() const {
+    Key ret;
+    ret.kind = kind;
+    ret.lm = lm;
+    ret.words = *words;
+    ret.states.resize(NumStates());
+    for(int i = 0; i < (int)ret.states.size(); i++)
+        ret.states[i] = GetState(i);
+    return ret;
+}
+
+namespace {
+
+// Compare a KeyRef to the keys in the map
+struct KeyRefEqual {
+    bool operator()(const LMScoreCache::KeyRef & lhs, const LMScoreCache::Key & rhs) const {
+        if(lhs.kind != rhs.kind || lhs.lm != rhs.lm || *lhs.words != rhs.words || lhs.NumStates() != (int)rhs.states.size())
+            return false;
+        for(int i = 0; i < (int)rhs.states.size(); i++)
+            if(!(lhs.GetState(i) == rhs.states[i]))
+                return false;
+        return true;
+    }
+};
+
+// Return a hash that was already calculated for the key
+struct FixedHash {
+    FixedHash(size_t hash) : hash_(hash) { }
+    size_t operator()(const LMScoreCache::KeyRef & key) const { return hash_; }
+    size_t hash_;
+};
+
+}
+
+LMScoreCache::LMScoreCache(size_t max_bytes, int num_shards) :
+        max_bytes_(max_bytes), shard_bytes_(max_bytes / num_shards) {
+    if(num_shards <= 0)
+        THROW_ERROR("LMScoreCache must have at least one shard");
+    for(int i = 0; i < num_shards; i++)
+        shards_.push_back(boost::shared_ptr<Shard>(new Shard));
+}
+
+size_t LMScoreCache::EntryBytes(const Key & key, const Value & value) {
+    // The key and value, their vectors, and the node and bucket of the map
+    return sizeof(Key) + sizeof(Value) + 4 * sizeof(void*)
+           + key.words.size() * sizeof(WordId)
+           + (key.states.size() + value.states.size()) * sizeof(lm::ngram::ChartState);
+}
+
+bool LMScoreCache::Find(const KeyRef & key, Value & value) {
+    size_t hash = KeyHash()(key);
+    Shard & shard = GetShard(hash);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    EntryMap::iterator it = shard.curr.find(key, FixedHash(hash), KeyRefEqual());
+    if(it != shard.curr.end()) {
+        value = it->second;
+        shard.hits++;
+        return true;
+    }
+    it = shard.prev.find(key, FixedHash(hash), KeyRefEqual());
+    if(it != shard.prev.end()) {
+        value = it->second;
+        shard.hits++;
+        // Move the entry to the newer generation, as it is still in use
+        EntryMap::value_type entry(*it);
+        shard.prev.erase(it);
+        AddLocked(shard, entry);
+        return true;
+    }
+    shard.misses++;
+    return false;
+}
+
+void LMScoreCache::Add(const KeyRef & key, const Value & value) {
+    size_t hash = KeyHash()(key);
+    Shard & shard = GetShard(hash);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    if(shard.curr.find(key, FixedHash(hash), KeyRefEqual()) != shard.curr.end())
+        return;
+    // Never keep the same entry in both generations
+    EntryMap::iterator it = shard.prev.find(key, FixedHash(hash), KeyRefEqual());
+    if(it != shard.prev.end())
+        shard.prev.erase(it);
+    AddLocked(shard, EntryMap::value_type(key.ToKey(), value));
+}
+
+void LMScoreCache::AddLocked(Shard & shard, const EntryMap::value_type & entry) {
+    if(!shard.curr.insert(entry).second)
+        return;
+    shard.bytes += EntryBytes(entry.first, entry.second);
+    // Each generation can use half of the shard's budget
+    if(shard.bytes * 2 > shard_bytes_) {
+        shard.prev.swap(shard.curr);
+        shard.curr.clear();
+        shard.bytes = 0;
+    }
+}
+
+void LMScoreCache::Clear() {
+    BOOST_FOREACH(const boost::shared_ptr<Shard> & shard, shards_) {
+        boost::mutex::scoped_lock lock(shard->mutex);
+        shard->curr.clear();
+        shard->prev.clear();
+        shard->bytes = 0;
+        shard->hits = shard->misses = 0;
+    }
+}
+
+long LMScoreCache::GetHits() const {
+    long ret = 0;
+    BOOST_FOREACH(const boost::shared_ptr<Shard> & shard, shards_) {
+        boost::mutex::scoped_lock lock(shard->mutex);
+        ret += shard->hits;
+    }
+    return ret;
+}
+
+long LMScoreCache::GetMisses() const {
+    long ret = 0;
+    BOOST_FOREACH(const boost::shared_ptr<Shard> & shard, shards_) {
+        boost::mutex::scoped_lock lock(shard->mutex);
+        ret += shard->misses;
+    }
+    return ret;
+}
+
+long LMScoreCache::GetSize() const {
+    long ret = 0;
+    BOOST_FOREACH(const boost::shared_ptr<Shard> & shard, shards_) {
+        boost::mutex::scoped_lock lock(shard->mutex);
+        ret += shard->curr.size() + shard->prev.size();
+    }
+    return ret;
+}
+
+size_t LMScoreCache::GetBytes() const {
+    size_t ret = 0;
+    BOOST_FOREACH(const boost::shared_ptr<Shard> & shard, shards_) {
+        boost::mutex::scoped_lock lock(shard->mutex);
+        ret += shard->bytes;
+        BOOST_FOREACH(const EntryMap::value_type & val, shard->prev)
+            ret += EntryBytes(val.first, val.second);
+    }
+    return ret;
+}
@@ -4,10 +4,16 @@
 #include <travatar/string-util.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/lookup-table-fsm.h>
+#include <travatar/rule-table-limit.h>
 #include <travatar/sentence.h>
 #include <travatar/input-file-stream.h>
+#include <travatar/io-util.h>
+#include <travatar/thread-pool.h>
+#include <travatar/task.h>
 #include <boost/foreach.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <sstream>
+#include <cstring>
 
 using namespace travatar;
 using namespace std;
@@ -28,6 +34,74 @@ inline string PrintState(const string & str) {
     return oss.str();
 }
 
+// The layout of a binary RuleFSM image is
+//  header | payload | unaries | vocabulary | index | trie
+// The trie keys are created by CreateKey over image-local word IDs, so
+// input words are converted with MapWord before they are searched.
+#define FSM_BIN_MAGIC "TRVFSM01"
+
+struct FsmBinHeader {
+    char magic[8];
+    uint64_t num_vocab, vocab_offset;
+    uint64_t num_keys, index_offset;
+    uint64_t payload_offset, unary_offset;
+    uint64_t trie_offset, trie_size;
+};
+
+inline WordId LocalId(WordId wid, unordered_map<WordId,WordId> & ids, vector<WordId> & vocab) {
+    if(wid < 0) return wid;
+    unordered_map<WordId,WordId>::const_iterator it = ids.find(wid);
+    if(it != ids.end()) return it->second;
+    WordId ret = vocab.size();
+    ids.insert(make_pair(wid, ret));
+    vocab.push_back(wid);
+    return ret;
+}
+
+inline CfgData LocalCfgData(const CfgData & data, unordered_map<WordId,WordId> & ids, vector<WordId> & vocab) {
+    CfgData ret(data);
+    ret.label = LocalId(ret.label, ids, vocab);
+    BOOST_FOREACH(WordId & wid, ret.words)
+        wid = LocalId(wid, ids, vocab);
+    BOOST_FOREACH(WordId & wid, ret.syms)
+        wid = LocalId(wid, ids, vocab);
+    return ret;
+}
+
+inline void WriteLabels(ostream & out, const vector<WordId> & labels) {
+    IoUtil::WriteBinary(out, (uint32_t)labels.size());
+    BOOST_FOREACH(WordId wid, labels)
+        IoUtil::WriteBinary(out, (int32_t)wid);
+}
+
+inline void ReadLabels(const char * & ptr, vector<WordId> & labels, const vector<WordId> & vocab) {
+    labels.resize(IoUtil::ReadBinary<uint32_t>(ptr));
+    BOOST_FOREACH(WordId & wid, labels) {
+        int32_t val = IoUtil::ReadBinary<int32_t>(ptr);
+        wid = (val < 0 ? val : vocab[val]);
+    }
+}
+
+// A rule of the key being compiled, with the source in local IDs
+struct CompileRule {
+    CfgData src;
+    vector<CfgData> trg;
+    SparseVector features;
+};
+
+inline void WriteCfgData(ostream & out, const CfgData & data) {
+    IoUtil::WriteBinary(out, (int32_t)data.label);
+    WriteLabels(out, data.words);
+    WriteLabels(out, data.syms);
+}
+
+inline void ReadCfgData(const char * & ptr, CfgData & data, const vector<WordId> & vocab) {
+    int32_t label = IoUtil::ReadBinary<int32_t>(ptr);
+    data.label = (label < 0 ? label : vocab[label]);
+    ReadLabels(ptr, data.words, vocab);
+    ReadLabels(ptr, data.syms, vocab);
+}
+
 ///////////////////////////////////
 ///     LOOK UP TABLE FSM        //
 ///////////////////////////////////
@@ -36,7 +110,7 @@ LookupTableFSM::LookupTableFSM() : rule_fsms_(),
                    trg_factors_(1),
                    root_symbol_(HieroHeadLabels(vector<WordId>(GlobalVars::trg_factors+1,Dict::WID("S")))),
                    unk_symbol_(HieroHeadLabels(vector<WordId>(GlobalVars::trg_factors+1,Dict::WID("X")))),
-                   save_src_str_(false) { }
+                   save_src_str_(false), num_threads_(1) { }
 
 LookupTableFSM::~LookupTableFSM() {
     BOOST_FOREACH(RuleFSM* rule_fsm, rule_fsms_) {
@@ -45,6 +119,9 @@ LookupTableFSM::~LookupTableFSM() {
     }
 }
 
+RuleFSM::RuleFSM() : span_length_(20), save_src_str_(false),
+                     offsets_(NULL), payload_(NULL) { }
+
 RuleFSM::~RuleFSM() {
     BOOST_FOREACH(RuleVec & vec, rules_)
         BOOST_FOREACH(TranslationRuleHiero * rule, vec)
@@ -79,7 +156,7 @@ RuleFSM * RuleFSM::ReadFromRuleTable(istream & in) {
     RuleMap rules;
 
     while(getline(in, line)) {
-        vector<string> columns = Tokenize(line, " ||| ");;
+        vector<string> columns = Tokenize(line, " ||| ");
         if(columns.size() < 3)
             THROW_ERROR("Wrong number of columns in rule table, expected at least 3 but got "<<columns.size()<<": " << endl << line);
         CfgData src_data = Dict::ParseAnnotatedWords(columns[0]);
@@ -108,6 +185,25 @@ RuleFSM * RuleFSM::ReadFromRuleTable(istream & in) {
         keyset.push_back(rule.first.c_str(), rule.first.length());
 
     // Expand unary values
+    ExpandUnaries(unaries);
+    // Compile the marisa trie
+    ret->GetTrie().build(keyset);
+    // Insert the rule arrays into the appropriate position based on the tree ID
+    RuleSet & main_rules = ret->GetRules();
+    main_rules.resize(keyset.size());
+    BOOST_FOREACH(RuleMap::value_type & rule, rules) {
+        marisa::Agent agent;
+        agent.set_query(rule.first.c_str(), rule.first.length());
+        if(!ret->GetTrie().lookup(agent))
+            THROW_ERROR("Internal error when building rule table");
+        main_rules[agent.key().id()].swap(rule.second);
+        // BOOST_FOREACH(TranslationRuleHiero * hier, main_rules[agent.key().id()])
+        //     cerr << "RULE: " << PrintState(rule.first) << " @ "<<agent.key().id()<<": " << *hier << endl;
+    }
+    return ret;
+}
+
+void RuleFSM::ExpandUnaries(UnaryMap & unaries) {
     bool added = true;
     while(added) {
         added = false;
@@ -118,33 +214,272 @@ RuleFSM * RuleFSM::ReadFromRuleTable(istream & in) {
                 UnaryMap::iterator it = unaries.find(target);
                 if(it != unaries.end()) {
                     BOOST_FOREACH(HieroHeadLabels second_trg, it->second) {
-                        set<HieroHeadLabels>::iterator it2 = val.second.find(target);
-                        if(it2 == val.second.end()) {
+                        // Don't add a label to its own closure
+                        if(second_trg != val.first && val.second.insert(second_trg).second)
                             added = true;
-                            val.second.insert(second_trg);
-                        } 
                     }
                 }
             }
         }
     }
-    // Compile the marisa trie
-    ret->GetTrie().build(keyset);
-    // Insert the rule arrays into the appropriate position based on the tree ID
-    RuleSet & main_rules = ret->GetRules();
-    main_rules.resize(keyset.size());
-    BOOST_FOREACH(RuleMap::value_type & rule, rules) {
+}
+
+void RuleFSM::CompileRuleTable(istream & in, ostream & out, const RuleTableLimit * limit) {
+    FsmBinHeader header;
+    memset(&header, 0, sizeof(header));
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    header.payload_offset = out.tellp();
+    // Serialize the rules with image-local word IDs. The table is read in
+    // blocks of lines with the same source, and the rules of each block are
+    // written when it ends, so only one block is held in memory at a time
+    unordered_map<WordId,WordId> ids;
+    vector<WordId> vocab;
+    UnaryMap unaries;
+    typedef unordered_map<string, vector<pair<Real, CompileRule> > > RuleMap;
+    RuleMap block;
+    vector<string> block_keys;
+    marisa::Keyset keyset;
+    vector<uint64_t> group_offsets;
+    string line, last_src;
+    while(true) {
+        bool more = !getline(in, line).fail();
+        vector<string> columns;
+        if(more) {
+            columns = Tokenize(line, " ||| ");
+            if(columns.size() < 3)
+                THROW_ERROR("Wrong number of columns in rule table, expected at least 3 but got "<<columns.size()<<": " << endl << line);
+        }
+        // Write the rules of the finished block. Only the rules that are
+        // kept by the limit are given local IDs for their targets and features
+        if(!more || columns[0] != last_src) {
+            BOOST_FOREACH(const string & key, block_keys) {
+                vector<pair<Real, CompileRule> > & rules = block[key];
+                keyset.push_back(key.c_str(), key.length());
+                group_offsets.push_back((uint64_t)out.tellp() - header.payload_offset);
+                if(limit != NULL)
+                    limit->Apply(rules);
+                IoUtil::WriteBinary(out, (uint32_t)rules.size());
+                for(int i = 0; i < (int)rules.size(); i++) {
+                    const CompileRule & rule = rules[i].second;
+                    WriteCfgData(out, rule.src);
+                    IoUtil::WriteBinary(out, (uint32_t)rule.trg.size());
+                    BOOST_FOREACH(const CfgData & trg_datum, rule.trg)
+                        WriteCfgData(out, LocalCfgData(trg_datum, ids, vocab));
+                    IoUtil::WriteBinary(out, (uint32_t)rule.features.size());
+                    BOOST_FOREACH(const SparsePair & feat, rule.features.GetImpl()) {
+                        IoUtil::WriteBinary(out, (int32_t)LocalId(feat.first, ids, vocab));
+                        IoUtil::WriteBinary(out, (double)feat.second);
+                    }
+                }
+            }
+            block.clear();
+            block_keys.clear();
+            if(!more) break;
+            last_src = columns[0];
+        }
+        CfgData src_data = Dict::ParseAnnotatedWords(columns[0]);
+        vector<CfgData> trg_data = Dict::ParseAnnotatedVector(columns[1]);
+        SparseVector features = Dict::ParseSparseVector(columns[2]);
+        TranslationRuleHiero rule(trg_data, features, src_data);
+        if(src_data.syms.size() == 1 && src_data.words.size() == 1)
+            unaries[rule.GetChildHeadLabels(0)].insert(rule.GetHeadLabels());
+        // Sanity check
+        BOOST_FOREACH(const CfgData & trg_datum, trg_data)
+            if(trg_datum.syms.size() != src_data.syms.size())
+                THROW_ERROR("Mismatched number of non-terminals in rule table: " << endl << line);
+        if(src_data.words.size() == 0)
+            THROW_ERROR("Empty sources in a rule are not allowed: " << endl << line);
+        // The key only needs local IDs for the source and the target symbols
+        CfgData src_local = LocalCfgData(src_data, ids, vocab);
+        vector<CfgData> trg_syms(trg_data.size());
+        for(int i = 0; i < (int)trg_data.size(); i++)
+            BOOST_FOREACH(WordId wid, trg_data[i].syms)
+                trg_syms[i].syms.push_back(LocalId(wid, ids, vocab));
+        string key = CreateKey(src_local, trg_syms);
+        RuleMap::iterator it = block.find(key);
+        if(it == block.end()) {
+            it = block.insert(make_pair(key, vector<pair<Real, CompileRule> >())).first;
+            block_keys.push_back(key);
+        }
+        it->second.push_back(make_pair(limit != NULL ? limit->Score(features) : 0, CompileRule()));
+        CompileRule & compiled = it->second.back().second;
+        compiled.src = src_local;
+        compiled.trg.swap(trg_data);
+        compiled.features = features;
+    }
+    ExpandUnaries(unaries);
+    // Write the unary closure
+    IoUtil::PadBinary(out);
+    header.unary_offset = out.tellp();
+    IoUtil::WriteBinary(out, (uint32_t)unaries.size());
+    BOOST_FOREACH(const UnaryMap::value_type & val, unaries) {
+        HieroHeadLabels local(val.first);
+        BOOST_FOREACH(WordId & wid, local) wid = LocalId(wid, ids, vocab);
+        WriteLabels(out, local);
+        IoUtil::WriteBinary(out, (uint32_t)val.second.size());
+        BOOST_FOREACH(HieroHeadLabels labels, val.second) {
+            BOOST_FOREACH(WordId & wid, labels) wid = LocalId(wid, ids, vocab);
+            WriteLabels(out, labels);
+        }
+    }
+    // Write the vocabulary
+    IoUtil::PadBinary(out);
+    header.num_vocab = vocab.size();
+    header.vocab_offset = out.tellp();
+    BOOST_FOREACH(WordId wid, vocab) {
+        const string & str = Dict::WSym(wid);
+        out.write(str.c_str(), str.length()+1);
+    }
+    // Build the trie and write the index in key ID order
+    marisa::Trie trie;
+    trie.build(keyset);
+    // A key that was written in more than one block has been merged by the
+    // trie, so the keyset does not need a second copy to check for this
+    if(trie.num_keys() != keyset.size())
+        THROW_ERROR("Rules with the same source must be on consecutive lines of the rule table (sort it first)");
+    vector<uint64_t> index(trie.num_keys(), 0);
+    for(size_t i = 0; i < group_offsets.size(); i++) {
         marisa::Agent agent;
-        agent.set_query(rule.first.c_str(), rule.first.length());
-        if(!ret->GetTrie().lookup(agent))
+        agent.set_query(keyset[i].ptr(), keyset[i].length());
+        if(!trie.lookup(agent))
             THROW_ERROR("Internal error when building rule table");
-        main_rules[agent.key().id()].swap(rule.second);
-        // BOOST_FOREACH(TranslationRuleHiero * hier, main_rules[agent.key().id()])
-        //     cerr << "RULE: " << PrintState(rule.first) << " @ "<<agent.key().id()<<": " << *hier << endl;
+        index[agent.key().id()] = group_offsets[i];
+    }
+    IoUtil::PadBinary(out);
+    header.num_keys = index.size();
+    header.index_offset = out.tellp();
+    BOOST_FOREACH(uint64_t offset, index)
+        IoUtil::WriteBinary(out, offset);
+    // Write the trie
+    IoUtil::PadBinary(out);
+    header.trie_offset = out.tellp();
+    header.trie_size = trie.io_size();
+    marisa::write(out, trie);
+    // Go back and fill in the header
+    memcpy(header.magic, FSM_BIN_MAGIC, 8);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.flush();
+    if(!out)
+        THROW_ERROR("Failed to write the compiled rule table");
+}
+
+RuleFSM * RuleFSM::ReadFromBinaryFile(const std::string & filename) {
+    RuleFSM * ret = new RuleFSM;
+    try {
+        ret->mapped_.reset(new iostreams::mapped_file_source(filename));
+    } catch(std::exception & e) {
+        delete ret;
+        THROW_ERROR("Could not map binary TM: " << filename);
+    }
+    const char * base = ret->mapped_->data();
+    size_t size = ret->mapped_->size();
+    FsmBinHeader header;
+    if(size < sizeof(header)) { delete ret; THROW_ERROR("Binary TM is truncated: " << filename); }
+    memcpy(&header, base, sizeof(header));
+    if(memcmp(header.magic, FSM_BIN_MAGIC, 8) ||
+       header.trie_offset + header.trie_size > size ||
+       header.index_offset + header.num_keys * sizeof(uint64_t) > size) {
+        delete ret;
+        THROW_ERROR("Not a valid binary TM: " << filename);
+    }
+    // Map the vocabulary into the dictionary
+    const char * ptr = base + header.vocab_offset;
+    ret->vocab_.resize(header.num_vocab);
+    for(uint64_t i = 0; i < header.num_vocab; i++) {
+        size_t len = strlen(ptr);
+        ret->vocab_[i] = Dict::WID(string(ptr, len));
+        ret->local_ids_[ret->vocab_[i]] = i;
+        ptr += len + 1;
     }
+    // Read the unary closure
+    ptr = base + header.unary_offset;
+    uint32_t num_unaries = IoUtil::ReadBinary<uint32_t>(ptr);
+    for(uint32_t i = 0; i < num_unaries; i++) {
+        HieroHeadLabels child;
+        ReadLabels(ptr, child, ret->vocab_);
+        set<HieroHeadLabels> & heads = ret->unaries_[child];
+        uint32_t num_heads = IoUtil::ReadBinary<uint32_t>(ptr);
+        for(uint32_t j = 0; j < num_heads; j++) {
+            HieroHeadLabels head;
+            ReadLabels(ptr, head, ret->vocab_);
+            heads.insert(head);
+        }
+    }
+    // Images written before the closure was fully expanded still work
+    ExpandUnaries(ret->unaries_);
+    ret->offsets_ = reinterpret_cast<const uint64_t*>(base + header.index_offset);
+    ret->payload_ = base + header.payload_offset;
+    try {
+        ret->trie_.map(base + header.trie_offset, header.trie_size);
+    } catch(marisa::Exception & e) {
+        delete ret;
+        THROW_ERROR("Could not read trie in binary TM " << filename << ": " << e.what());
+    }
+    ret->rules_.resize(header.num_keys);
     return ret;
 }
 
+void RuleFSM::DecodeRules(size_t id, RuleVec & rules) const {
+    const char * ptr = payload_ + offsets_[id];
+    uint32_t num_rules = IoUtil::ReadBinary<uint32_t>(ptr);
+    rules.reserve(num_rules);
+    for(uint32_t i = 0; i < num_rules; i++) {
+        CfgData src_data;
+        ReadCfgData(ptr, src_data, vocab_);
+        CfgDataVector trg_data(IoUtil::ReadBinary<uint32_t>(ptr));
+        BOOST_FOREACH(CfgData & trg_datum, trg_data)
+            ReadCfgData(ptr, trg_datum, vocab_);
+        vector<SparsePair> features(IoUtil::ReadBinary<uint32_t>(ptr));
+        BOOST_FOREACH(SparsePair & feat, features) {
+            feat.first = vocab_[IoUtil::ReadBinary<int32_t>(ptr)];
+            feat.second = IoUtil::ReadBinary<double>(ptr);
+        }
+        rules.push_back(new TranslationRuleHiero(trg_data, SparseVector(features), src_data));
+    }
+    if(table_limit_.get() != NULL)
+        table_limit_->ApplyRules(rules);
+    if(preparer_.get() != NULL) {
+        BOOST_FOREACH(TranslationRuleHiero * rule, rules)
+            preparer_->Prepare(*rule);
+    }
+}
+
+void RuleFSM::SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer) {
+    preparer_ = preparer;
+    BOOST_FOREACH(RuleVec & vec, rules_)
+        BOOST_FOREACH(TranslationRuleHiero * rule, vec)
+            preparer->Prepare(*rule);
+}
+
+void RuleFSM::SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit) {
+    table_limit_ = limit;
+    // Rules of a mapped image that are decoded later are limited in DecodeRules
+    BOOST_FOREACH(RuleVec & vec, rules_)
+        limit->ApplyRules(vec);
+}
+
+const RuleFSM::RuleVec & RuleFSM::FindRules(size_t id) const {
+    if(mapped_.get()) {
+        {
+            boost::shared_lock<boost::shared_mutex> lock(rules_mutex_);
+            if(rules_[id].size()) return rules_[id];
+        }
+        // Decode outside of the lock, and discard our copy if another
+        // thread got there first
+        RuleVec decoded;
+        DecodeRules(id, decoded);
+        boost::unique_lock<boost::shared_mutex> lock(rules_mutex_);
+        if(rules_[id].size()) {
+            BOOST_FOREACH(TranslationRuleHiero * rule, decoded)
+                delete rule;
+        } else {
+            rules_[id].swap(decoded);
+        }
+    }
+    return rules_[id];
+}
+
 #define VALID_NODE 99999999
 
 HyperGraph * LookupTableFSM::TransformGraph(const HyperGraph & graph) const {
@@ -153,48 +488,48 @@ HyperGraph * LookupTableFSM::TransformGraph(const HyperGraph & graph) const {
     Sentence sent = graph.GetWords();
     _graph->SetWords(sent);
 
-    HieroRuleSpans span = HieroRuleSpans();
-    HieroNodeMap node_map = HieroNodeMap();
-    EdgeList edge_list = EdgeList(); 
-    // For each starting point
-    for(int i = sent.size()-1; i >= 0; i--) {
+    int length = sent.size();
+    if(length == 0) {
+        delete _graph;
+        return new HyperGraph;
+    }
+
+    HieroRuleSpans span;
+    string key;
+    marisa::Agent agent;
+    HieroNodeMap node_map(length);
+    HieroMatches matches;
+    // For each starting point, parse the rules starting there. All nodes
+    // that start later are already complete
+    for(int i = length-1; i >= 0; i--) {
         // Add a size 0 node for unknown words
         LookupTableFSM::FindNode(node_map, i, i+1, unk_symbol_);
         // For each grammar, add rules
         BOOST_FOREACH(RuleFSM* rule_fsm, rule_fsms_)
-            rule_fsm->BuildHyperGraphComponent(node_map, edge_list, sent, "", i, span);
+            rule_fsm->BuildHyperGraphComponent(node_map, matches, sent, key, i, span, agent);
     }
+    EdgeList edge_list;
+    BuildMatchEdges(matches, node_map, edge_list);
 
     // Add rules for unknown words
     vector<TailSpanKey> temp_spans;
-    BOOST_FOREACH(HieroNodeMap::value_type & val, node_map) {
-        BOOST_FOREACH(HeadNodePairs::value_type & head_node, val.second) {
+    for(int i = 0; i < length; i++) {
+        BOOST_FOREACH(HeadNodePairs::value_type & head_node, node_map.Get(i, i+1)) {
             HyperNode* node = head_node.second;
-            pair<int,int> node_span = node->GetSpan();
-            if (node_span.second - node_span.first == 1) {
-                int i = node_span.first;
-                if(node->GetEdges().size() == 0) {
-                    TranslationRuleHiero* unk_rule = GetUnknownRule(delete_unknown_? Dict::WID("") : sent[i], head_node.first);
-                    HyperEdge* unk_edge = LookupTableFSM::TransformRuleIntoEdge(node_map,i,i+1,temp_spans,unk_rule,save_src_str_);
-                    edge_list.push_back(unk_edge);
-                    delete unk_rule;
-                } 
-            }
+            if(node->GetEdges().size() == 0) {
+                TranslationRuleHiero* unk_rule = GetUnknownRule(delete_unknown_? Dict::WID("") : sent[i], head_node.first);
+                HyperEdge* unk_edge = LookupTableFSM::TransformRuleIntoEdge(node_map,i,i+1,temp_spans,unk_rule,save_src_str_);
+                edge_list.push_back(unk_edge);
+                delete unk_rule;
+            } 
         }
     }
 
     // Find the root node
     HyperNode * root_node = NULL;
-    HieroNodeMap::iterator big_span_node = node_map.find(make_pair(0,(int)sent.size()));
-    if(big_span_node != node_map.end()) {
-        HieroHeadLabels root_sym = GetRootSymbol();
-        BOOST_FOREACH(HeadNodePairs::value_type & hnp, big_span_node->second) {
-            if(hnp.first == root_sym) {
-                root_node = hnp.second;
-                break;
-            }
-        }
-    }
+    HeadNodePairs::iterator root_it = node_map.Get(0, length).find(GetRootSymbol());
+    if(root_it != node_map.Get(0, length).end())
+        root_node = root_it->second;
 
     // If the node is not found, delete and return an empty graph
     if(root_node == NULL) {
@@ -202,9 +537,11 @@ HyperGraph * LookupTableFSM::TransformGraph(const HyperGraph & graph) const {
         BOOST_FOREACH (HyperEdge* edges, edge_list) 
             if(edges)
                 delete edges;
-        BOOST_FOREACH(HieroNodeMap::value_type nodes, node_map)
-            BOOST_FOREACH(HeadNodePairs::value_type & hnp, nodes.second)
-                delete hnp.second;
+        for(int i = 0; i < length; i++)
+            for(int j = i+1; j <= length; j++)
+                BOOST_FOREACH(HeadNodePairs::value_type & hnp, node_map.Get(i, j))
+                    delete hnp.second;
+        delete _graph;
         return new HyperGraph;
     } else {
         // Deleting nodes that are unreachable from root node
@@ -225,15 +562,14 @@ HyperGraph * LookupTableFSM::TransformGraph(const HyperGraph & graph) const {
             }
         }
         // Delete the edges that are unreachable from root
-        EdgeList::iterator it = edge_list.begin();
-        while(it != edge_list.end()) {
-            if ((*it)->GetId() != VALID_NODE) {
-                delete *it;
-                it = edge_list.erase(it);
-            } else {
-                ++it;
-            }
+        EdgeList::iterator out = edge_list.begin();
+        BOOST_FOREACH(HyperEdge* edge, edge_list) {
+            if (edge->GetId() != VALID_NODE)
+                delete edge;
+            else
+                *out++ = edge;
         }
+        edge_list.erase(out, edge_list.end());
 
         // // Delete the nodes that are unreachable from root
         // HieroNodeMap::iterator itr = node_map.begin();
@@ -253,13 +589,15 @@ HyperGraph * LookupTableFSM::TransformGraph(const HyperGraph & graph) const {
     }
 
     // Add the rest of the nodes
-    BOOST_FOREACH (HieroNodeMap::value_type nodes, node_map) {
-        BOOST_FOREACH(HeadNodePairs::value_type & head_node, nodes.second) {
-            if(head_node.second->GetId() == VALID_NODE) {
-                head_node.second->SetId(-1);
-                _graph->AddNode(head_node.second);
-            } else if (head_node.second != root_node) {
-                delete head_node.second;
+    for(int i = 0; i < length; i++) {
+        for(int j = i+1; j <= length; j++) {
+            BOOST_FOREACH(HeadNodePairs::value_type & head_node, node_map.Get(i, j)) {
+                if(head_node.second->GetId() == VALID_NODE) {
+                    head_node.second->SetId(-1);
+                    _graph->AddNode(head_node.second);
+                } else if (head_node.second != root_node) {
+                    delete head_node.second;
+                }
             }
         }
     }
@@ -276,99 +614,98 @@ HyperGraph * LookupTableFSM::TransformGraph(const HyperGraph & graph) const {
     return _graph;
 }
 
+bool RuleFSM::MatchKey(const string & key, const HieroRuleSpans & spans,
+                       HieroNodeMap & node_map, HieroMatches & matches,
+                       marisa::Agent & agent) const {
+    // Search for keys that start with this one. If the key itself is in the
+    // trie, it is always the first result, and the next result tells
+    // whether there are longer keys
+    agent.set_query(key.c_str(), key.length());
+    if(!trie_.predictive_search(agent))
+        return false;
+    if(agent.key().length() != key.length())
+        return true;
+    const RuleVec & rules = FindRules(agent.key().id());
+    if(rules.size()) {
+        // Only the head nodes are needed to continue parsing
+        HieroMatch match;
+        match.spans_begin = matches.spans.size();
+        matches.spans.insert(matches.spans.end(), spans.begin(), spans.end());
+        match.spans_end = matches.spans.size();
+        match.save_src_str = save_src_str_;
+        BOOST_FOREACH(TranslationRuleHiero* rule, rules) {
+            match.rule = rule;
+            match.head = LookupTableFSM::FindNode(node_map, spans[0].first, spans.rbegin()->second, rule->GetHeadLabels());
+            matches.rules.push_back(match);
+        }
+    }
+    return trie_.predictive_search(agent);
+}
+
+void RuleFSM::ExpandUnaryNodes(HieroNodeMap & node_map, int begin, int end) const {
+    HeadNodePairs * cell = node_map.Find(begin, end);
+    if(cell == NULL) return;
+    // unaries_ is a closure, so a single pass over the current labels adds
+    // every reachable label
+    vector<HieroHeadLabels> labels;
+    BOOST_FOREACH(const HeadNodePairs::value_type & head_node, *cell)
+        labels.push_back(head_node.first);
+    BOOST_FOREACH(const HieroHeadLabels & label, labels) {
+        UnaryMap::const_iterator it = unaries_.find(label);
+        if(it != unaries_.end()) {
+            BOOST_FOREACH(const HieroHeadLabels & head_label, it->second)
+                LookupTableFSM::FindNode(node_map, begin, end, head_label);
+        }
+    }
+}
+
 void RuleFSM::BuildHyperGraphComponent(
         HieroNodeMap & node_map, 
-        EdgeList & edge_list, 
+        HieroMatches & matches, 
         const Sentence & input,
-        const string & state,
+        string & key,
         int position, 
-        HieroRuleSpans & spans) const {
+        HieroRuleSpans & spans,
+        marisa::Agent & agent) const {
     if (position >= (int)input.size())
         return;
+    size_t key_length = key.length();
 
     // First, match single words
-    string next_state = state;
-    next_state.append((char*)&input[position], sizeof(WordId));
-    marisa::Agent agent;
-    agent.set_query(next_state.c_str(), next_state.length());
-    // Update the spans
-    HieroRuleSpans rule_span_next = HieroRuleSpans(spans);
-    pair<int,int> span = make_pair(position,position+1);
-    rule_span_next.push_back(span);
-    // cerr << " Searching word " <<  PrintState(state) << "->" << PrintState(next_state) << endl;
-    if(trie_.predictive_search(agent)) {
-        // cerr << " FOUND WORD " <<  PrintState(state) << "->" << PrintState(next_state) << endl;
-        // If this exactly matched a rule add the rules
-        marisa::Agent agent_exact;
-        agent_exact.set_query(next_state.c_str(), next_state.length());
-        if(trie_.lookup(agent_exact)) {
-            BOOST_FOREACH(TranslationRuleHiero* rule, rules_[agent_exact.key().id()]) {
-                // cerr << "Matched word for "<<PrintState(next_state)<<" == "<<PrintState(string(agent_exact.key().ptr(), agent_exact.key().length()))<<": " << *rule << endl;
-                edge_list.push_back(LookupTableFSM::TransformRuleIntoEdge(rule, rule_span_next, node_map, save_src_str_));
-            }
-        }
-        // Recurse to match the following rules
-        BuildHyperGraphComponent(node_map, edge_list, input, next_state, position+1, rule_span_next);
+    WordId wid = input[position];
+    if(MapWord(wid)) {
+        key.append((char*)&wid, sizeof(WordId));
+        spans.push_back(make_pair(position,position+1));
+        // If this is the prefix of a rule, recurse to match the following symbols
+        if(MatchKey(key, spans, node_map, matches, agent))
+            BuildHyperGraphComponent(node_map, matches, input, key, position+1, spans, agent);
+        spans.pop_back();
+        key.resize(key_length);
     }
 
     // Continue until the end of the sentence or the max span length
     int until = min((int)input.size(), position+span_length_);
     for(int next_pos = position+1; next_pos <= until; next_pos++) {
-        pair<int,int> span(position,next_pos);
         // If this is the root, ensure unary nodes are expanded
-        if(state.length() == 0) {
-            set<HieroHeadLabels> next_set;
-            int last_size;
-            do {
-                last_size = next_set.size();
-                BOOST_FOREACH(const UnaryMap::value_type & val, unaries_) {
-                    HieroNodeMap::iterator it = node_map.find(span);
-                    if(it != node_map.end()) {
-                        if(it->second.find(val.first) != it->second.end()) {
-                            BOOST_FOREACH(HieroHeadLabels child_lab, val.second) {
-                                next_set.insert(child_lab);
-                                LookupTableFSM::FindNode(node_map, position, next_pos, child_lab);
-                            }
-                        }
-                    }
-                }
-            } while(last_size != (int)next_set.size());
-        }
+        if(key_length == 0)
+            ExpandUnaryNodes(node_map, position, next_pos);
         // Find nodes that match the current span
-        HieroNodeMap::iterator node_it = node_map.find(span);
-        if(node_it == node_map.end()) continue;
+        HeadNodePairs * cell = node_map.Find(position, next_pos);
+        if(cell == NULL) continue;
         // Build every node
-        HieroRuleSpans rule_span_next = HieroRuleSpans(spans);
-        rule_span_next.push_back(span);
-        BOOST_FOREACH(const HeadNodePairs::value_type & heads_node, node_it->second) {
-            vector<WordId> sym(heads_node.first);
-            BOOST_FOREACH(WordId & wid, sym)
-                wid = -1-wid;
-            string next_state = state;
-            next_state.append((char*)&sym[0], sizeof(WordId)*sym.size());
-            marisa::Agent agent;
-            agent.set_query(next_state.c_str(), next_state.length());
-            // cerr << " Searching nonterm " <<  PrintState(state) << "->" << PrintState(next_state) << endl;
-            if(trie_.predictive_search(agent)) {
-                // cerr << " FOUND NONTERM " <<  PrintState(state) << "->" << PrintState(next_state) << endl;
-                // // TODO: Maybe we need to do something with unks?
-                // if(span.second - span.first == 1 && node_it->second.find(sym) == node_it->second.end()) {
-                //     cerr << "Adding unknown node @ " << span.first << ":" << span.second << ", " << sym << endl;
-                //     LookupTableFSM::FindNode(node_map, span.first, span.second, sym);
-                // }
-                // If this exactly matched a rule add the rules
-                marisa::Agent agent_exact;
-                agent_exact.set_query(next_state.c_str(), next_state.length());
-                if(trie_.lookup(agent_exact)) {
-                    BOOST_FOREACH(TranslationRuleHiero* rule, rules_[agent_exact.key().id()]) {
-                        // cerr << "Matched nonterm: " << *rule << endl;
-                        edge_list.push_back(LookupTableFSM::TransformRuleIntoEdge(rule, rule_span_next, node_map, save_src_str_));
-                    }
-                }
-                // Recurse to match the next node
-                BuildHyperGraphComponent(node_map, edge_list, input, next_state, next_pos, rule_span_next);
+        spans.push_back(make_pair(position,next_pos));
+        BOOST_FOREACH(const HeadNodePairs::value_type & heads_node, *cell) {
+            bool known = true;
+            BOOST_FOREACH(WordId sym, heads_node.first) {
+                if(!MapWord(sym)) { known = false; break; }
+                sym = -1-sym;
+                key.append((char*)&sym, sizeof(WordId));
             }
+            if(known && MatchKey(key, spans, node_map, matches, agent))
+                BuildHyperGraphComponent(node_map, matches, input, key, next_pos, spans, agent);
+            key.resize(key_length);
         }
+        spans.pop_back();
     }
 
 }
@@ -421,37 +758,82 @@ HyperEdge* LookupTableFSM::TransformRuleIntoEdge(HieroNodeMap& node_map,
     return hedge;
 }
 
+HyperEdge* LookupTableFSM::BuildMatchEdge(const HieroMatch & match, const HieroRuleSpans & spans, const HieroNodeMap & node_map) {
+    TranslationRuleHiero * rule = match.rule;
+    HyperEdge* hedge = new HyperEdge;
+    hedge->SetHead(match.head);
+    if (match.save_src_str)
+        hedge->SetSrcStr(Dict::PrintAnnotatedWords(rule->GetSrcData()));
+    hedge->SetRule(rule);
+    // The tails were matched from nodes in the chart, so they only need to be
+    // found, and the chart is not changed
+    vector<int> non_term_position = rule->GetSrcData().GetNontermPositions();
+    for (int i=0 ; i < (int)non_term_position.size(); ++i) {
+        if(non_term_position[i] >= match.spans_end - match.spans_begin)
+            THROW_ERROR("non_term_position[" << i << "] "<<non_term_position[i]<<" >= " << match.spans_end - match.spans_begin);
+        const pair<int,int> & span = spans[match.spans_begin + non_term_position[i]];
+        const HeadNodePairs * cell = node_map.Find(span.first, span.second);
+        HeadNodePairs::const_iterator it;
+        if(cell == NULL || (it = cell->find(rule->GetChildHeadLabels(i))) == cell->end())
+            THROW_ERROR("Could not find the tail of a matched rule at " << span.first << "," << span.second);
+        hedge->AddTail(it->second);
+    }
+    return hedge;
+}
+
+// Builds the edges of a range of matches
+class HieroMatchEdgeTask : public Task {
+public:
+    HieroMatchEdgeTask(const HieroMatches & matches, const HieroNodeMap & node_map,
+                       EdgeList & edge_list, int begin, int end) :
+        matches_(matches), node_map_(node_map), edge_list_(edge_list), begin_(begin), end_(end) { }
+    void Run() {
+        for(int i = begin_; i < end_; i++)
+            edge_list_[i] = LookupTableFSM::BuildMatchEdge(matches_.rules[i], matches_.spans, node_map_);
+    }
+protected:
+    const HieroMatches & matches_;
+    const HieroNodeMap & node_map_;
+    EdgeList & edge_list_;
+    int begin_, end_;
+};
+
+#define MATCH_EDGE_TASKS_PER_THREAD 4
+#define MIN_MATCH_EDGES_PER_TASK 64
+
+void LookupTableFSM::BuildMatchEdges(const HieroMatches & matches, const HieroNodeMap & node_map, EdgeList & edge_list) const {
+    int num_matches = matches.rules.size();
+    edge_list.resize(num_matches);
+    int block = max((num_matches + num_threads_*MATCH_EDGE_TASKS_PER_THREAD - 1) / (num_threads_*MATCH_EDGE_TASKS_PER_THREAD), MIN_MATCH_EDGES_PER_TASK);
+    if(num_threads_ <= 1 || block >= num_matches) {
+        HieroMatchEdgeTask(matches, node_map, edge_list, 0, num_matches).Run();
+    } else {
+        TaskGroup group(ThreadPool::GetShared());
+        for(int i = 0; i < num_matches; i += block)
+            group.Submit(new HieroMatchEdgeTask(matches, node_map, edge_list, i, min(i+block, num_matches)));
+        group.Wait();
+    }
+    // Only add the edges to their heads now, so each head gets its edges in
+    // the order the rules were matched
+    BOOST_FOREACH(HyperEdge * edge, edge_list)
+        edge->GetHead()->AddEdge(edge);
+}
+
 // Get an HyperNode, indexed by its span in some map.
 HyperNode* LookupTableFSM::FindNode(HieroNodeMap& map_ptr, 
         const int span_begin, const int span_end, const HieroHeadLabels& head_label)
 {
-    if (span_begin < 0 || span_end < 0) 
-        THROW_ERROR("Invalid span range in constructing HyperGraph.");
-    pair<int,int> span = make_pair(span_begin,span_end);
-
-    HieroNodeMap::iterator it = map_ptr.find(span);
-    if (it == map_ptr.end()) {
-        // Fresh New Node!
-        HyperNode* ret = new HyperNode;
-        ret->SetSpan(make_pair(span_begin,span_end));
-        ret->SetSym(head_label[0]);
-        map_ptr[span][head_label] = ret;
-        // cerr << "Adding node! " << span.first << ":" << span.second << ", " << head_label << endl;
-        return ret;
-    } else {
-        HeadNodePairs::iterator it2 = it->second.find(head_label);
-        if (it2 == it->second.end()) {
-            // Fresh New Node!
-            HyperNode* ret = new HyperNode;
-            ret->SetSpan(make_pair(span_begin,span_end));
-            ret->SetSym(head_label[0]);
-            map_ptr[span][head_label] = ret;
-            // cerr << "Adding node! " << span.first << ":" << span.second << ", " << head_label << endl;
-            return ret;
-        } else {
-            return it2->second;
-        }
-    }
+    HeadNodePairs & cell = map_ptr.Get(span_begin, span_end);
+    HeadNodePairs::iterator it = cell.find(head_label);
+    if (it != cell.end())
+        return it->second;
+    // Fresh New Node!
+    HyperNode* ret = new HyperNode;
+    ret->SetSpan(make_pair(span_begin,span_end));
+    ret->SetSym(head_label[0]);
+    cell.insert(make_pair(head_label, ret));
+    // cerr << "Adding node! " << span_begin << ":" << span_end << ", " << head_label << endl;
+    return ret;
 }
 
 TranslationRuleHiero* LookupTableFSM::GetUnknownRule(WordId unknown_word, const HieroHeadLabels& head_labels) 
@@ -478,6 +860,15 @@ LookupTableFSM * LookupTableFSM::ReadFromFiles(const std::vector<std::string> &
     return ret;
 }
 
+LookupTableFSM * LookupTableFSM::ReadFromBinaryFiles(const std::vector<std::string> & filenames) {
+    LookupTableFSM * ret = new LookupTableFSM;
+    BOOST_FOREACH(const std::string & filename, filenames) {
+        cerr << "Mapping binary TM file from "<<filename<<"..." << endl;
+        ret->AddRuleFSM(RuleFSM::ReadFromBinaryFile(filename));
+    }
+    return ret;
+}
+
 void LookupTableFSM::SetSpanLimits(const std::vector<int>& limits) {
     if(limits.size() != rule_fsms_.size())
         THROW_ERROR("The number of span limits (" << limits.size() << ") must be equal to the number of tm_files ("<<rule_fsms_.size()<<")");
@@ -491,6 +882,16 @@ void LookupTableFSM::SetSaveSrcStr(const bool save_src_str) {
         rfsm->SetSaveSrcStr(save_src_str);
 }
 
+void LookupTableFSM::SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer) {
+    BOOST_FOREACH(RuleFSM* rfsm, rule_fsms_) 
+        rfsm->SetRulePreparer(preparer);
+}
+
+void LookupTableFSM::SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit) {
+    BOOST_FOREACH(RuleFSM* rfsm, rule_fsms_) 
+        rfsm->SetTableLimit(limit);
+}
+
 
 ///////////////////////////////////
 ///     LOOK UP NODE FSM         //
@@ -1,5 +1,6 @@
 #include <travatar/translation-rule.h>
 #include <travatar/lookup-table-hash.h>
+#include <travatar/rule-table-limit.h>
 #include <travatar/dict.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/input-file-stream.h>
@@ -18,23 +19,36 @@ LookupTableHash::~LookupTableHash() {
             delete rule;
 };
 
+void LookupTableHash::SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer) {
+    LookupTable::SetRulePreparer(preparer);
+    BOOST_FOREACH(RulePair & rule_pair, rules_)
+        BOOST_FOREACH(TranslationRule * rule, rule_pair.second)
+            preparer->Prepare(*rule);
+}
+
+void LookupTableHash::SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit) {
+    LookupTable::SetTableLimit(limit);
+    BOOST_FOREACH(RulePair & rule_pair, rules_)
+        limit->ApplyRules(rule_pair.second);
+}
+
 // Match the start of an edge
-LookupState * LookupTableHash::MatchStart(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableHash::MatchStart(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const {
     const std::string & p = state.GetString();
     std::string next = p + (p.size()?" ":"") + Dict::WSym(node.GetSym()) + " (";
-    return MatchState(next, state);
+    return MatchState(next, state, arena);
 }
 
 // Match the end of an edge
-LookupState * LookupTableHash::MatchEnd(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableHash::MatchEnd(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const {
     std::string next = state.GetString() + " )";
-    return MatchState(next, state);
+    return MatchState(next, state, arena);
 }
 
-LookupState * LookupTableHash::MatchState(const std::string & next, const LookupState & state) const {
+LookupState * LookupTableHash::MatchState(const std::string & next, const LookupState & state, LookupStateArena & arena) const {
     if(src_matches.find(next) != src_matches.end()) {
         // std::cerr << "Matching " << next << " --> success!" << std::endl;
-        LookupState * ret = new LookupState;
+        LookupState * ret = arena.New<LookupState>();
         ret->SetString(next);
         ret->SetNonterms(state.GetNonterms());
         ret->SetFeatures(state.GetFeatures());
@@ -80,15 +94,15 @@ LookupTableHash * LookupTableHash::ReadFromRuleTable(std::istream & in) {
 }
 
 // Match a single node
-LookupState * LookupTableHash::MatchNode(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableHash::MatchNode(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const {
     LookupState * ret = NULL;
     if(node.IsTerminal()) {
         string next = state.GetString() + " \"" + Dict::WSym(node.GetSym()) + "\""; 
-        ret = MatchState(next, state);
+        ret = MatchState(next, state, arena);
     } else {
         ostringstream next;
         next << state.GetString() << " x" << state.GetNonterms().size() << ":" << Dict::WSym(node.GetSym());
-        ret = MatchState(next.str(), state);
+        ret = MatchState(next.str(), state, arena);
         if(ret != NULL) {
             ret->GetNonterms().push_back(&node);
             ret->SetFeatures(state.GetFeatures());
@@ -1,29 +1,95 @@
 #include <travatar/lookup-table-marisa.h>
+#include <travatar/rule-table-limit.h>
 #include <travatar/dict.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/input-file-stream.h>
 #include <travatar/global-debug.h>
 #include <travatar/string-util.h>
+#include <travatar/io-util.h>
 #include <marisa/marisa.h>
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <sstream>
+#include <cstring>
 
 using namespace travatar;
 using namespace std;
 using namespace boost;
 
+// The layout of a compiled rule table is
+//  header | payload | vocabulary | index | trie
+// where the payload holds the rules for each source key, the vocabulary
+// is a list of null-terminated strings, the index gives the payload offset
+// for every trie key ID, and the trie is in marisa's own format. All sections
+// but the payload start at 8-byte boundaries so they can be used directly
+// from the mapped file.
+#define MARISA_BIN_MAGIC "TRVMRS01"
+
+struct MarisaBinHeader {
+    char magic[8];
+    uint64_t num_vocab, vocab_offset;
+    uint64_t num_keys, index_offset;
+    uint64_t payload_offset;
+    uint64_t trie_offset, trie_size;
+};
+
+// Words are stored with table-local IDs. Negative values (nonterminals in
+// the target words, or unlabeled symbols) are kept as-is.
+inline int32_t LocalId(WordId wid, unordered_map<WordId,int32_t> & ids, vector<WordId> & vocab) {
+    if(wid < 0) return wid;
+    unordered_map<WordId,int32_t>::const_iterator it = ids.find(wid);
+    if(it != ids.end()) return it->second;
+    int32_t ret = vocab.size();
+    ids.insert(make_pair(wid, ret));
+    vocab.push_back(wid);
+    return ret;
+}
+
+// Write the rules for a single source. Only the rules that are kept by the
+// limit are given local IDs
+inline void WriteRuleGroup(ostream & out, vector<pair<Real,TranslationRule> > & group, const RuleTableLimit * limit,
+                           unordered_map<WordId,int32_t> & ids, vector<WordId> & vocab) {
+    if(limit != NULL)
+        limit->Apply(group);
+    IoUtil::WriteBinary(out, (uint32_t)group.size());
+    for(int i = 0; i < (int)group.size(); i++) {
+        const CfgDataVector & trg_data = group[i].second.GetTrgData();
+        IoUtil::WriteBinary(out, (uint32_t)trg_data.size());
+        BOOST_FOREACH(const CfgData & data, trg_data) {
+            IoUtil::WriteBinary(out, LocalId(data.label, ids, vocab));
+            IoUtil::WriteBinary(out, (uint32_t)data.words.size());
+            BOOST_FOREACH(WordId wid, data.words)
+                IoUtil::WriteBinary(out, LocalId(wid, ids, vocab));
+            IoUtil::WriteBinary(out, (uint32_t)data.syms.size());
+            BOOST_FOREACH(WordId wid, data.syms)
+                IoUtil::WriteBinary(out, LocalId(wid, ids, vocab));
+        }
+        const SparseVector & features = group[i].second.GetFeatures();
+        IoUtil::WriteBinary(out, (uint32_t)features.size());
+        BOOST_FOREACH(const SparsePair & feat, features.GetImpl()) {
+            IoUtil::WriteBinary(out, LocalId(feat.first, ids, vocab));
+            IoUtil::WriteBinary(out, (double)feat.second);
+        }
+    }
+    group.clear();
+}
+
+LookupTableMarisa::LookupTableMarisa() :
+    offsets_(NULL), payload_(NULL), payload_size_(0), num_decoded_chunks_(0), decoded_(NULL) { }
+
 // Match the start of an edge
-LookupState * LookupTableMarisa::MatchStart(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableMarisa::MatchStart(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const {
     const std::string & p = state.GetString();
     std::string next = p + (p.size()?" ":"") + Dict::WSym(node.GetSym()) + " (";
-    return MatchState(next, state);
+    return MatchState(next, state, arena);
 }
 
 // Match the end of an edge
-LookupState * LookupTableMarisa::MatchEnd(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableMarisa::MatchEnd(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const {
     std::string next = state.GetString() + " )";
-    return MatchState(next, state);
+    return MatchState(next, state, arena);
 }
 
 LookupTableMarisa * LookupTableMarisa::ReadFromFile(std::string & filename) {
@@ -73,28 +139,209 @@ LookupTableMarisa * LookupTableMarisa::ReadFromRuleTable(std::istream & in) {
     return ret;
 }
 
+void LookupTableMarisa::CompileRuleTable(std::istream & in, std::ostream & out,
+                                         const RuleTableLimit * limit) {
+    MarisaBinHeader header;
+    memset(&header, 0, sizeof(header));
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    header.payload_offset = out.tellp();
+    // Write the rules for each source in order, remembering where each starts
+    unordered_map<WordId,int32_t> ids;
+    vector<WordId> vocab;
+    marisa::Keyset keyset;
+    vector<uint64_t> group_offsets;
+    string line, last_src;
+    vector<pair<Real,TranslationRule> > group;
+    while(getline(in, line)) {
+        vector<string> columns = Tokenize(line, " ||| ");
+        if(columns.size() < 3) THROW_ERROR("Bad line in rule table: " << line);
+        if(group_offsets.size() == 0 || columns[0] != last_src) {
+            if(group.size())
+                WriteRuleGroup(out, group, limit, ids, vocab);
+            keyset.push_back(columns[0].c_str());
+            group_offsets.push_back((uint64_t)out.tellp() - header.payload_offset);
+            last_src = columns[0];
+        }
+        CfgDataVector trg_data = Dict::ParseAnnotatedVector(columns[1]);
+        SparseVector features = Dict::ParseSparseVector(columns[2]);
+        group.push_back(make_pair(limit != NULL ? limit->Score(features) : 0, TranslationRule(trg_data, features)));
+    }
+    if(group.size())
+        WriteRuleGroup(out, group, limit, ids, vocab);
+    // Write the vocabulary
+    IoUtil::PadBinary(out);
+    header.num_vocab = vocab.size();
+    header.vocab_offset = out.tellp();
+    BOOST_FOREACH(WordId wid, vocab) {
+        const string & str = Dict::WSym(wid);
+        out.write(str.c_str(), str.length()+1);
+    }
+    // Build the trie and write the index in key ID order
+    marisa::Trie trie;
+    trie.build(keyset);
+    vector<uint64_t> index(trie.num_keys(), 0);
+    for(size_t i = 0; i < group_offsets.size(); i++) {
+        marisa::Agent agent;
+        string str(keyset[i].ptr(), keyset[i].length());
+        agent.set_query(str.c_str());
+        if(!trie.lookup(agent))
+            THROW_ERROR("Internal error when building rule table @ " << str);
+        index[agent.key().id()] = group_offsets[i];
+    }
+    IoUtil::PadBinary(out);
+    header.num_keys = index.size();
+    header.index_offset = out.tellp();
+    BOOST_FOREACH(uint64_t offset, index)
+        IoUtil::WriteBinary(out, offset);
+    // Write the trie
+    IoUtil::PadBinary(out);
+    header.trie_offset = out.tellp();
+    header.trie_size = trie.io_size();
+    marisa::write(out, trie);
+    // Go back and fill in the header
+    memcpy(header.magic, MARISA_BIN_MAGIC, 8);
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.flush();
+    if(!out)
+        THROW_ERROR("Failed to write the compiled rule table");
+}
+
+LookupTableMarisa * LookupTableMarisa::ReadFromBinaryFile(const std::string & filename) {
+    cerr << "Mapping binary TM file from "<<filename<<"..." << endl;
+    LookupTableMarisa * ret = new LookupTableMarisa;
+    try {
+        ret->mapped_.reset(new iostreams::mapped_file_source(filename));
+    } catch(std::exception & e) {
+        delete ret;
+        THROW_ERROR("Could not map binary TM: " << filename);
+    }
+    const char * base = ret->mapped_->data();
+    size_t size = ret->mapped_->size();
+    MarisaBinHeader header;
+    if(size < sizeof(header)) { delete ret; THROW_ERROR("Binary TM is truncated: " << filename); }
+    memcpy(&header, base, sizeof(header));
+    if(memcmp(header.magic, MARISA_BIN_MAGIC, 8) ||
+       header.trie_offset + header.trie_size > size ||
+       header.index_offset + header.num_keys * sizeof(uint64_t) > size ||
+       header.payload_offset > header.vocab_offset ||
+       header.vocab_offset > size) {
+        delete ret;
+        THROW_ERROR("Not a valid binary TM: " << filename);
+    }
+    // Map the vocabulary into the dictionary
+    const char * ptr = base + header.vocab_offset, * end = base + size;
+    ret->vocab_.resize(header.num_vocab);
+    for(uint64_t i = 0; i < header.num_vocab; i++) {
+        const char * next = static_cast<const char*>(memchr(ptr, 0, end-ptr));
+        if(next == NULL) { delete ret; THROW_ERROR("Not a valid binary TM: " << filename); }
+        ret->vocab_[i] = Dict::WID(string(ptr, next-ptr));
+        ptr = next + 1;
+    }
+    ret->offsets_ = reinterpret_cast<const uint64_t*>(base + header.index_offset);
+    ret->payload_ = base + header.payload_offset;
+    ret->payload_size_ = header.vocab_offset - header.payload_offset;
+    try {
+        ret->trie_.map(base + header.trie_offset, header.trie_size);
+    } catch(marisa::Exception & e) {
+        delete ret;
+        THROW_ERROR("Could not read trie in binary TM " << filename << ": " << e.what());
+    }
+    ret->num_decoded_chunks_ = (header.num_keys + DECODED_CHUNK_SIZE - 1) / DECODED_CHUNK_SIZE;
+    ret->decoded_ = new boost::atomic<DecodedSlot*>[ret->num_decoded_chunks_];
+    for(size_t i = 0; i < ret->num_decoded_chunks_; i++)
+        ret->decoded_[i].store(NULL, boost::memory_order_relaxed);
+    return ret;
+}
+
+WordId LookupTableMarisa::MapWord(int32_t val, bool allow_negative) const {
+    if(val < 0 && allow_negative)
+        return val;
+    if(val < 0 || val >= (int32_t)vocab_.size())
+        THROW_ERROR("Bad word ID " << val << " in binary TM");
+    return vocab_[val];
+}
+
+// Read a value from the payload without running past its end
+template <class T>
+inline T ReadPayload(const char * & ptr, const char * end) {
+    if(end - ptr < (ptrdiff_t)sizeof(T))
+        THROW_ERROR("Binary TM is truncated");
+    return IoUtil::ReadBinary<T>(ptr);
+}
+
+// Read the number of elements that follow, each of which takes at least
+// min_size bytes, and reject it before allocating if they cannot fit
+inline uint32_t ReadPayloadCount(const char * & ptr, const char * end, size_t min_size) {
+    uint32_t count = ReadPayload<uint32_t>(ptr, end);
+    if((uint64_t)(end - ptr) < (uint64_t)count * min_size)
+        THROW_ERROR("Binary TM is truncated");
+    return count;
+}
+
+void LookupTableMarisa::DecodeRules(size_t id, vector<TranslationRule*> & rules) const {
+    if(offsets_[id] >= payload_size_)
+        THROW_ERROR("Bad rule offset " << offsets_[id] << " in binary TM");
+    const char * ptr = payload_ + offsets_[id], * end = payload_ + payload_size_;
+    // A rule is at least its two counts, target data its label and two counts,
+    // and a feature its ID and value
+    uint32_t num_rules = ReadPayloadCount(ptr, end, 2*sizeof(uint32_t));
+    rules.reserve(num_rules);
+    try {
+        for(uint32_t i = 0; i < num_rules; i++) {
+            CfgDataVector trg_data(ReadPayloadCount(ptr, end, sizeof(int32_t)+2*sizeof(uint32_t)));
+            BOOST_FOREACH(CfgData & data, trg_data) {
+                data.label = MapWord(ReadPayload<int32_t>(ptr, end), true);
+                data.words.resize(ReadPayloadCount(ptr, end, sizeof(int32_t)));
+                BOOST_FOREACH(WordId & wid, data.words)
+                    wid = MapWord(ReadPayload<int32_t>(ptr, end), true);
+                data.syms.resize(ReadPayloadCount(ptr, end, sizeof(int32_t)));
+                BOOST_FOREACH(WordId & wid, data.syms)
+                    wid = MapWord(ReadPayload<int32_t>(ptr, end), false);
+            }
+            vector<SparsePair> features(ReadPayloadCount(ptr, end, sizeof(int32_t)+sizeof(double)));
+            BOOST_FOREACH(SparsePair & feat, features) {
+                feat.first = MapWord(ReadPayload<int32_t>(ptr, end), false);
+                feat.second = ReadPayload<double>(ptr, end);
+            }
+            rules.push_back(new TranslationRule(trg_data, SparseVector(features)));
+        }
+    } catch(std::exception & e) {
+        BOOST_FOREACH(TranslationRule * rule, rules)
+            delete rule;
+        rules.clear();
+        throw;
+    }
+    if(table_limit_.get() != NULL)
+        table_limit_->ApplyRules(rules);
+    if(preparer_.get() != NULL) {
+        BOOST_FOREACH(TranslationRule * rule, rules)
+            preparer_->Prepare(*rule);
+    }
+}
+
 // Match a single node
-LookupState * LookupTableMarisa::MatchNode(const HyperNode & node, const LookupState & state) const {
+LookupState * LookupTableMarisa::MatchNode(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const {
     LookupState * ret = NULL;
     if(node.IsTerminal()) {
         string next = state.GetString() + " \"" + Dict::WSym(node.GetSym()) + "\""; 
-        ret = MatchState(next, state);
+        ret = MatchState(next, state, arena);
     } else {
         ostringstream next;
         next << state.GetString() << " x" << state.GetNonterms().size() << ":" << Dict::WSym(node.GetSym());
-        ret = MatchState(next.str(), state);
+        ret = MatchState(next.str(), state, arena);
         if(ret != NULL)
             ret->GetNonterms().push_back(&node);
     }
     return ret;
 }
 
-LookupState * LookupTableMarisa::MatchState(const string & next, const LookupState & state) const {
+LookupState * LookupTableMarisa::MatchState(const string & next, const LookupState & state, LookupStateArena & arena) const {
     marisa::Agent agent;
     agent.set_query(next.c_str());
     if(trie_.predictive_search(agent)) {
         // cerr << "Matching " << next << " --> success!" << endl;
-        LookupState * ret = new LookupState;
+        LookupState * ret = arena.New<LookupState>();
         ret->SetString(next);
         ret->SetNonterms(state.GetNonterms());
         ret->SetFeatures(state.GetFeatures());
@@ -106,11 +353,44 @@ LookupState * LookupTableMarisa::MatchState(const string & next, const LookupSta
 }
 
 
+LookupTableMarisa::DecodedSlot & LookupTableMarisa::GetDecodedSlot(size_t id) const {
+    boost::atomic<DecodedSlot*> & chunk_ptr = decoded_[id / DECODED_CHUNK_SIZE];
+    DecodedSlot * chunk = chunk_ptr.load(boost::memory_order_acquire);
+    if(chunk == NULL) {
+        DecodedSlot * fresh = new DecodedSlot[DECODED_CHUNK_SIZE];
+        for(size_t i = 0; i < DECODED_CHUNK_SIZE; i++)
+            fresh[i].store(NULL, boost::memory_order_relaxed);
+        if(chunk_ptr.compare_exchange_strong(chunk, fresh, boost::memory_order_acq_rel))
+            chunk = fresh;
+        else
+            delete [] fresh;
+    }
+    return chunk[id % DECODED_CHUNK_SIZE];
+}
+
 const vector<TranslationRule*> * LookupTableMarisa::FindRules(const LookupState & state) const {
     marisa::Agent agent;
     const char* query = state.GetString().c_str();
     agent.set_query(query);
-    const vector<TranslationRule*> * ret = trie_.lookup(agent) ? &rules_[agent.key().id()] : NULL;
+    if(!trie_.lookup(agent)) return NULL;
+    size_t id = agent.key().id();
+    if(!mapped_.get())
+        return &rules_[id];
+    DecodedSlot & slot = GetDecodedSlot(id);
+    vector<TranslationRule*> * ret = slot.load(boost::memory_order_acquire);
+    if(ret != NULL)
+        return ret;
+    // Decode without taking any lock, and discard our copy if another
+    // thread got there first
+    vector<TranslationRule*> decoded;
+    DecodeRules(id, decoded);
+    vector<TranslationRule*> * mine = new vector<TranslationRule*>;
+    mine->swap(decoded);
+    if(slot.compare_exchange_strong(ret, mine, boost::memory_order_acq_rel))
+        return mine;
+    BOOST_FOREACH(TranslationRule * rule, *mine)
+        delete rule;
+    delete mine;
     return ret;
 }
 
@@ -119,4 +399,32 @@ LookupTableMarisa::~LookupTableMarisa() {
     BOOST_FOREACH(std::vector<TranslationRule*> & vec, rules_)
         BOOST_FOREACH(TranslationRule * rule, vec)
             delete rule;
+    for(size_t i = 0; i < num_decoded_chunks_; i++) {
+        DecodedSlot * chunk = decoded_[i].load();
+        if(chunk == NULL) continue;
+        for(size_t j = 0; j < DECODED_CHUNK_SIZE; j++) {
+            std::vector<TranslationRule*> * vec = chunk[j].load();
+            if(vec == NULL) continue;
+            BOOST_FOREACH(TranslationRule * rule, *vec)
+                delete rule;
+            delete vec;
+        }
+        delete [] chunk;
+    }
+    delete [] decoded_;
 };
+
+void LookupTableMarisa::SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer) {
+    LookupTable::SetRulePreparer(preparer);
+    // Rules of a mapped table are prepared in DecodeRules
+    BOOST_FOREACH(std::vector<TranslationRule*> & vec, rules_)
+        BOOST_FOREACH(TranslationRule * rule, vec)
+            preparer->Prepare(*rule);
+}
+
+void LookupTableMarisa::SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit) {
+    LookupTable::SetTableLimit(limit);
+    // Rules of a mapped table are limited in DecodeRules
+    BOOST_FOREACH(std::vector<TranslationRule*> & vec, rules_)
+        limit->ApplyRules(vec);
+}
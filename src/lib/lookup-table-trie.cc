@@ -0,0 +1,157 @@
+#include <travatar/lookup-table-trie.h>
+#include <travatar/rule-table-limit.h>
+#include <travatar/translation-rule.h>
+#include <travatar/dict.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/input-file-stream.h>
+#include <travatar/global-debug.h>
+#include <travatar/string-util.h>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <sstream>
+
+using namespace travatar;
+using namespace std;
+using namespace boost;
+
+// Word IDs share the lower 32 bits of a transition key with the symbol type
+#define TRIE_MAX_WID (1 << 30)
+
+LookupTableTrie::~LookupTableTrie() {
+    BOOST_FOREACH(std::vector<TranslationRule*> & vec, rules_)
+        BOOST_FOREACH(TranslationRule * rule, vec)
+            delete rule;
+}
+
+void LookupTableTrie::SetRulePreparer(const boost::shared_ptr<RulePreparer> & preparer) {
+    LookupTable::SetRulePreparer(preparer);
+    BOOST_FOREACH(std::vector<TranslationRule*> & vec, rules_)
+        BOOST_FOREACH(TranslationRule * rule, vec)
+            preparer->Prepare(*rule);
+}
+
+void LookupTableTrie::SetTableLimit(const boost::shared_ptr<RuleTableLimit> & limit) {
+    LookupTable::SetTableLimit(limit);
+    BOOST_FOREACH(std::vector<TranslationRule*> & vec, rules_)
+        limit->ApplyRules(vec);
+}
+
+int LookupTableTrie::AddTransition(int node, TrieSymbolType type, WordId wid) {
+    if(wid < 0 || wid >= TRIE_MAX_WID)
+        THROW_ERROR("Word ID out of range for the rule trie: " << wid);
+    pair<TransitionMap::iterator, bool> it = 
+        transitions_.insert(make_pair(GetTransitionKey(node, type, wid), num_nodes_));
+    if(it.second) {
+        num_nodes_++;
+        rules_.resize(num_nodes_);
+    }
+    return it.first->second;
+}
+
+bool LookupTableTrie::AddRule(const std::string & src, TranslationRule * rule) {
+    vector<string> tokens = Tokenize(src, ' ');
+    int node = 0, nonterms = 0;
+    for(int i = 0; i < (int)tokens.size(); i++) {
+        const string & tok = tokens[i];
+        if(tok == ")") {
+            node = AddTransition(node, TRIE_CLOSE, 0);
+        } else if(tok.length() >= 2 && tok[0] == '"' && tok[tok.length()-1] == '"') {
+            node = AddTransition(node, TRIE_WORD, Dict::WID(tok.substr(1, tok.length()-2)));
+        } else if(i+1 < (int)tokens.size() && tokens[i+1] == "(") {
+            node = AddTransition(node, TRIE_OPEN, Dict::WID(tok));
+            i++;
+        } else {
+            size_t colon = tok.find(':');
+            if(tok[0] != 'x' || colon == string::npos)
+                THROW_ERROR("Bad source in rule table: " << src);
+            // Non-terminals are matched in order, so others can never match
+            if(lexical_cast<int>(tok.substr(1, colon-1)) != nonterms++)
+                return false;
+            node = AddTransition(node, TRIE_NONTERM, Dict::WID(tok.substr(colon+1)));
+        }
+    }
+    rules_[node].push_back(rule);
+    return true;
+}
+
+LookupTableTrie * LookupTableTrie::ReadFromFile(std::string & filename) {
+    InputFileStream tm_in(filename.c_str());
+    cerr << "Reading TM file from "<<filename<<"..." << endl;
+    if(!tm_in)
+        THROW_ERROR("Could not find TM: " << filename);
+    return ReadFromRuleTable(tm_in);
+}
+
+LookupTableTrie * LookupTableTrie::ReadFromRuleTable(std::istream & in) {
+    string line;
+    LookupTableTrie * ret = new LookupTableTrie;
+    while(getline(in, line)) {
+        vector<string> columns = Tokenize(line, " ||| ");
+        if(columns.size() < 3) { delete ret; THROW_ERROR("Bad line in rule table: " << line); }
+        CfgDataVector trg_data = Dict::ParseAnnotatedVector(columns[1]);
+        SparseVector features = Dict::ParseSparseVector(columns[2]);
+        TranslationRule * rule = new TranslationRule(trg_data, features);
+        if(!ret->AddRule(columns[0], rule)) {
+            PRINT_DEBUG("Skipping rule with out-of-order non-terminals: " << line << endl, 1);
+            delete rule;
+        }
+    }
+    return ret;
+}
+
+LookupStateTrie * LookupTableTrie::MatchState(TrieSymbolType type, WordId wid,
+                                              const LookupState & state,
+                                              LookupStateArena & arena) const {
+    if(wid < 0 || wid >= TRIE_MAX_WID) return NULL;
+    int next = FindTransition(((const LookupStateTrie &)state).GetTrieNode(), type, wid);
+    if(next == -1) return NULL;
+    LookupStateTrie * ret = arena.New<LookupStateTrie>();
+    ret->SetTrieNode(next);
+    ret->SetNonterms(state.GetNonterms());
+    ret->SetFeatures(state.GetFeatures());
+    return ret;
+}
+
+// Match the start of an edge
+LookupState * LookupTableTrie::MatchStart(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const {
+    LookupStateTrie * ret = MatchState(TRIE_OPEN, node.GetSym(), state, arena);
+    if(ret != NULL && save_src_str_) {
+        const std::string & p = state.GetString();
+        ret->SetString(p + (p.size()?" ":"") + Dict::WSym(node.GetSym()) + " (");
+    }
+    return ret;
+}
+
+// Match the end of an edge
+LookupState * LookupTableTrie::MatchEnd(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const {
+    LookupStateTrie * ret = MatchState(TRIE_CLOSE, 0, state, arena);
+    if(ret != NULL && save_src_str_)
+        ret->SetString(state.GetString() + " )");
+    return ret;
+}
+
+// Match a single node
+LookupState * LookupTableTrie::MatchNode(const HyperNode & node, const LookupState & state, LookupStateArena & arena) const {
+    LookupStateTrie * ret = NULL;
+    if(node.IsTerminal()) {
+        ret = MatchState(TRIE_WORD, node.GetSym(), state, arena);
+        if(ret != NULL && save_src_str_)
+            ret->SetString(state.GetString() + " \"" + Dict::WSym(node.GetSym()) + "\"");
+    } else {
+        ret = MatchState(TRIE_NONTERM, node.GetSym(), state, arena);
+        if(ret != NULL) {
+            if(save_src_str_) {
+                ostringstream next;
+                next << state.GetString() << " x" << state.GetNonterms().size() << ":" << Dict::WSym(node.GetSym());
+                ret->SetString(next.str());
+            }
+            ret->GetNonterms().push_back(&node);
+        }
+    }
+    return ret;
+}
+
+const vector<TranslationRule*> * LookupTableTrie::FindRules(const LookupState & state) const {
+    const vector<TranslationRule*> & ret = rules_[((const LookupStateTrie &)state).GetTrieNode()];
+    return ret.size() ? &ret : NULL;
+}
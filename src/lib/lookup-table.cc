@@ -17,27 +17,52 @@ LookupTable::LookupTable() :
 
 LookupTable::~LookupTable() { }
 
+#define LOOKUP_ARENA_BLOCK 65536
+#define LOOKUP_ARENA_ALIGN 16
+
+void * LookupStateArena::Allocate(size_t size) {
+    size = (size + LOOKUP_ARENA_ALIGN - 1) / LOOKUP_ARENA_ALIGN * LOOKUP_ARENA_ALIGN;
+    if(blocks_.size() == 0 || pos_ + size > LOOKUP_ARENA_BLOCK) {
+        blocks_.push_back(new char[max(size, (size_t)LOOKUP_ARENA_BLOCK)]);
+        pos_ = 0;
+    }
+    void * ret = *blocks_.rbegin() + pos_;
+    pos_ += size;
+    return ret;
+}
+
+void LookupStateArena::Clear() {
+    BOOST_REVERSE_FOREACH(LookupState * state, states_)
+        state->~LookupState();
+    states_.clear();
+    BOOST_FOREACH(char * block, blocks_)
+        delete [] block;
+    blocks_.clear();
+    pos_ = 0;
+}
+
 // Find all the translation rules rooted at a particular node in a parse graph
-vector<boost::shared_ptr<LookupState> > LookupTable::LookupSrc(
+vector<LookupState*> LookupTable::LookupSrc(
             const HyperNode & node, 
-            const vector<boost::shared_ptr<LookupState> > & old_states) const {
-    vector<boost::shared_ptr<LookupState> > ret_states;
-    BOOST_FOREACH(const boost::shared_ptr<LookupState> & state, old_states) {
+            const vector<LookupState*> & old_states,
+            LookupStateArena & arena) const {
+    vector<LookupState*> ret_states;
+    BOOST_FOREACH(const LookupState * state, old_states) {
         // Match the current node
-        boost::shared_ptr<LookupState> my_state(MatchNode(node, *state));
+        LookupState * my_state = MatchNode(node, *state, arena);
         if(my_state != NULL) ret_states.push_back(my_state);
         // Match all rules the require descent into the next node
-        boost::shared_ptr<LookupState> start_state(MatchStart(node, *state));
+        LookupState * start_state = MatchStart(node, *state, arena);
         if(start_state == NULL) continue;
         // Cycle through all the edges from this node
         BOOST_FOREACH(const HyperEdge * edge, node.GetEdges()) {
-            vector<boost::shared_ptr<LookupState> > my_states(1, start_state);
+            vector<LookupState*> my_states(1, start_state);
             // Cycle through all the tails in this edge
             BOOST_FOREACH(const HyperNode * child, edge->GetTails())
-                my_states = LookupSrc(*child, my_states);
+                my_states = LookupSrc(*child, my_states, arena);
             // Finish all the states found
-            BOOST_FOREACH(const boost::shared_ptr<LookupState> & my_state, my_states) {
-                boost::shared_ptr<LookupState> fin_state(MatchEnd(node, *my_state));
+            BOOST_FOREACH(const LookupState * my_state, my_states) {
+                LookupState * fin_state = MatchEnd(node, *my_state, arena);
                 if(fin_state != NULL) {
                     fin_state->AddFeatures(edge->GetFeatures());
                     ret_states.push_back(fin_state);
@@ -63,9 +88,9 @@ HyperGraph * LookupTable::TransformGraphSrc(const HyperGraph & parse) const {
     HyperGraph * ret = new HyperGraph;
     ret->SetWords(parse.GetWords());
     std::map<int,int> node_map, rev_node_map;
-    vector<vector<boost::shared_ptr<LookupState> > > lookups;
-    vector<boost::shared_ptr<LookupState> > init_state;
-    init_state.push_back(boost::shared_ptr<LookupState>(GetInitialState()));
+    LookupStateArena arena;
+    vector<vector<LookupState*> > lookups;
+    vector<LookupState*> init_state(1, GetInitialState(arena));
     BOOST_FOREACH(const HyperNode * node, parse.GetNodes()) {
         if(!node->IsTerminal()) {
             rev_node_map.insert(make_pair(node_map.size(), node->GetId()));
@@ -74,7 +99,7 @@ HyperGraph * LookupTable::TransformGraphSrc(const HyperGraph & parse) const {
             ret->AddNode(next_node);
             next_node->SetSym(node->GetSym());
             next_node->SetSpan(node->GetSpan());
-            lookups.push_back(LookupSrc(*node, init_state));
+            lookups.push_back(LookupSrc(*node, init_state, arena));
         }
     }
     // For each node
@@ -83,7 +108,7 @@ HyperGraph * LookupTable::TransformGraphSrc(const HyperGraph & parse) const {
         int my_size = lookups[next_node->GetId()].size();
         if(my_size > 0) {
             // For each matched portion of the source tree
-            BOOST_FOREACH(const boost::shared_ptr<LookupState> & state, lookups[next_node->GetId()]) {
+            BOOST_FOREACH(const LookupState * state, lookups[next_node->GetId()]) {
                 // For each tail in the 
                 vector<HyperNode*> next_tails;
                 BOOST_FOREACH(const HyperNode * tail, state->GetNonterms())
@@ -147,11 +172,11 @@ HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse) const {
     ret->SetWords(parse.GetWords());
     
     priority_queue<SpannedState,vector<SpannedState>,SpannedStateComparator> lookups;
-    vector<boost::shared_ptr<LookupState> > init_state;
-    init_state.push_back(boost::shared_ptr<LookupState>(GetInitialState()));
+    LookupStateArena arena;
+    vector<LookupState*> init_state(1, GetInitialState(arena));
     BOOST_REVERSE_FOREACH(const HyperNode * node, parse.GetNodes()) {
         if(!node->IsTerminal()) {
-            lookups.push(make_pair(LookupSrc(*node, init_state),node));
+            lookups.push(make_pair(LookupSrc(*node, init_state, arena),node));
         } 
     }
 
@@ -165,7 +190,7 @@ HyperGraph * LookupTable::TransformGraphSrcTrg(const HyperGraph & parse) const {
         const HyperNode* input_node = spanned_state.second;
         // Expand This state
         TargetMap indexed_head;
-        BOOST_FOREACH (const boost::shared_ptr<LookupState> & state, spanned_state.first) {
+        BOOST_FOREACH (const LookupState * state, spanned_state.first) {
             std::vector<const HyperNode*> non_terms = state->GetNonterms();
             BOOST_FOREACH (const TranslationRule * rule, *FindRules(*state)) {
                 CfgDataVector trg_data = rule->GetTrgData();
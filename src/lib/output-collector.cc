@@ -7,6 +7,9 @@ using namespace boost;
 void OutputCollector::Write(int id, const string & out, const string & err) { 
     typedef map<int,pair<string,string> > TraceMap;
     boost::mutex::scoped_lock lock(mutex_);
+    // Apply back-pressure to writers that are too far ahead
+    while(window_ && id >= next_ + window_)
+        window_moved_.wait(lock);
     if(id == next_) {
         *out_stream_ << out;
         *err_stream_ << err;
@@ -20,8 +23,11 @@ void OutputCollector::Write(int id, const string & out, const string & err) {
             out_stream_->flush();
             err_stream_->flush();
         }
+        if(window_)
+            window_moved_.notify_all();
     } else {
         saved_[id] = pair<string,string>(out,err);
+        max_saved_ = max(max_saved_, (int)saved_.size());
     }
 }
 
@@ -30,6 +36,12 @@ void OutputCollector::Flush() {
     err_stream_->flush();
 }
 
-void OutputCollector::Skip() {
-    ++next_;
+int OutputCollector::GetNumSaved() {
+    boost::mutex::scoped_lock lock(mutex_);
+    return saved_.size();
+}
+
+int OutputCollector::GetMaxSaved() {
+    boost::mutex::scoped_lock lock(mutex_);
+    return max_saved_;
 }
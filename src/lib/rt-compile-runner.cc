@@ -0,0 +1,48 @@
+#include <iostream>
+#include <fstream>
+#include <travatar/global-debug.h>
+#include <travatar/rt-compile-runner.h>
+#include <travatar/config-rt-compile-runner.h>
+#include <travatar/lookup-table-marisa.h>
+#include <travatar/lookup-table-fsm.h>
+#include <travatar/rule-table-limit.h>
+#include <travatar/dict.h>
+#include <travatar/input-file-stream.h>
+#include <boost/scoped_ptr.hpp>
+
+using namespace travatar;
+using namespace std;
+
+// Run the model
+void RtCompileRunner::Run(const ConfigRtCompileRunner & config) {
+
+    // Set the debugging level
+    GlobalVars::debug = config.GetInt("debug");
+
+    // Open the input and output
+    InputFileStream tm_in(config.GetMainArg(0).c_str());
+    if(!tm_in)
+        THROW_ERROR("Could not find TM: " << config.GetMainArg(0));
+    ofstream bin_out(config.GetMainArg(1).c_str(), ios::out | ios::binary);
+    if(!bin_out)
+        THROW_ERROR(config.GetMainArg(1) << " could not be opened for writing");
+
+    // Limit the rules for each source if necessary
+    boost::scoped_ptr<RuleTableLimit> limit;
+    if(config.GetInt("table_limit") > 0) {
+        if(config.GetString("weight_vals") == "")
+            THROW_ERROR("You must specify weights through -weight_vals to use -table_limit");
+        limit.reset(new RuleTableLimit(config.GetInt("table_limit"), Dict::ParseSparseMap(config.GetString("weight_vals"))));
+    }
+
+    // Compile the table
+    PRINT_DEBUG("Compiling " << config.GetMainArg(0) << " into " << config.GetMainArg(1) << "..." << endl, 1);
+    if(config.GetString("format") == "marisa")
+        LookupTableMarisa::CompileRuleTable(tm_in, bin_out, limit.get());
+    else if(config.GetString("format") == "fsm")
+        RuleFSM::CompileRuleTable(tm_in, bin_out, limit.get());
+    else
+        THROW_ERROR("Unknown table format: " << config.GetString("format"));
+    bin_out.close();
+
+}
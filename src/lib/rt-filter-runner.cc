@@ -0,0 +1,155 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <travatar/global-debug.h>
+#include <travatar/rt-filter-runner.h>
+#include <travatar/config-rt-filter-runner.h>
+#include <travatar/rule-table-filter.h>
+#include <travatar/lookup-table-marisa.h>
+#include <travatar/lookup-table-fsm.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/tree-io.h>
+#include <travatar/binarizer.h>
+#include <travatar/thread-pool.h>
+#include <travatar/output-collector.h>
+#include <travatar/input-file-stream.h>
+#include <travatar/dict.h>
+#include <travatar/string-util.h>
+#include <travatar/timer.h>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+
+using namespace travatar;
+using namespace std;
+using namespace boost;
+
+void RtFilterTask::Run() {
+    ostringstream oss;
+    filter_->FilterLines(lines_, oss);
+    collector_->Write(id_, oss.str(), "");
+}
+
+// Run the model
+void RtFilterRunner::Run(const ConfigRtFilterRunner & config) {
+
+    // Set the debugging level
+    GlobalVars::debug = config.GetInt("debug");
+    Timer timer;
+    timer.start();
+    int threads = config.GetInt("threads");
+    int block_size = config.GetInt("block_size");
+    if(threads < 1 || block_size < 1)
+        THROW_ERROR("threads and block_size must be at least one");
+
+    // Open the rule table, and read the first line to find its format
+    const vector<string> & args = config.GetMainArgs();
+    boost::scoped_ptr<istream> tm_file;
+    if(args.size() > 1 && args[1] != "-") {
+        tm_file.reset(new InputFileStream(args[1].c_str()));
+        if(!*tm_file)
+            THROW_ERROR("Could not find TM: " << args[1]);
+    }
+    istream & tm_in = (tm_file.get() ? *tm_file : cin);
+    string line;
+    bool has_line = !getline(tm_in, line).fail();
+    string format = config.GetString("format");
+    if(format == "guess" && has_line) {
+        vector<string> columns = Tokenize(line, " ||| ");
+        vector<string> src = Tokenize(columns[0], ' ');
+        format = (find(src.begin(), src.end(), "@") != src.end() ? "fsm" : "marisa");
+        PRINT_DEBUG("Guessed table format: " << format << endl, 1);
+    }
+
+    // Create the filter and add the input
+    boost::scoped_ptr<RuleTableFilter> filter;
+    if(format == "marisa" || format == "guess")
+        filter.reset(new RuleTableFilterTree);
+    else if(format == "fsm")
+        filter.reset(new RuleTableFilterHiero);
+    else
+        THROW_ERROR("Unknown table format: " << format);
+    boost::scoped_ptr<TreeIO> tree_io;
+    if(config.GetString("in_format") == "penn")
+        tree_io.reset(new PennTreeIO);
+    else if(config.GetString("in_format") == "egret")
+        tree_io.reset(new EgretTreeIO);
+    else if(config.GetString("in_format") == "moses")
+        tree_io.reset(new MosesXMLTreeIO);
+    else if(config.GetString("in_format") == "word")
+        tree_io.reset(new WordTreeIO);
+    else
+        THROW_ERROR("Bad in_format option " << config.GetString("in_format"));
+    boost::scoped_ptr<Binarizer> binarizer(Binarizer::CreateBinarizerFromString(config.GetString("binarize")));
+    InputFileStream input(args[0].c_str());
+    if(!input)
+        THROW_ERROR("Could not find input: " << args[0]);
+    int num_inputs = 0;
+    string tree_str;
+    while(tree_io->ReadRecord(input, tree_str)) {
+        boost::shared_ptr<HyperGraph> tree_graph(tree_io->ReadFromString(tree_str));
+        if(tree_graph.get() == NULL)
+            tree_graph.reset(new HyperGraph);
+        if(binarizer.get() != NULL) {
+            boost::shared_ptr<HyperGraph> bin_graph(binarizer->TransformGraph(*tree_graph));
+            tree_graph.swap(bin_graph);
+        }
+        filter->AddInput(*tree_graph);
+        num_inputs++;
+    }
+    PRINT_DEBUG("Read " << num_inputs << " inputs [" << timer << " sec]" << endl, 1);
+    // Symbols that are not in the input can never match, so don't add them
+    // to the dictionary, unless the table is compiled afterwards
+    bool compile = config.GetBool("compile");
+    if(!compile)
+        Dict::Freeze();
+
+    // Open the output. If the table is compiled, the filtered text is first
+    // collected in memory
+    boost::scoped_ptr<ostream> out_file;
+    if(args.size() > 2) {
+        out_file.reset(new ofstream(args[2].c_str(), ios::out | ios::binary));
+        if(!*out_file)
+            THROW_ERROR(args[2] << " could not be opened for writing");
+    }
+    ostream & out = (out_file.get() ? *out_file : cout);
+    ostringstream text_out;
+    OutputCollector collector(compile ? &text_out : &out, &cerr);
+
+    // Filter the table in blocks of lines, in parallel, and write them in order
+    ThreadPool::SetSharedSize(threads);
+    ThreadPool & pool = ThreadPool::GetShared();
+    TaskGroup group(pool, threads*4);
+    int num_blocks = 0;
+    long num_lines = 0;
+    while(has_line) {
+        RtFilterTask * task = new RtFilterTask(num_blocks++, filter.get(), &collector);
+        vector<string> & lines = task->GetLines();
+        lines.reserve(block_size);
+        do {
+            lines.push_back(line);
+            has_line = !getline(tm_in, line).fail();
+        } while(has_line && (int)lines.size() < block_size);
+        num_lines += lines.size();
+        if(threads == 1) {
+            task->Run();
+            delete task;
+        } else {
+            group.Submit(task);
+        }
+    }
+    group.Wait();
+    PRINT_DEBUG("Filtered " << num_lines << " lines of the table [" << timer << " sec]" << endl, 1);
+
+    // Compile the table if necessary
+    if(compile) {
+        istringstream text_in(text_out.str());
+        if(format == "fsm")
+            RuleFSM::CompileRuleTable(text_in, out);
+        else
+            LookupTableMarisa::CompileRuleTable(text_in, out);
+        PRINT_DEBUG("Compiled the filtered table [" << timer << " sec]" << endl, 1);
+    }
+    out.flush();
+
+}
@@ -0,0 +1,242 @@
+#include <travatar/rule-table-filter.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/string-util.h>
+#include <travatar/global-debug.h>
+#include <travatar/dict.h>
+#include <boost/foreach.hpp>
+#include <algorithm>
+#include <iterator>
+
+using namespace travatar;
+using namespace std;
+using namespace boost;
+
+void RuleTableFilter::FilterLines(const std::vector<std::string> & lines, std::ostream & out) const {
+    // Rules with the same source are usually next to each other, so only
+    // match each source once
+    string prev;
+    bool prev_matches = false;
+    for(int i = 0; i < (int)lines.size(); i++) {
+        const string & line = lines[i];
+        size_t pos = line.find(" ||| ");
+        if(pos == string::npos)
+            THROW_ERROR("Bad line in rule table: " << line);
+        if(i == 0 || line.compare(0, pos, prev) != 0) {
+            prev = line.substr(0, pos);
+            prev_matches = Matches(prev);
+        }
+        if(prev_matches)
+            out << line << '\n';
+    }
+}
+
+void RuleTableFilter::IndexWords(const Sentence & words, int sent,
+                                 boost::unordered_map<WordId, std::vector<int> > & index) {
+    BOOST_FOREACH(WordId wid, words) {
+        vector<int> & sents = index[wid];
+        if(sents.size() == 0 || *sents.rbegin() != sent)
+            sents.push_back(sent);
+    }
+}
+
+void RuleTableFilter::Intersect(std::vector<int> & sents, const std::vector<int> & other) {
+    vector<int> ret;
+    set_intersection(sents.begin(), sents.end(), other.begin(), other.end(), back_inserter(ret));
+    sents.swap(ret);
+}
+
+void RuleTableFilterTree::AddInput(const HyperGraph & input) {
+    int sent = inputs_.size();
+    boost::shared_ptr<HyperGraph> graph(new HyperGraph(input));
+    inputs_.push_back(graph);
+    nodes_.resize(sent+1);
+    BOOST_FOREACH(const HyperNode * node, graph->GetNodes()) {
+        if(node->IsTerminal())
+            continue;
+        nodes_[sent][node->GetSym()].push_back(node);
+        BOOST_FOREACH(const HyperEdge * edge, node->GetEdges()) {
+            Sentence key(1, node->GetSym());
+            BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+                key.push_back(tail->IsTerminal() ? -1-tail->GetSym() : tail->GetSym());
+            vector<int> & sents = productions_[key];
+            if(sents.size() == 0 || *sents.rbegin() != sent)
+                sents.push_back(sent);
+        }
+    }
+}
+
+bool RuleTableFilterTree::ParseFragment(const std::vector<std::string> & tokens, int & pos, Fragment & frag) {
+    if(pos >= (int)tokens.size())
+        return false;
+    const string & tok = tokens[pos];
+    if(tok.length() >= 2 && tok[0] == '"' && tok[tok.length()-1] == '"') {
+        frag.sym = Dict::WID(tok.substr(1, tok.length()-2));
+        frag.terminal = true;
+        pos++;
+    } else if(pos+1 < (int)tokens.size() && tokens[pos+1] == "(") {
+        frag.sym = Dict::WID(tok);
+        pos += 2;
+        while(pos < (int)tokens.size() && tokens[pos] != ")") {
+            frag.children.push_back(Fragment());
+            if(!ParseFragment(tokens, pos, *frag.children.rbegin()))
+                return false;
+        }
+        if(pos == (int)tokens.size() || frag.children.size() == 0)
+            return false;
+        pos++;
+    } else {
+        size_t colon = tok.find(':');
+        if(tok[0] != 'x' || colon == string::npos)
+            return false;
+        frag.sym = Dict::WID(tok.substr(colon+1));
+        pos++;
+    }
+    return true;
+}
+
+int RuleTableFilterTree::AddProductionKeys(const Fragment & frag, std::vector<Sentence> & keys) {
+    if(frag.sym < 0)
+        return -1;
+    Sentence key(1, frag.sym);
+    int depth = 0;
+    BOOST_FOREACH(const Fragment & child, frag.children) {
+        if(child.sym < 0)
+            return -1;
+        key.push_back(child.terminal ? -1-child.sym : child.sym);
+        if(child.children.size() != 0) {
+            int child_depth = AddProductionKeys(child, keys);
+            if(child_depth < 0)
+                return -1;
+            depth = max(depth, child_depth);
+        }
+    }
+    keys.push_back(key);
+    return depth+1;
+}
+
+bool RuleTableFilterTree::MatchFragment(const HyperNode & node, const Fragment & frag) {
+    BOOST_FOREACH(const HyperEdge * edge, node.GetEdges()) {
+        const vector<HyperNode*> & tails = edge->GetTails();
+        if(tails.size() != frag.children.size())
+            continue;
+        bool matches = true;
+        for(int i = 0; matches && i < (int)tails.size(); i++) {
+            const Fragment & child = frag.children[i];
+            if(tails[i]->GetSym() != child.sym || tails[i]->IsTerminal() != child.terminal)
+                matches = false;
+            else if(child.children.size() != 0)
+                matches = MatchFragment(*tails[i], child);
+        }
+        if(matches)
+            return true;
+    }
+    return false;
+}
+
+bool RuleTableFilterTree::Matches(const std::string & src) const {
+    vector<string> tokens = Tokenize(src, ' ');
+    Fragment root;
+    int pos = 0;
+    if(!ParseFragment(tokens, pos, root) || pos != (int)tokens.size())
+        THROW_ERROR("Bad source in rule table: " << src);
+    // A single word or non-terminal can't be checked against the input
+    if(root.children.size() == 0)
+        return true;
+    // Find the sentences that contain every production in the fragment
+    vector<Sentence> keys;
+    int depth = AddProductionKeys(root, keys);
+    if(depth < 0)
+        return false;
+    vector<int> sents;
+    for(int i = 0; i < (int)keys.size(); i++) {
+        boost::unordered_map<Sentence, vector<int> >::const_iterator it = productions_.find(keys[i]);
+        if(it == productions_.end())
+            return false;
+        if(i == 0)
+            sents = it->second;
+        else
+            Intersect(sents, it->second);
+        if(sents.size() == 0)
+            return false;
+    }
+    // A fragment with a single production matches if it is in any sentence
+    if(depth == 1)
+        return true;
+    // Otherwise, check if the productions are connected in the right way
+    BOOST_FOREACH(int sent, sents) {
+        boost::unordered_map<WordId, vector<const HyperNode*> >::const_iterator it = nodes_[sent].find(root.sym);
+        if(it == nodes_[sent].end())
+            continue;
+        BOOST_FOREACH(const HyperNode * node, it->second)
+            if(MatchFragment(*node, root))
+                return true;
+    }
+    return false;
+}
+
+void RuleTableFilterHiero::AddInput(const HyperGraph & input) {
+    IndexWords(input.GetWords(), sents_.size(), words_);
+    sents_.push_back(input.GetWords());
+}
+
+bool RuleTableFilterHiero::Matches(const std::string & src) const {
+    // Split the source into segments of words, and count the non-terminals
+    // before each segment and after the last one
+    vector<Sentence> segments;
+    vector<int> gaps(1, 0);
+    BOOST_FOREACH(const string & tok, Tokenize(src, ' ')) {
+        if(tok == "@") {
+            break;
+        } else if(tok.length() >= 2 && tok[0] == '"' && tok[tok.length()-1] == '"') {
+            if(*gaps.rbegin() != 0 || segments.size() == 0) {
+                segments.push_back(Sentence());
+                gaps.push_back(0);
+            }
+            segments.rbegin()->push_back(Dict::WID(tok.substr(1, tok.length()-2)));
+        } else {
+            (*gaps.rbegin())++;
+        }
+    }
+    // Rules without words can be used anywhere
+    if(segments.size() == 0)
+        return true;
+    // Find the sentences that contain every word
+    vector<int> sents;
+    bool first = true;
+    BOOST_FOREACH(const Sentence & segment, segments) {
+        BOOST_FOREACH(WordId wid, segment) {
+            boost::unordered_map<WordId, vector<int> >::const_iterator it = words_.find(wid);
+            if(it == words_.end())
+                return false;
+            if(first)
+                sents = it->second;
+            else
+                Intersect(sents, it->second);
+            first = false;
+            if(sents.size() == 0)
+                return false;
+        }
+    }
+    // Match each segment at its earliest position, leaving at least one word
+    // for each non-terminal. As there are only lower bounds on the gaps, this
+    // finds a match whenever one exists
+    BOOST_FOREACH(int sent, sents) {
+        const Sentence & words = sents_[sent];
+        Sentence::const_iterator pos = words.begin();
+        bool matches = true;
+        for(int i = 0; matches && i < (int)segments.size(); i++) {
+            if(words.end() - pos < gaps[i]) {
+                matches = false;
+                continue;
+            }
+            pos = search(pos + gaps[i], words.end(), segments[i].begin(), segments[i].end());
+            if(pos == words.end())
+                matches = false;
+            else
+                pos += segments[i].size();
+        }
+        if(matches && words.end() - pos >= *gaps.rbegin())
+            return true;
+    }
+    return false;
+}
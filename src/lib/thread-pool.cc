@@ -1,72 +1,264 @@
 #include <travatar/thread-pool.h>
 #include <travatar/global-debug.h>
 #include <travatar/task.h>
+#include <boost/thread/tss.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <algorithm>
 
 using namespace travatar;
 using namespace std;
 using namespace boost;
 
+namespace {
+// The pool and ID of the worker running on this thread
+struct WorkerInfo {
+    WorkerInfo(ThreadPool * p, int i) : pool(p), id(i) { }
+    ThreadPool * pool;
+    int id;
+};
+boost::thread_specific_ptr<WorkerInfo> current_worker;
+
+boost::mutex shared_pool_mutex;
+boost::scoped_ptr<ThreadPool> shared_pool;
+int shared_pool_size = 0;
+}
+
 ThreadPool::ThreadPool(int num_threads, int queue_limit) :
+        num_idle_(0), num_pending_(0),
         stopped_(false), stopping_(false), delete_tasks_(true),
-        queue_limit_(queue_limit) {
+        queue_limit_(queue_limit), max_queue_size_(0) {
     for(int i = 0; i < num_threads; i++)
-        threads_.create_thread(bind(&ThreadPool::Run, this));
+        workers_.push_back(boost::shared_ptr<Worker>(new Worker));
+    for(int i = 0; i < num_threads; i++)
+        threads_.create_thread(bind(&ThreadPool::Run, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    Stop(false);
+}
+
+void ThreadPool::SetSharedSize(int size) {
+    boost::mutex::scoped_lock lock(shared_pool_mutex);
+    if(size <= 0)
+        THROW_ERROR("The shared thread pool must have at least one thread, but " << size << " were requested");
+    if(shared_pool.get() != NULL && shared_pool->GetNumThreads() != size)
+        THROW_ERROR("The shared thread pool was already created with " << shared_pool->GetNumThreads() << " threads, and cannot be resized to " << size);
+    shared_pool_size = size;
 }
 
-void ThreadPool::Run() {
+ThreadPool & ThreadPool::GetShared() {
+    boost::mutex::scoped_lock lock(shared_pool_mutex);
+    if(shared_pool.get() == NULL) {
+        int size = shared_pool_size;
+        if(size <= 0)
+            size = max(1, (int)boost::thread::hardware_concurrency());
+        shared_pool.reset(new ThreadPool(size));
+    }
+    return *shared_pool;
+}
+
+void ThreadPool::Run(int id) {
+    current_worker.reset(new WorkerInfo(this, id));
+    Item item;
     while(!stopped_) {
-        Task* task = NULL;
-        {
-            boost::mutex::scoped_lock lock(mutex_);
-            if(tasks_.empty() && !stopped_)
-                thread_needed_.wait(lock);
-            if(!stopped_ && !tasks_.empty()) {
-                task = tasks_.front();
-                tasks_.pop();
-            }
+        if(PopLocal(item) || PopShared(item)) {
+            Execute(item);
+            continue;
         }
-        if(task) {
-            task->Run();
-            if(delete_tasks_)
-                delete task;
+        // Sleep until there is more work. Re-check after registering as idle
+        // so we do not miss a task that was pushed in the meantime
+        boost::mutex::scoped_lock lock(mutex_);
+        if(stopped_) break;
+        ++num_idle_;
+        if(!HasWork())
+            thread_needed_.wait(lock);
+        --num_idle_;
+    }
+}
+
+void ThreadPool::Push(const Item & item) {
+    ++num_pending_;
+    WorkerInfo * info = current_worker.get();
+    if(info != NULL && info->pool == this) {
+        Worker & worker = *workers_[info->id];
+        boost::mutex::scoped_lock lock(worker.mutex);
+        worker.tasks.push_back(item);
+    } else {
+        boost::mutex::scoped_lock lock(shared_mutex_);
+        if(stopping_) {
+            --num_pending_;
+            THROW_ERROR("Cannot accept new jobs while ThreadPool is stopping");
         }
-        thread_available_.notify_all();
+        while(queue_limit_ && (int)shared_.size() >= queue_limit_)
+            shared_available_.wait(lock);
+        shared_.push_back(item);
+        max_queue_size_ = max(max_queue_size_, (int)shared_.size());
+    }
+    if(num_idle_ > 0) {
+        boost::mutex::scoped_lock lock(mutex_);
+        thread_needed_.notify_one();
     }
 }
 
-void ThreadPool::Submit(Task* task) {
-    boost::mutex::scoped_lock lock(mutex_);
-    if(stopping_)
-        THROW_ERROR("Cannot accept new jobs while ThreadPool is stopping");
-    while(queue_limit_ && (int)tasks_.size() >= queue_limit_)
-        thread_available_.wait(lock);
-    tasks_.push(task);
-    thread_needed_.notify_all();
+bool ThreadPool::PopLocal(Item & item) {
+    WorkerInfo * info = current_worker.get();
+    if(info == NULL || info->pool != this)
+        return false;
+    int id = info->id, size = workers_.size();
+    // Take the newest task from our own deque
+    {
+        Worker & worker = *workers_[id];
+        boost::mutex::scoped_lock lock(worker.mutex);
+        if(worker.tasks.size()) {
+            item = worker.tasks.back();
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+    // Steal the oldest task from another worker
+    for(int i = 1; i < size; i++) {
+        Worker & worker = *workers_[(id+i) % size];
+        boost::mutex::scoped_lock lock(worker.mutex);
+        if(worker.tasks.size()) {
+            item = worker.tasks.front();
+            worker.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
 }
 
-void ThreadPool::Wait() {
-    while(!tasks_.empty()) {
+bool ThreadPool::PopShared(Item & item) {
+    boost::mutex::scoped_lock lock(shared_mutex_);
+    if(shared_.size() == 0)
+        return false;
+    item = shared_.front();
+    shared_.pop_front();
+    if(queue_limit_)
+        shared_available_.notify_all();
+    return true;
+}
+
+bool ThreadPool::HasWork() {
+    {
+        boost::mutex::scoped_lock lock(shared_mutex_);
+        if(shared_.size()) return true;
+    }
+    for(int i = 0; i < (int)workers_.size(); i++) {
+        boost::mutex::scoped_lock lock(workers_[i]->mutex);
+        if(workers_[i]->tasks.size()) return true;
+    }
+    return false;
+}
+
+void ThreadPool::Execute(const Item & item) {
+    item.first->Run();
+    Finish(item);
+}
+
+void ThreadPool::Finish(const Item & item) {
+    if(item.second != NULL) {
+        if(item.second->GetDeleteTasks())
+            delete item.first;
+        item.second->Finish();
+    } else if(delete_tasks_) {
+        delete item.first;
+    }
+    if(--num_pending_ == 0) {
         boost::mutex::scoped_lock lock(mutex_);
-        thread_available_.wait(lock);
+        all_done_.notify_all();
     }
-    sleep(1);
+}
+
+void ThreadPool::Submit(Task* task) {
+    Push(Item(task, (TaskGroup*)NULL));
+}
+
+void ThreadPool::Wait() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while(num_pending_ > 0)
+        all_done_.wait(lock);
 }
 
 void ThreadPool::Stop(bool process_remaining) {
     {
-        boost::mutex::scoped_lock lock(mutex_);
-        if(stopped_) return;
+        boost::mutex::scoped_lock lock(shared_mutex_);
+        if(stopping_) return;
         stopping_ = true;
     }
-    if(process_remaining) {
-        boost::mutex::scoped_lock lock(mutex_);
-        while(!tasks_.empty() && !stopped_)
-            thread_available_.wait(lock);
-    }
+    if(process_remaining)
+        Wait();
     {
         boost::mutex::scoped_lock lock(mutex_);
         stopped_ = true;
+        thread_needed_.notify_all();
     }
-    thread_needed_.notify_all();
     threads_.join_all();
+    Discard();
+}
+
+void ThreadPool::Discard() {
+    vector<Item> items;
+    {
+        boost::mutex::scoped_lock lock(shared_mutex_);
+        items.insert(items.end(), shared_.begin(), shared_.end());
+        shared_.clear();
+        shared_available_.notify_all();
+    }
+    BOOST_FOREACH(const boost::shared_ptr<Worker> & worker, workers_) {
+        boost::mutex::scoped_lock lock(worker->mutex);
+        items.insert(items.end(), worker->tasks.begin(), worker->tasks.end());
+        worker->tasks.clear();
+    }
+    BOOST_FOREACH(const Item & item, items)
+        Finish(item);
+}
+
+int ThreadPool::GetQueueSize() {
+    boost::mutex::scoped_lock lock(shared_mutex_);
+    return shared_.size();
+}
+
+int ThreadPool::GetMaxQueueSize() {
+    boost::mutex::scoped_lock lock(shared_mutex_);
+    return max_queue_size_;
+}
+
+void TaskGroup::Submit(Task * task) {
+    if(limit_)
+        WaitUntil(limit_-1);
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        pending_++;
+    }
+    pool_->Push(ThreadPool::Item(task, this));
+}
+
+void TaskGroup::Wait() {
+    WaitUntil(0);
+}
+
+void TaskGroup::WaitUntil(int max_pending) {
+    while(true) {
+        // Workers of the pool help with the tasks on the deques
+        ThreadPool::Item item;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            if(pending_ <= max_pending) return;
+        }
+        if(pool_->PopLocal(item)) {
+            pool_->Execute(item);
+        } else {
+            boost::mutex::scoped_lock lock(mutex_);
+            if(pending_ > max_pending)
+                finished_.wait(lock);
+        }
+    }
+}
+
+void TaskGroup::Finish() {
+    boost::mutex::scoped_lock lock(mutex_);
+    pending_--;
+    finished_.notify_all();
 }
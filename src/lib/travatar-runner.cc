@@ -7,15 +7,23 @@
 #include <travatar/tree-io.h>
 #include <travatar/translation-rule.h>
 #include <travatar/travatar-runner.h>
+#include <travatar/rule-table-limit.h>
 #include <travatar/trimmer-nbest.h>
+#include <travatar/trimmer-max-marginal.h>
+#include <travatar/trimmer-posterior.h>
+#include <travatar/trimmer-top-k.h>
 #include <travatar/lookup-table-hash.h>
 #include <travatar/lookup-table-marisa.h>
+#include <travatar/lookup-table-trie.h>
 #include <travatar/lookup-table-fsm.h>
 #include <travatar/weights.h>
 #include <travatar/weights-perceptron.h>
 #include <travatar/weights-delayed-perceptron.h>
+#include <travatar/weight-vector.h>
 #include <travatar/lm-composer-bu.h>
+#include <travatar/lm-composer-coarse-to-fine.h>
 #include <travatar/lm-composer-incremental.h>
+#include <travatar/lm-score-cache.h>
 #include <travatar/binarizer.h>
 #include <travatar/eval-measure.h>
 #include <travatar/eval-measure-loader.h>
@@ -35,16 +43,44 @@ using namespace lm::ngram;
 
 void TravatarRunnerTask::Run() {
     typedef boost::shared_ptr<GraphTransformer> GTPtr;
-    PRINT_DEBUG("Translating sentence " << sent_ << endl << Dict::PrintWords(tree_graph_->GetWords()) << endl, 1);
-    // { /* DEBUG */ JSONTreeIO io; io.WriteTree(*tree_graph_, cerr); cerr << endl; }
+    // Parse the input here, so parsing is done in parallel with other sentences
+    boost::shared_ptr<HyperGraph> tree_graph;
+    try {
+        tree_graph.reset(runner_->GetTreeIO().ReadFromString(tree_str_));
+    } catch(std::exception & e) {
+        // The run fails once the other sentences are done. Write nothing for
+        // this sentence, so the later ones are not kept waiting
+        runner_->SetInputError(sent_, e.what());
+        collector_->Write(sent_, "", "");
+        if(nbest_collector_ != NULL) nbest_collector_->Write(sent_, "", "");
+        if(trace_collector_ != NULL) trace_collector_->Write(sent_, "", "");
+        if(forest_collector_ != NULL) forest_collector_->Write(sent_, "", "");
+        return;
+    }
+    if(tree_graph.get() == NULL)
+        tree_graph.reset(new HyperGraph);
+    PRINT_DEBUG("Translating sentence " << sent_ << endl << Dict::PrintWords(tree_graph->GetWords()) << endl, 1);
+    // { /* DEBUG */ JSONTreeIO io; io.WriteTree(*tree_graph, cerr); cerr << endl; }
     // Binarizer if necessary
     if(runner_->HasBinarizer()) {
-        boost::shared_ptr<HyperGraph> bin_graph(runner_->GetBinarizer().TransformGraph(*tree_graph_));
-        tree_graph_.swap(bin_graph);
+        boost::shared_ptr<HyperGraph> bin_graph(runner_->GetBinarizer().TransformGraph(*tree_graph));
+        tree_graph.swap(bin_graph);
+    }
+    // { /* DEBUG */ JSONTreeIO io; io.WriteTree(*tree_graph, cerr); cerr << endl; }
+    boost::shared_ptr<HyperGraph> rule_graph(runner_->GetTM().TransformGraph(*tree_graph));
+    if(runner_->GetDoTuning())
+        rule_graph->ScoreEdges(runner_->GetWeights());
+    else
+        rule_graph->ScoreEdges(runner_->GetWeightVector());
+    // Trim the rule graph using only the TM scores
+    if(rule_graph->NumNodes() > 0) {
+        BOOST_FOREACH(GTPtr trimmer, runner_->GetRuleTrimmers()) {
+            int num_edges = rule_graph->NumEdges();
+            boost::shared_ptr<HyperGraph> trim_graph(trimmer->TransformGraph(*rule_graph));
+            trim_graph.swap(rule_graph);
+            PRINT_DEBUG("SENT " << sent_ << " rule graph trimmed: " << num_edges << " -> " << rule_graph->NumEdges() << " edges" << endl, 2);
+        }
     }
-    // { /* DEBUG */ JSONTreeIO io; io.WriteTree(*tree_graph_, cerr); cerr << endl; }
-    boost::shared_ptr<HyperGraph> rule_graph(runner_->GetTM().TransformGraph(*tree_graph_));
-    rule_graph->ScoreEdges(runner_->GetWeights());
     rule_graph->ResetViterbiScores();
 
     // If we have an lm, score with the LM
@@ -102,8 +138,8 @@ void TravatarRunnerTask::Run() {
             }
             trace_collector_->Write(sent_, trace_out.str(), "");
         } else {
-            // Skip this sentence
-            trace_collector_->Skip();
+            // Skip this sentence, but keep the output in order
+            trace_collector_->Write(sent_, "", "");
         }
     }
 
@@ -115,17 +151,29 @@ void TravatarRunnerTask::Run() {
             out_for.reset(runner_->GetTrimmer().TransformGraph(*out_for));
         // Print
         ostringstream forest_out;
-        JSONTreeIO io;
-        io.WriteTree(*out_for, forest_out);
+        runner_->GetForestIO().WriteTree(*out_for, forest_out);
         forest_out << endl;
         forest_collector_->Write(sent_, forest_out.str(), "");
     }
 
     // If we are tuning load the next references and check the weights
     if(runner_->GetDoTuning())
-        runner_->GetWeights().Adjust(tree_graph_->GetWords(), refs_, runner_->GetEvalMeasure(), nbest_list);
+        runner_->GetWeights().Adjust(tree_graph->GetWords(), refs_, runner_->GetEvalMeasure(), nbest_list);
+}
+
+
+void TravatarRunner::SetInputError(int sent, const string & error) {
+    boost::mutex::scoped_lock lock(input_error_mutex_);
+    if(input_error_sent_ == -1 || sent < input_error_sent_) {
+        input_error_sent_ = sent;
+        input_error_ = error;
+    }
 }
 
+bool TravatarRunner::HasInputError() const {
+    boost::mutex::scoped_lock lock(input_error_mutex_);
+    return input_error_sent_ != -1;
+}
 
 // Run the model
 void TravatarRunner::Run(const ConfigTravatarRunner & config) {
@@ -143,6 +191,14 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
     Timer timer;
     timer.start();
 
+    // Load the vocabulary before any other words are used
+    if(config.GetString("vocab_in") != "") {
+        ifstream vocab_in(config.GetString("vocab_in").c_str(), ios::in | ios::binary);
+        if(!vocab_in)
+            THROW_ERROR("Could not open vocabulary file: " << config.GetString("vocab_in"));
+        Dict::ReadVocab(vocab_in);
+    }
+
     // Set weights
     if(config.GetString("weight_vals") == "") {
         THROW_ERROR("You must specify weights through -weight_vals. If you really don't want any weights, just set -weight_vals dummy=0");
@@ -165,6 +221,7 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
     } else {
         THROW_ERROR("Invalid value for tune_update: "<<config.GetString("tune_update"));
     }    
+    weight_vector_.reset(new WeightVector(init_weights));
     vector<boost::shared_ptr<istream> > tune_ins;
     // If we need to do tuning
     if(do_tuning_) {
@@ -204,15 +261,14 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
     binarizer_.reset(Binarizer::CreateBinarizerFromString(config.GetString("binarize")));
 
     // Get the input format parser
-    boost::shared_ptr<TreeIO> tree_io;
     if(config.GetString("in_format") == "penn")
-        tree_io = boost::shared_ptr<TreeIO>(new PennTreeIO);
+        tree_io_ = boost::shared_ptr<TreeIO>(new PennTreeIO);
     else if(config.GetString("in_format") == "egret")
-        tree_io = boost::shared_ptr<TreeIO>(new EgretTreeIO);
+        tree_io_ = boost::shared_ptr<TreeIO>(new EgretTreeIO);
     else if(config.GetString("in_format") == "moses")
-        tree_io = boost::shared_ptr<TreeIO>(new MosesXMLTreeIO);
+        tree_io_ = boost::shared_ptr<TreeIO>(new MosesXMLTreeIO);
     else if(config.GetString("in_format") == "word") 
-        tree_io = boost::shared_ptr<TreeIO>(new WordTreeIO);
+        tree_io_ = boost::shared_ptr<TreeIO>(new WordTreeIO);
     else
         THROW_ERROR("Bad in_format option " << config.GetString("in_format"));
 
@@ -222,6 +278,9 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
     string lm_string = config.GetString("lm_file");
     if(lm_string != "") {
         vector<string> lm_files = Tokenize(lm_string, " ");
+        // The cache is shared by all of the composers and threads
+        if(config.GetInt("lm_cache_size") > 0)
+            lm_cache_.reset(new LMScoreCache((size_t)config.GetInt("lm_cache_size") << 20));
         string multi_type = config.GetString("lm_multi_type");
         if(multi_type == "joint") {
             if(pop_limits.size() != 1)
@@ -241,35 +300,123 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
         } else {
             THROW_ERROR("Illegal lm_multi_type option " << multi_type);
         }
+        // Prune the rule graph with a coarse pass before the first LM
+        string coarse_file = config.GetString("lm_coarse_file");
+        if(coarse_file != "") {
+            coarse_lm_ = CreateLMComposer(config,
+                                          vector<string>(1, coarse_file),
+                                          config.GetInt("lm_coarse_pop_limit"),
+                                          weights_->GetCurrent());
+            ctf_.reset(new LMComposerCoarseToFine(coarse_lm_, lms_[0], config.GetReal("lm_coarse_threshold")));
+        }
     }
 
+    // Calculate the LM scores inside of each rule as the rules are loaded
+    boost::shared_ptr<RulePreparer> preparer;
+    if(config.GetBool("lm_precompute") && lms_.size() > 0) {
+        LMRulePreparer * lm_preparer = new LMRulePreparer;
+        BOOST_FOREACH(const boost::shared_ptr<GraphTransformer> & lm, lms_)
+            BOOST_FOREACH(const LMData * data, dynamic_cast<const LMComposer&>(*lm).GetData())
+                lm_preparer->AddData(data);
+        if(coarse_lm_.get() != NULL) {
+            BOOST_FOREACH(const LMData * data, dynamic_cast<const LMComposer&>(*coarse_lm_).GetData())
+                lm_preparer->AddData(data);
+        }
+        preparer.reset(lm_preparer);
+    }
+    if(ctf_.get() != NULL)
+        lms_[0] = ctf_;
+
     // Load the rule table
     PRINT_DEBUG(endl << "Loading translation model [" << timer << " sec]" << endl, 1);
+    boost::shared_ptr<RuleTableLimit> table_limit;
+    if(config.GetInt("tm_table_limit") > 0)
+        table_limit.reset(new RuleTableLimit(config.GetInt("tm_table_limit"), weights_->GetCurrent()));
     vector<string> tm_files = config.GetStringArray("tm_file");
     if(config.GetString("tm_storage") == "hash") {
         LookupTableHash * hash_tm_ = LookupTableHash::ReadFromFile(tm_files[0]);
         hash_tm_->SetMatchAllUnk(config.GetBool("all_unk"));
         hash_tm_->SetSaveSrcStr(save_src_str);
         hash_tm_->SetConsiderTrg(consider_trg);
+        if(table_limit.get() != NULL)
+            hash_tm_->SetTableLimit(table_limit);
+        if(preparer.get() != NULL)
+            hash_tm_->SetRulePreparer(preparer);
         tm_.reset(hash_tm_);
     } else if(config.GetString("tm_storage") == "marisa") {
         LookupTableMarisa * marisa_tm_ = LookupTableMarisa::ReadFromFile(tm_files[0]);
         marisa_tm_->SetMatchAllUnk(config.GetBool("all_unk"));
         marisa_tm_->SetSaveSrcStr(save_src_str);
         marisa_tm_->SetConsiderTrg(consider_trg);
+        if(table_limit.get() != NULL)
+            marisa_tm_->SetTableLimit(table_limit);
+        if(preparer.get() != NULL)
+            marisa_tm_->SetRulePreparer(preparer);
+        tm_.reset(marisa_tm_);
+    } else if(config.GetString("tm_storage") == "trie") {
+        LookupTableTrie * trie_tm_ = LookupTableTrie::ReadFromFile(tm_files[0]);
+        trie_tm_->SetMatchAllUnk(config.GetBool("all_unk"));
+        trie_tm_->SetSaveSrcStr(save_src_str);
+        trie_tm_->SetConsiderTrg(consider_trg);
+        if(table_limit.get() != NULL)
+            trie_tm_->SetTableLimit(table_limit);
+        if(preparer.get() != NULL)
+            trie_tm_->SetRulePreparer(preparer);
+        tm_.reset(trie_tm_);
+    } else if(config.GetString("tm_storage") == "marisa-bin") {
+        LookupTableMarisa * marisa_tm_ = LookupTableMarisa::ReadFromBinaryFile(tm_files[0]);
+        marisa_tm_->SetMatchAllUnk(config.GetBool("all_unk"));
+        marisa_tm_->SetSaveSrcStr(save_src_str);
+        marisa_tm_->SetConsiderTrg(consider_trg);
+        if(table_limit.get() != NULL)
+            marisa_tm_->SetTableLimit(table_limit);
+        if(preparer.get() != NULL)
+            marisa_tm_->SetRulePreparer(preparer);
         tm_.reset(marisa_tm_);
-    }  else if (config.GetString("tm_storage") == "fsm") {
-        LookupTableFSM * fsm_tm_ = LookupTableFSM::ReadFromFiles(tm_files);
+    }  else if (config.GetString("tm_storage") == "fsm" || config.GetString("tm_storage") == "fsm-bin") {
+        LookupTableFSM * fsm_tm_ = (config.GetString("tm_storage") == "fsm" ?
+                                    LookupTableFSM::ReadFromFiles(tm_files) :
+                                    LookupTableFSM::ReadFromBinaryFiles(tm_files));
         fsm_tm_->SetTrgFactors(GlobalVars::trg_factors);
         fsm_tm_->SetDeleteUnknown(config.GetBool("delete_unknown"));
         fsm_tm_->SetRootSymbol(Dict::WID(config.GetString("root_symbol")));
         fsm_tm_->SetSpanLimits(config.GetIntArray("hiero_span_limit"));
         fsm_tm_->SetSaveSrcStr(save_src_str);
+        fsm_tm_->SetNumThreads(config.GetInt("lookup_threads"));
+        if(table_limit.get() != NULL)
+            fsm_tm_->SetTableLimit(table_limit);
+        if(preparer.get() != NULL)
+            fsm_tm_->SetRulePreparer(preparer);
         tm_.reset(fsm_tm_);
     } else {
         THROW_ERROR("Unknown storage type: " << config.GetString("tm_storage"));
     }
 
+    // Create the trimmers for the rule graph
+    if(config.GetInt("rule_trim_top_k") > 0)
+        rule_trimmers_.push_back(boost::shared_ptr<GraphTransformer>(new TrimmerTopK(config.GetInt("rule_trim_top_k"))));
+    string rule_trim = config.GetString("rule_trim");
+    if(rule_trim == "max_marginal")
+        rule_trimmers_.push_back(boost::shared_ptr<GraphTransformer>(new TrimmerMaxMarginal(config.GetReal("rule_trim_threshold"))));
+    else if(rule_trim == "posterior")
+        rule_trimmers_.push_back(boost::shared_ptr<GraphTransformer>(new TrimmerPosterior(config.GetReal("rule_trim_threshold"))));
+    else if(rule_trim != "none")
+        THROW_ERROR("Illegal rule_trim option " << rule_trim);
+
+    // Save the vocabulary after all of the models are loaded
+    if(config.GetString("vocab_out") != "") {
+        ofstream vocab_out(config.GetString("vocab_out").c_str(), ios::out | ios::binary);
+        if(!vocab_out)
+            THROW_ERROR("Could not open vocabulary file for writing: " << config.GetString("vocab_out"));
+        Dict::WriteVocab(vocab_out);
+    }
+
+    // The number of finished sentences that can wait for an earlier one
+    // before the output is written
+    int window = config.GetInt("reorder_window");
+    if(window == 0)
+        window = threads_ * 4;
+
     // Open the n-best output stream if it exists
     scoped_ptr<ostream> nbest_out;
     scoped_ptr<OutputCollector> nbest_collector;
@@ -277,7 +424,7 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
         nbest_out.reset(new ofstream(config.GetString("nbest_out").c_str()));
         if(!*nbest_out)
             THROW_ERROR("Could not open nbest output file: " << config.GetString("nbest_out"));
-        nbest_collector.reset(new OutputCollector(nbest_out.get(), &cerr, config.GetBool("buffer")));
+        nbest_collector.reset(new OutputCollector(nbest_out.get(), &cerr, config.GetBool("buffer"), window));
     } else if (!do_tuning_) {
         nbest_count_ = 1;
     }
@@ -286,10 +433,16 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
     scoped_ptr<ostream> forest_out;
     scoped_ptr<OutputCollector> forest_collector;
     if(config.GetString("forest_out") != "") {
-        forest_out.reset(new ofstream(config.GetString("forest_out").c_str()));
+        if(config.GetString("forest_format") == "json")
+            forest_io_.reset(new JSONTreeIO);
+        else if(config.GetString("forest_format") == "binary")
+            forest_io_.reset(new BinaryTreeIO);
+        else
+            THROW_ERROR("Bad forest_format option " << config.GetString("forest_format"));
+        forest_out.reset(new ofstream(config.GetString("forest_out").c_str(), ios::out | ios::binary));
         if(!*forest_out)
             THROW_ERROR("Could not open forest output file: " << config.GetString("forest_out"));
-        forest_collector.reset(new OutputCollector(forest_out.get(), &cerr, config.GetBool("buffer")));
+        forest_collector.reset(new OutputCollector(forest_out.get(), &cerr, config.GetBool("buffer"), window));
     } 
 
     // Get the class to trim the forest if necessary
@@ -304,20 +457,24 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
         trace_out.reset(new ofstream(config.GetString("trace_out").c_str()));
         if(!*trace_out)
             THROW_ERROR("Could not open trace output file: " << config.GetString("trace_out"));
-        trace_collector.reset(new OutputCollector(trace_out.get(), &cerr, config.GetBool("buffer")));
+        trace_collector.reset(new OutputCollector(trace_out.get(), &cerr, config.GetBool("buffer"), window));
     }
 
-    // Create the thread pool
-    ThreadPool pool(threads_, threads_*5);
-    OutputCollector collector;
+    // Create the thread pools. The main thread only reads the input text,
+    // parsing and translation are done by a pool of "threads" workers, so at
+    // most that many sentences are decoded at once, and the collectors keep
+    // the output in order. The LM composers and the hiero rule lookup split
+    // up a single sentence over the shared pool
+    ThreadPool::SetSharedSize(max(config.GetInt("lm_threads"), config.GetInt("lookup_threads")));
+    ThreadPool pool(threads_);
+    TaskGroup group(pool, threads_*6);
+    OutputCollector collector(&cout, &cerr, true, window);
     // Process one at a time
     int sent = 0;
-    string line;
+    string tree_str;
     PRINT_DEBUG("Started translating [" << timer << " sec]" << endl, 1);
-    while(1) {
-        // Load the tree
-        boost::shared_ptr<HyperGraph> tree_graph(tree_io->ReadTree(std::cin));
-        if(tree_graph.get() == NULL) break;
+    // Stop reading once some input could not be parsed
+    while(!HasInputError() && tree_io_->ReadRecord(std::cin, tree_str)) {
 
         // If we are tuning load the next references and check the weights
         vector<Sentence> refs;
@@ -329,16 +486,18 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
             }
         }
 
-        TravatarRunnerTask *task = new TravatarRunnerTask(sent++, tree_graph, this, refs, &collector, nbest_collector.get(), trace_collector.get(), forest_collector.get());
+        TravatarRunnerTask *task = new TravatarRunnerTask(sent++, tree_str, this, refs, &collector, nbest_collector.get(), trace_collector.get(), forest_collector.get());
         if(threads_ == 1) {
             task->Run();
             delete task;
         } else {
-            pool.Submit(task);
+            group.Submit(task);
         }
         cerr << (sent%100==0?'!':'.'); cerr.flush();
+        if(sent%100==0)
+            PRINT_DEBUG(" [queue=" << pool.GetQueueSize() << ", reorder=" << collector.GetNumSaved() << "]", 2);
     }
-    pool.Stop(true);
+    group.Wait();
     // Make sure all the collector flushed their output
     if (trace_collector.get() != NULL) 
         trace_collector->Flush();
@@ -346,6 +505,16 @@ void TravatarRunner::Run(const ConfigTravatarRunner & config) {
         nbest_collector->Flush();
     if (forest_collector.get() != NULL)
         forest_collector->Flush();
+    if(input_error_sent_ != -1)
+        THROW_ERROR("Could not parse the input of sentence " << input_error_sent_ << ": " << input_error_);
+    PRINT_DEBUG(endl << "Max queue depth: input=" << pool.GetMaxQueueSize() << ", reorder=" << collector.GetMaxSaved() << "/" << window, 1);
+
+    if(ctf_.get() != NULL) {
+        CoarseToFineStats stats = ctf_->GetStats();
+        PRINT_DEBUG(endl << "Coarse-to-fine: coarse=" << stats.coarse_time << "s, fine=" << stats.fine_time << "s, kept edges=" << stats.kept_edges << "/" << stats.edges, 1);
+    }
+    if(lm_cache_.get() != NULL)
+        PRINT_DEBUG(endl << "LM cache: hits=" << lm_cache_->GetHits() << ", misses=" << lm_cache_->GetMisses() << ", entries=" << lm_cache_->GetSize() << ", bytes=" << lm_cache_->GetBytes() << "/" << lm_cache_->GetMaxBytes(), 1);
 
     // Finished translating
     PRINT_DEBUG(endl << "Done translating [" << timer << " sec]" << endl, 1);
@@ -374,11 +543,17 @@ boost::shared_ptr<GraphTransformer> TravatarRunner::CreateLMComposer(
         LMComposerBU * bu = new LMComposerBU(lm_files);
         bu->SetStackPopLimit(pop_limit);
         bu->SetChartLimit(config.GetInt("chart_limit"));
+        bu->SetNumThreads(config.GetInt("lm_threads"));
+        bu->SetOutsideBeam(config.GetReal("outside_beam"));
+        bu->SetScoreCache(lm_cache_);
         bu->UpdateWeights(weights);
         ret.reset(bu);
     } else if(search == "inc") {
         LMComposerIncremental * inc = new LMComposerIncremental(lm_files);
         inc->SetStackPopLimit(pop_limit);
+        inc->SetNumThreads(config.GetInt("lm_threads"));
+        inc->SetOutsideBeam(config.GetReal("outside_beam"));
+        inc->SetScoreCache(lm_cache_);
         inc->UpdateWeights(weights);
         ret.reset(inc);
     } else {
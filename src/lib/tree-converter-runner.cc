@@ -33,6 +33,10 @@ void TreeConverterRunner::Run(const ConfigTreeConverterRunner & config) {
         tree_in.reset(new EgretTreeIO);
     else if(config.GetString("input_format") == "json")
         tree_in.reset(new JSONTreeIO);
+    else if(config.GetString("input_format") == "binary")
+        tree_in.reset(new BinaryTreeIO);
+    else if(config.GetString("input_format") == "mosesxml")
+        tree_in.reset(new MosesXMLTreeIO);
     else if(config.GetString("input_format") == "rule")
         tree_in.reset(new RuleTreeIO);
     else if(config.GetString("input_format") == "word")
@@ -47,6 +51,8 @@ void TreeConverterRunner::Run(const ConfigTreeConverterRunner & config) {
         tree_out.reset(new EgretTreeIO);
     else if(config.GetString("output_format") == "json")
         tree_out.reset(new JSONTreeIO);
+    else if(config.GetString("output_format") == "binary")
+        tree_out.reset(new BinaryTreeIO);
     else if(config.GetString("output_format") == "mosesxml")
         tree_out.reset(new MosesXMLTreeIO);
     else if(config.GetString("output_format") == "rule")
@@ -89,7 +95,7 @@ void TreeConverterRunner::Run(const ConfigTreeConverterRunner & config) {
     const vector<string> & argv = config.GetMainArgs();
     istream * src_in;
     if(argv.size() == 1 && argv[0] != "-") {
-        src_in = new ifstream(argv[0].c_str());
+        src_in = new ifstream(argv[0].c_str(), ios::in | ios::binary);
         if(!src_in) THROW_ERROR("Could not find src file: " << argv[0]);
     } else {
         src_in = &cin;
@@ -100,10 +106,11 @@ void TreeConverterRunner::Run(const ConfigTreeConverterRunner & config) {
     int sent = 0;
     cerr << "Transforming trees (.=10,000, !=100,000 sentences)" << endl;
     try {
-    while(true) {
+    while(tree_in->ReadRecord(*src_in, src_line)) {
         // Parse into the appropriate data structures
-        boost::shared_ptr<HyperGraph> src_graph(tree_in->ReadTree(*src_in));
-        if(src_graph.get() == NULL) break;
+        boost::shared_ptr<HyperGraph> src_graph(tree_in->ReadFromString(src_line));
+        if(src_graph.get() == NULL)
+            src_graph.reset(new HyperGraph);
         // { /* DEBUG */ JSONTreeIO io; io.WriteTree(*src_graph, cerr); cerr << endl; }
 
         // Splitter if necessary
@@ -6,10 +6,13 @@
 #include <travatar/symbol-set.h>
 #include <travatar/global-debug.h>
 #include <travatar/softmax.h>
-#include <boost/regex.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/unordered_map.hpp>
+#include <fstream>
+#include <cstring>
 
 
 using namespace travatar;
@@ -18,8 +21,35 @@ using namespace boost;
 using namespace boost::property_tree;
 
 HyperGraph * TreeIO::ReadFromString(const std::string & str) {
-    istringstream iss(str);
-    return ReadTree(iss);
+    const char * ptr = str.data();
+    return ReadFromBuffer(ptr, ptr + str.size());
+}
+
+HyperGraph * TreeIO::ReadFromBuffer(const char * & ptr, const char * end) {
+    istringstream iss(string(ptr, end));
+    HyperGraph * ret = ReadTree(iss);
+    streampos pos = iss.tellg();
+    ptr = (pos < 0 ? end : ptr + (streamoff)pos);
+    return ret;
+}
+
+inline bool IsWhiteSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline void SkipWhiteSpace(const char * & ptr, const char * end) {
+    while(ptr != end && IsWhiteSpace(*ptr))
+        ptr++;
+}
+
+// Get the rest of the line at ptr for error messages
+inline string RestOfLine(const char * ptr, const char * end) {
+    return string(ptr, find(ptr, end, '\n'));
+}
+
+bool TreeIO::ReadRecord(istream & in, string & record) {
+    if(!getline(in, record)) return false;
+    return true;
 }
 
 HyperGraph * WordTreeIO::ReadTree(istream & in) {
@@ -102,6 +132,91 @@ HyperGraph * PennTreeIO::ReadTree(istream & in) {
     return NULL;
 }
 
+// Read a tree in the same way as ReadTree, but by scanning the buffer and
+// looking up symbols in place
+HyperGraph * PennTreeIO::ReadFromBuffer(const char * & ptr, const char * end) {
+    HyperGraph * hg = new HyperGraph;
+    vector<HyperNode*> stack;
+    int pos = 0;
+    try {
+        while(true) {
+            SkipWhiteSpace(ptr, end);
+            if(ptr == end) break;
+            char next_char = *ptr++;
+            // If the next character is a close parenthesis, close the node on the top of the stack
+            if(next_char == ')') {
+                if(!stack.size()) THROW_ERROR("Unmatched close parenthesis at )" << RestOfLine(ptr, end));
+                HyperNode * child = *stack.rbegin(); stack.pop_back();
+                child->GetSpan().second = pos;
+                // If no parent exists, we are at the root. Return.
+                if(!stack.size()) return hg;
+                // If a parent exists, add the child to its tails
+                HyperNode * parent = *stack.rbegin();
+                parent->GetEdge(0)->AddTail(child);
+            // Otherwise, open a new node
+            } else if(next_char == '(') {
+                // If we are at the beginning of the sentence, check for empty sentences
+                if(stack.size() == 0 && ptr != end && *ptr == ')') {
+                    ptr++;
+                    return hg;
+                }
+                // Read the symbol
+                const char * sym = ptr;
+                for( ; ptr != end && !IsWhiteSpace(*ptr); ptr++)
+                    if(*ptr == '(' || *ptr == ')')
+                        THROW_ERROR("Forbidden character " << *ptr);
+                if(ptr == sym) THROW_ERROR("Empty symbol at '(" << RestOfLine(ptr, end) << "'");
+                // Create a new node
+                HyperNode* node = new HyperNode(Dict::WID(sym, ptr - sym), -1, make_pair(pos,-1));
+                stack.push_back(node); hg->AddNode(node);
+                HyperEdge* edge = new HyperEdge(node);
+                node->AddEdge(edge); hg->AddEdge(edge);
+                // If this is a terminal, add the string
+                SkipWhiteSpace(ptr, end);
+                if(ptr == end || *ptr != '(') {
+                    const char * val = ptr;
+                    for( ; ptr != end && *ptr != ')'; ptr++)
+                        if(*ptr == '(' || IsWhiteSpace(*ptr))
+                            THROW_ERROR("Forbidden character " << *ptr);
+                    WordId wid = Dict::WID(val, ptr - val);
+                    hg->GetWords().push_back(wid);
+                    HyperNode* child = new HyperNode(wid, -1, make_pair(pos,pos+1));
+                    hg->AddNode(child); edge->AddTail(child);
+                    ++pos;
+                }
+            } else {
+                THROW_ERROR("Expecting parenthesis but got '("<<(int)next_char<<")"<<next_char<<"'");
+            }
+        }
+    } catch(std::runtime_error & e) {
+        delete hg;
+        throw;
+    }
+    delete hg;
+    return NULL;
+}
+
+// Read until the parentheses of a tree are balanced. Trees may span several
+// lines, and reading stops at the parenthesis that closes the tree, so
+// anything after it on the same line is left for the next record
+bool PennTreeIO::ReadRecord(istream & in, string & record) {
+    record = "";
+    int depth = 0;
+    bool started = false;
+    char c;
+    while(in.get(c)) {
+        if(record.empty() && IsWhiteSpace(c))
+            continue;
+        record += c;
+        if(c == '(') {
+            depth++; started = true;
+        } else if(c == ')' && --depth <= 0 && started) {
+            return true;
+        }
+    }
+    return record.size() > 0;
+}
+
 void PennTreeIO::WriteNode(const vector<WordId> & words, 
                            const HyperNode & node, ostream & out) {
     if (node.NumEdges() > 1)
@@ -270,82 +385,494 @@ void JSONTreeIO::WriteTree(const HyperGraph & tree, ostream & out) {
     out << "]}";
 }
 
-HyperNode * EgretTreeIO::MakeEgretNode(const string & str_id, SymbolSet<int> & node_map, HyperGraph * graph) {
-    // Try to find the node
-    int id = node_map.GetId(str_id, true);
-    if(id < graph->NumNodes()) return graph->GetNode(id);
-    else if (id != graph->NumNodes()) THROW_ERROR("Mismatched ID numbers in MakeEgretTreeNode()");
-    // Make the node if it doesn't exist
-    regex node_regex("(.*)\\[(\\d+),(\\d+)\\]");
-    smatch node_match;
-    HyperNode * new_node;
-    if(!regex_match(str_id, node_match, node_regex)) {
-        new_node = new HyperNode(Dict::WID(str_id));
-    } else {
-        new_node = new HyperNode(Dict::WID(node_match[1]), 
-                                 -1,
-                                 make_pair(atoi(node_match[2].str().c_str()),
-                                           atoi(node_match[3].str().c_str())+1));
+// Binary graphs start with this, followed by the length of the record
+#define BINARY_TREE_MAGIC "TRVHG001"
+#define BINARY_TREE_MAGIC_LENGTH 8
+// Flags of the nodes and edges of binary graphs
+#define BINARY_NODE_VITERBI 1
+#define BINARY_EDGE_SCORE 1
+#define BINARY_EDGE_SRC_STR 2
+
+// The symbols used by a binary graph, with local IDs in the order they are
+// first used. IDs start at one, so that -1 (no symbol) is zero
+class BinarySymbolTable {
+public:
+    uint64_t GetId(WordId wid) {
+        if(wid < 0) return 0;
+        boost::unordered_map<WordId,uint64_t>::iterator it = ids_.find(wid);
+        if(it != ids_.end()) return it->second;
+        syms_.push_back(wid);
+        return (ids_[wid] = syms_.size());
+    }
+    // The words of target data are either symbols, or non-terminals with
+    // negative IDs, so use the low bit to tell which
+    uint64_t GetWordId(WordId wid) {
+        return (wid < 0 ? 2*(uint64_t)(-1-wid)+1 : 2*GetId(wid));
     }
-    graph->AddNode(new_node);
-    return new_node;
+    const vector<WordId> & GetSyms() const { return syms_; }
+private:
+    boost::unordered_map<WordId,uint64_t> ids_;
+    vector<WordId> syms_;
+};
+
+inline void AppendBinaryReal(string & buf, Real val) {
+    double dval = val;
+    buf.append(reinterpret_cast<const char*>(&dval), sizeof(double));
+}
+
+inline Real ReadBinaryReal(const char * & ptr, const char * end) {
+    if(end - ptr < (int)sizeof(double))
+        THROW_ERROR("Binary graph is truncated");
+    return IoUtil::ReadBinary<double>(ptr);
+}
+
+// Every counted element takes at least one byte, so reject counts larger than
+// the rest of the record before allocating anything for them
+inline uint64_t ReadBinaryCount(const char * & ptr, const char * end) {
+    uint64_t count = IoUtil::ReadVarint(ptr, end);
+    if((uint64_t)(end - ptr) < count)
+        THROW_ERROR("Binary graph is truncated");
+    return count;
+}
+
+inline WordId ReadBinarySym(const char * & ptr, const char * end, const vector<WordId> & syms) {
+    uint64_t id = IoUtil::ReadVarint(ptr, end);
+    if(id > syms.size())
+        THROW_ERROR("Bad symbol in binary graph: " << id);
+    return (id == 0 ? -1 : syms[id-1]);
+}
+
+inline WordId ReadBinaryWord(const char * & ptr, const char * end, const vector<WordId> & syms) {
+    uint64_t id = IoUtil::ReadVarint(ptr, end);
+    if(id & 1)
+        return -1-(WordId)(id >> 1);
+    if(id == 0 || (id >> 1) > syms.size())
+        THROW_ERROR("Bad word in binary graph: " << id);
+    return syms[(id >> 1)-1];
+}
+
+inline HyperNode * ReadBinaryNode(const char * & ptr, const char * end, HyperGraph & graph) {
+    uint64_t id = IoUtil::ReadVarint(ptr, end);
+    if(id >= graph.GetNodes().size())
+        THROW_ERROR("Bad node in binary graph: " << id);
+    return graph.GetNode(id);
+}
+
+void BinaryTreeIO::WriteTree(const HyperGraph & tree, ostream & out) {
+    // Write the body first, so the symbols it uses are known
+    BinarySymbolTable table;
+    string body;
+    const vector<WordId> & words = tree.GetWords();
+    IoUtil::AppendVarint(body, words.size());
+    BOOST_FOREACH(WordId wid, words)
+        IoUtil::AppendVarint(body, table.GetId(wid));
+    IoUtil::AppendVarint(body, tree.GetNodes().size());
+    BOOST_FOREACH(const HyperNode * node, tree.GetNodes()) {
+        IoUtil::AppendVarint(body, table.GetId(node->GetSym()));
+        IoUtil::AppendVarint(body, IoUtil::ZigZag(node->GetSpan().first));
+        IoUtil::AppendVarint(body, IoUtil::ZigZag(node->GetSpan().second));
+        const set<int> & trg_span = node->GetTrgSpan();
+        IoUtil::AppendVarint(body, trg_span.size());
+        BOOST_FOREACH(int v, trg_span)
+            IoUtil::AppendVarint(body, IoUtil::ZigZag(v));
+        body += (char)node->GetFrontier();
+        bool has_viterbi = node->GetViterbiScore() != -REAL_MAX;
+        body += (char)(has_viterbi ? BINARY_NODE_VITERBI : 0);
+        if(has_viterbi)
+            AppendBinaryReal(body, node->GetViterbiScore());
+    }
+    IoUtil::AppendVarint(body, tree.GetEdges().size());
+    BOOST_FOREACH(const HyperEdge * edge, tree.GetEdges()) {
+        IoUtil::AppendVarint(body, edge->GetHead() == NULL ? 0 : edge->GetHead()->GetId()+1);
+        IoUtil::AppendVarint(body, edge->GetTails().size());
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+            IoUtil::AppendVarint(body, tail->GetId());
+        IoUtil::AppendVarint(body, edge->GetFeatures().size());
+        BOOST_FOREACH(const SparsePair & feat, edge->GetFeatures().GetImpl()) {
+            IoUtil::AppendVarint(body, table.GetId(feat.first));
+            AppendBinaryReal(body, feat.second);
+        }
+        IoUtil::AppendVarint(body, edge->GetTrgData().size());
+        BOOST_FOREACH(const CfgData & trg, edge->GetTrgData()) {
+            IoUtil::AppendVarint(body, trg.words.size());
+            BOOST_FOREACH(WordId wid, trg.words)
+                IoUtil::AppendVarint(body, table.GetWordId(wid));
+            IoUtil::AppendVarint(body, table.GetId(trg.label));
+            IoUtil::AppendVarint(body, trg.syms.size());
+            BOOST_FOREACH(WordId wid, trg.syms)
+                IoUtil::AppendVarint(body, table.GetId(wid));
+        }
+        char flags = (edge->GetScore() != 0 ? BINARY_EDGE_SCORE : 0) |
+                     (edge->GetSrcStr().size() ? BINARY_EDGE_SRC_STR : 0);
+        body += flags;
+        if(flags & BINARY_EDGE_SCORE)
+            AppendBinaryReal(body, edge->GetScore());
+        if(flags & BINARY_EDGE_SRC_STR) {
+            IoUtil::AppendVarint(body, edge->GetSrcStr().size());
+            body += edge->GetSrcStr();
+        }
+    }
+    // Write the symbol table, and prefix both with the magic and length
+    string head;
+    IoUtil::AppendVarint(head, table.GetSyms().size());
+    BOOST_FOREACH(WordId wid, table.GetSyms()) {
+        const string & sym = Dict::WSym(wid);
+        IoUtil::AppendVarint(head, sym.size());
+        head += sym;
+    }
+    string prefix(BINARY_TREE_MAGIC);
+    IoUtil::AppendVarint(prefix, head.size() + body.size());
+    out << prefix << head << body;
+}
+
+HyperGraph * BinaryTreeIO::ReadFromBuffer(const char * & ptr, const char * end) {
+    // Skip the newline after the previous record
+    if(ptr != end && *ptr == '\n')
+        ptr++;
+    if(ptr == end)
+        return NULL;
+    if(end - ptr < BINARY_TREE_MAGIC_LENGTH || memcmp(ptr, BINARY_TREE_MAGIC, BINARY_TREE_MAGIC_LENGTH))
+        THROW_ERROR("Bad record in binary graph file");
+    ptr += BINARY_TREE_MAGIC_LENGTH;
+    uint64_t length = IoUtil::ReadVarint(ptr, end);
+    if((uint64_t)(end - ptr) < length)
+        THROW_ERROR("Binary graph is truncated");
+    end = ptr + length;
+    // Read the symbol table. Each symbol is only looked up once
+    vector<WordId> syms(ReadBinaryCount(ptr, end));
+    BOOST_FOREACH(WordId & wid, syms) {
+        uint64_t len = IoUtil::ReadVarint(ptr, end);
+        if((uint64_t)(end - ptr) < len)
+            THROW_ERROR("Binary graph is truncated");
+        wid = Dict::WID(string(ptr, len));
+        ptr += len;
+    }
+    HyperGraph * ret = new HyperGraph;
+    // Counts are checked before anything is allocated for them, but free the
+    // graph on any error
+    try {
+        Sentence words(ReadBinaryCount(ptr, end));
+        BOOST_FOREACH(WordId & wid, words)
+            wid = ReadBinarySym(ptr, end, syms);
+        ret->SetWords(words);
+        uint64_t num_nodes = ReadBinaryCount(ptr, end);
+        for(uint64_t i = 0; i < num_nodes; i++) {
+            HyperNode * node = new HyperNode;
+            ret->AddNode(node);
+            node->SetSym(ReadBinarySym(ptr, end, syms));
+            int l = IoUtil::UnZigZag(IoUtil::ReadVarint(ptr, end));
+            int r = IoUtil::UnZigZag(IoUtil::ReadVarint(ptr, end));
+            node->SetSpan(make_pair(l, r));
+            uint64_t num_trg = ReadBinaryCount(ptr, end);
+            for(uint64_t j = 0; j < num_trg; j++)
+                node->GetTrgSpan().insert(IoUtil::UnZigZag(IoUtil::ReadVarint(ptr, end)));
+            if(end - ptr < 2)
+                THROW_ERROR("Binary graph is truncated");
+            node->SetFrontier((HyperNode::FrontierType)*ptr++);
+            if(*ptr++ & BINARY_NODE_VITERBI)
+                node->SetViterbiScore(ReadBinaryReal(ptr, end));
+        }
+        uint64_t num_edges = ReadBinaryCount(ptr, end);
+        for(uint64_t i = 0; i < num_edges; i++) {
+            HyperEdge * edge = new HyperEdge;
+            ret->AddEdge(edge);
+            uint64_t head = IoUtil::ReadVarint(ptr, end);
+            if(head != 0) {
+                if(head > num_nodes)
+                    THROW_ERROR("Bad node in binary graph: " << head-1);
+                edge->SetHead(ret->GetNode(head-1));
+                edge->GetHead()->AddEdge(edge);
+            }
+            uint64_t num_tails = ReadBinaryCount(ptr, end);
+            edge->GetTails().reserve(num_tails);
+            for(uint64_t j = 0; j < num_tails; j++)
+                edge->AddTail(ReadBinaryNode(ptr, end, *ret));
+            // Feature IDs are local to the graph, so sort them again
+            SparseVector::SparseVectorImpl & feats = edge->GetFeatures().GetImpl();
+            feats.resize(ReadBinaryCount(ptr, end));
+            BOOST_FOREACH(SparsePair & feat, feats) {
+                feat.first = ReadBinarySym(ptr, end, syms);
+                feat.second = ReadBinaryReal(ptr, end);
+            }
+            sort(feats.begin(), feats.end());
+            CfgDataVector & trg_data = edge->GetTrgData();
+            trg_data.resize(ReadBinaryCount(ptr, end));
+            BOOST_FOREACH(CfgData & trg, trg_data) {
+                trg.words.resize(ReadBinaryCount(ptr, end));
+                BOOST_FOREACH(WordId & wid, trg.words)
+                    wid = ReadBinaryWord(ptr, end, syms);
+                trg.label = ReadBinarySym(ptr, end, syms);
+                trg.syms.resize(ReadBinaryCount(ptr, end));
+                BOOST_FOREACH(WordId & wid, trg.syms)
+                    wid = ReadBinarySym(ptr, end, syms);
+            }
+            if(ptr == end)
+                THROW_ERROR("Binary graph is truncated");
+            char flags = *ptr++;
+            if(flags & BINARY_EDGE_SCORE)
+                edge->SetScore(ReadBinaryReal(ptr, end));
+            if(flags & BINARY_EDGE_SRC_STR) {
+                uint64_t len = IoUtil::ReadVarint(ptr, end);
+                if((uint64_t)(end - ptr) < len)
+                    THROW_ERROR("Binary graph is truncated");
+                edge->SetSrcStr(string(ptr, len));
+                ptr += len;
+            }
+        }
+        if(ptr != end)
+            THROW_ERROR("Binary graph has extra data");
+    } catch(std::exception & e) {
+        delete ret;
+        throw;
+    }
+    return ret;
+}
+
+bool BinaryTreeIO::IsBinary(istream & in) {
+    if(in.peek() == '\n')
+        in.get();
+    return in.peek() == BINARY_TREE_MAGIC[0];
+}
+
+bool BinaryTreeIO::ReadRecord(istream & in, string & record) {
+    if(in.peek() == '\n')
+        in.get();
+    char magic[BINARY_TREE_MAGIC_LENGTH];
+    if(!in.read(magic, BINARY_TREE_MAGIC_LENGTH))
+        return false;
+    if(memcmp(magic, BINARY_TREE_MAGIC, BINARY_TREE_MAGIC_LENGTH))
+        THROW_ERROR("Bad record in binary graph file");
+    // Read the length a byte at a time
+    record.assign(magic, BINARY_TREE_MAGIC_LENGTH);
+    string length_str;
+    char c;
+    do {
+        if(!in.get(c))
+            THROW_ERROR("Binary graph is truncated");
+        length_str += c;
+    } while(c & 0x80);
+    const char * ptr = length_str.data();
+    uint64_t length = IoUtil::ReadVarint(ptr, ptr + length_str.size());
+    record += length_str;
+    size_t start = record.size();
+    record.resize(start + length);
+    if(!in.read(&record[start], length))
+        THROW_ERROR("Binary graph is truncated");
+    return true;
+}
+
+HyperGraph * BinaryTreeIO::ReadTree(istream & in) {
+    string record;
+    if(!ReadRecord(in, record))
+        return NULL;
+    const char * ptr = record.data();
+    return ReadFromBuffer(ptr, ptr + record.size());
+}
+
+BinaryTreeFile::BinaryTreeFile(const std::string & filename) {
+    try {
+        mapped_.reset(new iostreams::mapped_file_source(filename));
+    } catch(std::exception & e) {
+        THROW_ERROR("Could not map binary graph file: " << filename);
+    }
+    // Index the records by skipping over their lengths
+    const char * ptr = mapped_->data(), * end = ptr + mapped_->size();
+    while(true) {
+        if(ptr != end && *ptr == '\n')
+            ptr++;
+        if(ptr == end)
+            break;
+        records_.push_back(ptr);
+        if(end - ptr < BINARY_TREE_MAGIC_LENGTH || memcmp(ptr, BINARY_TREE_MAGIC, BINARY_TREE_MAGIC_LENGTH))
+            THROW_ERROR("Bad record " << records_.size() << " in binary graph file: " << filename);
+        ptr += BINARY_TREE_MAGIC_LENGTH;
+        uint64_t length = IoUtil::ReadVarint(ptr, end);
+        if((uint64_t)(end - ptr) < length)
+            THROW_ERROR("Record " << records_.size() << " is truncated in binary graph file: " << filename);
+        ptr += length;
+    }
+    records_.push_back(end);
+}
+
+BinaryTreeFile::~BinaryTreeFile() { }
+
+HyperGraph * BinaryTreeFile::ReadTree(int i) const {
+    if(i < 0 || i >= NumTrees())
+        THROW_ERROR("Graph " << i << " is out of range in binary graph file");
+    const char * ptr = records_[i];
+    BinaryTreeIO io;
+    return io.ReadFromBuffer(ptr, records_[i+1]);
+}
+
+bool BinaryTreeFile::IsBinaryFile(const std::string & filename) {
+    ifstream in(filename.c_str(), ios::in | ios::binary);
+    char magic[BINARY_TREE_MAGIC_LENGTH];
+    return in.read(magic, BINARY_TREE_MAGIC_LENGTH) && !memcmp(magic, BINARY_TREE_MAGIC, BINARY_TREE_MAGIC_LENGTH);
+}
+
+// Read the sentence line, the words, and the edges up until an empty line.
+// Failed parses have no edges, and are followed by an additional line
+bool EgretTreeIO::ReadRecord(istream & in, string & record) {
+    string line;
+    if(!getline(in, record)) return false;
+    int num_edges = 0;
+    for(int i = 0; getline(in, line); i++) {
+        record += '\n' + line;
+        if(i > 0) {
+            if(line == "") break;
+            num_edges++;
+        }
+    }
+    if(num_edges == 0 && getline(in, line))
+        record += '\n' + line;
+    record += '\n';
+    return true;
 }
 
 HyperGraph * EgretTreeIO::ReadTree(istream & in) {
+    string record;
+    if(!ReadRecord(in, record))
+        return NULL;
+    const char * ptr = record.data();
+    return ReadFromBuffer(ptr, ptr + record.size());
+}
+
+// Get the line at ptr without the newline, and advance ptr past it. Return
+// false at the end of the buffer
+inline bool NextLine(const char * & ptr, const char * end, const char * & line, const char * & line_end) {
+    if(ptr == end)
+        return false;
+    line = ptr;
+    line_end = find(ptr, end, '\n');
+    ptr = (line_end == end ? end : line_end + 1);
+    return true;
+}
+
+// Get the next token of a line that is separated by white space
+inline bool NextToken(const char * & ptr, const char * end, const char * & tok, const char * & tok_end) {
+    SkipWhiteSpace(ptr, end);
+    if(ptr == end)
+        return false;
+    tok = ptr;
+    while(ptr != end && !IsWhiteSpace(*ptr))
+        ptr++;
+    tok_end = ptr;
+    return true;
+}
+
+// Read a non-negative number that fills a range of characters
+inline bool ParseSpanIndex(const char * ptr, const char * end, int & val) {
+    if(ptr == end)
+        return false;
+    val = 0;
+    for( ; ptr != end; ptr++) {
+        if(*ptr < '0' || *ptr > '9')
+            return false;
+        val = val*10 + (*ptr - '0');
+    }
+    return true;
+}
+
+// Egret nodes are words, or labels followed by the span of words they cover,
+// such as NP[0,2]. Nodes with the same label and span are the same node
+typedef pair<WordId, pair<int,int> > EgretNodeKey;
+
+inline HyperNode * MakeEgretNode(const char * str, const char * end,
+                                 boost::unordered_map<EgretNodeKey, HyperNode*> & node_map,
+                                 HyperGraph * graph) {
+    EgretNodeKey key(-1, make_pair(-1, -1));
+    // Split the label from the span, as with the regex (.*)\[(\d+),(\d+)\]
+    bool spanned = false;
+    const char * open = end;
+    int l, r;
+    if(end - str >= 5 && *(end-1) == ']') {
+        for(open = end-2; open != str && *open != '['; open--) { }
+        const char * comma = find(open, end-1, ',');
+        spanned = (*open == '[' && comma != end-1 &&
+                   ParseSpanIndex(open+1, comma, l) && ParseSpanIndex(comma+1, end-1, r));
+    }
+    if(spanned) {
+        key.first = Dict::WID(str, open - str);
+        key.second = make_pair(l, r+1);
+    } else {
+        key.first = Dict::WID(str, end - str);
+    }
+    HyperNode * & node = node_map[key];
+    if(node == NULL) {
+        node = new HyperNode(key.first, -1, key.second);
+        graph->AddNode(node);
+    }
+    return node;
+}
+
+HyperGraph * EgretTreeIO::ReadFromBuffer(const char * & ptr, const char * end) {
+    const char * line, * line_end;
+    if(!NextLine(ptr, end, line, line_end)) return NULL;
+    if(line_end - line < 8 || memcmp(line, "sentence", 8)) THROW_ERROR("Missing sentence line: " << endl);
+    // Create the sentence
+    if(!NextLine(ptr, end, line, line_end)) THROW_ERROR("Egret file ended prematurely");
     HyperGraph * ret = new HyperGraph;
-    string line, buff;
-    Real score;
-    SymbolSet<int> node_map;
-    // Make various regexes
-    cmatch edge_match, sent_match;
-    if(!getline(in,line)) return NULL;
-    if(line.substr(0,8) != "sentence") THROW_ERROR("Missing sentence line: " << endl);
-    // Create the sentence and root node
-    string wordstring;
-    if(!getline(in,wordstring)) THROW_ERROR("Egret file ended prematurely");
-    ret->SetWords(Dict::ParseWords(wordstring));
-    // Get the lines one by one and reverse
-    vector<string> lines;
-    while(getline(in, line) && line != "")
-        lines.push_back(line);
-    // If we have a failed parse, return the source words
-    if(lines.size() == 0) {
-        getline(in,line);
-        // WordTreeIO wtio;
-        // istringstream iss(wordstring);
-        // return wtio.ReadTree(iss);
-        return ret;
-    }
-    // Save the parse ID, and also vectors of scores
-    WordId parse_id = Dict::WID("parse");
-    // For each line
-    BOOST_REVERSE_FOREACH(const std::string & line, lines) {
-        istringstream iss(line);
-        // Get the head
-        iss >> buff;
-        HyperNode * head = MakeEgretNode(buff, node_map, ret);
-        HyperEdge * edge = new HyperEdge(head); ret->AddEdge(edge); head->AddEdge(edge);
-        // The next string should always be "=>"
-        iss >> buff;
-        if(buff != "=>") THROW_ERROR("=> not found in Egret node string: " << line);
-        // Read the tail nodes
-        while(iss >> buff && buff != "|||") {
-            HyperNode * tail = MakeEgretNode(buff, node_map, ret);
-            // Set terminal node's spans to those of their parent
-            if(tail->GetSpan().first == -1)
-                tail->SetSpan(head->GetSpan());
-            edge->AddTail(tail);
+    try {
+        const char * tok, * tok_end;
+        while(NextToken(line, line_end, tok, tok_end))
+            ret->AddWord(Dict::WID(tok, tok_end - tok));
+        // Get the lines one by one
+        vector<pair<const char*, const char*> > lines;
+        while(NextLine(ptr, end, line, line_end) && line != line_end)
+            lines.push_back(make_pair(line, line_end));
+        // If we have a failed parse, return the source words
+        if(lines.size() == 0) {
+            NextLine(ptr, end, line, line_end);
+            return ret;
+        }
+        // Save the parse ID, and also vectors of scores
+        WordId parse_id = Dict::WID("parse");
+        boost::unordered_map<EgretNodeKey, HyperNode*> node_map;
+        // For each line in reverse
+        for(int i = lines.size()-1; i >= 0; i--) {
+            line = lines[i].first; line_end = lines[i].second;
+            // Get the head
+            if(!NextToken(line, line_end, tok, tok_end))
+                THROW_ERROR("=> not found in Egret node string: " << string(lines[i].first, line_end));
+            HyperNode * head = MakeEgretNode(tok, tok_end, node_map, ret);
+            HyperEdge * edge = new HyperEdge(head); ret->AddEdge(edge); head->AddEdge(edge);
+            // The next string should always be "=>"
+            if(!NextToken(line, line_end, tok, tok_end) || tok_end - tok != 2 || memcmp(tok, "=>", 2))
+                THROW_ERROR("=> not found in Egret node string: " << string(lines[i].first, line_end));
+            // Read the tail nodes
+            bool found = false;
+            while(NextToken(line, line_end, tok, tok_end)) {
+                if(tok_end - tok == 3 && !memcmp(tok, "|||", 3)) {
+                    found = true;
+                    break;
+                }
+                HyperNode * tail = MakeEgretNode(tok, tok_end, node_map, ret);
+                // Set terminal node's spans to those of their parent
+                if(tail->GetSpan().first == -1)
+                    tail->SetSpan(head->GetSpan());
+                edge->AddTail(tail);
+            }
+            if(!found) THROW_ERROR("||| not found in Egret node string: " << string(lines[i].first, line_end));
+            // Finally, read the score and add it to a parse
+            char score_str[64];
+            Real score = 0;
+            if(NextToken(line, line_end, tok, tok_end) && tok_end - tok < (int)sizeof(score_str)) {
+                memcpy(score_str, tok, tok_end - tok);
+                score_str[tok_end - tok] = 0;
+                score = strtod(score_str, NULL);
+            }
+            edge->SetScore(score);
+            if(!normalize_) edge->GetFeatures().Add(parse_id, score);
         }
-        if(buff != "|||") THROW_ERROR("||| not found in Egret node string: " << line);
-        // Finally, read the score and add it to a parse
-        iss >> score;
-        edge->SetScore(score);
-        if(!normalize_) edge->GetFeatures().Add(parse_id, score);
+    } catch(std::runtime_error & e) {
+        delete ret;
+        throw;
     }
     // Because Egret outputs posterior probabilities of the edge appearing in
     // the tree, not the relative probability of each edge coming out of a
     // particular node, we need to normalize by nodes
     if(normalize_) {
+        WordId parse_id = Dict::WID("parse");
         BOOST_FOREACH(HyperNode* node, ret->GetNodes()) {
             vector<Real> scores; scores.reserve(node->GetEdges().size());
             BOOST_FOREACH(HyperEdge * edge, node->GetEdges())
@@ -386,7 +913,113 @@ void EgretTreeIO::WriteTree(const HyperGraph & tree, ostream & out) {
 }
 
 HyperGraph * MosesXMLTreeIO::ReadTree(istream & in) {
-    THROW_ERROR("Moses XML is not supported as an input format (yet)");
+    string line;
+    if(!getline(in, line))
+        return NULL;
+    const char * ptr = line.data();
+    HyperGraph * ret = ReadFromBuffer(ptr, ptr + line.size());
+    return (ret != NULL ? ret : new HyperGraph);
+}
+
+// Decode the entities written by Dict::EncodeXML, and numeric ones
+inline void DecodeXML(const char * ptr, const char * end, string & out) {
+    out.clear();
+    while(ptr != end) {
+        if(*ptr != '&') {
+            out += *ptr++;
+            continue;
+        }
+        const char * semi = find(ptr, end, ';');
+        if(semi == end)
+            THROW_ERROR("Unterminated entity in Moses XML: " << string(ptr, end));
+        string name(ptr+1, semi);
+        if(name == "amp") out += '&';
+        else if(name == "quot") out += '"';
+        else if(name == "apos") out += '\'';
+        else if(name == "lt") out += '<';
+        else if(name == "gt") out += '>';
+        else if(name.length() > 1 && name[0] == '#') {
+            long val = (name[1] == 'x' ? strtol(name.c_str()+2, NULL, 16) : strtol(name.c_str()+1, NULL, 10));
+            if(val <= 0 || val >= 128)
+                THROW_ERROR("Unsupported entity in Moses XML: &" << name << ";");
+            out += (char)val;
+        } else {
+            THROW_ERROR("Unknown entity in Moses XML: &" << name << ";");
+        }
+        ptr = semi+1;
+    }
+}
+
+// Get the ID of a possibly escaped symbol, only copying it if it is escaped
+inline WordId MosesXMLWID(const char * ptr, const char * end, string & buff) {
+    if(find(ptr, end, '&') == end)
+        return Dict::WID(ptr, end - ptr);
+    DecodeXML(ptr, end, buff);
+    return Dict::WID(buff);
+}
+
+// Read trees written by WriteTree, such as <tree label="A"> x </tree>. Each
+// tree becomes a node with one edge, and each word a terminal node, which
+// gives the same graph as the Penn tree (A x)
+HyperGraph * MosesXMLTreeIO::ReadFromBuffer(const char * & ptr, const char * end) {
+    SkipWhiteSpace(ptr, end);
+    if(ptr == end)
+        return NULL;
+    HyperGraph * hg = new HyperGraph;
+    vector<HyperNode*> stack;
+    int pos = 0;
+    string buff;
+    try {
+        while(true) {
+            SkipWhiteSpace(ptr, end);
+            if(ptr == end) THROW_ERROR("Moses XML tree ended prematurely");
+            if(*ptr == '<') {
+                const char * tag = ptr+1;
+                const char * tag_end = find(tag, end, '>');
+                if(tag_end == end) THROW_ERROR("Unterminated tag in Moses XML: " << RestOfLine(ptr, end));
+                ptr = tag_end+1;
+                // Close the node on the top of the stack
+                if(*tag == '/') {
+                    if(tag_end - tag != 5 || memcmp(tag, "/tree", 5))
+                        THROW_ERROR("Bad closing tag in Moses XML: " << string(tag-1, ptr));
+                    if(!stack.size()) THROW_ERROR("Unmatched </tree> in Moses XML");
+                    HyperNode * child = *stack.rbegin(); stack.pop_back();
+                    child->GetSpan().second = pos;
+                    if(!stack.size()) return hg;
+                    (*stack.rbegin())->GetEdge(0)->AddTail(child);
+                    continue;
+                }
+                // Open a new node with the label of the tree
+                if(tag_end - tag < 5 || memcmp(tag, "tree", 4) || !IsWhiteSpace(tag[4]))
+                    THROW_ERROR("Bad tag in Moses XML: " << string(tag-1, ptr));
+                static const char label_attr[] = "label=\"";
+                const char * label = search(tag+4, tag_end, label_attr, label_attr + sizeof(label_attr) - 1);
+                if(label == tag_end) THROW_ERROR("Missing label in Moses XML: " << string(tag-1, ptr));
+                label += sizeof(label_attr) - 1;
+                const char * label_end = find(label, tag_end, '"');
+                if(label_end == tag_end || label_end == label) THROW_ERROR("Bad label in Moses XML: " << string(tag-1, ptr));
+                HyperNode * node = new HyperNode(MosesXMLWID(label, label_end, buff), -1, make_pair(pos,-1));
+                stack.push_back(node); hg->AddNode(node);
+                HyperEdge * edge = new HyperEdge(node);
+                node->AddEdge(edge); hg->AddEdge(edge);
+            } else {
+                // Add a word to the tree on the top of the stack
+                if(!stack.size()) THROW_ERROR("Word outside of a tree in Moses XML: " << RestOfLine(ptr, end));
+                const char * word = ptr;
+                while(ptr != end && !IsWhiteSpace(*ptr) && *ptr != '<')
+                    ptr++;
+                WordId wid = MosesXMLWID(word, ptr, buff);
+                hg->GetWords().push_back(wid);
+                HyperNode * child = new HyperNode(wid, -1, make_pair(pos,pos+1));
+                hg->AddNode(child); (*stack.rbegin())->GetEdge(0)->AddTail(child);
+                ++pos;
+            }
+        }
+    } catch(std::runtime_error & e) {
+        delete hg;
+        throw;
+    }
+    return hg;
 }
 
 void MosesXMLTreeIO::WriteNode(const vector<WordId> & words, 
@@ -0,0 +1,42 @@
+#include <travatar/trimmer-max-marginal.h>
+#include <travatar/hyper-graph.h>
+#include <boost/foreach.hpp>
+#include <cmath>
+
+using namespace std;
+using namespace travatar;
+using namespace boost;
+
+void TrimmerMaxMarginal::FindActiveEdges(const HyperGraph & hg, vector<bool> & active) const {
+    active.assign(hg.NumEdges(), false);
+    if(hg.NumNodes() == 0)
+        return;
+    vector<Real> edge_scores(hg.NumEdges()), inside, outside;
+    BOOST_FOREACH(const HyperEdge * edge, hg.GetEdges())
+        edge_scores[edge->GetId()] = edge->GetScore();
+    hg.CalcViterbiInsideOutside(edge_scores, inside, outside);
+    if(inside[0] == -REAL_MAX)
+        return;
+    // Allow for rounding errors, so the best derivation is always kept
+    Real limit = inside[0] - threshold_ - 1e-5 * (1 + fabs(inside[0]));
+    BOOST_FOREACH(const HyperEdge * edge, hg.GetEdges()) {
+        Real score = outside[edge->GetHead()->GetId()];
+        bool reachable = (score != -REAL_MAX);
+        score += edge->GetScore();
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails()) {
+            if(inside[tail->GetId()] == -REAL_MAX)
+                reachable = false;
+            score += inside[tail->GetId()];
+        }
+        active[edge->GetId()] = (reachable && score >= limit);
+    }
+}
+
+// Find which nodes and edges should be active in this hypergraph
+void TrimmerMaxMarginal::FindActive(const HyperGraph & hg,
+                std::map<int,int> & active_nodes,
+                std::map<int,int> & active_edges) const {
+    vector<bool> active;
+    FindActiveEdges(hg, active);
+    Trimmer::AddEdges(hg, active, active_nodes, active_edges);
+}
@@ -1,5 +1,5 @@
 #include <travatar/trimmer-nbest.h>
-#include <travatar/nbest-list.h>
+#include <travatar/lazy-kbest.h>
 #include <travatar/sentence.h>
 #include <travatar/hyper-graph.h>
 #include <boost/foreach.hpp>
@@ -13,13 +13,19 @@ void TrimmerNbest::FindActive(const HyperGraph & hg,
                 std::map<int,int> & active_nodes,
                 std::map<int,int> & active_edges) const {
     // Always preserve the root node
-    if(hg.GetNodes().size() != 0)
-        Trimmer::AddId(active_nodes, 0);
-    // Get the n-best
+    if(hg.GetNodes().size() == 0)
+        return;
+    Trimmer::AddId(active_nodes, 0);
+    // Calculate the Viterbi scores to be copied into the trimmed graph
     // TODO: const_cast is a bit dangerous, but let's leave it for now
-    NbestList nbest = const_cast<HyperGraph&>(hg).GetNbest(n_);;
-    BOOST_FOREACH(boost::shared_ptr<HyperPath> & hyp, nbest) {
-        BOOST_FOREACH(HyperEdge * edge, hyp->GetEdges()) {
+    const_cast<HyperGraph&>(hg).GetNode(0)->CalcViterbiScore();
+    // Find the n-best derivations, and activate the nodes and edges they use
+    LazyKbest kbest(hg);
+    vector<HyperEdge*> edges;
+    for(int k = 0; k < n_ && kbest.HasKth(k); k++) {
+        edges.clear();
+        kbest.GetEdges(k, edges);
+        BOOST_FOREACH(HyperEdge * edge, edges) {
             Trimmer::AddId(active_nodes, edge->GetHead()->GetId());
             Trimmer::AddId(active_edges, edge->GetId());
             BOOST_FOREACH(HyperNode * tail, edge->GetTails())
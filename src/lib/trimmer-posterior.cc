@@ -0,0 +1,52 @@
+#include <travatar/trimmer-posterior.h>
+#include <travatar/trimmer-max-marginal.h>
+#include <travatar/hyper-graph.h>
+#include <boost/foreach.hpp>
+#include <cmath>
+
+using namespace std;
+using namespace travatar;
+using namespace boost;
+
+void TrimmerPosterior::FindActiveEdges(const HyperGraph & hg, vector<bool> & active) const {
+    if(threshold_ <= 0) {
+        active.assign(hg.NumEdges(), true);
+        return;
+    }
+    // Start with the edges of the best derivation, so the graph is never empty
+    TrimmerMaxMarginal(0).FindActiveEdges(hg, active);
+    if(hg.NumNodes() == 0)
+        return;
+    vector<Real> edge_scores(hg.NumEdges()), inside, outside;
+    BOOST_FOREACH(const HyperEdge * edge, hg.GetEdges())
+        edge_scores[edge->GetId()] = edge->GetScore();
+    hg.CalcInsideOutside(edge_scores, inside, outside);
+    if(inside[0] == -REAL_MAX)
+        return;
+    Real log_threshold = log(threshold_);
+    BOOST_FOREACH(const HyperEdge * edge, hg.GetEdges()) {
+        Real score = outside[edge->GetHead()->GetId()];
+        if(score == -REAL_MAX) continue;
+        score += edge->GetScore() - inside[0];
+        bool reachable = true;
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails()) {
+            if(inside[tail->GetId()] == -REAL_MAX)
+                reachable = false;
+            score += inside[tail->GetId()];
+        }
+        if(reachable && score >= log_threshold)
+            active[edge->GetId()] = true;
+    }
+    // An edge can have a high posterior while the edges below it are all
+    // pruned, so remove edges that can no longer be used
+    RemoveDeadEdges(hg, active);
+}
+
+// Find which nodes and edges should be active in this hypergraph
+void TrimmerPosterior::FindActive(const HyperGraph & hg,
+                std::map<int,int> & active_nodes,
+                std::map<int,int> & active_edges) const {
+    vector<bool> active;
+    FindActiveEdges(hg, active);
+    Trimmer::AddEdges(hg, active, active_nodes, active_edges);
+}
@@ -0,0 +1,52 @@
+#include <travatar/trimmer-top-k.h>
+#include <travatar/hyper-graph.h>
+#include <boost/foreach.hpp>
+#include <algorithm>
+
+using namespace std;
+using namespace travatar;
+using namespace boost;
+
+void TrimmerTopK::FindActiveEdges(const HyperGraph & hg, vector<bool> & active) const {
+    active.assign(hg.NumEdges(), false);
+    if(hg.NumNodes() == 0)
+        return;
+    vector<Real> edge_scores(hg.NumEdges()), inside, outside;
+    BOOST_FOREACH(const HyperEdge * edge, hg.GetEdges())
+        edge_scores[edge->GetId()] = edge->GetScore();
+    hg.CalcViterbiInsideOutside(edge_scores, inside, outside);
+    // Within a node, the edge with the best inside score also has the best
+    // max-marginal, so rank the edges by their inside scores. Ties are broken
+    // by the edge ID
+    vector<pair<Real,int> > ranked;
+    BOOST_FOREACH(const HyperNode * node, hg.GetNodes()) {
+        if(outside[node->GetId()] == -REAL_MAX) continue;
+        ranked.clear();
+        BOOST_FOREACH(const HyperEdge * edge, node->GetEdges()) {
+            Real score = edge->GetScore();
+            BOOST_FOREACH(const HyperNode * tail, edge->GetTails()) {
+                if(inside[tail->GetId()] == -REAL_MAX) {
+                    score = -REAL_MAX;
+                    break;
+                }
+                score += inside[tail->GetId()];
+            }
+            if(score != -REAL_MAX)
+                ranked.push_back(make_pair(-score, edge->GetId()));
+        }
+        int size = min((int)ranked.size(), k_);
+        partial_sort(ranked.begin(), ranked.begin() + size, ranked.end());
+        for(int i = 0; i < size; i++)
+            active[ranked[i].second] = true;
+    }
+    RemoveDeadEdges(hg, active);
+}
+
+// Find which nodes and edges should be active in this hypergraph
+void TrimmerTopK::FindActive(const HyperGraph & hg,
+                std::map<int,int> & active_nodes,
+                std::map<int,int> & active_edges) const {
+    vector<bool> active;
+    FindActiveEdges(hg, active);
+    Trimmer::AddEdges(hg, active, active_nodes, active_edges);
+}
@@ -13,6 +13,108 @@ void Trimmer::AddId(std::map<int,int> & id_map, int id) {
         id_map.insert(make_pair(id, id_map.size()));
 }
 
+void Trimmer::AddEdges(const HyperGraph & hg,
+                       const vector<bool> & active_edges,
+                       std::map<int,int> & active_nodes,
+                       std::map<int,int> & active_edge_ids) {
+    if(hg.NumNodes() == 0)
+        return;
+    AddId(active_nodes, 0);
+    BOOST_FOREACH(const HyperEdge * edge, hg.GetEdges()) {
+        if(!active_edges[edge->GetId()]) continue;
+        AddId(active_nodes, edge->GetHead()->GetId());
+        AddId(active_edge_ids, edge->GetId());
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+            AddId(active_nodes, tail->GetId());
+    }
+}
+
+namespace travatar {
+
+// Find the nodes that can be derived using only active edges. Starting from
+// the terminals, the head of each active edge becomes derivable once all of
+// its tails are
+inline void FindDerivable(const HyperGraph & hg, const vector<bool> & active_edges, vector<bool> & derivable) {
+    derivable.assign(hg.NumNodes(), false);
+    // The number of tails of each edge that are not known to be derivable,
+    // and the active edges that each node is a tail of
+    vector<int> waiting(hg.NumEdges(), 0);
+    vector<vector<const HyperEdge*> > parents(hg.NumNodes());
+    vector<int> stack;
+    BOOST_FOREACH(const HyperNode * node, hg.GetNodes()) {
+        if(node->IsTerminal()) {
+            derivable[node->GetId()] = true;
+            stack.push_back(node->GetId());
+        }
+    }
+    BOOST_FOREACH(const HyperEdge * edge, hg.GetEdges()) {
+        if(!active_edges[edge->GetId()]) continue;
+        waiting[edge->GetId()] = edge->GetTails().size();
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails())
+            parents[tail->GetId()].push_back(edge);
+        int head = edge->GetHead()->GetId();
+        if(edge->GetTails().size() == 0 && !derivable[head]) {
+            derivable[head] = true;
+            stack.push_back(head);
+        }
+    }
+    while(stack.size()) {
+        int id = stack.back();
+        stack.pop_back();
+        BOOST_FOREACH(const HyperEdge * edge, parents[id]) {
+            int head = edge->GetHead()->GetId();
+            if(--waiting[edge->GetId()] == 0 && !derivable[head]) {
+                derivable[head] = true;
+                stack.push_back(head);
+            }
+        }
+    }
+}
+
+// Mark the active edges that can be reached from a node
+inline void MarkReachable(const HyperNode * node, const vector<bool> & active_edges, vector<bool> & reached_nodes, vector<bool> & reached_edges) {
+    vector<const HyperNode*> stack;
+    if(!reached_nodes[node->GetId()]) {
+        reached_nodes[node->GetId()] = true;
+        stack.push_back(node);
+    }
+    while(stack.size()) {
+        const HyperNode * curr = stack.back();
+        stack.pop_back();
+        BOOST_FOREACH(const HyperEdge * edge, curr->GetEdges()) {
+            if(!active_edges[edge->GetId()]) continue;
+            reached_edges[edge->GetId()] = true;
+            BOOST_FOREACH(const HyperNode * tail, edge->GetTails()) {
+                if(!reached_nodes[tail->GetId()]) {
+                    reached_nodes[tail->GetId()] = true;
+                    stack.push_back(tail);
+                }
+            }
+        }
+    }
+}
+
+}
+
+void Trimmer::RemoveDeadEdges(const HyperGraph & hg, vector<bool> & active_edges) {
+    if(hg.NumNodes() == 0)
+        return;
+    vector<bool> derivable;
+    FindDerivable(hg, active_edges, derivable);
+    BOOST_FOREACH(const HyperEdge * edge, hg.GetEdges()) {
+        if(!active_edges[edge->GetId()]) continue;
+        BOOST_FOREACH(const HyperNode * tail, edge->GetTails()) {
+            if(!derivable[tail->GetId()]) {
+                active_edges[edge->GetId()] = false;
+                break;
+            }
+        }
+    }
+    vector<bool> reached_nodes(hg.NumNodes(), false), reached_edges(hg.NumEdges(), false);
+    MarkReachable(hg.GetNode(0), active_edges, reached_nodes, reached_edges);
+    active_edges.swap(reached_edges);
+}
+
 HyperGraph * Trimmer::TransformGraph(const HyperGraph & hg) const {
     std::map<int,int> active_nodes, active_edges;
     FindActive(hg, active_nodes, active_edges);
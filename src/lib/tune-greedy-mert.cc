@@ -75,12 +75,12 @@ LineSearchResult TuneGreedyMert::TuneOnce(SparseMap & weights) {
             vals.push_back(make_pair(val.second, val.first));
     sort(vals.begin(), vals.end());
 
-    // Create the threads
-    boost::shared_ptr<ThreadPool> thread_pool;
+    // Use the shared threads
+    boost::shared_ptr<TaskGroup> task_group;
     boost::shared_ptr<OutputCollector> out_collect;
     int task_id = 0;
     if(threads_) {
-        thread_pool.reset(new ThreadPool(threads_, 1000));
+        task_group.reset(new TaskGroup(ThreadPool::GetShared()));
         out_collect.reset(new OutputCollector);
     }
 
@@ -91,13 +91,13 @@ LineSearchResult TuneGreedyMert::TuneOnce(SparseMap & weights) {
             break;
         GreedyMertTask* task = new GreedyMertTask(task_id++, *this, val.second, val.first, out_collect.get());
         // If the threads are not correct
-        if(thread_pool)
-            thread_pool->Submit(task);
+        if(task_group)
+            task_group->Submit(task);
         else
             task->Run();
     }
-    if(thread_pool)
-        thread_pool->Stop(true);
+    if(task_group)
+        task_group->Wait();
 
     // Update with the best value
     if(best_result_.gain > gain_threshold_) {
@@ -1,5 +1,5 @@
 #include <cfloat>
-#include <map>
+#include <vector>
 #include <boost/foreach.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/lexical_cast.hpp>
@@ -12,7 +12,11 @@
 #include <travatar/gradient-xeval.h>
 #include <travatar/eval-measure.h>
 #include <travatar/sparse-map.h>
+#include <travatar/weight-vector.h>
 #include <travatar/output-collector.h>
+#include <travatar/thread-pool.h>
+#include <travatar/task.h>
+#include <algorithm>
 
 using namespace std;
 using namespace boost;
@@ -20,59 +24,206 @@ using namespace travatar;
 
 #define MARGIN 1
 
-TuneMert::TuneMert() : use_coordinate_(true), num_random_(0) { }
+TuneMert::TuneMert() : use_coordinate_(true), num_random_(0), threads_(1) { }
+
+namespace travatar {
+
+// The places where the total evaluation stats change along the gradient,
+// sorted by position. Changes at the same position are kept in the order
+// of their examples, so they can be added in the same order as they would
+// be if the examples were processed one at a time
+typedef vector<pair<Real,EvalStatsPtr> > MertBoundaries;
+
+inline bool CompareBoundaries(const pair<Real,EvalStatsPtr> & a, const pair<Real,EvalStatsPtr> & b) {
+    return a.first < b.first;
+}
+
+// Calculate the convex hulls for a shard of examples, saving the stats of
+// the first span of each example, and the sorted changes of the others
+class MertHullTask : public Task {
+public:
+    MertHullTask(const SparseMap & weights, const SparseMap & gradient,
+                 const WeightVector & weight_vec, const WeightVector & gradient_vec,
+                 const vector<boost::shared_ptr<TuningExample> > & examps,
+                 int begin, int end,
+                 vector<EvalStatsPtr> & bases, MertBoundaries & boundaries) :
+        weights_(weights), gradient_(gradient), weight_vec_(weight_vec), gradient_vec_(gradient_vec),
+        examps_(examps), begin_(begin), end_(end), bases_(bases), boundaries_(boundaries) { }
+    void Run() {
+        for(int i = begin_; i < end_; i++) {
+            // Calculate the convex hull
+            ConvexHull convex_hull = examps_[i]->CalculateConvexHull(weights_, gradient_, weight_vec_, gradient_vec_);
+            PRINT_DEBUG("Convex hull size == " << convex_hull.size() << endl, 5);
+            if(convex_hull.size() == 0) continue;
+            bases_[i] = convex_hull[0].second;
+            PRINT_DEBUG("convex_hull[0]: " << convex_hull[0] << endl, 5);
+            // Add all the changed values
+            int start = boundaries_.size();
+            for(int j = 1; j < (int)convex_hull.size(); j++) {
+                EvalStatsPtr diff = convex_hull[j].second->Plus(*convex_hull[j-1].second->Times(-1));
+                PRINT_DEBUG("convex_hull["<<j<<"]: " << convex_hull[j] << endl, 5);
+                if(!diff->IsZero())
+                    boundaries_.push_back(make_pair(convex_hull[j].first.first, diff));
+            }
+            stable_sort(boundaries_.begin()+start, boundaries_.end(), CompareBoundaries);
+            inplace_merge(boundaries_.begin(), boundaries_.begin()+start, boundaries_.end(), CompareBoundaries);
+        }
+    }
+protected:
+    const SparseMap & weights_;
+    const SparseMap & gradient_;
+    const WeightVector & weight_vec_;
+    const WeightVector & gradient_vec_;
+    const vector<boost::shared_ptr<TuningExample> > & examps_;
+    int begin_, end_;
+    vector<EvalStatsPtr> & bases_;
+    MertBoundaries & boundaries_;
+};
+
+// Merge the boundaries of two neighboring shards into the first
+class MertMergeTask : public Task {
+public:
+    MertMergeTask(MertBoundaries & left, MertBoundaries & right) :
+        left_(left), right_(right) { }
+    void Run() {
+        MertBoundaries merged(left_.size() + right_.size());
+        merge(left_.begin(), left_.end(), right_.begin(), right_.end(), merged.begin(), CompareBoundaries);
+        left_.swap(merged);
+        MertBoundaries().swap(right_);
+    }
+protected:
+    MertBoundaries & left_;
+    MertBoundaries & right_;
+};
+
+// Sweep over a range of boundaries starting with the given stats, finding
+// the best span in the range and the stats at zero
+class MertSweepTask : public Task {
+public:
+    MertSweepTask(const MertBoundaries & boundaries, int begin, int end,
+                  const EvalStatsPtr & stats, pair<Real,Real> range) :
+        boundaries_(boundaries), begin_(begin), end_(end), curr_stats_(stats), range_(range),
+        best_span_(Span(-REAL_MAX, -REAL_MAX), EvalStatsPtr()), best_score_(-REAL_MAX) { }
+    void Run() {
+        Real last_bound = (begin_ == 0 ? -REAL_MAX : boundaries_[begin_-1].first);
+        for(int i = begin_; i < end_; i++) {
+            const pair<Real,EvalStatsPtr> & boundary = boundaries_[i];
+            // Find the score at zero. If there is a boundary directly at zero, break ties
+            // to the less optimistic side (or gain to the optimistic side)
+            if(last_bound <= 0 && boundary.first >= 0)
+                zero_stats_ = curr_stats_->Clone();
+            // Update the span if it exceeds the previous best and is in the acceptable gradient range
+            Real curr_score = curr_stats_->ConvertToScore();
+            if(curr_score > best_score_ && (last_bound < range_.second && boundary.first > range_.first)) {
+                best_span_ = ScoredSpan(Span(last_bound, boundary.first), curr_stats_->Clone());
+                best_score_ = curr_score;
+            }
+            PRINT_DEBUG("bef: " << boundary << " curr_stats=" << *curr_stats_ << endl, 4);
+            curr_stats_->PlusEquals(*boundary.second);
+            PRINT_DEBUG("aft: " << boundary << " curr_stats=" << *curr_stats_ << endl, 4);
+            last_bound = boundary.first;
+        }
+    }
+    const ScoredSpan & GetBestSpan() const { return best_span_; }
+    Real GetBestScore() const { return best_score_; }
+    const EvalStatsPtr & GetZeroStats() const { return zero_stats_; }
+protected:
+    const MertBoundaries & boundaries_;
+    int begin_, end_;
+    EvalStatsPtr curr_stats_, zero_stats_;
+    pair<Real,Real> range_;
+    ScoredSpan best_span_;
+    Real best_score_;
+};
+
+}
 
 LineSearchResult TuneMert::LineSearch(
                 const SparseMap & weights,
                 const SparseMap & gradient,
                 vector<boost::shared_ptr<TuningExample> > & examps,
-                pair<Real,Real> range) {
-    EvalStatsPtr base_stats;
-    map<Real,EvalStatsPtr> boundaries;
-    typedef pair<Real,EvalStatsPtr> DoublePair;
-    // Create the search plane
-    BOOST_FOREACH(const boost::shared_ptr<TuningExample> & examp, examps) {
-        // Calculate the convex hull
-        ConvexHull convex_hull = examp->CalculateConvexHull(weights, gradient);
-        PRINT_DEBUG("Convex hull size == " << convex_hull.size() << endl, 5);
-        if(convex_hull.size() == 0) continue;
-        // Update the base values
-        if(base_stats) base_stats->PlusEquals(*convex_hull[0].second);
-        else           base_stats = convex_hull[0].second->Clone();
-        PRINT_DEBUG("convex_hull[0]: " << convex_hull[0] << endl, 5);
-        // Add all the changed values
-        for(int i = 1; i < (int)convex_hull.size(); i++) {
-            EvalStatsPtr diff = convex_hull[i].second->Plus(*convex_hull[i-1].second->Times(-1));
-            PRINT_DEBUG("convex_hull["<<i<<"]: " << convex_hull[i] << endl, 5);
-            if(!diff->IsZero()) {
-                map<Real,EvalStatsPtr>::iterator it = boundaries.find(convex_hull[i].first.first);
-                if(it != boundaries.end()) it->second->PlusEquals(*diff);
-                else                       boundaries.insert(make_pair(convex_hull[i].first.first, diff));
+                pair<Real,Real> range,
+                int threads) {
+    // Split the examples into shards, more than one per thread so threads
+    // that get small examples can take on more
+    int num_shards = min((int)examps.size(), max(threads, 1) * 4);
+    vector<EvalStatsPtr> bases(examps.size());
+    vector<MertBoundaries> shards(max(num_shards, 1));
+    // Convert the weights once for all examples
+    WeightVector weight_vec(weights), gradient_vec(gradient);
+    {
+        ThreadPool * pool = (threads > 1 ? &ThreadPool::GetShared() : NULL);
+        boost::shared_ptr<TaskGroup> group(pool ? new TaskGroup(*pool) : NULL);
+        for(int i = 0; i < num_shards; i++) {
+            Task * task = new MertHullTask(weights, gradient, weight_vec, gradient_vec, examps,
+                                           (long)examps.size() * i / num_shards,
+                                           (long)examps.size() * (i+1) / num_shards,
+                                           bases, shards[i]);
+            if(group) { group->Submit(task); } else { task->Run(); delete task; }
+        }
+        if(group) group->Wait();
+        // Merge the neighboring shards in pairs until only the first is left
+        for(int width = 1; width < num_shards; width *= 2) {
+            for(int i = 0; i + width < num_shards; i += width*2) {
+                Task * task = new MertMergeTask(shards[i], shards[i+width]);
+                if(group) { group->Submit(task); } else { task->Run(); delete task; }
             }
+            if(group) group->Wait();
         }
     }
-    boundaries[REAL_MAX] = base_stats->Times(0);
+    // Add the stats of the first spans and the changes at the same position
+    // in the order of the examples
+    EvalStatsPtr base_stats;
+    BOOST_FOREACH(const EvalStatsPtr & stats, bases) {
+        if(!stats) continue;
+        if(base_stats) base_stats->PlusEquals(*stats);
+        else           base_stats = stats->Clone();
+    }
+    MertBoundaries boundaries;
+    typedef pair<Real,EvalStatsPtr> DoublePair;
+    BOOST_FOREACH(const DoublePair & boundary, shards[0]) {
+        if(boundaries.size() && boundaries.rbegin()->first == boundary.first)
+            boundaries.rbegin()->second->PlusEquals(*boundary.second);
+        else
+            boundaries.push_back(boundary);
+    }
+    if(boundaries.size() && boundaries.rbegin()->first == REAL_MAX)
+        boundaries.rbegin()->second = base_stats->Times(0);
+    else
+        boundaries.push_back(make_pair(REAL_MAX, base_stats->Times(0)));
     // if(boundaries.size() == 0) return make_pair(-REAL_MAX, -REAL_MAX);
-    // Find the place with the best score on the plane
+    // Find the place with the best score on the plane. The boundaries are
+    // split into ranges, and the stats at the start of each are found by
+    // adding up the changes in order, so each range can be swept separately
+    int num_ranges = (threads > 1 ? min((int)boundaries.size(), threads * 4) : 1);
+    vector<boost::shared_ptr<MertSweepTask> > sweeps(num_ranges);
+    EvalStatsPtr curr_stats = base_stats->Clone();
+    for(int i = 0; i < num_ranges; i++) {
+        int begin = (long)boundaries.size() * i / num_ranges, end = (long)boundaries.size() * (i+1) / num_ranges;
+        sweeps[i].reset(new MertSweepTask(boundaries, begin, end, curr_stats->Clone(), range));
+        if(i != num_ranges - 1)
+            for(int j = begin; j < end; j++)
+                curr_stats->PlusEquals(*boundaries[j].second);
+    }
+    if(num_ranges > 1) {
+        TaskGroup group(ThreadPool::GetShared());
+        group.SetDeleteTasks(false);
+        BOOST_FOREACH(const boost::shared_ptr<MertSweepTask> & sweep, sweeps)
+            group.Submit(sweep.get());
+        group.Wait();
+    } else {
+        sweeps[0]->Run();
+    }
     ScoredSpan best_span(Span(-REAL_MAX, -REAL_MAX), base_stats);
     Real best_score = -REAL_MAX;
-    EvalStatsPtr curr_stats = base_stats->Clone(), zero_stats;
-    Real last_bound = -REAL_MAX;
-    BOOST_FOREACH(const DoublePair & boundary, boundaries) {
-        // Find the score at zero. If there is a boundary directly at zero, break ties
-        // to the less optimistic side (or gain to the optimistic side)
-        if(last_bound <= 0 && boundary.first >= 0)
-            zero_stats = curr_stats->Clone();
-        // Update the span if it exceeds the previous best and is in the acceptable gradient range
-        Real curr_score = curr_stats->ConvertToScore();
-        if(curr_score > best_score && (last_bound < range.second && boundary.first > range.first)) {
-            best_span = ScoredSpan(Span(last_bound, boundary.first), curr_stats->Clone());
-            best_score = curr_score;
+    EvalStatsPtr zero_stats;
+    BOOST_FOREACH(const boost::shared_ptr<MertSweepTask> & sweep, sweeps) {
+        if(sweep->GetZeroStats())
+            zero_stats = sweep->GetZeroStats();
+        if(sweep->GetBestScore() > best_score) {
+            best_span = sweep->GetBestSpan();
+            best_score = sweep->GetBestScore();
         }
-        PRINT_DEBUG("bef: " << boundary << " curr_stats=" << *curr_stats << endl, 4);
-        curr_stats->PlusEquals(*boundary.second);
-        PRINT_DEBUG("aft: " << boundary << " curr_stats=" << *curr_stats << endl, 4);
-        last_bound = boundary.first;
     }
     // Given the best span, find the middle
     Real middle;
@@ -146,7 +297,7 @@ Real TuneMert::RunTuning(SparseMap & weights) {
 
         // 3) Perform line search over one gradient at a time
         BOOST_FOREACH(const SparseMap & gradient, gradients) {
-            LineSearchResult result = TuneMert::LineSearch(weights, gradient, examps_);
+            LineSearchResult result = TuneMert::LineSearch(weights, gradient, examps_, make_pair(-REAL_MAX, REAL_MAX), threads_);
             // Redo the gain in comparison to the currently saved best score.
             // Given that ties might exist, it is safer to take the gain this way in case
             // a tie results in a change in the best hypothesis.
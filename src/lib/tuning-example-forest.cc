@@ -4,6 +4,9 @@
 #include <travatar/weights.h>
 #include <travatar/dict.h>
 #include <travatar/hyper-graph.h>
+#include <travatar/hyper-graph-semiring.h>
+#include <travatar/compact-hyper-graph.h>
+#include <travatar/weight-vector.h>
 #include <travatar/mert-geometry.h>
 #include <travatar/eval-measure.h>
 #include <boost/foreach.hpp>
@@ -41,6 +44,7 @@ void TuningExampleForest::AddHypothesis(const boost::shared_ptr<HyperGraph> & hg
         forest_->SetWords(hg->GetWords());
     }
     // Append the forest, and add an edge connecting to the root node
+    compact_forest_.reset();
     int id = forest_->Append(*hg);
     HyperNode *root = forest_->GetNode(0), *child = forest_->GetNode(id);
     HyperEdge *edge = new HyperEdge(root);
@@ -49,11 +53,28 @@ void TuningExampleForest::AddHypothesis(const boost::shared_ptr<HyperGraph> & hg
     root->AddEdge(edge); forest_->AddEdge(edge);
 }
 
+const CompactHyperGraph & TuningExampleForest::GetCompactForest() const {
+    boost::mutex::scoped_lock lock(compact_mutex_);
+    if(compact_forest_.get() == NULL)
+        compact_forest_.reset(new CompactHyperGraph(*forest_));
+    return *compact_forest_;
+}
+
+CfgDataVector TuningExampleForest::CalculateViterbiTranslation(const WeightVector & weights) const {
+    const CompactHyperGraph & compact = GetCompactForest();
+    vector<Real> scores;
+    compact.ScoreEdges(weights, scores);
+    HyperPath path;
+    compact.GetViterbiEdges(scores, path.GetEdges());
+    if(path.GetEdges().size() == 0)
+        THROW_ERROR("No derivation in the forest for example " << id_);
+    return path.CalcTranslations();
+}
+
 void TuningExampleForest::FindActiveFeatures() {
     active_.clear();
-    BOOST_FOREACH(const HyperEdge * edge, forest_->GetEdges())
-        BOOST_FOREACH(const SparsePair & feat, edge->GetFeatures().GetImpl())
-            active_.insert(feat.first);
+    const vector<WordId> & feats = GetCompactForest().GetFeatures();
+    active_.insert(feats.begin(), feats.end());
 }
 
 void TuningExampleForest::CalculateOracle() {
@@ -72,19 +93,14 @@ void TuningExampleForest::CalculateOracle() {
 
 // Add weights
 void TuningExampleForest::CountWeights(set<WordId> & weights) {
-    BOOST_FOREACH(const HyperEdge * edge, forest_->GetEdges())
-        BOOST_FOREACH(const SparsePair & feat, edge->GetFeatures().GetImpl())
-            weights.insert(feat.first);
+    const vector<WordId> & feats = GetCompactForest().GetFeatures();
+    weights.insert(feats.begin(), feats.end());
 }
 
 // Calculate the potential gain for a single example given the current weights
 SparseMap TuningExampleForest::CalculatePotentialGain(const SparseMap & weights) {
     // Find the best according to the weights
-    forest_->ResetViterbiScores();
-    Weights wval(weights);
-    forest_->ScoreEdges(wval);
-    NbestList nbest_list = forest_->GetNbest(1);
-    curr_score_ = measure_->CalculateCachedStats(refs_, nbest_list[0]->GetTrgData(), id_)->ConvertToScore() * mult_;
+    curr_score_ = measure_->CalculateCachedStats(refs_, CalculateViterbiTranslation(WeightVector(weights)), id_)->ConvertToScore() * mult_;
     // Find the potential gain
     oracle_score_ = max(oracle_score_, curr_score_);
     Real gain = oracle_score_ - curr_score_;
@@ -97,22 +113,16 @@ SparseMap TuningExampleForest::CalculatePotentialGain(const SparseMap & weights)
     return ret;
 }
 
-// Perform the inside step using memoized recursion
-const MertHull & TuningExampleForest::CalculateMertHull(
-                        const MertHullWeightFunction & func,
-                        vector<boost::shared_ptr<MertHull> > & hulls, 
-                        int node_id) const {
-    if(hulls[node_id].get() == NULL) {
-        hulls[node_id].reset(new MertHull);
-        BOOST_FOREACH(const HyperEdge * edge, forest_->GetNode(node_id)->GetEdges()) {
-            MertHull my_hull = func(*edge);
-            BOOST_FOREACH(const HyperNode * node, edge->GetTails())
-                my_hull *= CalculateMertHull(func, hulls, node->GetId());
-            *hulls[node_id] += my_hull;
-        }
+// The line of each edge of a compact forest, as in MertHullWeightFunction
+struct CompactMertLines {
+    CompactMertLines(const CompactHyperGraph & graph, const vector<Real> & slopes, const vector<Real> & intercepts) :
+        graph_(graph), slopes_(slopes), intercepts_(intercepts) { }
+    MertHull operator()(int edge) const {
+        return MertHull(1, new MertLine(slopes_[edge], intercepts_[edge], *graph_.GetEdge(edge)));
     }
-    return *hulls[node_id];
-}
+    const CompactHyperGraph & graph_;
+    const vector<Real> & slopes_, & intercepts_;
+};
 
 inline Real PosZero(Real dub) { return (dub == -0.0 ? 0.0 : dub); }
 
@@ -120,6 +130,13 @@ inline Real PosZero(Real dub) { return (dub == -0.0 ? 0.0 : dub); }
 ConvexHull TuningExampleForest::CalculateConvexHull(
                         const SparseMap & weights,
                         const SparseMap & gradient) const {
+    return CalculateConvexHull(weights, gradient, WeightVector(weights), WeightVector(gradient));
+}
+ConvexHull TuningExampleForest::CalculateConvexHull(
+                        const SparseMap & weights,
+                        const SparseMap & gradient,
+                        const WeightVector & weight_vec,
+                        const WeightVector & gradient_vec) const {
     ConvexHull ret;
     // Find if any features in the gradient are not active
     bool active = (active_.size() == 0);
@@ -132,22 +149,23 @@ ConvexHull TuningExampleForest::CalculateConvexHull(
             }
         }
     }
-    // Calculate the score of the current best hypothesis
-    forest_->ResetViterbiScores();
-    Weights wval(weights);
-    forest_->ScoreEdges(wval);
-    NbestList nbest_list = forest_->GetNbest(1);
-    EvalStatsPtr curr_stats = measure_->CalculateCachedStats(refs_, nbest_list[0]->GetTrgData(), id_);
+    // Calculate the score of the current best hypothesis. The compact view
+    // of the forest is used so the forest itself is not changed, and hulls
+    // can be calculated from several threads at once
+    EvalStatsPtr curr_stats = measure_->CalculateCachedStats(refs_, CalculateViterbiTranslation(weight_vec), id_);
     curr_stats->TimesEquals(mult_);
     // If we are not active, return the simple convex hull
     if(!active) {
         ret.push_back(make_pair(make_pair(-REAL_MAX, REAL_MAX), curr_stats));
     // Otherwise, calculate the convex hull from the forest
     } else {
-        vector<boost::shared_ptr<MertHull> > hulls(forest_->NumNodes());
-        MertHullWeightFunction func(weights, gradient);
-        CalculateMertHull(func, hulls, 0);
-        MertHull top_hull = *hulls[0];
+        const CompactHyperGraph & compact = GetCompactForest();
+        vector<Real> slopes, intercepts;
+        compact.ScoreEdges(gradient_vec, slopes);
+        compact.ScoreEdges(weight_vec, intercepts);
+        vector<MertHull> hulls;
+        CalcInside<MertSemiring>(compact, CompactMertLines(compact, slopes, intercepts), MertSemiring::Zero(), hulls);
+        MertHull top_hull = hulls[0];
         top_hull.Sort();
         PRINT_DEBUG("Hull for: " << Dict::PrintWords(refs_[0]) << endl, 6);
         for(int i = 0; i < (int)top_hull.size(); i++) {
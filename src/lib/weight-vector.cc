@@ -0,0 +1,38 @@
+#include <travatar/weight-vector.h>
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace travatar;
+
+void WeightVector::SetWeights(const SparseMap & weights) {
+    vals_.clear();
+    has_weight_.clear();
+    feats_.clear();
+    BOOST_FOREACH(const SparsePair & val, weights)
+        GetWeightRef(val.first) = val.second;
+}
+
+void WeightVector::Add(const SparseVector & feats, Real scale) {
+    BOOST_FOREACH(const SparsePair & val, feats.GetImpl())
+        GetWeightRef(val.first) += val.second * scale;
+}
+
+Real & WeightVector::GetWeightRef(WordId feat) {
+    size_t id = Dict::AddFeatureId(feat);
+    if(id >= vals_.size()) {
+        vals_.resize(id+1, 0.0);
+        has_weight_.resize(id+1, false);
+    }
+    if(!has_weight_[id]) {
+        has_weight_[id] = true;
+        feats_.push_back(feat);
+    }
+    return vals_[id];
+}
+
+SparseMap WeightVector::ToMap() const {
+    SparseMap ret;
+    BOOST_FOREACH(WordId feat, feats_)
+        ret[feat] = vals_[Dict::FeatureId(feat)];
+    return ret;
+}
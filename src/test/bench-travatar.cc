@@ -0,0 +1,219 @@
+// Benchmarks for the decoder that measure the speed and the number of memory
+// allocations on synthetic input, the speed of hiero rule lookup with
+// different numbers of threads, and the speed of reading input trees from
+// streams and from buffers.
+//  Usage: bench-travatar [SENT_LEN] [REPEAT]
+
+#include <travatar/dict.h>
+#include <travatar/hyper-graph.h>
+#include <travatar/lookup-table-hash.h>
+#include <travatar/lookup-table-fsm.h>
+#include <travatar/lm-composer-bu.h>
+#include <travatar/tree-io.h>
+#include <travatar/weight-vector.h>
+#include <travatar/timer.h>
+#include <travatar/thread-pool.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/foreach.hpp>
+#include <boost/atomic.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+using namespace travatar;
+
+// Count every call to the global allocator. The hiero lookup allocates
+// from several threads, so the count is atomic
+static boost::atomic<size_t> num_allocs(0);
+void * operator new(size_t size) {
+    num_allocs.fetch_add(1, boost::memory_order_relaxed);
+    void * ret = malloc(size ? size : 1);
+    if(ret == NULL) throw std::bad_alloc();
+    return ret;
+}
+void operator delete(void * ptr) throw() {
+    free(ptr);
+}
+void * operator new[](size_t size) { return operator new(size); }
+void operator delete[](void * ptr) throw() { operator delete(ptr); }
+
+#define BENCH_VOCAB 5
+#define BENCH_MAX_THREADS 4
+
+// Create a balanced binary tree over the words "w(i % BENCH_VOCAB)"
+void MakeTree(int start, int end, ostream & out) {
+    if(end - start == 1) {
+        out << "(X (NN w" << start % BENCH_VOCAB << "))";
+    } else {
+        int mid = (start + end) / 2;
+        out << "(X ";
+        MakeTree(start, mid, out);
+        out << " ";
+        MakeTree(mid, end, out);
+        out << ")";
+    }
+}
+
+// Translate the tree "repeat" times, and return the sentences per second
+double BenchDecode(const HyperGraph & tree, const LookupTable & tm,
+                   const LMComposerBU & lm, const WeightVector & weights,
+                   int repeat, size_t & allocs) {
+    Timer timer;
+    timer.start();
+    size_t start_allocs = num_allocs;
+    for(int i = 0; i < repeat; i++) {
+        boost::scoped_ptr<HyperGraph> rule_graph(tm.TransformGraph(tree));
+        rule_graph->ScoreEdges(weights);
+        rule_graph->ResetViterbiScores();
+        boost::scoped_ptr<HyperGraph> lm_graph(lm.TransformGraph(*rule_graph));
+        NbestList nbest = lm_graph->GetNbest(10);
+    }
+    allocs = (num_allocs - start_allocs) / repeat;
+    return repeat / timer.get_elapsed_time();
+}
+
+// Build the hiero rule graph for a sentence "repeat" times, and return the
+// sentences per second
+double BenchHieroLookup(const HyperGraph & sent, const LookupTableFSM & tm, int repeat, int & edges) {
+    Timer timer;
+    timer.start();
+    for(int i = 0; i < repeat; i++) {
+        boost::scoped_ptr<HyperGraph> rule_graph(tm.TransformGraph(sent));
+        edges = rule_graph->NumEdges();
+    }
+    return repeat / timer.get_elapsed_time();
+}
+
+// Read all the trees in a text, either from a stream or a buffer, and
+// return the trees per second
+double BenchReadTrees(TreeIO & io, const string & text, bool from_buffer, int & trees) {
+    Timer timer;
+    timer.start();
+    trees = 0;
+    if(from_buffer) {
+        const char * ptr = text.data(), * end = ptr + text.size();
+        HyperGraph * hg;
+        while((hg = io.ReadFromBuffer(ptr, end)) != NULL) {
+            delete hg;
+            trees++;
+        }
+    } else {
+        istringstream iss(text);
+        HyperGraph * hg;
+        while((hg = io.ReadTree(iss)) != NULL && hg->NumNodes() != 0) {
+            delete hg;
+            trees++;
+        }
+        delete hg;
+    }
+    return trees / timer.get_elapsed_time();
+}
+
+int main(int argc, char** argv) {
+    int sent_len = (argc > 1 ? boost::lexical_cast<int>(argv[1]) : 20);
+    int repeat = (argc > 2 ? boost::lexical_cast<int>(argv[2]) : 100);
+
+    // Create the input tree
+    ostringstream tree_oss;
+    MakeTree(0, sent_len, tree_oss);
+    istringstream tree_iss(tree_oss.str());
+    PennTreeIO tree_io;
+    boost::scoped_ptr<HyperGraph> tree(tree_io.ReadTree(tree_iss));
+
+    // Create a rule table with both monotone and swapped rules
+    ostringstream rule_oss;
+    rule_oss << "X ( x0:X x1:X ) ||| x0:X x1:X @ X ||| mono=1" << endl;
+    rule_oss << "X ( x0:X x1:X ) ||| x1:X x0:X @ X ||| swap=1" << endl;
+    rule_oss << "X ( x0:NN ) ||| x0:NN @ X ||| pre=1" << endl;
+    for(int i = 0; i < BENCH_VOCAB; i++) {
+        rule_oss << "NN ( \"w" << i << "\" ) ||| \"t" << i << "\" @ NN ||| lex=1" << endl;
+        rule_oss << "NN ( \"w" << i << "\" ) ||| \"u" << i << "\" @ NN ||| lex=1 alt=1" << endl;
+    }
+    istringstream rule_iss(rule_oss.str());
+    boost::scoped_ptr<LookupTableHash> tm(LookupTableHash::ReadFromRuleTable(rule_iss));
+
+    // Create a bigram language model over the target words
+    string lm_file = "/tmp/bench-travatar-lm.arpa";
+    {
+        ofstream arpa_out(lm_file.c_str());
+        arpa_out << "\\data\\" << endl << "ngram 1=" << BENCH_VOCAB*2+3 << endl << "ngram 2=" << BENCH_VOCAB << endl << endl;
+        arpa_out << "\\1-grams:" << endl << "-1.0\t</s>" << endl << "-99\t<s>\t-0.3" << endl << "-2.0\t<unk>" << endl;
+        for(int i = 0; i < BENCH_VOCAB; i++)
+            arpa_out << "-0." << i+1 << "\tt" << i << "\t-0.3" << endl << "-0." << i+2 << "\tu" << i << endl;
+        arpa_out << endl << "\\2-grams:" << endl;
+        for(int i = 0; i < BENCH_VOCAB; i++)
+            arpa_out << "-0.2\tt" << i << " t" << (i+1) % BENCH_VOCAB << endl;
+        arpa_out << endl << "\\end\\" << endl;
+    }
+    LMComposerBU lm(vector<string>(1, lm_file));
+    lm.SetStackPopLimit(100);
+    remove(lm_file.c_str());
+
+    WeightVector weights(Dict::ParseSparseMap("mono=0.1 swap=-0.1 pre=0.1 lex=0.1 alt=-0.2"));
+
+    cout << "Decoding " << repeat << " sentences of length " << sent_len << endl;
+    size_t allocs;
+    double speed = BenchDecode(*tree, *tm, lm, weights, repeat, allocs);
+    cout << "decode: " << speed << " sent/sec, " << allocs << " allocations/sent" << endl;
+
+    // Create a hiero grammar with phrases, rules with gaps, and a glue
+    // grammar that can cover the whole sentence
+    ostringstream hiero_oss, glue_oss;
+    for(int i = 0; i < BENCH_VOCAB; i++) {
+        hiero_oss << "\"w" << i << "\" @ X ||| \"t" << i << "\" @ X ||| lex=1" << endl;
+        hiero_oss << "x0:X \"w" << i << "\" @ X ||| x0:X \"t" << i << "\" @ X ||| lex=1" << endl;
+        hiero_oss << "\"w" << i << "\" x0:X @ X ||| \"t" << i << "\" x0:X @ X ||| lex=1" << endl;
+        hiero_oss << "x0:X \"w" << i << "\" x1:X @ X ||| x1:X \"t" << i << "\" x0:X @ X ||| swap=1" << endl;
+        for(int j = 0; j < BENCH_VOCAB; j++) {
+            hiero_oss << "\"w" << i << "\" \"w" << j << "\" @ X ||| \"t" << i << "\" \"t" << j << "\" @ X ||| lex=1" << endl;
+            hiero_oss << "\"w" << i << "\" x0:X \"w" << j << "\" @ X ||| \"t" << j << "\" x0:X \"t" << i << "\" @ X ||| swap=1" << endl;
+        }
+    }
+    glue_oss << "x0:X x1:X @ X ||| x0:X x1:X @ X ||| glue=1" << endl;
+    istringstream hiero_iss(hiero_oss.str()), glue_iss(glue_oss.str());
+    LookupTableFSM hiero_tm;
+    hiero_tm.AddRuleFSM(RuleFSM::ReadFromRuleTable(hiero_iss));
+    hiero_tm.AddRuleFSM(RuleFSM::ReadFromRuleTable(glue_iss));
+    hiero_tm.SetRootSymbol(Dict::WID("X"));
+    vector<int> limits(2, 10); limits[1] = sent_len;
+    hiero_tm.SetSpanLimits(limits);
+    HyperGraph hiero_sent;
+    hiero_sent.SetWords(tree->GetWords());
+    // Look up with different numbers of threads building the edges
+    ThreadPool::SetSharedSize(BENCH_MAX_THREADS);
+    double base_speed = 0;
+    for(int threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2) {
+        hiero_tm.SetNumThreads(threads);
+        int edges;
+        speed = BenchHieroLookup(hiero_sent, hiero_tm, repeat, edges);
+        if(threads == 1) base_speed = speed;
+        cout << "hiero lookup (" << threads << " threads): " << speed << " sent/sec, "
+             << speed/base_speed << "x, " << edges << " edges/sent" << endl;
+    }
+
+    // Write the tree "repeat" times in each input format, and read it back
+    PennTreeIO penn_io;
+    EgretTreeIO egret_io;
+    MosesXMLTreeIO moses_io;
+    TreeIO * read_ios[3] = { &penn_io, &egret_io, &moses_io };
+    const char * read_names[3] = { "penn", "egret", "moses" };
+    for(int i = 0; i < 3; i++) {
+        ostringstream text_oss;
+        for(int j = 0; j < repeat; j++) {
+            read_ios[i]->WriteTree(*tree, text_oss);
+            text_oss << endl;
+        }
+        for(int from_buffer = 0; from_buffer < 2; from_buffer++) {
+            int trees;
+            double speed = BenchReadTrees(*read_ios[i], text_oss.str(), from_buffer, trees);
+            cout << "read " << read_names[i] << " (" << (from_buffer ? "buffer" : "stream") << "): "
+                 << speed << " trees/sec, " << trees << " trees" << endl;
+        }
+    }
+    return 0;
+}
@@ -4,12 +4,26 @@
 #include <travatar/sentence.h>
 #include <travatar/dict.h>
 #include <travatar/check-equal.h>
+#include <travatar/concurrent-symbol-set.h>
+#include <boost/thread.hpp>
+#include <boost/lexical_cast.hpp>
+#include <sstream>
 #include <vector>
 #include <boost/foreach.hpp>
 
 using namespace std;
 using namespace travatar;
 
+// Add symbols "0" to "n-1" in a particular order, and check their IDs
+void AddSymbols(ConcurrentSymbolSet * symbols, int n, int offset, bool * ok) {
+    for(int i = 0; i < n; i++) {
+        string sym = boost::lexical_cast<string>((i + offset) % n);
+        WordId id = symbols->GetId(sym, true);
+        if(symbols->GetSymbol(id) != sym || symbols->GetId(sym) != id)
+            *ok = false;
+    }
+}
+
 BOOST_AUTO_TEST_SUITE(dict)
 
 BOOST_AUTO_TEST_CASE(TestParseWords) {
@@ -35,4 +49,54 @@ BOOST_AUTO_TEST_CASE(TestParseSparseMap) {
     BOOST_CHECK(CheckMap(feat_exp, feat_act));
 }
 
+BOOST_AUTO_TEST_CASE(TestConcurrentSymbolSet) {
+    // Add the same symbols from several threads in different orders. This
+    // grows the hash table several times
+    ConcurrentSymbolSet symbols;
+    int n = 5000;
+    bool ok[4] = {true, true, true, true};
+    boost::thread_group threads;
+    for(int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(AddSymbols, &symbols, n, i*1234, ok+i));
+    threads.join_all();
+    BOOST_CHECK(ok[0] && ok[1] && ok[2] && ok[3]);
+    BOOST_CHECK_EQUAL(symbols.size(), n);
+    BOOST_CHECK_EQUAL(symbols.GetId("none"), -1);
+}
+
+BOOST_AUTO_TEST_CASE(TestSymbolSetBuffer) {
+    // Symbols in a buffer have the same IDs as strings, and are only added
+    // with the characters in the range
+    ConcurrentSymbolSet symbols;
+    const char * buff = "abc abcd";
+    WordId abc = symbols.GetId("abc", true);
+    BOOST_CHECK_EQUAL(symbols.GetIdFromBuffer(buff, 3), abc);
+    BOOST_CHECK_EQUAL(symbols.GetIdFromBuffer(buff+4, 4), -1);
+    WordId abcd = symbols.GetIdFromBuffer(buff+4, 4, true);
+    BOOST_CHECK_EQUAL(symbols.GetSymbol(abcd), "abcd");
+    BOOST_CHECK_EQUAL(symbols.GetId("abcd"), abcd);
+    BOOST_CHECK_EQUAL(symbols.GetIdFromBuffer(buff, 2), -1);
+}
+
+BOOST_AUTO_TEST_CASE(TestSymbolSetBinary) {
+    ConcurrentSymbolSet symbols;
+    symbols.GetId("a", true);
+    symbols.GetId("", true);
+    symbols.GetId("c d", true);
+    stringstream ss;
+    symbols.WriteBinary(ss);
+    // Symbols are read back with the same IDs
+    ConcurrentSymbolSet read_symbols;
+    read_symbols.GetId("a", true);
+    read_symbols.ReadBinary(ss);
+    BOOST_CHECK_EQUAL(read_symbols.size(), 3);
+    BOOST_CHECK_EQUAL(read_symbols.GetId(""), 1);
+    BOOST_CHECK_EQUAL(read_symbols.GetSymbol(2), "c d");
+    // Reading into a set with different IDs is an error
+    ConcurrentSymbolSet bad_symbols;
+    bad_symbols.GetId("c d", true);
+    ss.clear(); ss.seekg(0);
+    BOOST_CHECK_THROW(bad_symbols.ReadBinary(ss), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
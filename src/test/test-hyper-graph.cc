@@ -4,6 +4,9 @@
 #include <travatar/dict.h>
 #include <travatar/check-equal.h>
 #include <travatar/hyper-graph.h>
+#include <travatar/hyper-graph-semiring.h>
+#include <travatar/compact-hyper-graph.h>
+#include <travatar/weight-vector.h>
 #include <travatar/translation-rule.h>
 #include <travatar/alignment.h>
 #include <travatar/tree-io.h>
@@ -170,6 +173,87 @@ BOOST_AUTO_TEST_CASE(TestInsideOutsideUnbalanced) {
     BOOST_CHECK(ApproximateRealEquals(score_exp, score_act));
 }
 
+BOOST_AUTO_TEST_CASE(TestViterbiInsideOutside) {
+    vector<Real> edge_scores(9, 0), inside, outside;
+    edge_scores[0] = -1; edge_scores[1] = -2; edge_scores[2] = -0.5; edge_scores[3] = -0.25;
+    src2_graph->CalcViterbiInsideOutside(edge_scores, inside, outside);
+    Real inside_exp[10] = {-1.5, -0.5, -0.25, 0, 0, 0, 0, 0, 0, 0};
+    Real outside_exp[10] = {0, -1, -2, -2.25, -1.5, -1.5, -1.5, -1.5, -1.5, -1.5};
+    BOOST_CHECK(ApproximateRealEquals(vector<Real>(inside_exp, inside_exp+10), inside));
+    BOOST_CHECK(ApproximateRealEquals(vector<Real>(outside_exp, outside_exp+10), outside));
+}
+
+BOOST_AUTO_TEST_CASE(TestCalcInsideOutside) {
+    // Both derivations have probability 0.5, and share the nodes below them
+    vector<Real> edge_scores(9, 0), inside, outside;
+    edge_scores[0] = log(0.5); edge_scores[1] = log(0.5);
+    src2_graph->CalcInsideOutside(edge_scores, inside, outside);
+    Real h = log(0.5);
+    Real outside_exp[10] = {0, h, h, h, h, h, 0, h, 0, 0};
+    BOOST_CHECK(ApproximateRealEquals(vector<Real>(10, 0), inside));
+    BOOST_CHECK(ApproximateRealEquals(vector<Real>(outside_exp, outside_exp+10), outside));
+}
+
+BOOST_AUTO_TEST_CASE(TestExpectationSemiring) {
+    // The expected value of a quantity on the first edge of each of the two
+    // derivations, which both have probability 0.5
+    vector<ExpectationSemiring::Value> edge_vals(9, ExpectationSemiring::One()), inside;
+    edge_vals[0] = ExpectationSemiring::Value(log(0.5), 1);
+    edge_vals[1] = ExpectationSemiring::Value(log(0.5), 3);
+    vector<int> order;
+    src2_graph->GetTopologicalOrder(order);
+    BOOST_CHECK_EQUAL(*order.rbegin(), 0);
+    CalcInside<ExpectationSemiring>(src2_graph->GetNodes(), order,
+                                    EdgeValueArray<ExpectationSemiring::Value>(edge_vals),
+                                    ExpectationSemiring::One(), inside);
+    BOOST_CHECK_SMALL(inside[0].prob, 1e-6);
+    BOOST_CHECK_CLOSE(inside[0].expect, 2.0, 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(TestDeepGraph) {
+    // A chain of nodes that is too deep to be handled recursively
+    int depth = 300000;
+    HyperGraph hg;
+    for(int i = 0; i < depth; i++)
+        hg.AddNode(new HyperNode(Dict::WID("X"), -1, make_pair(0,1)));
+    for(int i = 0; i < depth-1; i++) {
+        HyperEdge * edge = new HyperEdge(hg.GetNode(i));
+        edge->AddTail(hg.GetNode(i+1));
+        edge->SetScore(-1);
+        hg.GetNode(i)->AddEdge(edge); hg.AddEdge(edge);
+    }
+    vector<int> order;
+    hg.GetTopologicalOrder(order);
+    BOOST_CHECK_EQUAL((int)order.size(), depth);
+    hg.GetNode(depth-1)->SetViterbiScore(0);
+    BOOST_CHECK_EQUAL(hg.GetNode(0)->CalcViterbiScore(), 1-depth);
+    vector<Real> edge_scores(depth-1, 0), inside, outside;
+    hg.CalcInsideOutside(edge_scores, inside, outside);
+    BOOST_CHECK_EQUAL(inside[0], 0);
+    BOOST_CHECK_EQUAL(outside[depth-1], 0);
+    hg.InsideOutsideNormalize();
+    BOOST_CHECK_EQUAL(hg.GetEdge(depth-2)->GetScore(), 0);
+    // Add an edge without tails at the bottom and a worse edge above it,
+    // and find both derivations
+    BOOST_FOREACH(HyperEdge * edge, hg.GetEdges())
+        edge->SetScore(-1);
+    HyperEdge * leaf_edge = new HyperEdge(hg.GetNode(depth-1));
+    hg.GetNode(depth-1)->AddEdge(leaf_edge); hg.AddEdge(leaf_edge);
+    HyperEdge * edge = new HyperEdge(hg.GetNode(depth-2));
+    edge->AddTail(hg.GetNode(depth-1));
+    edge->SetScore(-2);
+    hg.GetNode(depth-2)->AddEdge(edge); hg.AddEdge(edge);
+    NbestList nbest = hg.GetNbest(3);
+    BOOST_CHECK_EQUAL((int)nbest.size(), 2);
+    if(nbest.size() == 2) {
+        BOOST_CHECK_EQUAL(nbest[0]->GetScore(), 1-depth);
+        BOOST_CHECK_EQUAL(nbest[1]->GetScore(), -depth);
+        BOOST_CHECK_EQUAL((int)nbest[1]->GetEdges().size(), depth);
+        BOOST_CHECK_EQUAL(nbest[1]->GetEdges()[depth-2], edge);
+        BOOST_CHECK_EQUAL(nbest[1]->GetEdges()[depth-1], leaf_edge);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TestCopy) {
     HyperGraph src1_copy(*src1_graph);
     int ret = src1_graph->CheckEqual(src1_copy);
@@ -326,6 +410,79 @@ BOOST_AUTO_TEST_CASE(TestNbestTied) {
     BOOST_CHECK(CheckPtrVector(exp_nbest, act_nbest));
 }
 
+// Scores are compared exactly, so derivations that are better by less than
+// 1e-6 come first, even though the edge IDs would put them after the others
+BOOST_AUTO_TEST_CASE(TestNbestNearlyTied) {
+    boost::scoped_ptr<HyperGraph> tied_graph(new HyperGraph(*rule_graph_));
+    BOOST_FOREACH(HyperEdge* e, tied_graph->GetEdges())
+        e->SetScore(0.0);
+    tied_graph->GetEdge(3)->SetScore(1e-7);
+    tied_graph->ResetViterbiScores();
+    // The two-best lists are (a c x) (a c y), where all scores within 1e-6
+    // would give (a b x) (a b y)
+    vector<boost::shared_ptr<HyperPath> > exp_nbest, act_nbest;
+    exp_nbest.push_back(boost::shared_ptr<HyperPath>(new HyperPath)); exp_nbest[0]->AddEdge(tied_graph->GetEdge(0)); exp_nbest[0]->AddEdge(tied_graph->GetEdge(3)); exp_nbest[0]->AddEdge(tied_graph->GetEdge(4)); exp_nbest[0]->SetScore(1e-7);
+    exp_nbest.push_back(boost::shared_ptr<HyperPath>(new HyperPath)); exp_nbest[1]->AddEdge(tied_graph->GetEdge(0)); exp_nbest[1]->AddEdge(tied_graph->GetEdge(3)); exp_nbest[1]->AddEdge(tied_graph->GetEdge(5)); exp_nbest[1]->SetScore(1e-7);
+    act_nbest = tied_graph->GetNbest(2);
+    BOOST_CHECK(CheckPtrVector(exp_nbest, act_nbest));
+}
+
+// The compact view finds the same best derivation as the n-best list,
+// including ties, and scores edges in the same way as the graph
+BOOST_AUTO_TEST_CASE(TestCompactViterbi) {
+    HyperGraph graph(*rule_graph_);
+    CompactHyperGraph compact(graph);
+    BOOST_CHECK_EQUAL(compact.NumNodes(), 3);
+    BOOST_CHECK_EQUAL(compact.NumEdges(), 7);
+    BOOST_CHECK_EQUAL(compact.EdgeEnd(1) - compact.EdgeBegin(1), 2);
+    BOOST_CHECK_EQUAL(compact.NumTails(0), 2);
+    BOOST_CHECK_EQUAL(compact.GetTail(0, 1), 2);
+    vector<Real> scores(compact.NumEdges());
+    for(int i = 0; i < compact.NumEdges(); i++)
+        scores[i] = compact.GetEdge(i)->GetScore();
+    HyperPath act_path;
+    act_path.SetScore(compact.GetViterbiEdges(scores, act_path.GetEdges()));
+    NbestList exp_nbest = graph.GetNbest(1);
+    BOOST_CHECK(*exp_nbest[0] == act_path);
+    // All edges tied
+    scores.assign(compact.NumEdges(), 0);
+    BOOST_CHECK_EQUAL(compact.GetViterbiEdges(scores, act_path.GetEdges()), 0);
+    vector<HyperEdge*> exp_edges;
+    exp_edges.push_back(graph.GetEdge(0)); exp_edges.push_back(graph.GetEdge(2)); exp_edges.push_back(graph.GetEdge(4));
+    BOOST_CHECK(exp_edges == act_path.GetEdges());
+    // Score the edges with features
+    graph.GetEdge(2)->GetFeatures().Add(Dict::WID("toy_feature"), 0.1);
+    graph.GetEdge(2)->GetFeatures().Add(Dict::WID("other_feature"), 0.3);
+    CompactHyperGraph compact2(graph);
+    WeightVector weights(Dict::ParseSparseMap("toy_feature=0.7 other_feature=-1.3"));
+    compact2.ScoreEdges(weights, scores);
+    graph.ScoreEdges(weights);
+    for(int i = 0; i < compact2.NumEdges(); i++)
+        BOOST_CHECK_EQUAL(scores[i], compact2.GetEdge(i)->GetScore());
+}
+
+// Test that a long n-best list contains every derivation exactly once, in order
+BOOST_AUTO_TEST_CASE(TestNbestAll) {
+    rule_graph_->ResetViterbiScores();
+    NbestList nbest = rule_graph_->GetNbest(100);
+    set<vector<int> > seen;
+    int ret = 1;
+    for(int i = 0; i < (int)nbest.size(); i++) {
+        vector<int> ids;
+        BOOST_FOREACH(const HyperEdge * edge, nbest[i]->GetEdges())
+            ids.push_back(edge->GetId());
+        if(!seen.insert(ids).second) {
+            cerr << "Duplicate derivation @ " << i << endl; ret = 0;
+        }
+        if(i > 0 && nbest[i]->GetScore() > nbest[i-1]->GetScore() + 1e-6) {
+            cerr << "Derivations out of order @ " << i << endl; ret = 0;
+        }
+    }
+    BOOST_CHECK(ret);
+    // Two edges for the root, times two for n1, times three for n2
+    BOOST_CHECK_EQUAL((int)nbest.size(), 12);
+}
+
 // Test whether we can create an n-best list with unique output strings
 BOOST_AUTO_TEST_CASE(TestNbestUniq) {
     // Accumulate Viterbi scores over nodes
@@ -34,4 +34,24 @@ BOOST_AUTO_TEST_CASE(TestReadUntil) {
     BOOST_CHECK(ret);
 }
 
+BOOST_AUTO_TEST_CASE(TestVarint) {
+    // Values around the byte boundaries, and signed values with zigzag
+    uint64_t vals[] = {0, 1, 127, 128, 16383, 16384, 1234567890123ULL, UINT64_MAX};
+    int64_t svals[] = {0, -1, 1, -64, 64, INT64_MIN, INT64_MAX};
+    string buf;
+    BOOST_FOREACH(uint64_t val, vals) IoUtil::AppendVarint(buf, val);
+    BOOST_FOREACH(int64_t val, svals) IoUtil::AppendVarint(buf, IoUtil::ZigZag(val));
+    // Small values take a single byte
+    BOOST_CHECK_EQUAL(buf[2], (char)127);
+    BOOST_CHECK_EQUAL(IoUtil::ZigZag(-1), 1ULL);
+    const char * ptr = buf.data(), * end = ptr + buf.size();
+    BOOST_FOREACH(uint64_t val, vals) BOOST_CHECK_EQUAL(IoUtil::ReadVarint(ptr, end), val);
+    BOOST_FOREACH(int64_t val, svals) BOOST_CHECK_EQUAL(IoUtil::UnZigZag(IoUtil::ReadVarint(ptr, end)), val);
+    BOOST_CHECK(ptr == end);
+    // A truncated varint is an error
+    string bad(1, (char)0x80);
+    ptr = bad.data();
+    BOOST_CHECK_THROW(IoUtil::ReadVarint(ptr, bad.data()+bad.size()), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,9 +3,11 @@
 
 #include <travatar/lm-composer-incremental.h>
 #include <travatar/lm-composer-bu.h>
+#include <travatar/lm-composer-coarse-to-fine.h>
 #include <travatar/dict.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/translation-rule.h>
+#include <travatar/lm-score-cache.h>
 #include <boost/shared_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <string>
@@ -616,4 +618,201 @@ BOOST_AUTO_TEST_CASE(TestReverseIncremental) {
     BOOST_CHECK(act_graph.get() && exp_graph->CheckMaybeEqual(*act_graph));
 }
 
+// Check that building independent chart cells in parallel gives the same graph
+BOOST_AUTO_TEST_CASE(TestLMComposerBUThreads) {
+    LMComposerBU lm(vector<string>(1, file_name_));
+    lm.SetStackPopLimit(3);
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    lm.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_graph(lm.TransformGraph(*rule_graph_));
+    lm.SetNumThreads(4);
+    boost::shared_ptr<HyperGraph> act_graph(lm.TransformGraph(*rule_graph_));
+    BOOST_CHECK(exp_graph->CheckEqual(*act_graph));
+}
+
+BOOST_AUTO_TEST_CASE(TestLMComposerIncrementalThreads) {
+    LMComposerIncremental lm(vector<string>(1, file_name_));
+    lm.SetStackPopLimit(5);
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    lm.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_graph(lm.TransformGraph(*rule_graph_));
+    lm.SetNumThreads(4);
+    boost::shared_ptr<HyperGraph> act_graph(lm.TransformGraph(*rule_graph_));
+    BOOST_CHECK(act_graph.get() && exp_graph->CheckEqual(*act_graph));
+}
+
+// Check that the outside estimates keep the best translation when the beam
+// is wide, and still give a translation when it is narrow
+BOOST_AUTO_TEST_CASE(TestLMComposerOutsideBeam) {
+    LMComposerBU bu(vector<string>(1, file_name_));
+    bu.SetStackPopLimit(100);
+    LMComposerIncremental inc(vector<string>(1, file_name_));
+    inc.SetStackPopLimit(100);
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    bu.UpdateWeights(weights);
+    inc.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_bu(bu.TransformGraph(*rule_graph_));
+    boost::shared_ptr<HyperGraph> exp_inc(inc.TransformGraph(*rule_graph_));
+    bu.SetOutsideBeam(100);
+    inc.SetOutsideBeam(100);
+    boost::shared_ptr<HyperGraph> act_bu(bu.TransformGraph(*rule_graph_));
+    boost::shared_ptr<HyperGraph> act_inc(inc.TransformGraph(*rule_graph_));
+    BOOST_CHECK_CLOSE(exp_bu->GetNode(0)->CalcViterbiScore(), act_bu->GetNode(0)->CalcViterbiScore(), 0.0001);
+    BOOST_CHECK_CLOSE(exp_inc->GetNode(0)->CalcViterbiScore(), act_inc->GetNode(0)->CalcViterbiScore(), 0.0001);
+    bu.SetOutsideBeam(0.001);
+    inc.SetOutsideBeam(0.001);
+    act_bu.reset(bu.TransformGraph(*rule_graph_));
+    act_inc.reset(inc.TransformGraph(*rule_graph_));
+    BOOST_CHECK(act_bu->NumNodes() > 0 && act_bu->GetNode(0)->GetEdges().size() > 0);
+    BOOST_CHECK(act_inc->NumNodes() > 0 && act_inc->GetNode(0)->GetEdges().size() > 0);
+}
+
+// Check that coarse-to-fine decoding with a wide threshold finds the same
+// best translation as the fine pass alone, without the coarse features
+BOOST_AUTO_TEST_CASE(TestLMComposerCoarseToFine) {
+    boost::shared_ptr<LMComposerBU> coarse(new LMComposerBU(vector<string>(1, file_name_ + "|lm_feat=lmc,lm_unk_feat=lmcunk")));
+    boost::shared_ptr<LMComposerBU> fine(new LMComposerBU(vector<string>(1, file_name_)));
+    coarse->SetStackPopLimit(100);
+    fine->SetStackPopLimit(100);
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    weights[Dict::WID("lmcunk")] = -20;
+    weights[Dict::WID("lmc")] = 1;
+    coarse->UpdateWeights(weights);
+    fine->UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_graph(fine->TransformGraph(*rule_graph_));
+    LMComposerCoarseToFine ctf(coarse, fine, 100);
+    boost::shared_ptr<HyperGraph> act_graph(ctf.TransformGraph(*rule_graph_));
+    BOOST_CHECK_CLOSE(exp_graph->GetNode(0)->CalcViterbiScore(), act_graph->GetNode(0)->CalcViterbiScore(), 0.0001);
+    NbestList nbest = act_graph->GetNbest(1);
+    SparseMap feats = nbest[0]->CalcFeatures().ToMap();
+    BOOST_CHECK(feats.find(Dict::WID("lmc")) == feats.end());
+    BOOST_CHECK(feats.find(Dict::WID("lm")) != feats.end());
+    // With no threshold, only the edges of the best coarse derivation are
+    // kept, so the result is a single derivation
+    LMComposerCoarseToFine ctf_zero(coarse, fine, 0);
+    act_graph.reset(ctf_zero.TransformGraph(*rule_graph_));
+    BOOST_CHECK_EQUAL(act_graph->GetNbest(10).size(), 1);
+    CoarseToFineStats stats = ctf_zero.GetStats();
+    BOOST_CHECK_EQUAL(stats.sentences, 1);
+    BOOST_CHECK_EQUAL(stats.edges, rule_graph_->NumEdges());
+    BOOST_CHECK_EQUAL(stats.kept_edges, 3);
+}
+
+// Check that scores found in the cache give the same graph, both when the
+// cache is filled and when it is reused
+BOOST_AUTO_TEST_CASE(TestLMComposerBUCache) {
+    LMComposerBU lm(vector<string>(1, file_name_));
+    lm.SetStackPopLimit(3);
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    lm.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_graph(lm.TransformGraph(*rule_graph_));
+    boost::shared_ptr<LMScoreCache> cache(new LMScoreCache(1 << 20, 4));
+    lm.SetScoreCache(cache);
+    boost::shared_ptr<HyperGraph> act_graph(lm.TransformGraph(*rule_graph_));
+    BOOST_CHECK(exp_graph->CheckEqual(*act_graph));
+    long misses = cache->GetMisses();
+    BOOST_CHECK(misses > 0);
+    act_graph.reset(lm.TransformGraph(*rule_graph_));
+    BOOST_CHECK(exp_graph->CheckEqual(*act_graph));
+    BOOST_CHECK_EQUAL(cache->GetMisses(), misses);
+    BOOST_CHECK(cache->GetHits() >= misses);
+}
+
+BOOST_AUTO_TEST_CASE(TestLMComposerIncrementalCache) {
+    LMComposerIncremental lm(vector<string>(1, file_name_));
+    lm.SetStackPopLimit(5);
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    lm.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_graph(lm.TransformGraph(*rule_graph_));
+    boost::shared_ptr<LMScoreCache> cache(new LMScoreCache(1 << 20, 4));
+    lm.SetScoreCache(cache);
+    for(int i = 0; i < 2; i++) {
+        boost::shared_ptr<HyperGraph> act_graph(lm.TransformGraph(*rule_graph_));
+        BOOST_CHECK(act_graph.get() && exp_graph->CheckEqual(*act_graph));
+    }
+    BOOST_CHECK(cache->GetHits() > 0);
+}
+
+// Check that a cache with a tiny budget drops old entries
+BOOST_AUTO_TEST_CASE(TestLMScoreCacheBudget) {
+    LMScoreCache cache(4096, 1);
+    LMScoreCache::Key key;
+    LMScoreCache::Value val;
+    for(int i = 0; i < 1000; i++) {
+        key.words = Sentence(1, i);
+        val.score = i;
+        cache.Add(key, val);
+    }
+    BOOST_CHECK(cache.GetBytes() <= cache.GetMaxBytes());
+    BOOST_CHECK(cache.GetSize() < 1000);
+    key.words = Sentence(1, 999);
+    BOOST_CHECK(cache.Find(key, val));
+    BOOST_CHECK_EQUAL(val.score, 999);
+    key.words = Sentence(1, 0);
+    BOOST_CHECK(!cache.Find(key, val));
+    // Entries found in the older generation are moved, not copied
+    for(int i = 0; i < 1000; i++) {
+        long size = cache.GetSize();
+        key.words = Sentence(1, i);
+        if(cache.Find(key, val))
+            BOOST_CHECK(cache.GetSize() <= size);
+    }
+}
+
+// Check that composers of different kinds do not share entries, as the same
+// words have different values for each
+BOOST_AUTO_TEST_CASE(TestLMScoreCacheKind) {
+    LMScoreCache cache(1 << 20, 4);
+    Sentence words(2, Dict::WID("a"));
+    LMScoreCache::Value val;
+    val.score = -1.5;
+    cache.Add(LMScoreCache::KeyRef(LMScoreCache::BOTTOM_UP, NULL, words), val);
+    BOOST_CHECK(!cache.Find(LMScoreCache::KeyRef(LMScoreCache::INCREMENTAL, NULL, words), val));
+    BOOST_CHECK(cache.Find(LMScoreCache::KeyRef(LMScoreCache::BOTTOM_UP, NULL, words), val));
+    BOOST_CHECK_EQUAL(val.score, -1.5);
+}
+
+// Check that the graph is the same when the rule-internal scores are
+// calculated in advance
+BOOST_AUTO_TEST_CASE(TestLMComposerPrecompute) {
+    LMComposerBU bu(vector<string>(1, file_name_));
+    bu.SetStackPopLimit(3);
+    LMComposerIncremental inc(vector<string>(1, file_name_));
+    inc.SetStackPopLimit(5);
+    SparseMap weights;
+    weights[Dict::WID("lmunk")] = -20;
+    weights[Dict::WID("lm")] = 1;
+    bu.UpdateWeights(weights);
+    inc.UpdateWeights(weights);
+    boost::shared_ptr<HyperGraph> exp_bu(bu.TransformGraph(*rule_graph_));
+    boost::shared_ptr<HyperGraph> exp_inc(inc.TransformGraph(*rule_graph_));
+    // Prepare the rules for both LMs and re-attach them to the edges
+    LMRulePreparer preparer;
+    preparer.AddData(bu.GetData()[0]);
+    preparer.AddData(inc.GetData()[0]);
+    TranslationRule* rules[8] = {rule_01.get(), rule_10.get(), rule_a.get(), rule_b.get(), rule_x.get(), rule_y.get(), rule_unk.get(), rule_01bad.get()};
+    for(int i = 0; i < 8; i++) {
+        preparer.Prepare(*rules[i]);
+        BOOST_CHECK(rules[i]->GetLMScores() != NULL);
+        rule_graph_->GetEdge(i)->SetLMScores(rules[i]->GetLMScores());
+    }
+    BOOST_CHECK_EQUAL(rule_unk->GetLMScores()->Find(bu.GetData()[0]->GetLM())->unk, 1);
+    boost::shared_ptr<HyperGraph> act_bu(bu.TransformGraph(*rule_graph_));
+    boost::shared_ptr<HyperGraph> act_inc(inc.TransformGraph(*rule_graph_));
+    BOOST_CHECK(exp_bu->CheckEqual(*act_bu));
+    BOOST_CHECK(act_inc.get() && exp_inc->CheckEqual(*act_inc));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,10 +5,13 @@
 #include <travatar/hyper-graph.h>
 #include <travatar/translation-rule-hiero.h>
 #include <travatar/lookup-table-fsm.h>
+#include <travatar/rule-table-limit.h>
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
 #include <string>
+#include <fstream>
+#include <cstdio>
 
 using namespace std;
 using namespace boost;
@@ -36,6 +39,11 @@ public:
         lookup_fsm->SetTrgFactors(1);
         lookup_fsm->SetRootSymbol(Dict::WID("X"));
         lookup_fsm->AddRuleFSM(RuleFSM::ReadFromRuleTable(rule_iss));
+        istringstream rule_iss_bin(rule_oss.str());
+        lookup_fsm_bin.reset(new LookupTableFSM);
+        lookup_fsm_bin->SetTrgFactors(1);
+        lookup_fsm_bin->SetRootSymbol(Dict::WID("X"));
+        lookup_fsm_bin->AddRuleFSM(CompileAndMap(rule_iss_bin, "/tmp/test-lookup-table-fsm.rtb"));
     
         // Load the rules
         ostringstream rule_oss1, rule_oss2;
@@ -112,9 +120,25 @@ public:
         lookup_fsm_mhd->SetTrgFactors(1);
         lookup_fsm_mhd->SetRootSymbol(Dict::WID("S"));
         lookup_fsm_mhd->AddRuleFSM(RuleFSM::ReadFromRuleTable(rule_iss_mhd));
+        istringstream rule_iss_mhd_bin(rule_oss_mhd.str());
+        lookup_fsm_mhd_bin.reset(new LookupTableFSM);
+        lookup_fsm_mhd_bin->SetTrgFactors(1);
+        lookup_fsm_mhd_bin->SetRootSymbol(Dict::WID("S"));
+        lookup_fsm_mhd_bin->AddRuleFSM(CompileAndMap(rule_iss_mhd_bin, "/tmp/test-lookup-table-fsm-mhd.rtb"));
     }
     
-    ~TestLookupTableFSM() { }
+    ~TestLookupTableFSM() {
+        remove("/tmp/test-lookup-table-fsm.rtb");
+        remove("/tmp/test-lookup-table-fsm-mhd.rtb");
+    }
+
+    RuleFSM * CompileAndMap(istream & in, const string & file_name) {
+        {
+            ofstream bin_out(file_name.c_str(), ios::out | ios::binary);
+            RuleFSM::CompileRuleTable(in, bin_out);
+        }
+        return RuleFSM::ReadFromBinaryFile(file_name);
+    }
 
     TranslationRuleHiero* BuildRule(const string & src, const string & trg, const string & feat) {
     	return new TranslationRuleHiero(
@@ -577,6 +601,8 @@ public:
     boost::scoped_ptr<LookupTableFSM> lookup_fsm_extra;
     boost::scoped_ptr<LookupTableFSM> lookup_fsm_c;
     boost::scoped_ptr<LookupTableFSM> lookup_fsm_mhd;
+    boost::scoped_ptr<LookupTableFSM> lookup_fsm_bin;
+    boost::scoped_ptr<LookupTableFSM> lookup_fsm_mhd_bin;
 };
 
 
@@ -607,6 +633,112 @@ BOOST_AUTO_TEST_CASE(TestMultiHead) {
     BOOST_CHECK(MultiHead(*lookup_fsm_mhd));
 }
 
+BOOST_AUTO_TEST_CASE(TestBuildRulesBin) {
+    BOOST_CHECK(BuildRules(*lookup_fsm_bin));
+}
+
+BOOST_AUTO_TEST_CASE(TestMultiHeadBin) {
+    BOOST_CHECK(MultiHead(*lookup_fsm_mhd_bin));
+}
+
+BOOST_AUTO_TEST_CASE(TestTableLimit) {
+    ostringstream rule_oss;
+    rule_oss << "\"two\" @ X ||| \"ni\" @ X ||| Pegf=0.1" << endl;
+    rule_oss << "\"two\" @ X ||| \"futatsu\" @ X ||| Pegf=0.3" << endl;
+    rule_oss << "\"two\" @ X ||| \"nihon\" @ X ||| Pegf=0.2" << endl;
+    RuleTableLimit limit(2, Dict::ParseSparseMap("Pegf=1"));
+    // Limit the rules when compiling, and after loading the text table
+    istringstream rule_iss_bin(rule_oss.str());
+    {
+        ofstream bin_out("/tmp/test-lookup-table-fsm-limit.rtb", ios::out | ios::binary);
+        RuleFSM::CompileRuleTable(rule_iss_bin, bin_out, &limit);
+    }
+    istringstream rule_iss(rule_oss.str());
+    LookupTableFSM lookup, lookup_bin;
+    lookup.AddRuleFSM(RuleFSM::ReadFromRuleTable(rule_iss));
+    lookup.SetTableLimit(boost::shared_ptr<RuleTableLimit>(new RuleTableLimit(limit)));
+    lookup_bin.AddRuleFSM(RuleFSM::ReadFromBinaryFile("/tmp/test-lookup-table-fsm-limit.rtb"));
+    lookup.SetTrgFactors(1); lookup.SetRootSymbol(Dict::WID("X"));
+    lookup_bin.SetTrgFactors(1); lookup_bin.SetRootSymbol(Dict::WID("X"));
+    HyperGraph input;
+    input.SetWords(Dict::ParseWords("two"));
+    boost::scoped_ptr<HyperGraph> graph(lookup.TransformGraph(input)), graph_bin(lookup_bin.TransformGraph(input));
+    BOOST_CHECK_EQUAL(graph->NumEdges(), 2);
+    BOOST_CHECK(graph->CheckEqual(*graph_bin));
+    remove("/tmp/test-lookup-table-fsm-limit.rtb");
+}
+
+BOOST_AUTO_TEST_CASE(TestCompileUnsorted) {
+    ostringstream rule_oss;
+    rule_oss << "\"two\" @ X ||| \"ni\" @ X ||| Pegf=0.1" << endl;
+    rule_oss << "\"three\" @ X ||| \"san\" @ X ||| Pegf=0.3" << endl;
+    rule_oss << "\"two\" @ X ||| \"futatsu\" @ X ||| Pegf=0.2" << endl;
+    istringstream rule_iss(rule_oss.str());
+    ostringstream bin_out(ios::out | ios::binary);
+    BOOST_CHECK_THROW(RuleFSM::CompileRuleTable(rule_iss, bin_out), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(TestExpandUnaries) {
+    HieroHeadLabels a(2, Dict::WID("A")), b(2, Dict::WID("B")), c(2, Dict::WID("C"));
+    UnaryMap unaries;
+    unaries[a].insert(b);
+    unaries[b].insert(c);
+    unaries[c].insert(a);
+    RuleFSM::ExpandUnaries(unaries);
+    set<HieroHeadLabels> exp_a; exp_a.insert(b); exp_a.insert(c);
+    BOOST_CHECK(unaries[a] == exp_a);
+    set<HieroHeadLabels> exp_b; exp_b.insert(a); exp_b.insert(c);
+    BOOST_CHECK(unaries[b] == exp_b);
+}
+
+BOOST_AUTO_TEST_CASE(TestUnaryChain) {
+    ostringstream rule_oss;
+    rule_oss << "\"a\" @ A ||| \"a\" @ A ||| p=1" << endl;
+    rule_oss << "x0:A @ B ||| x0:A @ B ||| p=1" << endl;
+    rule_oss << "x0:B @ C ||| x0:B @ C ||| p=1" << endl;
+    rule_oss << "x0:C \"b\" @ C ||| x0:C \"b\" @ C ||| p=1" << endl;
+    istringstream rule_iss(rule_oss.str());
+    LookupTableFSM lookup;
+    lookup.AddRuleFSM(RuleFSM::ReadFromRuleTable(rule_iss));
+    lookup.SetTrgFactors(1); lookup.SetRootSymbol(Dict::WID("C"));
+    HyperGraph input;
+    input.SetWords(Dict::ParseWords("a b"));
+    boost::scoped_ptr<HyperGraph> graph(lookup.TransformGraph(input));
+    // A, B and C over "a", and C over "a b"
+    BOOST_CHECK_EQUAL(graph->NumNodes(), 4);
+    BOOST_CHECK_EQUAL(graph->NumEdges(), 4);
+}
+
+BOOST_AUTO_TEST_CASE(TestParallelLookup) {
+    ostringstream rule_oss, glue_oss;
+    rule_oss << "\"a\" @ X ||| \"A\" @ X ||| p=1" << endl;
+    rule_oss << "\"b\" @ Y ||| \"B\" @ Y ||| p=1" << endl;
+    rule_oss << "x0:Y @ X ||| x0:Y @ X ||| p=1" << endl;
+    rule_oss << "\"a\" x0:X @ X ||| x0:X \"A\" @ X ||| p=1" << endl;
+    rule_oss << "x0:X \"b\" x1:X @ Y ||| x1:X \"B\" x0:X @ Y ||| p=1" << endl;
+    rule_oss << "x0:Y x1:X @ X ||| x1:X x0:Y @ X ||| p=1" << endl;
+    rule_oss << "\"c\" \"a\" @ X ||| \"C\" @ X ||| p=1" << endl;
+    glue_oss << "x0:X @ S ||| x0:X @ S ||| glue=1" << endl;
+    glue_oss << "x0:S x1:X @ S ||| x0:S x1:X @ S ||| glue=1" << endl;
+    istringstream rule_iss(rule_oss.str()), glue_iss(glue_oss.str());
+    LookupTableFSM lookup;
+    lookup.AddRuleFSM(RuleFSM::ReadFromRuleTable(rule_iss));
+    lookup.AddRuleFSM(RuleFSM::ReadFromRuleTable(glue_iss));
+    vector<int> limits(2, 4); limits[1] = 20;
+    lookup.SetTrgFactors(1); lookup.SetSpanLimits(limits); lookup.SetSaveSrcStr(true);
+    HyperGraph input;
+    input.SetWords(Dict::ParseWords("a b a c a b b a d a b c a a b"));
+    boost::scoped_ptr<HyperGraph> exp_graph(lookup.TransformGraph(input));
+    // There must be enough edges to be split between the threads
+    BOOST_CHECK(exp_graph->NumEdges() > 64);
+    // The graphs must be the same, including the order of nodes and edges
+    for(int threads = 2; threads <= 4; threads++) {
+        lookup.SetNumThreads(threads);
+        boost::scoped_ptr<HyperGraph> act_graph(lookup.TransformGraph(input));
+        BOOST_CHECK(exp_graph->CheckEqual(*act_graph));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 
@@ -7,12 +7,19 @@
 #include <travatar/hyper-graph.h>
 #include <travatar/lookup-table-hash.h>
 #include <travatar/lookup-table-marisa.h>
+#include <travatar/lookup-table-trie.h>
+#include <travatar/rule-table-limit.h>
 #include <travatar/safe-access.h>
 #include <travatar/translation-rule.h>
 #include <travatar/tree-io.h>
 #include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/foreach.hpp>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
 
 using namespace std;
 using namespace boost;
@@ -65,12 +72,16 @@ struct TestLookupTable {
         rule_oss << "PRP ( \"he\" ) ||| \"il\" @ PRP ||| Pegf=0.5 ppen=2.718" << endl;
         rule_oss << "VP ( AUX ( \"does\" ) RB ( \"not\" ) x0:VB ) ||| \"ne\" x0:VB \"pas\" @ VP ||| Pegf=0.6 ppen=2.718" << endl;
         rule_oss << "VB ( \"go\" ) ||| \"va\" @ VB ||| Pegf=0.7 ppen=2.718" << endl;
+        rule_str_ = rule_oss.str();
         istringstream rule_iss_hash(rule_oss.str());
         lookup_hash.reset(LookupTableHash::ReadFromRuleTable(rule_iss_hash));
         lookup_hash->SetSaveSrcStr(true);
         istringstream rule_iss_marisa(rule_oss.str());
         lookup_marisa.reset(LookupTableMarisa::ReadFromRuleTable(rule_iss_marisa));
         lookup_marisa->SetSaveSrcStr(true);
+        istringstream rule_iss_trie(rule_oss.str());
+        lookup_trie.reset(LookupTableTrie::ReadFromRuleTable(rule_iss_trie));
+        lookup_trie->SetSaveSrcStr(true);
     
         string src2_tree = 
     "{\"nodes\": ["
@@ -120,7 +131,35 @@ struct TestLookupTable {
         lookup_trg->SetConsiderTrg(true);
     }
     
-    ~TestLookupTable() { }
+    ~TestLookupTable() {
+        if(bin_file_.size())
+            remove(bin_file_.c_str());
+    }
+
+    // Compile a rule table into a fresh temporary file, and map it
+    LookupTableMarisa * CompileAndMap(const string & rule_str, const RuleTableLimit * limit = NULL) {
+        if(!bin_file_.size()) {
+            char name[] = "/tmp/test-lookup-table-XXXXXX";
+            int fd = mkstemp(name);
+            BOOST_REQUIRE(fd != -1);
+            close(fd);
+            bin_file_ = name;
+        }
+        {
+            istringstream rule_iss(rule_str);
+            ofstream bin_out(bin_file_.c_str(), ios::out | ios::binary);
+            LookupTableMarisa::CompileRuleTable(rule_iss, bin_out, limit);
+        }
+        return LookupTableMarisa::ReadFromBinaryFile(bin_file_);
+    }
+
+    LookupTableMarisa & GetMarisaBin() {
+        if(lookup_marisa_bin.get() == NULL) {
+            lookup_marisa_bin.reset(CompileAndMap(rule_str_));
+            lookup_marisa_bin->SetSaveSrcStr(true);
+        }
+        return *lookup_marisa_bin;
+    }
     
     int TestLookup(LookupTable & lookup) {
         vector<int> exp_match_cnt(11, 0), act_match_cnt(11, 0);
@@ -129,19 +168,19 @@ struct TestLookupTable {
         exp_match_cnt[2] = 1;
         exp_match_cnt[4] = 1;
         exp_match_cnt[9] = 1;
-        vector<boost::shared_ptr<LookupState> > old_states;
-        old_states.push_back(boost::shared_ptr<LookupState>(lookup.GetInitialState()));
+        LookupStateArena arena;
+        vector<LookupState*> old_states(1, lookup.GetInitialState(arena));
         for(int i = 0; i < 11; i++)
-            act_match_cnt[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states).size();
+            act_match_cnt[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states, arena).size();
         return CheckVector(exp_match_cnt, act_match_cnt);
     }
     
     int TestLookupRules(LookupTable & lookup) {
-        vector<vector<boost::shared_ptr<LookupState> > > act_lookups(11);
-        vector<boost::shared_ptr<LookupState> > old_states;
-        old_states.push_back(boost::shared_ptr<LookupState>(lookup.GetInitialState()));
+        vector<vector<LookupState*> > act_lookups(11);
+        LookupStateArena arena;
+        vector<LookupState*> old_states(1, lookup.GetInitialState(arena));
         for(int i = 0; i < 11; i++)
-            act_lookups[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states);
+            act_lookups[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states, arena);
         vector<TranslationRule*> exp_rules(7), act_rules(7);
         act_rules[0] = SafeReference(lookup.FindRules(*act_lookups[0][0]))[0]; // First S(NP, VP)
         act_rules[1] = SafeReference(lookup.FindRules(*act_lookups[0][0]))[1]; // Second S(NP, VP)
@@ -200,11 +239,11 @@ struct TestLookupTable {
     int TestBuildRuleGraph(LookupTable & lookup) {
         // Make the rule graph
         boost::shared_ptr<HyperGraph> act_rule_graph(lookup.TransformGraph(*src1_graph));
-        vector<vector<boost::shared_ptr<LookupState> > > act_lookups(11);
-        vector<boost::shared_ptr<LookupState> > old_states;
-        old_states.push_back(boost::shared_ptr<LookupState>(lookup.GetInitialState()));
+        vector<vector<LookupState*> > act_lookups(11);
+        LookupStateArena arena;
+        vector<LookupState*> old_states(1, lookup.GetInitialState(arena));
         for(int i = 0; i < 11; i++)
-            act_lookups[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states);
+            act_lookups[i] = lookup.LookupSrc(*src1_graph->GetNode(i), old_states, arena);
         // Create the rule graph
         // string src1_tree = "(S0 (NP1 (PRP2 he3)) (VP4 (AUX5 does6) (RB7 not8) (VB9 go10)))";
         HyperGraph exp_rule_graph;
@@ -294,6 +333,9 @@ struct TestLookupTable {
     JSONTreeIO tree_io;
     boost::scoped_ptr<LookupTableHash> lookup_hash;
     boost::scoped_ptr<LookupTableMarisa> lookup_marisa;
+    boost::scoped_ptr<LookupTableMarisa> lookup_marisa_bin;
+    boost::scoped_ptr<LookupTableTrie> lookup_trie;
+    std::string rule_str_, bin_file_;
     boost::scoped_ptr<HyperGraph> src1_graph;
     boost::scoped_ptr<HyperGraph> src2_graph;
     boost::scoped_ptr<LookupTable> lookup_trg;
@@ -312,6 +354,12 @@ BOOST_AUTO_TEST_CASE(TestLookupHash) {
 BOOST_AUTO_TEST_CASE(TestLookupMarisa) {
     BOOST_CHECK(TestLookup(*lookup_marisa));
 }
+BOOST_AUTO_TEST_CASE(TestLookupMarisaBin) {
+    BOOST_CHECK(TestLookup(GetMarisaBin()));
+}
+BOOST_AUTO_TEST_CASE(TestLookupTrie) {
+    BOOST_CHECK(TestLookup(*lookup_trie));
+}
 
 BOOST_AUTO_TEST_CASE(TestLookupRulesHash) {
     BOOST_CHECK(TestLookupRules(*lookup_hash));
@@ -319,6 +367,12 @@ BOOST_AUTO_TEST_CASE(TestLookupRulesHash) {
 BOOST_AUTO_TEST_CASE(TestLookupRulesMarisa) {
     BOOST_CHECK(TestLookupRules(*lookup_marisa));
 }
+BOOST_AUTO_TEST_CASE(TestLookupRulesMarisaBin) {
+    BOOST_CHECK(TestLookupRules(GetMarisaBin()));
+}
+BOOST_AUTO_TEST_CASE(TestLookupRulesTrie) {
+    BOOST_CHECK(TestLookupRules(*lookup_trie));
+}
 
 BOOST_AUTO_TEST_CASE(TestBuildRuleGraphHash) {
     BOOST_CHECK(TestBuildRuleGraph(*lookup_hash));
@@ -326,11 +380,77 @@ BOOST_AUTO_TEST_CASE(TestBuildRuleGraphHash) {
 BOOST_AUTO_TEST_CASE(TestBuildRuleGraphMarisa) {
     BOOST_CHECK(TestBuildRuleGraph(*lookup_marisa));
 }
+BOOST_AUTO_TEST_CASE(TestBuildRuleGraphMarisaBin) {
+    BOOST_CHECK(TestBuildRuleGraph(GetMarisaBin()));
+}
+BOOST_AUTO_TEST_CASE(TestBuildRuleGraphTrie) {
+    BOOST_CHECK(TestBuildRuleGraph(*lookup_trie));
+}
 
 BOOST_AUTO_TEST_CASE(TestBuildTrgRules) {
     BOOST_CHECK(TestBuildRuleTrg(*lookup_trg));
 }
 
+// Get the values of the Pegf feature of the rules for a source
+vector<Real> GetPegfs(const LookupTable & lookup, const string & src) {
+    LookupState state;
+    state.SetString(src);
+    SparseMap pegf = Dict::ParseSparseMap("Pegf=1");
+    vector<Real> ret;
+    BOOST_FOREACH(const TranslationRule * rule, SafeReference(lookup.FindRules(state)))
+        ret.push_back(pegf * rule->GetFeatures());
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(TestTableLimit) {
+    ostringstream rule_oss;
+    rule_oss << "S ( x0:NP x1:VP ) ||| x0:NP x1:VP @ S ||| Pegf=0.1" << endl;
+    rule_oss << "S ( x0:NP x1:VP ) ||| x1:VP x0:NP @ S ||| Pegf=0.3" << endl;
+    rule_oss << "S ( x0:NP x1:VP ) ||| x0:NP \"a\" x1:VP @ S ||| Pegf=0.2" << endl;
+    rule_oss << "VB ( \"go\" ) ||| \"va\" @ VB ||| Pegf=0.7" << endl;
+    boost::shared_ptr<RuleTableLimit> limit(new RuleTableLimit(2, Dict::ParseSparseMap("Pegf=1")));
+    Real exp_arr[2] = {0.3, 0.2};
+    vector<Real> exp_pegfs(exp_arr, exp_arr+2);
+    // Limit the rules after loading the table
+    istringstream rule_iss_hash(rule_oss.str());
+    boost::scoped_ptr<LookupTableHash> hash(LookupTableHash::ReadFromRuleTable(rule_iss_hash));
+    hash->SetTableLimit(limit);
+    BOOST_CHECK(CheckAlmostVector(exp_pegfs, GetPegfs(*hash, "S ( x0:NP x1:VP )")));
+    BOOST_CHECK_EQUAL(GetPegfs(*hash, "VB ( \"go\" )").size(), 1);
+    istringstream rule_iss_marisa(rule_oss.str());
+    boost::scoped_ptr<LookupTableMarisa> marisa(LookupTableMarisa::ReadFromRuleTable(rule_iss_marisa));
+    marisa->SetTableLimit(limit);
+    BOOST_CHECK(CheckAlmostVector(exp_pegfs, GetPegfs(*marisa, "S ( x0:NP x1:VP )")));
+    // Limit the rules of a mapped table as they are decoded
+    boost::scoped_ptr<LookupTableMarisa> marisa_bin(CompileAndMap(rule_oss.str()));
+    marisa_bin->SetTableLimit(limit);
+    BOOST_CHECK(CheckAlmostVector(exp_pegfs, GetPegfs(*marisa_bin, "S ( x0:NP x1:VP )")));
+    // Limit the rules when compiling the table, unmapping the old one first
+    marisa_bin.reset();
+    marisa_bin.reset(CompileAndMap(rule_oss.str(), limit.get()));
+    BOOST_CHECK(CheckAlmostVector(exp_pegfs, GetPegfs(*marisa_bin, "S ( x0:NP x1:VP )")));
+}
+
+BOOST_AUTO_TEST_CASE(TestCorruptMarisaBin) {
+    // Compile a table with a single source, so its rules start the payload
+    boost::scoped_ptr<LookupTableMarisa> marisa_bin(CompileAndMap("VB ( \"go\" ) ||| \"va\" @ VB ||| Pegf=0.7\n"));
+    marisa_bin.reset();
+    // Overwrite the number of target data of the first rule with one that
+    // runs far past the end of the payload, whose offset follows the magic
+    // and four other values in the header
+    {
+        fstream bin(bin_file_.c_str(), ios::in | ios::out | ios::binary);
+        uint64_t payload_offset;
+        bin.seekg(8 + 4*sizeof(uint64_t));
+        bin.read(reinterpret_cast<char*>(&payload_offset), sizeof(uint64_t));
+        uint32_t bad_count = 0x7fffffff;
+        bin.seekp(payload_offset + sizeof(uint32_t));
+        bin.write(reinterpret_cast<const char*>(&bad_count), sizeof(uint32_t));
+    }
+    marisa_bin.reset(LookupTableMarisa::ReadFromBinaryFile(bin_file_));
+    BOOST_CHECK_THROW(GetPegfs(*marisa_bin, "VB ( \"go\" )"), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(TestBadInputHash) {
     // Load the rules
     ostringstream rule_oss;
@@ -0,0 +1,81 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <travatar/rule-table-filter.h>
+#include <travatar/tree-io.h>
+#include <travatar/hyper-graph.h>
+
+#include <boost/scoped_ptr.hpp>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace boost;
+using namespace travatar;
+
+struct TestRuleTableFilter {
+
+    TestRuleTableFilter() {
+        PennTreeIO penn;
+        boost::scoped_ptr<HyperGraph> tree0(penn.ReadFromString("(S (NP (PRP he)) (VP (VBD ate) (NP (DT an) (NN apple))))"));
+        tree_filter_.AddInput(*tree0);
+        hiero_filter_.AddInput(*tree0);
+        boost::scoped_ptr<HyperGraph> tree1(penn.ReadFromString("(S (NP (PRP she)) (VP (VBD ran)))"));
+        tree_filter_.AddInput(*tree1);
+        hiero_filter_.AddInput(*tree1);
+    }
+    ~TestRuleTableFilter() { }
+
+    RuleTableFilterTree tree_filter_;
+    RuleTableFilterHiero hiero_filter_;
+};
+
+BOOST_FIXTURE_TEST_SUITE(rule_table_filter, TestRuleTableFilter)
+
+BOOST_AUTO_TEST_CASE(TestTreeMatches) {
+    // Single productions
+    BOOST_CHECK(tree_filter_.Matches("S ( x0:NP x1:VP )"));
+    BOOST_CHECK(tree_filter_.Matches("PRP ( \"she\" )"));
+    BOOST_CHECK(!tree_filter_.Matches("PRP ( \"it\" )"));
+    BOOST_CHECK(!tree_filter_.Matches("S ( x0:VP x1:NP )"));
+    // Larger fragments
+    BOOST_CHECK(tree_filter_.Matches("S ( NP ( PRP ( \"he\" ) ) x0:VP )"));
+    BOOST_CHECK(tree_filter_.Matches("VP ( VBD ( \"ate\" ) NP ( x0:DT NN ( \"apple\" ) ) )"));
+    // Each production is in some sentence, but not together
+    BOOST_CHECK(!tree_filter_.Matches("S ( NP ( PRP ( \"he\" ) ) VP ( VBD ( \"ran\" ) ) )"));
+    // Each production is in the same sentence, but not connected
+    BOOST_CHECK(!tree_filter_.Matches("VP ( VBD ( \"ate\" ) NP ( PRP ( \"he\" ) ) )"));
+    // A variable can't match a word, or a word a variable
+    BOOST_CHECK(!tree_filter_.Matches("PRP ( x0:he )"));
+    BOOST_CHECK(!tree_filter_.Matches("NP ( \"PRP\" )"));
+}
+
+BOOST_AUTO_TEST_CASE(TestHieroMatches) {
+    BOOST_CHECK(hiero_filter_.Matches("\"ate\" \"an\" @ X"));
+    BOOST_CHECK(hiero_filter_.Matches("x0:X \"ate\" x1:X @ X"));
+    BOOST_CHECK(hiero_filter_.Matches("\"he\" x0:X \"apple\" @ X"));
+    BOOST_CHECK(hiero_filter_.Matches("x0:X x1:X @ X"));
+    // Words must be in order and in one sentence
+    BOOST_CHECK(!hiero_filter_.Matches("\"apple\" x0:X \"he\" @ X"));
+    BOOST_CHECK(!hiero_filter_.Matches("\"he\" x0:X \"ran\" @ X"));
+    // Each non-terminal must cover at least one word
+    BOOST_CHECK(!hiero_filter_.Matches("\"he\" x0:X \"ate\" @ X"));
+    BOOST_CHECK(!hiero_filter_.Matches("x0:X \"she\" @ X"));
+    BOOST_CHECK(!hiero_filter_.Matches("\"apple\" x0:X @ X"));
+    BOOST_CHECK(hiero_filter_.Matches("\"he\" x0:X x1:X \"apple\" @ X"));
+    BOOST_CHECK(!hiero_filter_.Matches("\"he\" x0:X x1:X x2:X \"apple\" @ X"));
+}
+
+BOOST_AUTO_TEST_CASE(TestFilterLines) {
+    vector<string> lines;
+    lines.push_back("\"he\" @ X ||| \"kare\" @ X ||| p=1");
+    lines.push_back("\"he\" @ X ||| \"kare\" \"wa\" @ X ||| p=1");
+    lines.push_back("\"it\" @ X ||| \"sore\" @ X ||| p=1");
+    lines.push_back("\"ran\" @ X ||| \"hashitta\" @ X ||| p=1");
+    ostringstream oss;
+    hiero_filter_.FilterLines(lines, oss);
+    string exp = lines[0] + "\n" + lines[1] + "\n" + lines[3] + "\n";
+    BOOST_CHECK_EQUAL(exp, oss.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <travatar/thread-pool.h>
+#include <travatar/task.h>
+#include <boost/atomic.hpp>
+#include <vector>
+
+using namespace std;
+using namespace travatar;
+
+// A task that adds one to a counter
+class CountTask : public Task {
+public:
+    CountTask(boost::atomic<int> * count) : count_(count) { }
+    void Run() { ++*count_; }
+protected:
+    boost::atomic<int> * count_;
+};
+
+// A task that recursively forks into two halves and joins, summing the range
+class SumTask : public Task {
+public:
+    SumTask(ThreadPool * pool, int begin, int end) :
+        pool_(pool), begin_(begin), end_(end), sum_(0) { }
+    void Run() {
+        if(end_ - begin_ <= 4) {
+            for(int i = begin_; i < end_; i++)
+                sum_ += i;
+            return;
+        }
+        int mid = (begin_ + end_) / 2;
+        SumTask left(pool_, begin_, mid), right(pool_, mid, end_);
+        TaskGroup group(*pool_);
+        group.SetDeleteTasks(false);
+        group.Submit(&left);
+        group.Submit(&right);
+        group.Wait();
+        sum_ = left.GetSum() + right.GetSum();
+    }
+    long GetSum() const { return sum_; }
+protected:
+    ThreadPool * pool_;
+    int begin_, end_;
+    long sum_;
+};
+
+// ****** The tests *******
+BOOST_AUTO_TEST_SUITE(thread_pool)
+
+// Check that all tasks submitted to a pool are run before it stops
+BOOST_AUTO_TEST_CASE(TestStopProcessRemaining) {
+    boost::atomic<int> count(0);
+    ThreadPool pool(4, 10);
+    for(int i = 0; i < 100; i++)
+        pool.Submit(new CountTask(&count));
+    pool.Stop(true);
+    BOOST_CHECK_EQUAL(count, 100);
+}
+
+// A task that waits until it is released
+class BlockTask : public Task {
+public:
+    BlockTask(boost::atomic<bool> * started, boost::atomic<bool> * released) :
+        started_(started), released_(released) { }
+    void Run() {
+        *started_ = true;
+        while(!*released_)
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+protected:
+    boost::atomic<bool> * started_, * released_;
+};
+
+// Release a BlockTask after a while
+void ReleaseLater(boost::atomic<bool> * released) {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    *released = true;
+}
+
+// Check that stopping without processing the remaining tasks finishes the
+// running task, but does not start the ones that are waiting
+BOOST_AUTO_TEST_CASE(TestStopDiscard) {
+    boost::atomic<int> count(0);
+    boost::atomic<bool> started(false), released(false);
+    ThreadPool pool(1);
+    pool.Submit(new BlockTask(&started, &released));
+    while(!started)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    for(int i = 0; i < 10; i++)
+        pool.Submit(new CountTask(&count));
+    boost::thread releaser(boost::bind(ReleaseLater, &released));
+    pool.Stop(false);
+    releaser.join();
+    BOOST_CHECK(released);
+    BOOST_CHECK_EQUAL(count, 0);
+    BOOST_CHECK_EQUAL(pool.GetQueueSize(), 0);
+}
+
+// Check that nested fork-join does not dead-lock, even with a small pool
+BOOST_AUTO_TEST_CASE(TestNestedTaskGroup) {
+    for(int threads = 1; threads <= 3; threads++) {
+        ThreadPool pool(threads);
+        SumTask task(&pool, 0, 1000);
+        TaskGroup group(pool);
+        group.SetDeleteTasks(false);
+        group.Submit(&task);
+        group.Wait();
+        BOOST_CHECK_EQUAL(task.GetSum(), 999*1000/2);
+    }
+}
+
+// Check that groups with a limit on the number of tasks finish everything
+BOOST_AUTO_TEST_CASE(TestTaskGroupLimit) {
+    boost::atomic<int> count(0);
+    ThreadPool & pool = ThreadPool::GetShared();
+    {
+        TaskGroup group(pool, 3);
+        for(int i = 0; i < 100; i++)
+            group.Submit(new CountTask(&count));
+    }
+    BOOST_CHECK_EQUAL(count, 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,9 +6,12 @@
 #include <travatar/global-debug.h>
 #include <travatar/check-equal.h>
 #include <travatar/hyper-graph.h>
+#include <travatar/io-util.h>
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
 #include <string>
 
 using namespace std;
@@ -181,6 +184,27 @@ BOOST_AUTO_TEST_CASE(TestReadPenn) {
     BOOST_CHECK(tree_exp.CheckEqual(*hg_act) && left_act == left_exp);
 }
 
+BOOST_AUTO_TEST_CASE(TestReadPennBuffer) {
+    // Read two trees from a buffer, leaving the rest
+    string buff = tree_str + " (A b)AAA";
+    const char * ptr = buff.data(), * end = ptr + buff.size();
+    PennTreeIO io;
+    boost::scoped_ptr<HyperGraph> hg_act(io.ReadFromBuffer(ptr, end));
+    BOOST_CHECK(tree_exp.CheckEqual(*hg_act));
+    BOOST_CHECK_EQUAL(string(ptr, end), "AAA (A b)AAA");
+    ptr += 3;
+    boost::scoped_ptr<HyperGraph> hg_act2(io.ReadFromBuffer(ptr, end));
+    BOOST_CHECK_EQUAL(hg_act2->NumNodes(), 2);
+    BOOST_CHECK_EQUAL(string(ptr, end), "AAA");
+    // Empty trees, the end of the buffer and errors
+    string empty = "()";
+    ptr = empty.data();
+    boost::scoped_ptr<HyperGraph> hg_empty(io.ReadFromBuffer(ptr, ptr + empty.size()));
+    BOOST_CHECK(HyperGraph().CheckEqual(*hg_empty));
+    BOOST_CHECK(io.ReadFromBuffer(ptr, ptr) == NULL);
+    BOOST_CHECK_THROW(io.ReadFromString("(A b c)"), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(TestReadPennEmpty) {
     PennTreeIO io;
     HyperGraph hg_exp;
@@ -194,6 +218,53 @@ BOOST_AUTO_TEST_CASE(TestReadPennEmpty) {
     // BOOST_CHECK(hg_exp.CheckEqual(*hg_act1) && hg_exp.CheckEqual(*hg_act2));
 }
 
+BOOST_AUTO_TEST_CASE(TestReadRecordPenn) {
+    // Trees spanning multiple lines are read as one record
+    istringstream instr(tree_str.substr(0, tree_str.find("AAA")) + "\n\n(A b)\n");
+    PennTreeIO io;
+    string rec1, rec2, rec3;
+    BOOST_CHECK(io.ReadRecord(instr, rec1));
+    boost::scoped_ptr<HyperGraph> hg_act(io.ReadFromString(rec1));
+    BOOST_CHECK(tree_exp.CheckEqual(*hg_act));
+    BOOST_CHECK(io.ReadRecord(instr, rec2));
+    BOOST_CHECK_EQUAL(rec2, "(A b)");
+    BOOST_CHECK(!io.ReadRecord(instr, rec3));
+}
+
+BOOST_AUTO_TEST_CASE(TestReadRecordPennOneLine) {
+    // Two trees on the same line are read as two records
+    istringstream instr("(A b) (C d)\n(E f)");
+    PennTreeIO io;
+    string rec;
+    BOOST_CHECK(io.ReadRecord(instr, rec));
+    BOOST_CHECK_EQUAL(rec, "(A b)");
+    BOOST_CHECK(io.ReadRecord(instr, rec));
+    BOOST_CHECK_EQUAL(rec, "(C d)");
+    BOOST_CHECK(io.ReadRecord(instr, rec));
+    BOOST_CHECK_EQUAL(rec, "(E f)");
+    BOOST_CHECK(!io.ReadRecord(instr, rec));
+    // Anything else after a tree is read with the next one, and fails to parse
+    istringstream instr2("(A b)AAA\n(C d)\n");
+    BOOST_CHECK(io.ReadRecord(instr2, rec));
+    BOOST_CHECK(io.ReadRecord(instr2, rec));
+    BOOST_CHECK_EQUAL(rec, "AAA\n(C d)");
+    BOOST_CHECK_THROW(io.ReadFromString(rec), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadRecordEgret) {
+    // Read two Egret trees one record at a time
+    string egret_one = egret_str.substr(0, egret_str.find("sentence 2"));
+    istringstream instr(egret_one + egret_one);
+    EgretTreeIO io; io.SetNormalize(false);
+    string rec;
+    for(int i = 0; i < 2; i++) {
+        BOOST_CHECK(io.ReadRecord(instr, rec));
+        boost::scoped_ptr<HyperGraph> hg_act(io.ReadFromString(rec));
+        BOOST_CHECK(egret_exp.CheckEqual(*hg_act));
+    }
+    BOOST_CHECK(!io.ReadRecord(instr, rec));
+}
+
 BOOST_AUTO_TEST_CASE(TestReadRule) {
     // Use this rule_str
     istringstream instr(rule_str);
@@ -269,6 +340,64 @@ BOOST_AUTO_TEST_CASE(TestRoundtripJSONQuote) {
     BOOST_CHECK(quote_exp.CheckEqual(*hg_act));
 }
 
+BOOST_AUTO_TEST_CASE(TestRoundtripBinary) {
+    // Write two graphs, each followed by a newline
+    stringstream strm;
+    BinaryTreeIO io;
+    io.WriteTree(graph_exp, strm); strm << endl;
+    io.WriteTree(quote_exp, strm); strm << endl;
+    BOOST_CHECK(BinaryTreeIO::IsBinary(strm));
+    boost::scoped_ptr<HyperGraph> graph_act(io.ReadTree(strm));
+    boost::scoped_ptr<HyperGraph> quote_act(io.ReadTree(strm));
+    BOOST_CHECK(graph_exp.CheckEqual(*graph_act));
+    BOOST_CHECK(quote_exp.CheckEqual(*quote_act));
+    BOOST_CHECK(io.ReadTree(strm) == NULL);
+    // The features and target data are the same as in JSON
+    ostringstream oss; JSONTreeIO json; json.WriteTree(*graph_act, oss);
+    BOOST_CHECK(CheckEqual(graph_str, oss.str()));
+}
+
+BOOST_AUTO_TEST_CASE(TestBinaryHugeCount) {
+    // A record whose counts are larger than the record itself must be
+    // rejected before anything is allocated for them
+    BinaryTreeIO io;
+    string words_body, syms_body;
+    IoUtil::AppendVarint(words_body, 0);
+    IoUtil::AppendVarint(words_body, (uint64_t)1 << 60);
+    IoUtil::AppendVarint(syms_body, (uint64_t)1 << 60);
+    string words_rec("TRVHG001"), syms_rec("TRVHG001");
+    IoUtil::AppendVarint(words_rec, words_body.size()); words_rec += words_body;
+    IoUtil::AppendVarint(syms_rec, syms_body.size()); syms_rec += syms_body;
+    BOOST_CHECK_THROW(io.ReadFromString(words_rec), std::runtime_error);
+    BOOST_CHECK_THROW(io.ReadFromString(syms_rec), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(TestBinaryTreeFile) {
+    string filename = "/tmp/test-tree-io.bin";
+    {
+        ofstream out(filename.c_str(), ios::out | ios::binary);
+        BinaryTreeIO io;
+        io.WriteTree(graph_exp, out); out << endl;
+        io.WriteTree(quote_exp, out); out << endl;
+        io.WriteTree(tree_exp, out); out << endl;
+    }
+    BOOST_CHECK(BinaryTreeFile::IsBinaryFile(filename));
+    BinaryTreeFile file(filename);
+    BOOST_CHECK_EQUAL(file.NumTrees(), 3);
+    // Graphs can be read in any order
+    boost::scoped_ptr<HyperGraph> tree_act(file.ReadTree(2));
+    boost::scoped_ptr<HyperGraph> graph_act(file.ReadTree(0));
+    BOOST_CHECK(tree_exp.CheckEqual(*tree_act));
+    BOOST_CHECK(graph_exp.CheckEqual(*graph_act));
+    // JSON is not binary
+    {
+        ofstream out(filename.c_str());
+        out << graph_str << endl;
+    }
+    BOOST_CHECK(!BinaryTreeFile::IsBinaryFile(filename));
+    remove(filename.c_str());
+}
+
 BOOST_AUTO_TEST_CASE(TestWritePenn) {
     string tree_str = "(A (B (C x) (D y)) (E z))";
     PennTreeIO penn;
@@ -300,6 +429,25 @@ BOOST_AUTO_TEST_CASE(TestWriteMosesXML) {
     BOOST_CHECK(CheckEqual(exp_str, act_str));
 }
 
+BOOST_AUTO_TEST_CASE(TestReadMosesXML) {
+    // Trees written as Moses XML are read back as the same graph
+    PennTreeIO penn;
+    MosesXMLTreeIO moses;
+    boost::scoped_ptr<HyperGraph> exp_graph(penn.ReadFromString("(A (B (C x) (D &<)) (E z))"));
+    ostringstream oss; moses.WriteTree(*exp_graph, oss);
+    BOOST_CHECK_EQUAL(oss.str(), "<tree label=\"A\"> <tree label=\"B\"> <tree label=\"C\"> x </tree> <tree label=\"D\"> &amp;&lt; </tree> </tree> <tree label=\"E\"> z </tree> </tree>");
+    istringstream iss(oss.str() + "\n");
+    boost::scoped_ptr<HyperGraph> act_graph(moses.ReadTree(iss));
+    BOOST_CHECK(exp_graph->CheckEqual(*act_graph));
+    // Several words in one tree
+    boost::scoped_ptr<HyperGraph> exp_words(penn.ReadFromString("(A (NP (DT the) (NN cat)) (X (W a) (W b)))"));
+    boost::scoped_ptr<HyperGraph> act_words(moses.ReadFromString("<tree label=\"A\"><tree label=\"NP\"><tree label=\"DT\">the</tree> <tree label=\"NN\">cat</tree></tree> <tree label=\"X\"> a b </tree></tree>"));
+    BOOST_CHECK(CheckEqual(Dict::PrintWords(exp_words->GetWords()), Dict::PrintWords(act_words->GetWords())));
+    BOOST_CHECK_EQUAL(act_words->NumNodes(), 9);
+    BOOST_CHECK(act_words->GetNode(6)->GetSpan() == make_pair(2,4));
+    BOOST_CHECK_THROW(moses.ReadFromString("<tree label=\"A\"> x"), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(TestReadWord) {
     string word_str = "hello this is a test";
     string exp_str = "(X (X hello) (X this) (X is) (X a) (X test))";
@@ -3,6 +3,9 @@
 
 #include <travatar/dict.h>
 #include <travatar/trimmer-nbest.h>
+#include <travatar/trimmer-max-marginal.h>
+#include <travatar/trimmer-posterior.h>
+#include <travatar/trimmer-top-k.h>
 #include <travatar/hyper-graph.h>
 #include <travatar/translation-rule.h>
 
@@ -98,5 +101,78 @@ BOOST_AUTO_TEST_CASE(TestNbestNode) {
     BOOST_CHECK(exp_graph->CheckEqual(*act_graph));
 }
 
+BOOST_AUTO_TEST_CASE(TestMaxMarginal) {
+    // The best derivation is -0.6, and the max-marginals of the edges are
+    // -0.6, -1.0, -0.6, -0.8, -0.6, -0.9, and -2.9
+    TrimmerMaxMarginal trim(0.35);
+    vector<bool> act_active;
+    trim.FindActiveEdges(*rule_graph_, act_active);
+    bool exp_arr[7] = {true, false, true, true, true, true, false};
+    vector<bool> exp_active(exp_arr, exp_arr+7);
+    BOOST_CHECK(exp_active == act_active);
+    boost::shared_ptr<HyperGraph> act_graph(trim.TransformGraph(*rule_graph_));
+    BOOST_CHECK_EQUAL(act_graph->NumNodes(), 3);
+    BOOST_CHECK_EQUAL(act_graph->NumEdges(), 5);
+    BOOST_CHECK_EQUAL(act_graph->GetNode(0)->GetEdges().size(), 1);
+    // Even with no threshold the best derivation is kept
+    TrimmerMaxMarginal trim_zero(0);
+    act_graph.reset(trim_zero.TransformGraph(*rule_graph_));
+    BOOST_CHECK_EQUAL(act_graph->NumEdges(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(TestPosterior) {
+    // The posteriors of the edges are about
+    // 0.599, 0.401, 0.550, 0.450, 0.543, 0.402, and 0.054
+    vector<bool> act_active;
+    TrimmerPosterior(0.42).FindActiveEdges(*rule_graph_, act_active);
+    bool exp_arr[7] = {true, false, true, true, true, false, false};
+    BOOST_CHECK(vector<bool>(exp_arr, exp_arr+7) == act_active);
+    TrimmerPosterior(0.1).FindActiveEdges(*rule_graph_, act_active);
+    exp_arr[1] = true; exp_arr[5] = true;
+    BOOST_CHECK(vector<bool>(exp_arr, exp_arr+7) == act_active);
+    // Even with a high threshold the best derivation is kept
+    boost::shared_ptr<HyperGraph> act_graph(TrimmerPosterior(0.9).TransformGraph(*rule_graph_));
+    BOOST_CHECK_EQUAL(act_graph->NumEdges(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(TestTopK) {
+    vector<bool> act_active;
+    TrimmerTopK(2).FindActiveEdges(*rule_graph_, act_active);
+    bool exp_arr[7] = {true, true, true, true, true, true, false};
+    BOOST_CHECK(vector<bool>(exp_arr, exp_arr+7) == act_active);
+    // Edge 2 is the best edge of node 1, but node 1 can no longer be reached
+    TrimmerTopK(1).FindActiveEdges(*binary_graph_, act_active);
+    bool bin_arr[4] = {false, true, false, true};
+    BOOST_CHECK(vector<bool>(bin_arr, bin_arr+4) == act_active);
+    boost::shared_ptr<HyperGraph> act_graph(TrimmerTopK(1).TransformGraph(*binary_graph_));
+    BOOST_CHECK_EQUAL(act_graph->NumNodes(), 2);
+    BOOST_CHECK_EQUAL(act_graph->NumEdges(), 2);
+}
+
+// Check that dead edges are removed from graphs too deep to search
+// recursively
+BOOST_AUTO_TEST_CASE(TestTopKDeep) {
+    const int depth = 100000;
+    HyperGraph graph;
+    for(int i = 0; i <= depth; i++)
+        graph.AddNode(new HyperNode);
+    // Each node has an edge to the next, and the last node has two edges to
+    // a node with a single edge that is not in the top one
+    for(int i = 0; i < depth; i++) {
+        HyperEdge * edge = new HyperEdge(graph.GetNode(i));
+        edge->AddTail(graph.GetNode(i+1));
+        graph.GetNode(i)->AddEdge(edge); graph.AddEdge(edge);
+    }
+    HyperNode * dead = new HyperNode; graph.AddNode(dead);
+    HyperEdge * dead_edge = new HyperEdge(dead); dead_edge->SetScore(-1);
+    dead->AddEdge(dead_edge); graph.AddEdge(dead_edge);
+    HyperEdge * to_dead = new HyperEdge(graph.GetNode(depth)); to_dead->AddTail(dead);
+    to_dead->SetScore(-1); graph.GetNode(depth)->AddEdge(to_dead); graph.AddEdge(to_dead);
+    HyperEdge * leaf = new HyperEdge(graph.GetNode(depth));
+    graph.GetNode(depth)->AddEdge(leaf); graph.AddEdge(leaf);
+    boost::shared_ptr<HyperGraph> act_graph(TrimmerTopK(1).TransformGraph(graph));
+    BOOST_CHECK_EQUAL(act_graph->NumNodes(), depth+1);
+    BOOST_CHECK_EQUAL(act_graph->NumEdges(), depth+1);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
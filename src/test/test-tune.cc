@@ -190,6 +190,26 @@ BOOST_AUTO_TEST_CASE(TestLineSearch) {
     BOOST_CHECK(CheckAlmost(exp_score2.after->ConvertToScore(), act_score2.after->ConvertToScore()));
 }
 
+BOOST_AUTO_TEST_CASE(TestLineSearchThreads) {
+    // Repeat the examples so there are several shards with ties between them
+    vector<boost::shared_ptr<TuningExample> > examps;
+    for(int i = 0; i < 11; i++)
+        examps.push_back(examp_set[i % 2]);
+    vector<pair<Real,Real> > ranges;
+    ranges.push_back(make_pair(-REAL_MAX, REAL_MAX));
+    ranges.push_back(make_pair(-REAL_MAX, 0.0));
+    ranges.push_back(make_pair(-REAL_MAX, -3.0));
+    int ok = 1;
+    for(int i = 0; i < (int)ranges.size(); i++) {
+        LineSearchResult exp_score = TuneMert::LineSearch(weights, gradient, examps, ranges[i]);
+        LineSearchResult act_score = TuneMert::LineSearch(weights, gradient, examps, ranges[i], 3);
+        ok = ok && exp_score.pos == act_score.pos
+                && exp_score.before->ConvertToString() == act_score.before->ConvertToString()
+                && exp_score.after->ConvertToString() == act_score.after->ConvertToString();
+    }
+    BOOST_CHECK(ok);
+}
+
 BOOST_AUTO_TEST_CASE(TestLatticeHull) {
     EvalMeasureBleu bleu(4, 1, SENTENCE);
     vector<Sentence> ref = Dict::ParseWordVector("c a");
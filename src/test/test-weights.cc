@@ -4,6 +4,7 @@
 #include <travatar/weights.h>
 #include <travatar/weights-perceptron.h>
 #include <travatar/weights-average-perceptron.h>
+#include <travatar/weight-vector.h>
 #include <travatar/dict.h>
 #include <travatar/check-equal.h>
 
@@ -63,4 +64,37 @@ BOOST_AUTO_TEST_CASE(TestAvgPerceptronUpdate) {
     BOOST_CHECK(CheckMap(weights_exp.GetFinal(), weights_act.GetFinal()));
 }
 
+BOOST_AUTO_TEST_CASE(TestWeightVector) {
+    SparseMap map;
+    map[Dict::WID("a")] = 0.5;
+    map[Dict::WID("b")] = -2.0;
+    map[Dict::WID("c")] = 0.0;
+    WeightVector weights(map);
+    SparseVector feats;
+    feats.Add(Dict::WID("a"), 2.0);
+    feats.Add(Dict::WID("b"), 0.25);
+    feats.Add(Dict::WID("d"), 3.0);
+    // The dot product should be the same as with the sparse map
+    BOOST_CHECK_EQUAL(map * feats, weights * feats);
+    BOOST_CHECK_EQUAL(weights.GetWeight(Dict::WID("d")), 0.0);
+    BOOST_CHECK_EQUAL(weights.GetFeatureId(Dict::WID("d")), -1);
+    // Weights are indexed by the dense IDs of Dict, which only features have
+    BOOST_CHECK_EQUAL(weights.GetFeatureId(Dict::WID("a")), Dict::FeatureId(Dict::WID("a")));
+    BOOST_CHECK(weights.GetValues().size() <= (size_t)Dict::NumFeatureIds());
+    WordId word = Dict::WID("test_weight_vector_word");
+    BOOST_CHECK_EQUAL(Dict::FeatureId(word), -1);
+    weights.SetWeight(word, 1.0);
+    BOOST_CHECK_EQUAL(Dict::FeatureId(word), Dict::NumFeatureIds()-1);
+    BOOST_CHECK_EQUAL(weights.GetWeight(word), 1.0);
+    BOOST_CHECK_EQUAL(weights.GetValues().size(), (size_t)Dict::NumFeatureIds());
+    weights.SetWeights(map);
+    // Adding a vector adds new features as necessary
+    weights.Add(feats, 2.0);
+    SparseMap exp_map = map;
+    exp_map[Dict::WID("a")] = 4.5;
+    exp_map[Dict::WID("b")] = -1.5;
+    exp_map[Dict::WID("d")] = 6.0;
+    BOOST_CHECK(CheckMap(exp_map, weights.ToMap()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()